@@ -1 +1 @@
-g++ -std=c++0x -O2 -Wall CppLinq.Mini.cpp -o cpplinqmini
+g++ -std=c++0x -O2 -pthread -Wall CppLinq.Mini.cpp -o cpplinqmini
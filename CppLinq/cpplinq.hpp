@@ -15,13 +15,18 @@
 #   define CPPLINQ__HEADER_GUARD
 // ----------------------------------------------------------------------------
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <climits>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <map>
+#include <memory>
 #include <numeric>
 #include <set>
 #include <string>
@@ -48,7 +53,70 @@
 #   define CPPLINQ_INLINEMETHOD inline
 #endif
 #ifndef CPPLINQ_NOEXCEPT
-#   define CPPLINQ_NOEXCEPT throw ()
+#   if defined(_MSC_VER) && _MSC_VER < 1900
+#       define CPPLINQ_NOEXCEPT throw ()
+#   else
+#       define CPPLINQ_NOEXCEPT noexcept
+#   endif
+#endif
+#ifndef CPPLINQ_BATCH_SIZE
+#   define CPPLINQ_BATCH_SIZE 256
+#endif
+#ifndef CPPLINQ_RVALUE_OPERATORS
+#   if defined(_MSC_VER) && _MSC_VER < 1900
+        // Ref-qualified member functions are supported from VS2015
+#       define CPPLINQ_RVALUE_OPERATORS 0
+#   else
+#       define CPPLINQ_RVALUE_OPERATORS 1
+#   endif
+#endif
+#if CPPLINQ_RVALUE_OPERATORS
+#   define CPPLINQ_LVALUE_THIS const &
+#else
+#   define CPPLINQ_LVALUE_THIS const
+#endif
+#ifndef CPPLINQ_CONSTEXPR_PIPELINES
+#   if __cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L)
+        // Needs constexpr std::construct_at and trivial default initialization
+        // in constant expressions, both C++20
+#       define CPPLINQ_CONSTEXPR_PIPELINES 1
+#   else
+#       define CPPLINQ_CONSTEXPR_PIPELINES 0
+#   endif
+#endif
+#if CPPLINQ_CONSTEXPR_PIPELINES
+#   define CPPLINQ_CONSTEXPR constexpr
+#else
+#   define CPPLINQ_CONSTEXPR CPPLINQ_INLINEMETHOD
+#endif
+#ifndef CPPLINQ_NO_PARALLEL
+#   if defined(_MSC_VER) && _MSC_VER < 1900
+        // thread_local is supported from VS2015
+#       define CPPLINQ_NO_PARALLEL
+#   endif
+#endif
+#ifndef CPPLINQ_NO_PARALLEL
+#   include <condition_variable>
+#   include <deque>
+#   include <mutex>
+#   include <thread>
+#endif
+#ifndef CPPLINQ_INLINE_THRESHOLD
+#   define CPPLINQ_INLINE_THRESHOLD 4096
+#endif
+#ifndef CPPLINQ_SPLIT_GRAIN
+#   define CPPLINQ_SPLIT_GRAIN 1024
+#endif
+#ifndef CPPLINQ_PARALLEL_SORT_THRESHOLD
+#   define CPPLINQ_PARALLEL_SORT_THRESHOLD 65536
+#endif
+#ifndef CPPLINQ_PREFETCH
+#   if defined(__GNUC__) || defined(__clang__)
+#       define CPPLINQ_PREFETCH(address) __builtin_prefetch (address)
+#   else
+        // Prefetching is only a hint, without the builtin it's left out
+#       define CPPLINQ_PREFETCH(address) ((void)(address))
+#   endif
 #endif
 // ----------------------------------------------------------------------------
 
@@ -90,4254 +158,11390 @@ namespace cpplinq
         }
     };
 
-    // -------------------------------------------------------------------------
+    struct operation_cancelled_exception : base_exception
+    {
+        virtual const char* what ()  const CPPLINQ_NOEXCEPT
+        {
+            return "operation_cancelled_exception";
+        }
+    };
 
-    // -------------------------------------------------------------------------
-    // Tedious implementation details of cpplinq
     // -------------------------------------------------------------------------
 
-    namespace detail
+    // cancellation_token is a flag that queries observe through
+    // with_cancellation, any thread may cancel it. The token must outlive the
+    // queries that observe it.
+    class cancellation_token
     {
-
-        // -------------------------------------------------------------------------
-
-        size_type const invalid_size = static_cast<size_type>(-1);
-
-        // -------------------------------------------------------------------------
-
-        template<typename TValue>
-        struct cleanup_type
+    public:
+        CPPLINQ_INLINEMETHOD cancellation_token () CPPLINQ_NOEXCEPT
+            :   cancelled   (false)
         {
-            typedef typename std::remove_const<
-                typename std::remove_reference<TValue>::type
-                >::type                                         type;
-        };
+        }
 
-        template<typename TRangeBuilder, typename TRange>
-        struct get_builtup_type
+        CPPLINQ_INLINEMETHOD void cancel () CPPLINQ_NOEXCEPT
         {
-            static TRangeBuilder get_builder ();
-            static TRange get_range ();
-
-            typedef decltype (get_builder ().build (get_range ()))  type;
-        };
+            cancelled.store (true, std::memory_order_release);
+        }
 
-        template<typename TPredicate, typename TValue>
-        struct get_transformed_type
+        CPPLINQ_INLINEMETHOD bool is_cancelled () const CPPLINQ_NOEXCEPT
         {
-            static TValue                       get_value ();
-            static TPredicate                   get_predicate ();
+            return cancelled.load (std::memory_order_acquire);
+        }
 
-            typedef     decltype (get_predicate ()(get_value ()))   raw_type    ;
-            typedef     typename cleanup_type<raw_type>::type       type        ;
-        };
+    private:
+        cancellation_token (cancellation_token const &);
+        cancellation_token & operator= (cancellation_token const &);
 
-        template<typename TArray>
-        struct get_array_properties;
+        std::atomic<bool>       cancelled   ;
+    };
 
-        template<typename TValue, int Size>
-        struct get_array_properties<TValue[Size]>
-        {
-            enum
-            {
-                size = Size ,
-            };
+    // -------------------------------------------------------------------------
 
-            typedef typename    cleanup_type<TValue>::type  value_type      ;
-            typedef             value_type const *          iterator_type   ;
-        };
+#ifndef CPPLINQ_NO_PARALLEL
+    // -------------------------------------------------------------------------
+    // Parallel execution
+    // -------------------------------------------------------------------------
 
-        template<typename TValue>
-        struct opt
+    namespace detail
+    {
+        // A unit of work that can be stolen by other workers. Tasks are owned by
+        // the thread that forked them, that thread waits for them to be done
+        // before they go out of scope so tasks never need to be heap allocated.
+        struct executor_task
         {
-            typedef     TValue  value_type;
+            std::atomic<bool>       done    ;
+            std::exception_ptr      error   ;
 
-            CPPLINQ_INLINEMETHOD opt () CPPLINQ_NOEXCEPT
-                :   is_initialized (false)
+            CPPLINQ_INLINEMETHOD executor_task () CPPLINQ_NOEXCEPT
+                :   done    (false)
             {
             }
 
-            CPPLINQ_INLINEMETHOD explicit opt (value_type && value)
-                :   is_initialized      (true)
+            virtual ~executor_task () CPPLINQ_NOEXCEPT
             {
-                new (&storage) value_type (std::move (value));
             }
 
-            CPPLINQ_INLINEMETHOD explicit opt (value_type const & value)
-                :   is_initialized      (true)
-            {
-                new (&storage) value_type (value);
-            }
+            virtual void execute () = 0;
 
-            CPPLINQ_INLINEMETHOD ~opt () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD void run () CPPLINQ_NOEXCEPT
             {
-                auto ptr = get_ptr ();
-                if (ptr)
+                try
                 {
-                    ptr->~value_type ();
+                    execute ();
                 }
-                is_initialized = false;
-            }
-
-            CPPLINQ_INLINEMETHOD opt (opt const & v)
-                :   is_initialized      (v.is_initialized)
-            {
-                if (v.is_initialized)
+                catch (...)
                 {
-                    copy (&storage  , &v.storage    );
+                    error = std::current_exception ();
                 }
+
+                // Sequentially consistent so a joiner going to sleep either
+                // sees done or is seen by the executor, see help_until_done
+                done.store (true);
             }
 
-            CPPLINQ_INLINEMETHOD opt (opt && v)  CPPLINQ_NOEXCEPT
-                :   is_initialized      (v.is_initialized)
+            CPPLINQ_INLINEMETHOD bool is_done () const CPPLINQ_NOEXCEPT
             {
-                if (v.is_initialized)
-                {
-                    move (&storage  , &v.storage    );
-                }
-                v.is_initialized = false;
+                return done.load ();
             }
 
-            CPPLINQ_METHOD void swap (opt & v)
+            // Makes a task that is done ready to be queued again
+            CPPLINQ_INLINEMETHOD void reset () CPPLINQ_NOEXCEPT
             {
-                if (is_initialized && v.is_initialized)
-                {
-                    storage_type tmp;
-
-                    move (&tmp          , &storage      );
-                    move (&storage      , &v.storage    );
-                    move (&v.storage    , &tmp          );
-                }
-                else if (is_initialized)
-                {
-                    move (&v.storage    , &storage      );
-                    v.is_initialized= true;
-                    is_initialized  = false;
-                }
-                else if (v.is_initialized)
-                {
-                    move (&storage      , &v.storage    );
-                    v.is_initialized= false;
-                    is_initialized  = true;
-                }
-                else
-                {
-                    // Do nothing
-                }
+                error = nullptr;
+                done.store (false, std::memory_order_relaxed);
             }
 
-            CPPLINQ_INLINEMETHOD opt & operator= (opt const & v)
-            {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
+        private:
+            executor_task (executor_task const &);
+            executor_task & operator= (executor_task const &);
+        };
 
-                opt<value_type> o (v);
+        template<typename TFunction>
+        struct executor_function_task : executor_task
+        {
+            typedef                 TFunction               function_type   ;
 
-                swap (o);
+            function_type &         function    ;
 
-                return *this;
+            CPPLINQ_INLINEMETHOD explicit executor_function_task (function_type & function) CPPLINQ_NOEXCEPT
+                :   function    (function)
+            {
             }
 
-            CPPLINQ_INLINEMETHOD opt & operator= (opt && v)
+            virtual void execute ()
             {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
+                function ();
+            }
+        };
 
-                swap (v);
+        // The owner pushes and pops at the back, thieves steal from the front
+        // which is where the largest pieces of forked work end up
+        struct executor_queue
+        {
+            std::mutex                      lock    ;
+            std::deque<executor_task *>     tasks   ;
+            std::atomic<size_type>          count   ;
 
-                return *this;
+            CPPLINQ_INLINEMETHOD executor_queue () CPPLINQ_NOEXCEPT
+                :   count   (0U)
+            {
             }
 
-            CPPLINQ_INLINEMETHOD opt & operator= (value_type v)
+            // Read without the lock, good enough to decide whether to split
+            CPPLINQ_INLINEMETHOD bool is_empty () const CPPLINQ_NOEXCEPT
             {
-                return *this = opt (std::move (v));
+                return count.load (std::memory_order_relaxed) == 0U;
             }
 
-            CPPLINQ_INLINEMETHOD void clear () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD void push (executor_task * task)
             {
-                opt empty;
-                swap (empty);
+                std::lock_guard<std::mutex> guard (lock);
+                tasks.push_back (task);
+                count.store (tasks.size (), std::memory_order_relaxed);
             }
 
-            CPPLINQ_INLINEMETHOD value_type const * get_ptr () const CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD executor_task * pop ()
             {
-                if (is_initialized)
-                {
-                    return reinterpret_cast<value_type const *> (&storage);
-                }
-                else
+                std::lock_guard<std::mutex> guard (lock);
+                if (tasks.empty ())
                 {
                     return nullptr;
                 }
+
+                auto task = tasks.back ();
+                tasks.pop_back ();
+                count.store (tasks.size (), std::memory_order_relaxed);
+                return task;
             }
 
-            CPPLINQ_INLINEMETHOD value_type * get_ptr () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD executor_task * steal ()
             {
-                if (is_initialized)
-                {
-                    return reinterpret_cast<value_type*> (&storage);
-                }
-                else
+                std::lock_guard<std::mutex> guard (lock);
+                if (tasks.empty ())
                 {
                     return nullptr;
                 }
-            }
 
-            CPPLINQ_INLINEMETHOD value_type const & get () const CPPLINQ_NOEXCEPT
-            {
-                CPPLINQ_ASSERT (is_initialized);
-                return *get_ptr ();
+                auto task = tasks.front ();
+                tasks.pop_front ();
+                count.store (tasks.size (), std::memory_order_relaxed);
+                return task;
             }
+        };
+    }
 
-            CPPLINQ_INLINEMETHOD value_type & get () CPPLINQ_NOEXCEPT
+    // executor is a work-stealing thread pool that the parallel operators run
+    // on. Each worker has a queue of its own, threads that are not workers
+    // share one extra queue. Work is forked with fork_join, the forking thread
+    // helps out by running queued tasks until the forked work is done and
+    // sleeps when there is nothing left to help with.
+    //
+    // An executor without workers runs everything inline on the calling thread
+    // as does parallel_for for counts below inline_threshold.
+    class executor
+    {
+    public:
+        CPPLINQ_INLINEMETHOD explicit executor (
+                size_type worker_count      = default_worker_count ()
+            ,   size_type inline_threshold  = CPPLINQ_INLINE_THRESHOLD
+            )
+            :   pending             (0U)
+            ,   sleeping_joiners    (0U)
+            ,   stopping            (false)
+            ,   threshold           (inline_threshold)
+        {
+            queues.reserve (worker_count + 1U);
+            for (auto index = 0U; index < worker_count + 1U; ++index)
             {
-                CPPLINQ_ASSERT (is_initialized);
-                return *get_ptr ();
+                queues.emplace_back (new detail::executor_queue ());
             }
 
-            CPPLINQ_INLINEMETHOD bool has_value () const CPPLINQ_NOEXCEPT
+            workers.reserve (worker_count);
+            for (auto index = 0U; index < worker_count; ++index)
             {
-                return is_initialized;
+                workers.emplace_back (&executor::work, this, index);
             }
+        }
 
-            // TODO: To be replaced with explicit operator bool ()
-            typedef bool (opt::*type_safe_bool_type) () const;
-
-            CPPLINQ_INLINEMETHOD operator type_safe_bool_type () const CPPLINQ_NOEXCEPT
+        CPPLINQ_INLINEMETHOD ~executor () CPPLINQ_NOEXCEPT
+        {
             {
-                return is_initialized ? &opt::has_value : nullptr;
+                std::lock_guard<std::mutex> guard (sleep_lock);
+                stopping = true;
             }
+            sleep_signal.notify_all ();
 
-            CPPLINQ_INLINEMETHOD value_type const & operator* () const CPPLINQ_NOEXCEPT
+            for (auto & worker : workers)
             {
-                return get ();
+                worker.join ();
             }
+        }
 
-            CPPLINQ_INLINEMETHOD value_type & operator* () CPPLINQ_NOEXCEPT
-            {
-                return get ();
-            }
+        // One worker less than the number of cores as the calling thread joins in
+        static CPPLINQ_INLINEMETHOD size_type default_worker_count () CPPLINQ_NOEXCEPT
+        {
+            auto cores = static_cast<size_type> (std::thread::hardware_concurrency ());
+            return cores > 1U ? cores - 1U : 0U;
+        }
 
-            CPPLINQ_INLINEMETHOD value_type const * operator-> () const CPPLINQ_NOEXCEPT
-            {
-                return get_ptr ();
-            }
+        CPPLINQ_INLINEMETHOD size_type worker_count () const CPPLINQ_NOEXCEPT
+        {
+            return workers.size ();
+        }
 
-            CPPLINQ_INLINEMETHOD value_type * operator-> () CPPLINQ_NOEXCEPT
-            {
-                return get_ptr ();
-            }
+        // The number of threads that run work, the workers and the calling thread
+        CPPLINQ_INLINEMETHOD size_type concurrency () const CPPLINQ_NOEXCEPT
+        {
+            return workers.size () + 1U;
+        }
 
-        private:
-            typedef typename std::aligned_storage<
-                    sizeof (value_type)
-                ,   std::alignment_of<value_type>::value
-                >::type storage_type    ;
+        CPPLINQ_INLINEMETHOD size_type inline_threshold () const CPPLINQ_NOEXCEPT
+        {
+            return threshold;
+        }
 
-            storage_type    storage         ;
-            bool            is_initialized  ;
+        CPPLINQ_INLINEMETHOD bool runs_inline (size_type count) const CPPLINQ_NOEXCEPT
+        {
+            return workers.empty () || count < threshold;
+        }
 
-            CPPLINQ_INLINEMETHOD static void move (
-                    storage_type * to
-                ,   storage_type * from
-                ) CPPLINQ_NOEXCEPT
-            {
-                auto f = reinterpret_cast<value_type*> (from);
-                new (to) value_type (std::move (*f));
-                f->~value_type ();
-            }
+        // True when the calling thread has no queued work left for idle workers
+        // to steal, lazy binary splitting only forks more work then
+        CPPLINQ_INLINEMETHOD bool should_split () const CPPLINQ_NOEXCEPT
+        {
+            return !workers.empty () && queues[current_queue ()]->is_empty ();
+        }
 
-            CPPLINQ_INLINEMETHOD static void copy (
-                    storage_type * to
-                ,   storage_type const * from
-                )
+        // Runs left and right, possibly in parallel, and returns when both are
+        // done. If either throws the exception is rethrown once both are done,
+        // left takes precedence.
+        template<typename TLeft, typename TRight>
+        CPPLINQ_INLINEMETHOD void fork_join (TLeft && left, TRight && right)
+        {
+            if (workers.empty ())
             {
-                auto f = reinterpret_cast<value_type const *> (from);
-                new (to) value_type (*f);
+                left ();
+                right ();
+                return;
             }
 
+            auto index = current_queue ();
 
-        };
-
-        // -------------------------------------------------------------------------
-        // The generic interface
-        // -------------------------------------------------------------------------
-        // _range classes:
-        //      inherit base_range
-        //      COPYABLE
-        //      MOVEABLE (movesemantics)
-        //      typedef                 ...         this_type       ;
-        //      typedef                 ...         value_type      ;
-        //      typedef                 ...         return_type     ;   // value_type | value_type const &
-        //      enum { returns_reference = 0|1 };
-        //      return_type front () const
-        //      bool next ()
-        //      template<typename TRangeBuilder>
-        //      typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-        // -------------------------------------------------------------------------
-        // _builder classes:
-        //      inherit base_builder
-        //      COPYABLE
-        //      MOVEABLE (movesemantics)
-        //      typedef                 ...         this_type       ;
-        //      template<typename TRange>
-        //      TAggregated build (TRange range) const
-        // -------------------------------------------------------------------------
-
-        struct base_range
-        {
-#ifdef CPPLINQ_DETECT_INVALID_METHODS
-        protected:
-            // In order to prevent object slicing
+            detail::executor_function_task<typename std::remove_reference<TRight>::type> task (right);
+            push (index, &task);
 
-            CPPLINQ_INLINEMETHOD base_range () CPPLINQ_NOEXCEPT
+            std::exception_ptr error;
+            try
+            {
+                left ();
+            }
+            catch (...)
             {
+                error = std::current_exception ();
             }
 
-            CPPLINQ_INLINEMETHOD base_range (base_range const &) CPPLINQ_NOEXCEPT
+            help_until_done (index, task);
+
+            if (error)
             {
+                std::rethrow_exception (error);
             }
 
-            CPPLINQ_INLINEMETHOD base_range (base_range &&) CPPLINQ_NOEXCEPT
+            if (task.error)
             {
+                std::rethrow_exception (task.error);
             }
+        }
 
-            CPPLINQ_INLINEMETHOD ~base_range () CPPLINQ_NOEXCEPT
+        // Queues task for the workers, for work that is not forked and joined
+        // in one go. The caller waits for task with wait before it goes out of
+        // scope. Without workers task runs right away.
+        CPPLINQ_INLINEMETHOD void post (detail::executor_task & task)
+        {
+            if (workers.empty ())
             {
+                task.run ();
+                return;
             }
 
-        private:
-            CPPLINQ_INLINEMETHOD base_range & operator= (base_range const &);
-            CPPLINQ_INLINEMETHOD base_range & operator= (base_range &&);
-#endif
-        };
+            push (current_queue (), &task);
+        }
 
-        struct base_builder
+        // Runs queued tasks until task is done, rethrows what task threw
+        CPPLINQ_INLINEMETHOD void wait (detail::executor_task & task)
         {
-#ifdef CPPLINQ_DETECT_INVALID_METHODS
-        protected:
-            // In order to prevent object slicing
+            help_until_done (current_queue (), task);
 
-            CPPLINQ_INLINEMETHOD base_builder () CPPLINQ_NOEXCEPT
+            if (task.error)
             {
+                std::rethrow_exception (task.error);
             }
+        }
 
-            CPPLINQ_INLINEMETHOD base_builder (base_builder const &) CPPLINQ_NOEXCEPT
+        // Calls function (begin, end) over disjoint subranges of [begin, end),
+        // splitting in halves down to grain elements. A grain of 0 picks one
+        // that gives each thread a few pieces to balance the load with.
+        template<typename TFunction>
+        CPPLINQ_INLINEMETHOD void parallel_for (
+                size_type   begin
+            ,   size_type   end
+            ,   size_type   grain
+            ,   TFunction   function
+            )
+        {
+            if (end <= begin)
             {
+                return;
             }
 
-            CPPLINQ_INLINEMETHOD base_builder (base_builder &&) CPPLINQ_NOEXCEPT
+            auto count = end - begin;
+            if (runs_inline (count))
             {
+                function (begin, end);
+                return;
             }
 
-            CPPLINQ_INLINEMETHOD ~base_builder () CPPLINQ_NOEXCEPT
+            if (grain == 0U)
             {
+                grain = (std::max) (count / (4U * concurrency ()), static_cast<size_type> (1U));
             }
 
-        private:
-            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder const &);
-            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder &&);
-#endif
+            parallel_for_range (begin, end, grain, function);
+        }
+
+    private:
+        executor (executor const &);
+        executor & operator= (executor const &);
+
+        struct current_worker
+        {
+            executor const *    owner   ;
+            size_type           index   ;
         };
 
-        template<typename TValueIterator>
-        struct from_range : base_range
+        static CPPLINQ_INLINEMETHOD current_worker & get_current_worker () CPPLINQ_NOEXCEPT
         {
-            static TValueIterator get_iterator ();
+            static thread_local current_worker worker = { nullptr, 0U };
+            return worker;
+        }
 
-            typedef                 from_range<TValueIterator>          this_type       ;
-            typedef                 TValueIterator                      iterator_type   ;
+        // Workers use their own queue, other threads the shared one at the end
+        CPPLINQ_INLINEMETHOD size_type current_queue () const CPPLINQ_NOEXCEPT
+        {
+            auto const & worker = get_current_worker ();
+            return worker.owner == this ? worker.index : workers.size ();
+        }
 
-            typedef                 decltype (*get_iterator ())         raw_value_type  ;
-            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
+        CPPLINQ_INLINEMETHOD void push (size_type index, detail::executor_task * task)
+        {
+            // The task is counted before it becomes visible, a thief taking it
+            // right away must not take pending below zero
             {
-                returns_reference = 1,
-            };
-
-            iterator_type           current ;
-            iterator_type           upcoming;
-            iterator_type           end     ;
-
+                std::lock_guard<std::mutex> guard (sleep_lock);
+                ++pending;
+            }
+            queues[index]->push (task);
+            sleep_signal.notify_one ();
+        }
 
-            CPPLINQ_INLINEMETHOD from_range (
-                    iterator_type begin
-                ,   iterator_type end
-                ) CPPLINQ_NOEXCEPT
-                :   current (std::move (begin))
-                ,   upcoming(current)
-                ,   end     (std::move (end))
+        CPPLINQ_INLINEMETHOD detail::executor_task * take (size_type index)
+        {
+            auto task = queues[index]->pop ();
+            if (task)
             {
+                return task;
             }
 
-            CPPLINQ_INLINEMETHOD from_range (from_range const & v) CPPLINQ_NOEXCEPT
-                :   current (v.current)
-                ,   upcoming(v.upcoming)
-                ,   end     (v.end)
+            auto queue_count = queues.size ();
+            for (auto offset = 1U; offset < queue_count; ++offset)
             {
+                task = queues[(index + offset) % queue_count]->steal ();
+                if (task)
+                {
+                    return task;
+                }
             }
 
-            CPPLINQ_INLINEMETHOD from_range (from_range && v) CPPLINQ_NOEXCEPT
-                :   current (std::move (v.current))
-                ,   upcoming(std::move (v.upcoming))
-                ,   end     (std::move (v.end))
+            return nullptr;
+        }
+
+        // Runs queued tasks while task runs elsewhere. With nothing to run it
+        // spins a little, then sleeps until task is done or work is queued.
+        CPPLINQ_INLINEMETHOD void help_until_done (size_type index, detail::executor_task const & task)
+        {
+            auto spin = 0U;
+            while (!task.is_done ())
             {
+                if (run_one (index))
+                {
+                    spin = 0U;
+                    continue;
+                }
+
+                if (spin < 64U)
+                {
+                    ++spin;
+                    std::this_thread::yield ();
+                    continue;
+                }
+
+                // Either the thread finishing task sees the joiner and wakes it
+                // or the joiner sees task done before it sleeps
+                std::unique_lock<std::mutex> guard (sleep_lock);
+                ++sleeping_joiners;
+                sleep_signal.wait (guard, [&] () {return task.is_done () || pending.load () > 0U;});
+                --sleeping_joiners;
+                spin = 0U;
             }
+        }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+        CPPLINQ_INLINEMETHOD bool run_one (size_type index)
+        {
+            auto task = take (index);
+            if (!task)
             {
-                return range_builder.build (*this);
+                return false;
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current != upcoming);
-                CPPLINQ_ASSERT (current != end);
+            --pending;
+            task->run ();
 
-                return *current;
+            if (sleeping_joiners.load () > 0U)
+            {
+                std::lock_guard<std::mutex> guard (sleep_lock);
+                sleep_signal.notify_all ();
             }
+            return true;
+        }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+        CPPLINQ_INLINEMETHOD void work (size_type index)
+        {
+            auto & worker   = get_current_worker ();
+            worker.owner    = this;
+            worker.index    = index;
+
+            for (;;)
             {
-                if (upcoming == end)
+                if (run_one (index))
                 {
-                    return false;
+                    continue;
                 }
 
-                current = upcoming;
-                ++upcoming;
-                return true;
+                std::unique_lock<std::mutex> guard (sleep_lock);
+                sleep_signal.wait (guard, [this] () {return stopping || pending.load () > 0U;});
+                if (stopping)
+                {
+                    return;
+                }
             }
-        };
+        }
 
-        // -------------------------------------------------------------------------
+        template<typename TFunction>
+        CPPLINQ_INLINEMETHOD void parallel_for_range (
+                size_type   begin
+            ,   size_type   end
+            ,   size_type   grain
+            ,   TFunction & function
+            )
+        {
+            if (end - begin <= grain)
+            {
+                function (begin, end);
+                return;
+            }
 
-        // -------------------------------------------------------------------------
+            auto middle = begin + (end - begin) / 2U;
+            fork_join (
+                    [&] () {parallel_for_range (begin, middle, grain, function);}
+                ,   [&] () {parallel_for_range (middle, end, grain, function);}
+                );
+        }
 
-        template<typename TContainer>
-        struct from_copy_range : base_range
-        {
-            typedef                 from_copy_range<TContainer>         this_type       ;
+        std::vector<std::unique_ptr<detail::executor_queue>>    queues          ;
+        std::vector<std::thread>                                workers         ;
+        std::atomic<size_type>                                  pending         ;
+        std::atomic<size_type>                                  sleeping_joiners;
+        std::mutex                                              sleep_lock      ;
+        std::condition_variable                                 sleep_signal    ;
+        bool                                                    stopping        ;
+        size_type                                               threshold       ;
+    };
 
-            typedef                 TContainer                          container_type  ;
-            typedef        typename TContainer::const_iterator          iterator_type   ;
-            typedef        typename TContainer::value_type              value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
-            {
-                returns_reference = 1 ,
-            };
+    // The executor parallel operators use unless given one, created on first use
+    CPPLINQ_INLINEMETHOD executor & default_executor ()
+    {
+        static executor pool;
+        return pool;
+    }
 
-            container_type          container   ;
+    // How parallel operators combine the results of the parts of a range
+    enum parallel_mode
+    {
+        parallel_unordered  ,   // A result per thread, combined in any order
+        parallel_ordered    ,   // A result per part, combined in source order
+    };
 
-            iterator_type           current     ;
-            iterator_type           upcoming    ;
-            iterator_type           end         ;
+    // -------------------------------------------------------------------------
+#endif
 
-            CPPLINQ_INLINEMETHOD from_copy_range (
-                    container_type&&        container
-                )
-                :   container   (std::move (container))
-                ,   current     (container.begin ())
-                ,   upcoming    (container.begin ())
-                ,   end         (container.end ())
-            {
-            }
+    // Which side of hash_intersect_with and hash_except the hash table is built on
+    enum hash_build_side
+    {
+        build_other     ,   // The other range, the range is streamed
+        build_smaller   ,   // The side with the smaller size hint
+    };
 
-            CPPLINQ_INLINEMETHOD from_copy_range (
-                    container_type const &  container
-                )
-                :   container   (container)
-                ,   current     (container.begin ())
-                ,   upcoming    (container.begin ())
-                ,   end         (container.end ())
-            {
-            }
+    // Whether hash_join tests keys against a bloom filter of the keys of the
+    // other range before probing its table, this pays off when most keys of
+    // the range have no match
+    enum probe_filter
+    {
+        no_probe_filter     ,
+        bloom_probe_filter  ,
+    };
 
-            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range const & v)
-                :   container   (v.container)
-                ,   current     (v.current)
-                ,   upcoming    (v.upcoming)
-                ,   end         (v.end)
-            {
-            }
+    // -------------------------------------------------------------------------
+    // Tedious implementation details of cpplinq
+    // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range && v) CPPLINQ_NOEXCEPT
-                :   container   (std::move (v.container))
-                ,   current     (std::move (v.current))
-                ,   upcoming    (std::move (v.upcoming))
-                ,   end         (std::move (v.end))
-            {
-            }
+    namespace detail
+    {
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+        // -------------------------------------------------------------------------
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current != upcoming);
-                CPPLINQ_ASSERT (current != end);
+        size_type const invalid_size = static_cast<size_type>(-1);
 
-                return *current;
-            }
+        size_type const batch_size   = CPPLINQ_BATCH_SIZE;
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-            {
-                if (upcoming == end)
-                {
-                    return false;
-                }
+        // Kinds of size hints, see size_hint_traits
+        int const size_hint_none        = 0;
+        int const size_hint_upper_bound = 1;
+        int const size_hint_exact       = 2;
 
-                current = upcoming;
-                ++upcoming;
-                return true;
-            }
+        // -------------------------------------------------------------------------
+
+        template<typename TValue>
+        struct cleanup_type
+        {
+            typedef typename std::remove_const<
+                typename std::remove_reference<TValue>::type
+                >::type                                         type;
         };
 
-        // -------------------------------------------------------------------------
+        template<typename TRangeBuilder, typename TRange>
+        struct get_builtup_type
+        {
+            static TRangeBuilder get_builder ();
+            static TRange get_range ();
 
-        struct int_range : base_range
+            typedef decltype (get_builder ().build (get_range ()))  type;
+        };
+
+        template<typename TPredicate, typename TValue>
+        struct get_transformed_type
+        {
+            static TValue                       get_value ();
+            static TPredicate                   get_predicate ();
+
+            typedef     decltype (get_predicate ()(get_value ()))   raw_type    ;
+            typedef     typename cleanup_type<raw_type>::type       type        ;
+        };
+
+        template<typename TArray>
+        struct get_array_properties;
+
+        template<typename TValue, int Size>
+        struct get_array_properties<TValue[Size]>
         {
-            typedef                 int_range                           this_type       ;
-            typedef                 int                                 value_type      ;
-            typedef                 int                                 return_type     ;
             enum
             {
-                returns_reference = 0   ,
+                size = Size ,
             };
 
-            int                     current ;
-            int                     end     ;
+            typedef typename    cleanup_type<TValue>::type  value_type      ;
+            typedef             value_type const *          iterator_type   ;
+        };
 
-            static int get_current (int begin, int end)
-            {
-                return (begin < end ? begin : end) - 1; // -1 in order to start one-step before the first element
-            }
+        // is_contiguous_iterator identifies iterators over contiguous memory,
+        // pointers and the iterators of std::vector (except vector<bool>) and
+        // std::basic_string
+        template<typename TIterator>
+        struct is_contiguous_iterator
+        {
+            typedef typename std::iterator_traits<TIterator>::value_type    value_type      ;
+
+            // The conditionals avoid instantiating vector<bool> or basic_string
+            // over non-character types
+            typedef typename std::conditional<
+                    std::is_same<value_type, bool>::value
+                ,   std::vector<char>
+                ,   std::vector<value_type>
+                >::type                                                     vector_type     ;
+            typedef typename std::conditional<
+                    std::is_same<value_type, char>::value
+                ||  std::is_same<value_type, wchar_t>::value
+                ||  std::is_same<value_type, char16_t>::value
+                ||  std::is_same<value_type, char32_t>::value
+                ,   std::basic_string<value_type>
+                ,   std::string
+                >::type                                                     string_type     ;
 
-            static int get_end (int begin, int end)     // -1 in order to avoid an extra test in next
+            enum
             {
-                return (begin < end ? end : begin) - 1;
-            }
+                value =
+                        std::is_pointer<TIterator>::value
+                    ||  std::is_same<TIterator, typename vector_type::iterator>::value
+                    ||  std::is_same<TIterator, typename vector_type::const_iterator>::value
+                    ||  std::is_same<TIterator, typename string_type::iterator>::value
+                    ||  std::is_same<TIterator, typename string_type::const_iterator>::value
+                    ,
+            };
+        };
 
-            CPPLINQ_INLINEMETHOD int_range (
-                    int begin
-                ,   int end
-                ) CPPLINQ_NOEXCEPT
-                :   current (get_current (begin, end))
-                ,   end     (get_end (begin,end))
+        template<typename TValue>
+        struct opt
+        {
+            typedef     TValue  value_type;
+
+            CPPLINQ_CONSTEXPR opt () CPPLINQ_NOEXCEPT
+                :   is_initialized (false)
             {
             }
 
-            CPPLINQ_INLINEMETHOD int_range (int_range const & v) CPPLINQ_NOEXCEPT
-                :   current (v.current)
-                ,   end     (v.end)
+            CPPLINQ_CONSTEXPR explicit opt (value_type && value)
+                :   is_initialized      (true)
             {
+                construct (&storage, std::move (value));
             }
 
-            CPPLINQ_INLINEMETHOD int_range (int_range && v) CPPLINQ_NOEXCEPT
-                :   current (std::move (v.current))
-                ,   end     (std::move (v.end))
+            CPPLINQ_CONSTEXPR explicit opt (value_type const & value)
+                :   is_initialized      (true)
             {
+                construct (&storage, value);
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR ~opt () CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                clear ();
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_CONSTEXPR opt (opt const & v)
+                :   is_initialized      (v.is_initialized)
             {
-                return current;
+                if (v.is_initialized)
+                {
+                    copy (&storage  , &v.storage    );
+                }
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR opt (opt && v)  CPPLINQ_NOEXCEPT
+                :   is_initialized      (v.is_initialized)
             {
-                if (current >= end)
+                if (v.is_initialized)
                 {
-                    return false;
+                    move (&storage  , &v.storage    );
                 }
-
-                ++current;
-
-                return true;
+                v.is_initialized = false;
             }
-        };
-
-        // -------------------------------------------------------------------------
 
-        template <typename TValue>
-        struct repeat_range : base_range
-        {
-            typedef                 repeat_range<TValue>                this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue                              return_type     ;
-            enum
+            CPPLINQ_CONSTEXPR void swap (opt & v)
             {
-                returns_reference = 0   ,
-            };
+                if (is_initialized && v.is_initialized)
+                {
+                    storage_type tmp;
 
-            TValue                  value       ;
-            size_type               remaining   ;
+                    move (&tmp          , &storage      );
+                    move (&storage      , &v.storage    );
+                    move (&v.storage    , &tmp          );
+                }
+                else if (is_initialized)
+                {
+                    move (&v.storage    , &storage      );
+                    v.is_initialized= true;
+                    is_initialized  = false;
+                }
+                else if (v.is_initialized)
+                {
+                    move (&storage      , &v.storage    );
+                    v.is_initialized= false;
+                    is_initialized  = true;
+                }
+                else
+                {
+                    // Do nothing
+                }
+            }
 
-            CPPLINQ_INLINEMETHOD repeat_range (
-                    value_type element
-                ,   size_type count
-                ) CPPLINQ_NOEXCEPT
-                :   value       (std::move (element))
-                ,   remaining   (count)
+            CPPLINQ_CONSTEXPR opt & operator= (opt const & v)
             {
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
+
+                opt<value_type> o (v);
+
+                swap (o);
+
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD repeat_range (repeat_range const & v) CPPLINQ_NOEXCEPT
-                :   value       (v.value)
-                ,   remaining   (v.remaining)
+            CPPLINQ_CONSTEXPR opt & operator= (opt && v)
             {
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
+
+                swap (v);
+
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD repeat_range (repeat_range && v) CPPLINQ_NOEXCEPT
-                :   value       (std::move (v.value))
-                ,   remaining   (std::move (v.remaining))
+            // Assigning a value destroys the current value and constructs the new
+            // one in place from v, one copy or move per assignment, for values
+            // that are expensive to copy or move that's significantly cheaper
+            // than going through swap. Assigning the current value (o = *o)
+            // leaves it as it is. If the copy or move throws the opt is left
+            // empty.
+
+            CPPLINQ_CONSTEXPR opt & operator= (value_type const & v)
             {
+                if (std::addressof (v) == get_ptr ())
+                {
+                    return *this;
+                }
+
+                clear ();
+                construct (&storage, v);
+                is_initialized = true;
+                return *this;
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR opt & operator= (value_type && v)
             {
-                return range_builder.build (*this);
+                if (std::addressof (v) == get_ptr ())
+                {
+                    return *this;
+                }
+
+                clear ();
+                construct (&storage, std::move (v));
+                is_initialized = true;
+                return *this;
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_CONSTEXPR void clear () CPPLINQ_NOEXCEPT
             {
-                return value;
+                if (is_initialized)
+                {
+                    destroy (&storage);
+                }
+                is_initialized = false;
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR value_type const * get_ptr () const CPPLINQ_NOEXCEPT
             {
-                if (remaining == 0U)
+                if (is_initialized)
                 {
-                    return false;
+                    return address (&storage);
+                }
+                else
+                {
+                    return nullptr;
                 }
+            }
 
-                --remaining;
+            CPPLINQ_CONSTEXPR value_type * get_ptr () CPPLINQ_NOEXCEPT
+            {
+                if (is_initialized)
+                {
+                    return address (&storage);
+                }
+                else
+                {
+                    return nullptr;
+                }
+            }
 
-                return true;
+            CPPLINQ_CONSTEXPR value_type const & get () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (is_initialized);
+                return *get_ptr ();
             }
-        };
 
-        // -------------------------------------------------------------------------
+            CPPLINQ_CONSTEXPR value_type & get () CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (is_initialized);
+                return *get_ptr ();
+            }
 
-        template <typename TValue>
-        struct empty_range : base_range
-        {
-            typedef                 empty_range<TValue>                 this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue                              return_type     ;
-            enum
+            CPPLINQ_CONSTEXPR bool has_value () const CPPLINQ_NOEXCEPT
             {
-                returns_reference = 0   ,
-            };
+                return is_initialized;
+            }
+
+            // TODO: To be replaced with explicit operator bool ()
+            typedef bool (opt::*type_safe_bool_type) () const;
 
-            CPPLINQ_INLINEMETHOD empty_range () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR operator type_safe_bool_type () const CPPLINQ_NOEXCEPT
             {
+                return is_initialized ? &opt::has_value : nullptr;
             }
 
-            CPPLINQ_INLINEMETHOD empty_range (empty_range const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR value_type const & operator* () const CPPLINQ_NOEXCEPT
             {
+                return get ();
             }
 
-            CPPLINQ_INLINEMETHOD empty_range (empty_range && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR value_type & operator* () CPPLINQ_NOEXCEPT
             {
+                return get ();
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR value_type const * operator-> () const CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                return get_ptr ();
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_CONSTEXPR value_type * operator-> () CPPLINQ_NOEXCEPT
             {
-                CPPLINQ_ASSERT (false);
-                throw programming_error_exception ();
+                return get_ptr ();
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+        private:
+#if CPPLINQ_CONSTEXPR_PIPELINES
+            // Placement new and reinterpret_cast aren't allowed in constant
+            // expressions, a union with construct_at/destroy_at is
+            union storage_type
             {
-                return false;
+                constexpr storage_type () CPPLINQ_NOEXCEPT
+                    :   empty   ()
+                {
+                }
+
+                constexpr ~storage_type () CPPLINQ_NOEXCEPT
+                {
+                }
+
+                char        empty   ;
+                value_type  value   ;
+            };
+
+            constexpr static value_type * address (storage_type * s) CPPLINQ_NOEXCEPT
+            {
+                return std::addressof (s->value);
             }
-        };
 
-        // -------------------------------------------------------------------------
+            constexpr static value_type const * address (storage_type const * s) CPPLINQ_NOEXCEPT
+            {
+                return std::addressof (s->value);
+            }
 
-        template <typename TValue>
-        struct singleton_range : base_range
-        {
-            typedef                 singleton_range<TValue>             this_type       ;
-            typedef                 TValue                              value_type      ;
-            typedef                 TValue const &                      return_type     ;
+            constexpr static void construct (storage_type * s, value_type const & v)
+            {
+                std::construct_at (address (s), v);
+            }
 
-            enum
+            constexpr static void construct (storage_type * s, value_type && v)
             {
-                returns_reference = 1   ,
-            };
+                std::construct_at (address (s), std::move (v));
+            }
 
-            value_type  value   ;
-            bool        done    ;
+            constexpr static void destroy (storage_type * s) CPPLINQ_NOEXCEPT
+            {
+                std::destroy_at (address (s));
+            }
+#else
+            typedef typename std::aligned_storage<
+                    sizeof (value_type)
+                ,   std::alignment_of<value_type>::value
+                >::type storage_type    ;
 
-            CPPLINQ_INLINEMETHOD singleton_range (TValue const & value)
-                :   value   (value)
-                ,   done    (false)
+            CPPLINQ_INLINEMETHOD static value_type * address (storage_type * s) CPPLINQ_NOEXCEPT
             {
+                return reinterpret_cast<value_type *> (s);
             }
 
-            CPPLINQ_INLINEMETHOD singleton_range (TValue&& value) CPPLINQ_NOEXCEPT
-                :   value   (std::move (value))
-                ,   done    (false)
+            CPPLINQ_INLINEMETHOD static value_type const * address (storage_type const * s) CPPLINQ_NOEXCEPT
             {
+                return reinterpret_cast<value_type const *> (s);
             }
 
-            CPPLINQ_INLINEMETHOD singleton_range (singleton_range const & v) CPPLINQ_NOEXCEPT
-                :   value   (v.value)
-                ,   done    (v.done)
+            CPPLINQ_INLINEMETHOD static void construct (storage_type * s, value_type const & v)
             {
+                new (s) value_type (v);
             }
 
-            CPPLINQ_INLINEMETHOD singleton_range (singleton_range && v) CPPLINQ_NOEXCEPT
-                :   value   (std::move (v.value))
-                ,   done    (std::move (v.done))
+            CPPLINQ_INLINEMETHOD static void construct (storage_type * s, value_type && v)
             {
+                new (s) value_type (std::move (v));
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD static void destroy (storage_type * s) CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                address (s)->~value_type ();
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            storage_type    storage         ;
+            bool            is_initialized  ;
+
+            CPPLINQ_CONSTEXPR static void move (
+                    storage_type * to
+                ,   storage_type * from
+                ) CPPLINQ_NOEXCEPT
             {
-                return value;
+                construct (to, std::move (*address (from)));
+                destroy (from);
             }
 
-            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR static void copy (
+                    storage_type * to
+                ,   storage_type const * from
+                )
             {
-                auto d  = done;
-                done    = true;
-                return !d;
+                construct (to, *address (from));
             }
+
+
         };
 
+        // -------------------------------------------------------------------------
+        // The generic interface
+        // -------------------------------------------------------------------------
+        // _range classes:
+        //      inherit base_range
+        //      COPYABLE
+        //      MOVEABLE (movesemantics)
+        //      typedef                 ...         this_type       ;
+        //      typedef                 ...         value_type      ;
+        //      typedef                 ...         return_type     ;   // value_type | value_type const &
+        //      enum { returns_reference = 0|1 };
+        //      return_type front () const
+        //      bool next ()
+        //      template<typename TRangeBuilder>
+        //      typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+        //      #if CPPLINQ_RVALUE_OPERATORS
+        //      template<typename TRangeBuilder>
+        //      typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+        //          Moves the range into the builder, temporary pipelines are moved
+        //          stage by stage rather than copied
+        //      #endif
+        // -------------------------------------------------------------------------
+        // _range classes may optionally support batches (see batch_traits):
+        //      enum { supports_batch = 0|1 };
+        //      enum { prefers_batch = 0|1 };
+        //          Set when draining in batches beats next ()/front (), typically
+        //          because a stage filters (see where_range)
+        //      typedef                 ...         batch_type      ;   // value_type | value_type const *
+        //      size_type next_batch (batch_type * batch, size_type capacity)
+        //          Fills at most capacity (> 0) elements, returns 0 only when the range is exhausted
+        //          front () is undefined until next () is called again
+        //      static return_type batch_value (batch_type const & v)
+        // -------------------------------------------------------------------------
+        // _range classes over contiguous memory may expose the elements not yet
+        // visited (see is_contiguous_range):
+        //      enum { is_contiguous = 0|1 };
+        //      value_type const * span_begin () const
+        //      size_type span_size () const
+        // -------------------------------------------------------------------------
+        // _range classes may optionally report how many elements next () will
+        // still produce (see size_hint_traits):
+        //      enum { size_hint_kind = size_hint_none|size_hint_upper_bound|size_hint_exact };
+        //      size_type size_hint () const
+        // -------------------------------------------------------------------------
+        // _range classes may optionally drive a sink themselves, which fuses a
+        // pipeline into a single loop (see push_traits):
+        //      enum { supports_push = 0|1 };
+        //      template<typename TSink>
+        //      bool push (TSink & sink)
+        //          Invokes sink (value) on the remaining elements until sink returns false
+        //          Returns false if sink stopped it, true if the range was exhausted
+        //          front () is undefined after push
+        // -------------------------------------------------------------------------
+        // _range classes may optionally give indexed access to the elements next ()
+        // will still produce (see is_random_access_range), materializing ranges
+        // may materialize on the first call:
+        //      enum { supports_random_access = 0|1 };
+        //      size_type size ()
+        //      value_type|value_type const & at (size_type index)
+        //      void advance (size_type steps)
+        //          Drops steps (<= size ()) elements, front () is undefined until
+        //          next () is called again
+        // -------------------------------------------------------------------------
+        // _range classes may optionally split off independent parts so that they
+        // can be processed in parallel (see split_traits):
+        //      enum { supports_split = 0|1 };
+        //      typedef                 ...         split_type      ;   // A splittable range, its split_type is itself
+        //      size_type split_size () const
+        //          The number of source elements left, filtering ranges may produce fewer
+        //      split_type split (size_type count)
+        //          Removes the first count (<= split_size ()) source elements and returns
+        //          them as a range of their own, front () is undefined until next () is
+        //          called again
+        // -------------------------------------------------------------------------
+        // _builder classes:
+        //      inherit base_builder
+        //      COPYABLE
+        //      MOVEABLE (movesemantics)
+        //      typedef                 ...         this_type       ;
+        //      template<typename TRange>
+        //      TAggregated build (TRange range) const
         // -------------------------------------------------------------------------
 
-        struct sorting_range : base_range
+        struct base_range
         {
 #ifdef CPPLINQ_DETECT_INVALID_METHODS
         protected:
             // In order to prevent object slicing
 
-            CPPLINQ_INLINEMETHOD sorting_range () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD base_range () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD sorting_range (sorting_range const &) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD base_range (base_range const &) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD sorting_range (sorting_range &&) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD base_range (base_range &&) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD ~sorting_range () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD ~base_range () CPPLINQ_NOEXCEPT
             {
             }
+
         private:
-            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range const &);
-            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range &&);
+            CPPLINQ_INLINEMETHOD base_range & operator= (base_range const &);
+            CPPLINQ_INLINEMETHOD base_range & operator= (base_range &&);
 #endif
         };
 
-        template<typename TRange, typename TPredicate>
-        struct orderby_range : sorting_range
+        struct base_builder
         {
+#ifdef CPPLINQ_DETECT_INVALID_METHODS
+        protected:
+            // In order to prevent object slicing
 
-            typedef                 orderby_range<TRange, TPredicate>   this_type               ;
-            typedef                 TRange                              range_type              ;
-            typedef                 TPredicate                          predicate_type          ;
+            CPPLINQ_INLINEMETHOD base_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            typedef                 typename TRange::value_type         value_type              ;
-            typedef                 typename TRange::return_type        forwarding_return_type  ;
-            typedef                 value_type const &                  return_type             ;
-            enum
-            {
-                forward_returns_reference   = TRange::returns_reference ,
-                returns_reference           = 1                         ,
-            };
-
-            range_type              range           ;
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
-
-            size_type               current         ;
-            std::vector<value_type> sorted_values   ;
-
-            CPPLINQ_INLINEMETHOD orderby_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ,   bool            sort_ascending
-                ) CPPLINQ_NOEXCEPT
-                :   range           (std::move (range))
-                ,   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
-                ,   current         (invalid_size)
+            CPPLINQ_INLINEMETHOD base_builder (base_builder const &) CPPLINQ_NOEXCEPT
             {
-                static_assert (
-                        !std::is_convertible<range_type, sorting_range>::value
-                    ,   "orderby may not follow orderby or thenby"
-                    );
             }
 
-            CPPLINQ_INLINEMETHOD orderby_range (orderby_range const & v)
-                :   range           (v.range)
-                ,   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
-                ,   current         (v.current)
-                ,   sorted_values   (v.sorted_values)
+            CPPLINQ_INLINEMETHOD base_builder (base_builder &&) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD orderby_range (orderby_range && v) CPPLINQ_NOEXCEPT
-                :   range           (std::move (v.range))
-                ,   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
-                ,   current         (std::move (v.current))
-                ,   sorted_values   (std::move (v.sorted_values))
+            CPPLINQ_INLINEMETHOD ~base_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
-            {
-                return range.front ();
-            }
+        private:
+            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder const &);
+            CPPLINQ_INLINEMETHOD base_builder & operator= (base_builder &&);
+#endif
+        };
 
-            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+        // -------------------------------------------------------------------------
+
+        // batch_traits gives uniform access to the batch protocol, ranges that
+        // don't support batches are filled by looping over next ()/front ()
+        template<typename TRange, typename TEnable = void>
+        struct batch_traits
+        {
+            typedef                 TRange                              range_type      ;
+            typedef        typename TRange::value_type                  batch_type      ;
+            typedef        typename TRange::value_type const &          return_type     ;
+            enum
             {
-                return range.next ();
-            }
+                is_native       = 0 ,
+                prefers_batch   = 0 ,
+            };
 
-            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
+            static CPPLINQ_CONSTEXPR size_type next_batch (
+                    range_type &    range
+                ,   batch_type *    batch
+                ,   size_type       capacity
+                )
             {
-                if (sort_ascending)
-                {
-                    return predicate (l) < predicate (r);
-                }
-                else
+                size_type count = 0U;
+                while (count < capacity && range.next ())
                 {
-                    return predicate (r) < predicate (l);
+                    batch[count] = range.front ();
+                    ++count;
                 }
+                return count;
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v) CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                return v;
             }
+        };
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+        template<typename TRange>
+        struct batch_traits<TRange, typename std::enable_if<(TRange::supports_batch != 0)>::type>
+        {
+            typedef                 TRange                              range_type      ;
+            typedef        typename TRange::batch_type                  batch_type      ;
+            typedef        typename TRange::return_type                 return_type     ;
+            enum
             {
-                return sorted_values[current];
+                is_native       = 1                         ,
+                prefers_batch   = TRange::prefers_batch     ,
+            };
+
+            static CPPLINQ_CONSTEXPR size_type next_batch (
+                    range_type &    range
+                ,   batch_type *    batch
+                ,   size_type       capacity
+                )
+            {
+                return range.next_batch (batch, capacity);
             }
 
-            CPPLINQ_METHOD bool next ()
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v)
             {
-                if (current == invalid_size)
-                {
-                    sorted_values.clear ();
+                return range_type::batch_value (v);
+            }
+        };
 
-                    while (range.next ())
-                    {
-                        sorted_values.push_back (range.front ());
-                    }
+        // push_traits gives uniform access to the push protocol, ranges that
+        // don't support it are pushed by looping over next ()/front ()
+        template<typename TRange, typename TEnable = void>
+        struct push_traits
+        {
+            enum
+            {
+                is_native = 0   ,
+            };
 
-                    if (sorted_values.size () == 0)
+            template<typename TSink>
+            static CPPLINQ_CONSTEXPR bool push (TRange & range, TSink & sink)
+            {
+                while (range.next ())
+                {
+                    if (!sink (range.front ()))
                     {
                         return false;
                     }
-
-                    std::sort (
-                            sorted_values.begin ()
-                        ,   sorted_values.end ()
-                        ,   [this] (value_type const & l, value_type const & r)
-                            {
-                                return this->compare_values (l,r);
-                            }
-                        );
-
-                    current = 0U;
-                    return true;
-                }
-
-                if (current < sorted_values.size ())
-                {
-                    ++current;
                 }
 
-                return current < sorted_values.size ();
+                return true;
             }
         };
 
-        template<typename TPredicate>
-        struct orderby_builder : base_builder
+        template<typename TRange>
+        struct push_traits<TRange, typename std::enable_if<(TRange::supports_push != 0)>::type>
         {
-            typedef                 orderby_builder<TPredicate> this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
-
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
-
-            CPPLINQ_INLINEMETHOD explicit orderby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
+            enum
             {
-            }
+                is_native = 1   ,
+            };
 
-            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder const & v)
-                :   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
+            template<typename TSink>
+            static CPPLINQ_CONSTEXPR bool push (TRange & range, TSink & sink)
             {
+                return range.push (sink);
             }
+        };
 
-            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
+        // -------------------------------------------------------------------------
+
+        // size_hint_traits gives uniform access to size hints, ranges without
+        // one report invalid_size
+        template<typename TRange, typename TEnable = void>
+        struct size_hint_traits
+        {
+            enum
             {
-            }
+                kind = size_hint_none   ,
+            };
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD orderby_range<TRange, TPredicate> build (TRange range) const
+            static CPPLINQ_CONSTEXPR size_type size_hint (TRange const &) CPPLINQ_NOEXCEPT
             {
-                return orderby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
+                return invalid_size;
             }
-
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TPredicate>
-        struct thenby_range : sorting_range
+        template<typename TRange>
+        struct size_hint_traits<TRange, typename std::enable_if<(TRange::size_hint_kind != size_hint_none)>::type>
         {
-            typedef                 thenby_range<TRange, TPredicate>        this_type               ;
-            typedef                 TRange                                  range_type              ;
-            typedef                 TPredicate                              predicate_type          ;
-
-            typedef                 typename TRange::value_type             value_type              ;
-            typedef                 typename TRange::forwarding_return_type forwarding_return_type  ;
-            typedef                 value_type const &                      return_type             ;
             enum
             {
-                forward_returns_reference   = TRange::forward_returns_reference ,
-                returns_reference           = 1                                 ,
+                kind = TRange::size_hint_kind   ,
             };
 
-            range_type              range           ;
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
-
-            size_type               current         ;
-            std::vector<value_type> sorted_values   ;
-
-            CPPLINQ_INLINEMETHOD thenby_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ,   bool            sort_ascending
-                ) CPPLINQ_NOEXCEPT
-                :   range           (std::move (range))
-                ,   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
-                ,   current         (invalid_size)
+            static CPPLINQ_CONSTEXPR size_type size_hint (TRange const & range) CPPLINQ_NOEXCEPT
             {
-                static_assert (
-                        std::is_convertible<range_type, sorting_range>::value
-                    ,   "thenby may only follow orderby or thenby"
-                    );
+                return range.size_hint ();
             }
+        };
 
-            CPPLINQ_INLINEMETHOD thenby_range (thenby_range const & v)
-                :   range           (v.range)
-                ,   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
-                ,   current         (v.current)
-                ,   sorted_values   (v.sorted_values)
-            {
-            }
+        // Returns the capacity to reserve for the remaining elements of range,
+        // capacity is the guess to use when range has no exact size
+        template<typename TRange>
+        CPPLINQ_INLINEMETHOD size_type get_reserve_capacity (TRange const & range, size_type capacity) CPPLINQ_NOEXCEPT
+        {
+            typedef size_hint_traits<TRange> traits;
 
-            CPPLINQ_INLINEMETHOD thenby_range (thenby_range && v) CPPLINQ_NOEXCEPT
-                :   range           (std::move (v.range))
-                ,   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
-                ,   current         (std::move (v.current))
-                ,   sorted_values   (std::move (v.sorted_values))
+            if (traits::kind == size_hint_none)
             {
+                return capacity;
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            auto hint = traits::size_hint (range);
+
+            if (traits::kind == size_hint_exact || hint < capacity)
             {
-                return range_builder.build (*this);
+                return hint;
             }
 
-            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
+            return capacity;
+        }
+
+        // Frees the memory held by a container, unlike clear () this also gives
+        // back the capacity of a vector
+        template<typename TContainer>
+        CPPLINQ_INLINEMETHOD void release_buffer (TContainer & container)
+        {
+            TContainer ().swap (container);
+        }
+
+        // is_random_access_range is true_type for ranges that give indexed access
+        // to their elements (size ()/at ()/advance ())
+        template<typename TRange, typename TEnable = void>
+        struct is_random_access_range : std::false_type
+        {
+        };
+
+        template<typename TRange>
+        struct is_random_access_range<TRange, typename std::enable_if<(TRange::supports_random_access != 0)>::type>
+            : std::true_type
+        {
+        };
+
+        // is_contiguous_range is true_type for ranges that expose their elements
+        // as a span (span_begin ()/span_size ())
+        template<typename TRange, typename TEnable = void>
+        struct is_contiguous_range : std::false_type
+        {
+        };
+
+        template<typename TRange>
+        struct is_contiguous_range<TRange, typename std::enable_if<(TRange::is_contiguous != 0)>::type>
+            : std::true_type
+        {
+        };
+
+        // split_traits tells if a range can split off parts and the type of the
+        // parts, for ranges that can't split_type is the range itself
+        template<typename TRange, typename TEnable = void>
+        struct split_traits
+        {
+            typedef                 TRange                              split_type      ;
+            enum
             {
-                return range.front ();
-            }
+                is_native = 0   ,
+            };
+        };
 
-            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+        template<typename TRange>
+        struct split_traits<TRange, typename std::enable_if<(TRange::supports_split != 0)>::type>
+        {
+            typedef        typename TRange::split_type                  split_type      ;
+            enum
             {
-                return range.next ();
-            }
+                is_native = 1   ,
+            };
+        };
 
-            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
+#ifndef CPPLINQ_NO_PARALLEL
+        template<typename TSplitRange, typename TResult, typename TSeed, typename TAccumulate, typename TCombine>
+        CPPLINQ_INLINEMETHOD void split_reduce_part (
+                executor &          pool
+            ,   TSplitRange &       range
+            ,   size_type           grain
+            ,   TResult &           result
+            ,   TSeed &             seed
+            ,   TAccumulate &       accumulate
+            ,   TCombine &          combine
+            )
+        {
+            for (;;)
             {
-                auto pless = range.compare_values (l,r);
-                if (pless)
+                auto remaining = range.split_size ();
+                if (remaining <= grain)
                 {
-                    return true;
+                    accumulate (result, range);
+                    return;
                 }
 
-                auto pgreater = range.compare_values (r,l);
-                if (pgreater)
+                if (pool.should_split ())
                 {
-                    return false;
+                    auto lower          = range.split (remaining / 2U);
+                    auto upper_result   = seed ();
+                    pool.fork_join (
+                            [&] () {split_reduce_part (pool, lower, grain, result, seed, accumulate, combine);}
+                        ,   [&] () {split_reduce_part (pool, range, grain, upper_result, seed, accumulate, combine);}
+                        );
+                    combine (result, std::move (upper_result));
+                    return;
                 }
 
-                if (sort_ascending)
-                {
-                    return predicate (l) < predicate (r);
-                }
-                else
-                {
-                    return predicate (r) < predicate (l);
-                }
+                auto part = range.split (grain);
+                accumulate (result, part);
             }
+        }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                return sorted_values[current];
-            }
-
-            CPPLINQ_METHOD bool next ()
-            {
-                if (current == invalid_size)
-                {
-                    sorted_values.clear ();
-
-                    while (range.forwarding_next ())
-                    {
-                        sorted_values.push_back (range.forwarding_front ());
-                    }
-
-                    if (sorted_values.size () == 0)
-                    {
-                        return false;
-                    }
-
-                    std::sort (
-                            sorted_values.begin ()
-                        ,   sorted_values.end ()
-                        ,   [this] (value_type const & l, value_type const & r)
-                            {
-                                return this->compare_values (l,r);
-                            }
-                        );
-
-                    current = 0U;
-                    return true;
-                }
-
-                if (current < sorted_values.size ())
-                {
-                    ++current;
-                }
-
-                return current < sorted_values.size ();
-            }
-        };
-
-        template<typename TPredicate>
-        struct thenby_builder : base_builder
+        // split_reduce drains a splittable range in parts on pool. Each part is
+        // drained by accumulate (result, part) into a result created by seed (),
+        // results are combined in source order by combine (result, std::move (other)).
+        //
+        // Parts are made by lazy binary splitting: a task works through its range
+        // grain elements at a time and splits off half of what is left only when
+        // its own queue has run dry. Busy workers cause few splits and idle ones
+        // many which balances the load even when the cost per element is skewed.
+        template<typename TRange, typename TSeed, typename TAccumulate, typename TCombine>
+        CPPLINQ_INLINEMETHOD auto split_reduce (
+                executor &          pool
+            ,   TRange &            range
+            ,   size_type           grain
+            ,   TSeed               seed
+            ,   TAccumulate         accumulate
+            ,   TCombine            combine
+            ) -> decltype (seed ())
         {
-            typedef                 thenby_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
-
-            predicate_type          predicate       ;
-            bool                    sort_ascending  ;
-
-            CPPLINQ_INLINEMETHOD explicit thenby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (predicate))
-                ,   sort_ascending  (sort_ascending)
-            {
-            }
+            static_assert (
+                    split_traits<TRange>::is_native
+                ,   "split_reduce requires a splittable range, typically sources over random access iterators"
+                );
 
-            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder const & v)
-                :   predicate       (v.predicate)
-                ,   sort_ascending  (v.sort_ascending)
-            {
-            }
+            auto whole  = range.split (range.split_size ());
+            auto result = seed ();
 
-            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate       (std::move (v.predicate))
-                ,   sort_ascending  (std::move (v.sort_ascending))
+            if (pool.runs_inline (whole.split_size ()))
             {
+                accumulate (result, whole);
             }
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD thenby_range<TRange, TPredicate> build (TRange range) const
+            else
             {
-                return thenby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
+                split_reduce_part (
+                        pool
+                    ,   whole
+                    ,   grain > 0U ? grain : static_cast<size_type> (CPPLINQ_SPLIT_GRAIN)
+                    ,   result
+                    ,   seed
+                    ,   accumulate
+                    ,   combine
+                    );
             }
 
-        };
-
-        // -------------------------------------------------------------------------
+            return result;
+        }
+#endif
 
-        template<typename TRange>
-        struct reverse_range : base_range
+        template<typename TValueIterator>
+        struct from_range : base_range
         {
-            typedef                 reverse_range<TRange>                       this_type           ;
-            typedef                 TRange                                      range_type          ;
-
-            typedef                 typename TRange::value_type                 value_type          ;
-            typedef                 value_type const &                          return_type         ;
+            static TValueIterator get_iterator ();
 
-            typedef                 std::vector<value_type>                     stack_type          ;
+            typedef                 from_range<TValueIterator>          this_type       ;
+            typedef                 TValueIterator                      iterator_type   ;
 
+            typedef                 decltype (*get_iterator ())         raw_value_type  ;
+            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
+            typedef                 value_type const &                  return_type     ;
             enum
             {
-                returns_reference   = 1     ,
+                returns_reference = 1,
+                // Scalars are copied into batches, other values are referenced.
+                // An input iterator may refer into itself (istream_iterator) so
+                // references are only kept from forward iterators
+                batch_by_value    = std::is_scalar<value_type>::value,
+                supports_batch    = batch_by_value || (std::is_reference<raw_value_type>::value && std::is_base_of<
+                        std::forward_iterator_tag
+                    ,   typename std::iterator_traits<iterator_type>::iterator_category
+                    >::value),
+                prefers_batch     = 0,
+                is_contiguous     = is_contiguous_iterator<iterator_type>::value,
+                supports_push     = 1,
+                supports_random_access = std::is_base_of<
+                        std::random_access_iterator_tag
+                    ,   typename std::iterator_traits<iterator_type>::iterator_category
+                    >::value,
+                size_hint_kind    = supports_random_access ? size_hint_exact : size_hint_none,
+                supports_split    = supports_random_access,
             };
+            typedef        typename std::conditional<
+                    batch_by_value
+                ,   value_type
+                ,   value_type const *
+                >::type                                                 batch_type      ;
+            typedef                 this_type                           split_type      ;
 
+            iterator_type           current ;
+            iterator_type           upcoming;
+            iterator_type           end     ;
 
-            range_type                  range               ;
-            size_type                   capacity            ;
-            std::vector<value_type>     reversed            ;
-            bool                        start               ;
 
-            CPPLINQ_INLINEMETHOD reverse_range (
-                    range_type          range
-                ,   size_type           capacity
+            CPPLINQ_INLINEMETHOD from_range (
+                    iterator_type begin
+                ,   iterator_type end
                 ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   capacity            (capacity)
-                ,   start               (true)
+                :   current (std::move (begin))
+                ,   upcoming(current)
+                ,   end     (std::move (end))
             {
             }
 
-            CPPLINQ_INLINEMETHOD reverse_range (reverse_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   capacity            (v.capacity)
-                ,   reversed            (v.reversed)
-                ,   start               (v.start)
+            CPPLINQ_INLINEMETHOD from_range (from_range const & v) CPPLINQ_NOEXCEPT
+                :   current (v.current)
+                ,   upcoming(v.upcoming)
+                ,   end     (v.end)
             {
             }
 
-            CPPLINQ_INLINEMETHOD reverse_range (reverse_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   capacity            (std::move (v.capacity))
-                ,   reversed            (std::move (v.reversed))
-                ,   start               (std::move (v.start))
+            CPPLINQ_INLINEMETHOD from_range (from_range && v) CPPLINQ_NOEXCEPT
+                :   current (std::move (v.current))
+                ,   upcoming(std::move (v.upcoming))
+                ,   end     (std::move (v.end))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                CPPLINQ_ASSERT (!start);
-                CPPLINQ_ASSERT (!reversed.empty ());
-                return reversed[reversed.size () - 1];
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            // current only moves onto upcoming or onto an element before end,
+            // once it differs from upcoming it can't be end
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
-                if (start)
-                {
-                    start = false;
-
-                    reversed.clear ();
-                    reversed.reserve (capacity);
-
-                    while (range.next ())
-                    {
-                        reversed.push_back (range.front ());
-                    }
+                CPPLINQ_ASSERT (current != upcoming);
 
-                    return !reversed.empty ();
-                }
+                return *current;
+            }
 
-                if (reversed.empty ())
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (upcoming == end)
                 {
                     return false;
                 }
 
-                reversed.pop_back ();
+                current = upcoming;
+                ++upcoming;
+                return true;
+            }
 
-                return !reversed.empty ();
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity) CPPLINQ_NOEXCEPT
+            {
+                return next_batch (
+                        batch
+                    ,   capacity
+                    ,   typename std::iterator_traits<iterator_type>::iterator_category ()
+                    );
             }
-        };
 
-        struct reverse_builder : base_builder
-        {
-            typedef             reverse_builder     this_type   ;
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity, std::input_iterator_tag) CPPLINQ_NOEXCEPT
+            {
+                // Iterators are kept in locals so the loop doesn't store to this
+                auto iter   = upcoming;
+                auto last   = end;
 
-            size_type           capacity                        ;
+                size_type count = 0U;
+                while (count < capacity && iter != last)
+                {
+                    batch[count] = to_batch_element (*iter);
+                    ++iter;
+                    ++count;
+                }
 
-            CPPLINQ_INLINEMETHOD reverse_builder (size_type capacity) CPPLINQ_NOEXCEPT
-                :   capacity (capacity)
-            {
+                upcoming = iter;
+
+                return count;
             }
 
-            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder const & v) CPPLINQ_NOEXCEPT
-                :   capacity (v.capacity)
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity, std::random_access_iterator_tag) CPPLINQ_NOEXCEPT
             {
+                // A known count gives the compiler a simple loop to unroll or vectorize
+                typedef typename std::iterator_traits<iterator_type>::difference_type difference_type;
+
+                auto iter       = upcoming;
+                auto remaining  = static_cast<size_type> (end - iter);
+                auto count      = remaining < capacity ? remaining : capacity;
+
+                for (size_type index = 0U; index < count; ++index)
+                {
+                    batch[index] = to_batch_element (iter[static_cast<difference_type> (index)]);
+                }
+
+                upcoming = iter + static_cast<difference_type> (count);
+
+                return count;
             }
 
-            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder && v) CPPLINQ_NOEXCEPT
-                :   capacity (std::move (v.capacity))
+            CPPLINQ_INLINEMETHOD value_type const * span_begin () const CPPLINQ_NOEXCEPT
             {
+                return upcoming == end ? nullptr : std::addressof (*upcoming);
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD reverse_range<TRange> build (TRange range) const
+            CPPLINQ_INLINEMETHOD size_type span_size () const CPPLINQ_NOEXCEPT
             {
-                return reverse_range<TRange> (std::move (range), capacity);
+                return static_cast<size_type> (end - upcoming);
             }
-        };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TPredicate>
-        struct where_range : base_range
-        {
-            typedef                 where_range<TRange, TPredicate> this_type       ;
-            typedef                 TRange                          range_type      ;
-            typedef                 TPredicate                      predicate_type  ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
             {
-                returns_reference   = TRange::returns_reference   ,
-            };
-
-            range_type              range       ;
-            predicate_type          predicate   ;
+                return static_cast<size_type> (end - upcoming);
+            }
 
-            CPPLINQ_INLINEMETHOD where_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
             {
+                return static_cast<size_type> (end - upcoming);
             }
 
-            CPPLINQ_INLINEMETHOD where_range (where_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
+            CPPLINQ_INLINEMETHOD return_type at (size_type index) const CPPLINQ_NOEXCEPT
             {
+                typedef typename std::iterator_traits<iterator_type>::difference_type difference_type;
+                return upcoming[static_cast<difference_type> (index)];
             }
 
-            CPPLINQ_INLINEMETHOD where_range (where_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD void advance (size_type steps) CPPLINQ_NOEXCEPT
             {
+                typedef typename std::iterator_traits<iterator_type>::difference_type difference_type;
+                upcoming += static_cast<difference_type> (steps);
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD size_type split_size () const CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                return static_cast<size_type> (end - upcoming);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD split_type split (size_type count) CPPLINQ_NOEXCEPT
             {
-                return range.front ();
+                typedef typename std::iterator_traits<iterator_type>::difference_type difference_type;
+                CPPLINQ_ASSERT (count <= split_size ());
+
+                auto begin  = upcoming;
+                upcoming    += static_cast<difference_type> (count);
+                current     = upcoming;
+
+                return split_type (begin, upcoming);
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
             {
-                while (range.next ())
+                // Iterators are kept in locals so the loop doesn't store to this
+                auto iter   = upcoming;
+                auto last   = end;
+
+                for (; iter != last; ++iter)
                 {
-                    if (predicate (range.front ()))
+                    if (!sink (*iter))
                     {
-                        return true;
+                        current     = iter;
+                        upcoming    = ++iter;
+                        return false;
                     }
                 }
 
-                return false;
-            }
-        };
+                upcoming = iter;
 
-        template<typename TPredicate>
-        struct where_builder : base_builder
-        {
-            typedef                 where_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+                return true;
+            }
 
-            predicate_type          predicate   ;
+            static CPPLINQ_INLINEMETHOD return_type batch_value (batch_type const & v) CPPLINQ_NOEXCEPT
+            {
+                return from_batch_element (v);
+            }
 
-            CPPLINQ_INLINEMETHOD explicit where_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+        private:
+            template<typename TValue>
+            static CPPLINQ_INLINEMETHOD batch_type to_batch_element (TValue && v) CPPLINQ_NOEXCEPT
             {
+                return to_batch_element (std::forward<TValue> (v), std::integral_constant<bool, batch_by_value != 0> ());
             }
 
-            CPPLINQ_INLINEMETHOD where_builder (where_builder const & v)
-                :   predicate (v.predicate)
+            template<typename TValue>
+            static CPPLINQ_INLINEMETHOD value_type to_batch_element (TValue && v, std::true_type) CPPLINQ_NOEXCEPT
             {
+                return v;
             }
 
-            CPPLINQ_INLINEMETHOD where_builder (where_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            static CPPLINQ_INLINEMETHOD value_type const * to_batch_element (value_type const & v, std::false_type) CPPLINQ_NOEXCEPT
             {
+                return std::addressof (v);
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD where_range<TRange, TPredicate> build (TRange range) const
+            static CPPLINQ_INLINEMETHOD return_type from_batch_element (value_type const & v) CPPLINQ_NOEXCEPT
             {
-                return where_range<TRange, TPredicate>(std::move (range), predicate);
+                return v;
             }
 
+            static CPPLINQ_INLINEMETHOD return_type from_batch_element (value_type const * v) CPPLINQ_NOEXCEPT
+            {
+                return *v;
+            }
         };
 
         // -------------------------------------------------------------------------
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange>
-        struct take_range : base_range
+        template<typename TContainer>
+        struct from_copy_range : base_range
         {
-            typedef                 take_range<TRange>              this_type       ;
-            typedef                 TRange                          range_type      ;
+            typedef                 from_copy_range<TContainer>         this_type       ;
 
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
+            typedef                 TContainer                          container_type  ;
+            typedef        typename TContainer::const_iterator          iterator_type   ;
+            typedef        typename TContainer::value_type              value_type      ;
+            typedef                 value_type const &                  return_type     ;
+            // Parts refer to the owned container which must outlive them
+            typedef                 from_range<iterator_type>           split_type      ;
             enum
             {
-                returns_reference   = TRange::returns_reference   ,
+                returns_reference = 1 ,
+                supports_split    = std::is_base_of<
+                        std::random_access_iterator_tag
+                    ,   typename std::iterator_traits<iterator_type>::iterator_category
+                    >::value,
             };
 
-            range_type              range       ;
-            size_type               count       ;
-            size_type               current     ;
-
+            container_type          container   ;
 
-            CPPLINQ_INLINEMETHOD take_range (
-                    range_type      range
-                ,   size_type       count
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   count       (std::move (count))
-                ,   current     (0)
+            iterator_type           current     ;
+            iterator_type           upcoming    ;
+            iterator_type           end         ;
+
+            // The iterators refer to the owned container so they are rebased
+            // whenever the container is copied or moved
+
+            CPPLINQ_INLINEMETHOD from_copy_range (
+                    container_type&&        container
+                )
+                :   container   (std::move (container))
+                ,   current     (get_begin (this->container))
+                ,   upcoming    (get_begin (this->container))
+                ,   end         (get_end (this->container))
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_range (take_range const & v)
-                :   range       (v.range)
-                ,   count       (v.count)
-                ,   current     (v.current)
+            CPPLINQ_INLINEMETHOD from_copy_range (
+                    container_type const &  container
+                )
+                :   container   (container)
+                ,   current     (get_begin (this->container))
+                ,   upcoming    (get_begin (this->container))
+                ,   end         (get_end (this->container))
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_range (take_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   count       (std::move (v.count))
-                ,   current     (std::move (v.current))
+            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range const & v)
+                :   container   (v.container)
+                ,   current     (rebase (container, v.container, v.current))
+                ,   upcoming    (rebase (container, v.container, v.upcoming))
+                ,   end         (rebase (container, v.container, v.end))
             {
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD from_copy_range (from_copy_range && v) CPPLINQ_NOEXCEPT
             {
-                return range_builder.build (*this);
+                take_over (v, typename std::iterator_traits<iterator_type>::iterator_category ());
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            CPPLINQ_INLINEMETHOD void take_over (from_copy_range & v, std::input_iterator_tag) CPPLINQ_NOEXCEPT
             {
-                return range.front ();
+                // Node based containers keep their iterators valid across a
+                // swap, except for end () which is remapped
+                auto v_end              = get_end (v.container);
+                auto current_at_end     = v.current == v_end;
+                auto upcoming_at_end    = v.upcoming == v_end;
+                auto end_at_end         = v.end == v_end;
+
+                container.swap (v.container);
+
+                current     = current_at_end    ? get_end (container) : v.current   ;
+                upcoming    = upcoming_at_end   ? get_end (container) : v.upcoming  ;
+                end         = end_at_end        ? get_end (container) : v.end       ;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD void take_over (from_copy_range & v, std::random_access_iterator_tag) CPPLINQ_NOEXCEPT
             {
-                if (current >= count)
-                {
-                    return false;
-                }
+                // A swap may invalidate the iterators of std::basic_string or
+                // std::array, offsets are cheap to rebase on
+                auto current_offset     = v.current - get_begin (v.container);
+                auto upcoming_offset    = v.upcoming - get_begin (v.container);
+                auto end_offset         = v.end - get_begin (v.container);
 
-                ++current;
-                return range.next ();
+                container.swap (v.container);
+
+                current     = get_begin (container) + current_offset;
+                upcoming    = get_begin (container) + upcoming_offset;
+                end         = get_begin (container) + end_offset;
             }
-        };
 
-        struct take_builder : base_builder
-        {
-            typedef                 take_builder        this_type       ;
+            static CPPLINQ_INLINEMETHOD iterator_type get_begin (container_type const & c) CPPLINQ_NOEXCEPT
+            {
+                return c.begin ();
+            }
 
-            size_type               count       ;
+            static CPPLINQ_INLINEMETHOD iterator_type get_end (container_type const & c) CPPLINQ_NOEXCEPT
+            {
+                return c.end ();
+            }
 
-            CPPLINQ_INLINEMETHOD explicit take_builder (size_type count) CPPLINQ_NOEXCEPT
-                :   count (std::move (count))
+            static CPPLINQ_INLINEMETHOD iterator_type rebase (
+                    container_type const &  to
+                ,   container_type const &  from
+                ,   iterator_type           position
+                ) CPPLINQ_NOEXCEPT
             {
+                return std::next (get_begin (to), std::distance (get_begin (from), position));
             }
 
-            CPPLINQ_INLINEMETHOD take_builder (take_builder const & v) CPPLINQ_NOEXCEPT
-                :   count (v.count)
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
+                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD take_builder (take_builder && v) CPPLINQ_NOEXCEPT
-                :   count (std::move (v.count))
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD take_range<TRange> build (TRange range) const
+            // current can't be end once it differs from upcoming, as in from_range
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
-                return take_range<TRange>(std::move (range), count);
+                CPPLINQ_ASSERT (current != upcoming);
+
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (upcoming == end)
+                {
+                    return false;
+                }
+
+                current = upcoming;
+                ++upcoming;
+                return true;
             }
 
+            CPPLINQ_INLINEMETHOD size_type split_size () const CPPLINQ_NOEXCEPT
+            {
+                return static_cast<size_type> (std::distance (upcoming, end));
+            }
+
+            CPPLINQ_INLINEMETHOD split_type split (size_type count) CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (count <= split_size ());
+
+                auto begin  = upcoming;
+                upcoming    = std::next (upcoming, static_cast<typename std::iterator_traits<iterator_type>::difference_type> (count));
+                current     = upcoming;
+
+                return split_type (begin, upcoming);
+            }
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TPredicate>
-        struct take_while_range : base_range
+        struct int_range : base_range
         {
-            typedef                 take_while_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                                  range_type      ;
-            typedef                 TPredicate                              predicate_type  ;
-
-            typedef                 typename TRange::value_type             value_type      ;
-            typedef                 typename TRange::return_type            return_type     ;
+            typedef                 int_range                           this_type       ;
+            typedef                 int                                 value_type      ;
+            typedef                 int                                 return_type     ;
+            typedef                 int                                 batch_type      ;
+            typedef                 int_range                           split_type      ;
             enum
             {
-                returns_reference   = TRange::returns_reference   ,
+                returns_reference       = 0                 ,
+                supports_batch          = 1                 ,
+                prefers_batch           = 0                 ,
+                size_hint_kind          = size_hint_exact   ,
+                supports_push           = 1                 ,
+                supports_random_access  = 1                 ,
+                supports_split          = 1                 ,
             };
 
-            range_type              range       ;
-            predicate_type          predicate   ;
-            bool                    done        ;
+            int                     current ;
+            int                     end     ;
+
+            static CPPLINQ_CONSTEXPR int get_current (int begin, int end)
+            {
+                return (begin < end ? begin : end) - 1; // -1 in order to start one-step before the first element
+            }
 
+            static CPPLINQ_CONSTEXPR int get_end (int begin, int end)     // -1 in order to avoid an extra test in next
+            {
+                return (begin < end ? end : begin) - 1;
+            }
 
-            CPPLINQ_INLINEMETHOD take_while_range (
-                    range_type      range
-                ,   predicate_type  predicate
+            CPPLINQ_CONSTEXPR int_range (
+                    int begin
+                ,   int end
                 ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-                ,   done        (false)
+                :   current (get_current (begin, end))
+                ,   end     (get_end (begin,end))
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_while_range (take_while_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   done        (v.done)
+            CPPLINQ_CONSTEXPR int_range (int_range const & v) CPPLINQ_NOEXCEPT
+                :   current (v.current)
+                ,   end     (v.end)
             {
             }
 
-            CPPLINQ_INLINEMETHOD take_while_range (take_while_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   done        (std::move (v.done))
+            CPPLINQ_CONSTEXPR int_range (int_range && v) CPPLINQ_NOEXCEPT
+                :   current (std::move (v.current))
+                ,   end     (std::move (v.end))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return range.front ();
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_CONSTEXPR return_type front () const
             {
-                if (done)
-                {
-                    return false;
-                }
+                return current;
+            }
 
-                if (!range.next ())
+            CPPLINQ_CONSTEXPR bool next () CPPLINQ_NOEXCEPT
+            {
+                if (current >= end)
                 {
-                    done = true;
                     return false;
                 }
 
-                if (!predicate (range.front ()))
+                ++current;
+
+                return true;
+            }
+
+            CPPLINQ_CONSTEXPR size_type next_batch (batch_type * batch, size_type capacity) CPPLINQ_NOEXCEPT
+            {
+                auto first      = current + 1;
+                auto remaining  = static_cast<size_type> (end - current);
+                auto count      = remaining < capacity ? remaining : capacity;
+                for (size_type iter = 0U; iter < count; ++iter)
                 {
-                    done = true;
-                    return false;
+                    batch[iter] = first + static_cast<int> (iter);
                 }
+                current += static_cast<int> (count);
+                return count;
+            }
 
-                return true;
+            CPPLINQ_CONSTEXPR size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return static_cast<size_type> (end - current);
             }
-        };
 
-        template<typename TPredicate>
-        struct take_while_builder : base_builder
-        {
-            typedef                 take_while_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            CPPLINQ_CONSTEXPR size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return static_cast<size_type> (end - current);
+            }
 
-            predicate_type          predicate   ;
+            CPPLINQ_CONSTEXPR return_type at (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                return current + 1 + static_cast<int> (index);
+            }
 
-            CPPLINQ_INLINEMETHOD take_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_CONSTEXPR void advance (size_type steps) CPPLINQ_NOEXCEPT
             {
+                current += static_cast<int> (steps);
             }
 
-            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_CONSTEXPR size_type split_size () const CPPLINQ_NOEXCEPT
             {
+                return static_cast<size_type> (end - current);
             }
 
-            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_CONSTEXPR split_type split (size_type count) CPPLINQ_NOEXCEPT
             {
+                CPPLINQ_ASSERT (count <= split_size ());
+
+                auto begin  = current + 1;
+                current     += static_cast<int> (count);
+
+                return split_type (begin, current + 1);
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD take_while_range<TRange, TPredicate> build (TRange range) const
+            template<typename TSink>
+            CPPLINQ_CONSTEXPR bool push (TSink & sink)
             {
-                return take_while_range<TRange, TPredicate>(std::move (range), predicate);
+                auto value  = current;
+                auto last   = end;
+
+                while (value < last)
+                {
+                    ++value;
+                    if (!sink (value))
+                    {
+                        current = value;
+                        return false;
+                    }
+                }
+
+                current = value;
+
+                return true;
             }
 
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v) CPPLINQ_NOEXCEPT
+            {
+                return v;
+            }
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange>
-        struct skip_range : base_range
+        template <typename TValue>
+        struct repeat_range : base_range
         {
-            typedef                 skip_range<TRange>              this_type       ;
-            typedef                 TRange                          range_type      ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
+            typedef                 repeat_range<TValue>                this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue                              return_type     ;
+            typedef                 TValue const *                      batch_type      ;
+            typedef                 repeat_range<TValue>                split_type      ;
             enum
             {
-                returns_reference   = TRange::returns_reference   ,
+                returns_reference       = 0                 ,
+                supports_batch          = 1                 ,
+                prefers_batch           = 0                 ,
+                size_hint_kind          = size_hint_exact   ,
+                supports_push           = 1                 ,
+                supports_random_access  = 1                 ,
+                supports_split          = 1                 ,
             };
 
-            range_type              range       ;
-            size_type               count       ;
-            size_type               current     ;
+            TValue                  value       ;
+            size_type               remaining   ;
 
-            CPPLINQ_INLINEMETHOD skip_range (
-                    range_type      range
-                ,   size_type       count
+            CPPLINQ_CONSTEXPR repeat_range (
+                    value_type element
+                ,   size_type count
                 ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   count       (std::move (count))
-                ,   current     (0)
+                :   value       (std::move (element))
+                ,   remaining   (count)
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_range (skip_range const & v)
-                :   range       (v.range)
-                ,   count       (v.count)
-                ,   current     (v.current)
+            CPPLINQ_CONSTEXPR repeat_range (repeat_range const & v) CPPLINQ_NOEXCEPT
+                :   value       (v.value)
+                ,   remaining   (v.remaining)
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_range (skip_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   count       (std::move (v.count))
-                ,   current     (std::move (v.current))
+            CPPLINQ_CONSTEXPR repeat_range (repeat_range && v) CPPLINQ_NOEXCEPT
+                :   value       (std::move (v.value))
+                ,   remaining   (std::move (v.remaining))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return range.front ();
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_CONSTEXPR return_type front () const
             {
-                if (current == invalid_size)
+                return value;
+            }
+
+            CPPLINQ_CONSTEXPR bool next () CPPLINQ_NOEXCEPT
+            {
+                if (remaining == 0U)
                 {
                     return false;
                 }
 
-                while (current < count && range.next ())
-                {
-                    ++current;
-                }
+                --remaining;
 
-                if (current < count)
-                {
-                    current = invalid_size;
-                    return false;
-                }
-
-                return range.next ();
+                return true;
             }
-        };
 
-        struct skip_builder : base_builder
-        {
-            typedef                 skip_builder        this_type       ;
-
-            size_type               count       ;
-
-            CPPLINQ_INLINEMETHOD explicit skip_builder (size_type count) CPPLINQ_NOEXCEPT
-                :   count (std::move (count))
+            CPPLINQ_CONSTEXPR size_type next_batch (batch_type * batch, size_type capacity) CPPLINQ_NOEXCEPT
             {
+                auto count = remaining < capacity ? remaining : capacity;
+                for (size_type iter = 0U; iter < count; ++iter)
+                {
+                    batch[iter] = std::addressof (value);
+                }
+                remaining -= count;
+                return count;
             }
 
-            CPPLINQ_INLINEMETHOD skip_builder (skip_builder const & v) CPPLINQ_NOEXCEPT
-                :   count (v.count)
+            CPPLINQ_CONSTEXPR size_type size_hint () const CPPLINQ_NOEXCEPT
             {
+                return remaining;
             }
 
-            CPPLINQ_INLINEMETHOD skip_builder (skip_builder && v) CPPLINQ_NOEXCEPT
-                :   count (std::move (v.count))
+            CPPLINQ_CONSTEXPR size_type size () const CPPLINQ_NOEXCEPT
             {
+                return remaining;
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD skip_range<TRange> build (TRange range) const
+            CPPLINQ_CONSTEXPR return_type at (size_type) const
             {
-                return skip_range<TRange>(std::move (range), count);
+                return value;
             }
 
-        };
-
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TPredicate>
-        struct skip_while_range : base_range
-        {
-            typedef                 skip_while_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                                  range_type      ;
-            typedef                 TPredicate                              predicate_type  ;
-
-            typedef                 typename TRange::value_type     value_type      ;
-            typedef                 typename TRange::return_type    return_type     ;
-            enum
-            {
-                returns_reference   = TRange::returns_reference   ,
-            };
-
-            range_type              range       ;
-            predicate_type          predicate   ;
-            bool                    skipping    ;
-
-            CPPLINQ_INLINEMETHOD skip_while_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
-                ,   skipping    (true)
+            CPPLINQ_CONSTEXPR void advance (size_type steps) CPPLINQ_NOEXCEPT
             {
+                remaining -= steps;
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   skipping    (v.skipping)
+            CPPLINQ_CONSTEXPR size_type split_size () const CPPLINQ_NOEXCEPT
             {
+                return remaining;
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   skipping    (std::move (v.skipping))
+            CPPLINQ_CONSTEXPR split_type split (size_type count)
             {
-            }
+                CPPLINQ_ASSERT (count <= remaining);
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
+                remaining -= count;
 
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                return range.front ();
+                return split_type (value, count);
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            template<typename TSink>
+            CPPLINQ_CONSTEXPR bool push (TSink & sink)
             {
-                if (!skipping)
-                {
-                    return range.next ();
-                }
+                auto count = remaining;
 
-                while (range.next ())
+                while (count > 0U)
                 {
-                    if (!predicate (range.front ()))
+                    --count;
+                    if (!sink (value))
                     {
-                        skipping = false;
-                        return true;
+                        remaining = count;
+                        return false;
                     }
                 }
 
-                return false;
+                remaining = 0U;
+
+                return true;
+            }
+
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v)
+            {
+                return *v;
             }
         };
 
-        template <typename TPredicate>
-        struct skip_while_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template <typename TValue>
+        struct empty_range : base_range
         {
-            typedef                 skip_while_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            typedef                 empty_range<TValue>                 this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue                              return_type     ;
+            enum
+            {
+                returns_reference = 0   ,
+            };
 
-            predicate_type          predicate   ;
+            CPPLINQ_CONSTEXPR empty_range () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_CONSTEXPR empty_range (empty_range const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_CONSTEXPR empty_range (empty_range && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
+                return range_builder.build (*this);
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD skip_while_range<TRange, TPredicate> build (TRange range) const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return skip_while_range<TRange, TPredicate>(std::move (range), predicate);
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_CONSTEXPR return_type front () const
+            {
+                CPPLINQ_ASSERT (false);
+                throw programming_error_exception ();
             }
 
+            CPPLINQ_CONSTEXPR bool next () CPPLINQ_NOEXCEPT
+            {
+                return false;
+            }
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange>
-        struct ref_range : base_range
+        template <typename TValue>
+        struct singleton_range : base_range
         {
-            typedef        std::reference_wrapper<
-                                typename TRange::value_type const>  value_type  ;
-            typedef                 value_type                      return_type ;
+            typedef                 singleton_range<TValue>             this_type       ;
+            typedef                 TValue                              value_type      ;
+            typedef                 TValue const &                      return_type     ;
+
             enum
             {
-                returns_reference   = 0   ,
+                returns_reference = 1   ,
             };
 
-            typedef                 ref_range<TRange>               this_type   ;
-            typedef                 TRange                          range_type  ;
+            value_type  value   ;
+            bool        done    ;
 
-            range_type              range       ;
+            CPPLINQ_CONSTEXPR singleton_range (TValue const & value)
+                :   value   (value)
+                ,   done    (false)
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD ref_range (
-                    range_type      range
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
+            CPPLINQ_CONSTEXPR singleton_range (TValue&& value) CPPLINQ_NOEXCEPT
+                :   value   (std::move (value))
+                ,   done    (false)
             {
-                static_assert (
-                        TRange::returns_reference
-                    ,   "ref may only follow a range that returns references"
-                    );
             }
 
-            CPPLINQ_INLINEMETHOD ref_range (ref_range const & v)
-                :   range       (v.range)
+            CPPLINQ_CONSTEXPR singleton_range (singleton_range const & v) CPPLINQ_NOEXCEPT
+                :   value   (v.value)
+                ,   done    (v.done)
             {
             }
 
-            CPPLINQ_INLINEMETHOD ref_range (ref_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
+            CPPLINQ_CONSTEXPR singleton_range (singleton_range && v) CPPLINQ_NOEXCEPT
+                :   value   (std::move (v.value))
+                ,   done    (std::move (v.done))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return value_type (range.front ());
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_CONSTEXPR return_type front () const CPPLINQ_NOEXCEPT
             {
-                return range.next ();
+                return value;
+            }
+
+            CPPLINQ_CONSTEXPR bool next () CPPLINQ_NOEXCEPT
+            {
+                auto d  = done;
+                done    = true;
+                return !d;
             }
         };
 
-        struct ref_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        // cancellation_poll lets operators that work a long time without pulling
+        // elements, such as the sort of orderby, poll the condition of a
+        // cancellation_range. It refers to the condition so it's only valid while
+        // that range stays in place.
+        struct cancellation_poll
         {
-            typedef                 ref_builder this_type   ;
+            void const *            condition       ;
+            bool                 (* is_cancelled)   (void const *);
 
-            CPPLINQ_INLINEMETHOD ref_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD cancellation_poll () CPPLINQ_NOEXCEPT
+                :   condition       (nullptr)
+                ,   is_cancelled    (nullptr)
             {
             }
 
-            CPPLINQ_INLINEMETHOD ref_builder (ref_builder const & v)
+            template<typename TCondition>
+            CPPLINQ_INLINEMETHOD explicit cancellation_poll (TCondition const & condition) CPPLINQ_NOEXCEPT
+                :   condition       (std::addressof (condition))
+                ,   is_cancelled    (&poll_condition<TCondition>)
             {
             }
 
-            CPPLINQ_INLINEMETHOD ref_builder (ref_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD bool is_set () const CPPLINQ_NOEXCEPT
             {
+                return is_cancelled != nullptr;
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD ref_range<TRange> build (TRange range) const
+            CPPLINQ_INLINEMETHOD void check () const
             {
-                return ref_range<TRange>(std::move (range));
+                if (is_cancelled && is_cancelled (condition))
+                {
+                    throw operation_cancelled_exception ();
+                }
             }
 
-        };
-
-        // -------------------------------------------------------------------------
-
-        // -------------------------------------------------------------------------
-
-        template<typename TRange, typename TPredicate>
-        struct select_range : base_range
-        {
-            static typename TRange::value_type get_source ();
-            static          TPredicate get_predicate ();
-
-
-            typedef        decltype (get_predicate ()(get_source ()))   raw_value_type  ;
-            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
-            typedef                 value_type const &                  return_type     ;
-            enum
+            // Counts one element against countdown, polls once it runs out
+            CPPLINQ_INLINEMETHOD void check_counted (size_type & countdown) const
             {
-                returns_reference   = 1   ,
-            };
-
-            typedef                 select_range<TRange, TPredicate>    this_type       ;
-            typedef                 TRange                              range_type      ;
-            typedef                 TPredicate                          predicate_type  ;
-
-            range_type              range       ;
-            predicate_type          predicate   ;
+                if (countdown > 0U)
+                {
+                    --countdown;
+                    return;
+                }
 
-            opt<value_type>         cache_value ;
+                check ();
+                countdown = batch_size;
+            }
 
-            CPPLINQ_INLINEMETHOD select_range (
-                    range_type      range
-                ,   predicate_type  predicate
-                ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
+        private:
+            template<typename TCondition>
+            static CPPLINQ_INLINEMETHOD bool poll_condition (void const * condition)
             {
+                return (*static_cast<TCondition const *> (condition)) ();
             }
+        };
 
-            CPPLINQ_INLINEMETHOD select_range (select_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   cache_value (v.cache_value)
+        // cancellation_traits gives the poll of ranges that can be cancelled
+        // (see cancellation_range), other ranges give a poll that isn't set
+        template<typename TRange, typename TEnable = void>
+        struct cancellation_traits
+        {
+            static CPPLINQ_INLINEMETHOD cancellation_poll get (TRange const &) CPPLINQ_NOEXCEPT
             {
+                return cancellation_poll ();
             }
+        };
 
-            CPPLINQ_INLINEMETHOD select_range (select_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   cache_value (std::move (v.cache_value))
+        template<typename TRange>
+        struct cancellation_traits<TRange, typename std::enable_if<(TRange::supports_cancellation != 0)>::type>
+        {
+            static CPPLINQ_INLINEMETHOD cancellation_poll get (TRange const & range) CPPLINQ_NOEXCEPT
             {
+                return range.get_cancellation ();
             }
+        };
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+        // std::stable_sort unless there's a poll, then runs of values are sorted
+        // and merged pairwise with the condition polled in between
+        template<typename TValue, typename TCompare>
+        CPPLINQ_METHOD void sequential_stable_sort (std::vector<TValue> & values, TCompare & compare, cancellation_poll const & cancellation)
+        {
+            if (!cancellation.is_set ())
             {
-                return range_builder.build (*this);
+                std::stable_sort (values.begin (), values.end (), compare);
+                return;
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            typedef typename std::vector<TValue>::difference_type difference_type;
+
+            auto count  = values.size ();
+            auto run    = static_cast<size_type> (CPPLINQ_SPLIT_GRAIN);
+            auto at     = [&values] (size_type index) {return values.begin () + static_cast<difference_type> (index);};
+
+            for (size_type begin = 0U; begin < count; begin += run)
             {
-                CPPLINQ_ASSERT (cache_value);
-                return *cache_value;
+                cancellation.check ();
+                std::stable_sort (at (begin), at ((std::min) (begin + run, count)), compare);
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            for (auto width = run; width < count; width *= 2U)
             {
-                if (range.next ())
+                for (size_type begin = 0U; begin + width < count; begin += 2U * width)
                 {
-                    cache_value = predicate (range.front ());
-                    return true;
+                    cancellation.check ();
+                    std::inplace_merge (at (begin), at (begin + width), at ((std::min) (begin + 2U * width, count)), compare);
                 }
+            }
+        }
 
-                cache_value.clear ();
+        // -------------------------------------------------------------------------
 
-                return false;
-            }
+        enum sort_mode
+        {
+            sort_automatic  ,   // In parallel from CPPLINQ_PARALLEL_SORT_THRESHOLD values on
+            sort_sequential ,
+            sort_parallel   ,
         };
 
-        template<typename TPredicate>
-        struct select_builder : base_builder
+        // How orderby and thenby sort, set per query with parallel_sort or
+        // sequential_sort
+        struct sort_policy
         {
-            typedef                 select_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                  predicate_type  ;
+            sort_mode               mode    ;
+#ifndef CPPLINQ_NO_PARALLEL
+            executor *              pool    ;   // The default executor if null
+#endif
 
-            predicate_type          predicate   ;
+            CPPLINQ_INLINEMETHOD sort_policy () CPPLINQ_NOEXCEPT
+                :   mode    (sort_automatic)
+#ifndef CPPLINQ_NO_PARALLEL
+                ,   pool    (nullptr)
+#endif
+            {
+            }
+        };
 
-            CPPLINQ_INLINEMETHOD explicit select_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+#ifndef CPPLINQ_NO_PARALLEL
+        // parallel_merge_sort is a stable merge sort that forks both the sorting
+        // of the halves and the merging of them. The values are sorted back and
+        // forth between two vectors, the halves of a sort land in the vector the
+        // sort doesn't so they merge into the right one. Merges split the longer
+        // run in the middle and the other at the matching bound, elements of the
+        // left run go first among equal ones.
+        template<typename TValue, typename TCompare>
+        struct parallel_merge_sort
+        {
+            typedef         typename std::vector<TValue>::iterator      iterator        ;
+            typedef         typename iterator::difference_type          difference_type ;
+
+            executor &              pool            ;
+            TCompare &              compare         ;
+            size_type               grain           ;
+            cancellation_poll       cancellation    ;   // Polled before each piece
+
+            CPPLINQ_INLINEMETHOD parallel_merge_sort (
+                    executor &                  pool
+                ,   TCompare &                  compare
+                ,   size_type                   grain
+                ,   cancellation_poll const &   cancellation
+                ) CPPLINQ_NOEXCEPT
+                :   pool            (pool)
+                ,   compare         (compare)
+                ,   grain           (grain)
+                ,   cancellation    (cancellation)
             {
             }
 
-            CPPLINQ_INLINEMETHOD select_builder (select_builder const & v)
-                :   predicate (v.predicate)
+            // Sorts values[begin, end), the result lands in buffer if into_buffer
+            CPPLINQ_METHOD void sort (
+                    iterator        values
+                ,   iterator        buffer
+                ,   size_type       begin
+                ,   size_type       end
+                ,   bool            into_buffer
+                )
             {
+                if (end - begin <= grain || !pool.should_split ())
+                {
+                    cancellation.check ();
+                    std::stable_sort (at (values, begin), at (values, end), compare);
+                    if (into_buffer)
+                    {
+                        std::move (at (values, begin), at (values, end), at (buffer, begin));
+                    }
+                    return;
+                }
+
+                auto middle = begin + (end - begin) / 2U;
+                pool.fork_join (
+                        [&] () {sort (values, buffer, begin, middle, !into_buffer);}
+                    ,   [&] () {sort (values, buffer, middle, end, !into_buffer);}
+                    );
+
+                if (into_buffer)
+                {
+                    merge (values, begin, middle, middle, end, buffer, begin);
+                }
+                else
+                {
+                    merge (buffer, begin, middle, middle, end, values, begin);
+                }
             }
 
-            CPPLINQ_INLINEMETHOD select_builder (select_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            // Merges source[first_begin, first_end) and source[second_begin, second_end)
+            // into target from target_begin on
+            CPPLINQ_METHOD void merge (
+                    iterator        source
+                ,   size_type       first_begin
+                ,   size_type       first_end
+                ,   size_type       second_begin
+                ,   size_type       second_end
+                ,   iterator        target
+                ,   size_type       target_begin
+                )
             {
+                auto first_count    = first_end - first_begin;
+                auto second_count   = second_end - second_begin;
+
+                if (first_count + second_count <= grain || !pool.should_split ())
+                {
+                    cancellation.check ();
+                    std::merge (
+                            std::make_move_iterator (at (source, first_begin))
+                        ,   std::make_move_iterator (at (source, first_end))
+                        ,   std::make_move_iterator (at (source, second_begin))
+                        ,   std::make_move_iterator (at (source, second_end))
+                        ,   at (target, target_begin)
+                        ,   compare
+                        );
+                    return;
+                }
+
+                size_type first_middle  ;
+                size_type second_middle ;
+                size_type first_rest    ;
+                size_type second_rest   ;
+                size_type split         ;
+
+                if (first_count >= second_count)
+                {
+                    first_middle    = first_begin + first_count / 2U;
+                    second_middle   = bound (std::lower_bound (at (source, second_begin), at (source, second_end), *at (source, first_middle), compare), source);
+                    first_rest      = first_middle + 1U;
+                    second_rest     = second_middle;
+                    split           = first_middle;
+                }
+                else
+                {
+                    second_middle   = second_begin + second_count / 2U;
+                    first_middle    = bound (std::upper_bound (at (source, first_begin), at (source, first_end), *at (source, second_middle), compare), source);
+                    first_rest      = first_middle;
+                    second_rest     = second_middle + 1U;
+                    split           = second_middle;
+                }
+
+                // The split element goes between the two merges
+                auto target_middle = target_begin + (first_middle - first_begin) + (second_middle - second_begin);
+                *at (target, target_middle) = std::move (*at (source, split));
+
+                pool.fork_join (
+                        [&] () {merge (source, first_begin, first_middle, second_begin, second_middle, target, target_begin);}
+                    ,   [&] () {merge (source, first_rest, first_end, second_rest, second_end, target, target_middle + 1U);}
+                    );
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD select_range<TRange, TPredicate> build (TRange range) const
+        private:
+            static CPPLINQ_INLINEMETHOD iterator at (iterator base, size_type index) CPPLINQ_NOEXCEPT
             {
-                return select_range<TRange, TPredicate>(std::move (range), predicate);
+                return base + static_cast<difference_type> (index);
             }
 
+            static CPPLINQ_INLINEMETHOD size_type bound (iterator position, iterator base) CPPLINQ_NOEXCEPT
+            {
+                return static_cast<size_type> (position - base);
+            }
         };
 
+        template<typename TValue, typename TCompare>
+        CPPLINQ_METHOD void parallel_stable_sort (
+                executor &                  pool
+            ,   std::vector<TValue> &       values
+            ,   TCompare                    compare
+            ,   cancellation_poll const &   cancellation
+            )
+        {
+            auto count = values.size ();
+            if (pool.runs_inline (count))
+            {
+                sequential_stable_sort (values, compare, cancellation);
+                return;
+            }
+
+            // Pieces small enough for each thread to get a few of them
+            auto grain = (std::max) (count / (4U * pool.concurrency ()), static_cast<size_type> (CPPLINQ_SPLIT_GRAIN));
+
+            // The values move to the buffer and are sorted back into values
+            std::vector<TValue> buffer (std::make_move_iterator (values.begin ()), std::make_move_iterator (values.end ()));
+            parallel_merge_sort<TValue, TCompare> (pool, compare, grain, cancellation).sort (buffer.begin (), values.begin (), 0U, count, true);
+        }
+#endif
+
+        // The sort orderby and thenby end with. Every mode is stable, so the
+        // order of equal keys doesn't depend on the size or the core count.
+        // A set cancellation is polled while sorting.
+        template<typename TValue, typename TCompare>
+        CPPLINQ_METHOD void sort_with_policy (
+                sort_policy const &         policy
+            ,   std::vector<TValue> &       values
+            ,   TCompare                    compare
+            ,   cancellation_poll const &   cancellation
+            )
+        {
+#ifndef CPPLINQ_NO_PARALLEL
+            if (policy.mode != sort_sequential)
+            {
+                auto & pool = policy.pool ? *policy.pool : default_executor ();
+                if (policy.mode == sort_parallel)
+                {
+                    parallel_stable_sort (pool, values, std::move (compare), cancellation);
+                    return;
+                }
+
+                if (values.size () >= CPPLINQ_PARALLEL_SORT_THRESHOLD && !pool.runs_inline (values.size ()))
+                {
+                    parallel_stable_sort (pool, values, std::move (compare), cancellation);
+                    return;
+                }
+            }
+#else
+            (void)policy;
+#endif
+
+            sequential_stable_sort (values, compare, cancellation);
+        }
+
         // -------------------------------------------------------------------------
 
-        // Some trickery in order to force the code to compile on VS2012
-        template<typename TRange, typename TPredicate>
-        struct select_many_range_helper
+        struct sorting_range : base_range
         {
-            static typename TRange::value_type get_source ();
-            static          TPredicate get_predicate ();
+#ifdef CPPLINQ_DETECT_INVALID_METHODS
+        protected:
+            // In order to prevent object slicing
 
-            typedef        decltype (get_predicate ()(get_source ()))           raw_inner_range_type    ;
-            typedef        typename cleanup_type<raw_inner_range_type>::type    inner_range_type        ;
+            CPPLINQ_INLINEMETHOD sorting_range () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            static         inner_range_type get_inner_range ();
+            CPPLINQ_INLINEMETHOD sorting_range (sorting_range const &) CPPLINQ_NOEXCEPT
+            {
+            }
 
-            typedef        decltype (get_inner_range ().front ())               raw_value_type          ;
-            typedef        typename cleanup_type<raw_value_type>::type          value_type              ;
+            CPPLINQ_INLINEMETHOD sorting_range (sorting_range &&) CPPLINQ_NOEXCEPT
+            {
+            }
 
+            CPPLINQ_INLINEMETHOD ~sorting_range () CPPLINQ_NOEXCEPT
+            {
+            }
+        private:
+            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range const &);
+            CPPLINQ_INLINEMETHOD sorting_range & operator= (sorting_range &&);
+#endif
         };
 
         template<typename TRange, typename TPredicate>
-        struct select_many_range : base_range
+        struct orderby_range : sorting_range
         {
-            typedef select_many_range_helper<TRange, TPredicate>    helper_type         ;
 
-            typedef        typename helper_type::inner_range_type   inner_range_type    ;
-            typedef        typename helper_type::value_type         value_type          ;
-            typedef                 value_type                      return_type         ;
+            typedef                 orderby_range<TRange, TPredicate>   this_type               ;
+            typedef                 TRange                              range_type              ;
+            typedef                 TPredicate                          predicate_type          ;
+
+            typedef                 typename TRange::value_type         value_type              ;
+            typedef                 typename TRange::return_type        forwarding_return_type  ;
+            typedef                 value_type const &                  return_type             ;
             enum
             {
-                returns_reference   = 0   ,
+                forward_returns_reference   = TRange::returns_reference ,
+                returns_reference           = 1                         ,
+                forward_size_hint_kind      = size_hint_traits<TRange>::kind,
+                size_hint_kind              = forward_size_hint_kind    ,
+                supports_random_access      = 1                         ,
             };
 
-            typedef                 select_many_range<TRange, TPredicate>       this_type               ;
-            typedef                 TRange                                      range_type              ;
-            typedef                 TPredicate                                  predicate_type          ;
-
-            range_type              range       ;
-            predicate_type          predicate   ;
-
-            opt<inner_range_type>   inner_range ;
+            range_type              range           ;
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+            sort_policy             policy          ;
+            cancellation_poll       cancellation    ;   // Set by a following with_cancellation
 
+            bool                    sorted          ;
+            size_type               current         ;
+            std::vector<value_type> sorted_values   ;
 
-            CPPLINQ_INLINEMETHOD select_many_range (
+            CPPLINQ_INLINEMETHOD orderby_range (
                     range_type      range
                 ,   predicate_type  predicate
+                ,   bool            sort_ascending
                 ) CPPLINQ_NOEXCEPT
-                :   range       (std::move (range))
-                ,   predicate   (std::move (predicate))
+                :   range           (std::move (range))
+                ,   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+                ,   sorted          (false)
+                ,   current         (invalid_size)
             {
+                static_assert (
+                        !std::is_convertible<range_type, sorting_range>::value
+                    ,   "orderby may not follow orderby or thenby"
+                    );
             }
 
-            CPPLINQ_INLINEMETHOD select_many_range (select_many_range const & v)
-                :   range       (v.range)
-                ,   predicate   (v.predicate)
-                ,   inner_range (v.inner_range)
+            CPPLINQ_INLINEMETHOD orderby_range (orderby_range const & v)
+                :   range           (v.range)
+                ,   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+                ,   policy          (v.policy)
+                ,   cancellation    (v.cancellation)
+                ,   sorted          (v.sorted)
+                ,   current         (v.current)
+                ,   sorted_values   (v.sorted_values)
             {
             }
 
-            CPPLINQ_INLINEMETHOD select_many_range (select_many_range && v) CPPLINQ_NOEXCEPT
-                :   range       (std::move (v.range))
-                ,   predicate   (std::move (v.predicate))
-                ,   inner_range (std::move (v.inner_range))
+            CPPLINQ_INLINEMETHOD orderby_range (orderby_range && v) CPPLINQ_NOEXCEPT
+                :   range           (std::move (v.range))
+                ,   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+                ,   policy          (std::move (v.policy))
+                ,   cancellation    (std::move (v.cancellation))
+                ,   sorted          (std::move (v.sorted))
+                ,   current         (std::move (v.current))
+                ,   sorted_values   (std::move (v.sorted_values))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
+            {
+                return range.front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool forwarding_next ()
+            {
+                return range.next ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type forwarding_size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return size_hint_traits<TRange>::size_hint (range);
+            }
+
+            CPPLINQ_INLINEMETHOD void set_cancellation (cancellation_poll const & poll) CPPLINQ_NOEXCEPT
             {
+                cancellation = poll;
+            }
+
+            // The poll the sort checks, a with_cancellation after orderby wins
+            // over one in front of it
+            CPPLINQ_INLINEMETHOD cancellation_poll sort_cancellation () const CPPLINQ_NOEXCEPT
+            {
+                return cancellation.is_set () ? cancellation : cancellation_traits<TRange>::get (range);
+            }
+
+            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
+            {
+                if (sort_ascending)
+                {
+                    return predicate (l) < predicate (r);
+                }
+                else
+                {
+                    return predicate (r) < predicate (l);
+                }
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
             CPPLINQ_INLINEMETHOD return_type front () const
             {
-                CPPLINQ_ASSERT (inner_range);
-                return inner_range->front ();
+                return sorted_values[current];
             }
 
             CPPLINQ_INLINEMETHOD bool next ()
             {
-                if (inner_range && inner_range->next ())
-                {
-                    return true;
-                }
+                sort_values ();
 
-                if (range.next ())
+                // current is invalid_size before the first call so current + 1U wraps to 0
+                auto upcoming = current + 1U;
+                if (upcoming < sorted_values.size ())
                 {
-                    inner_range = predicate (range.front ());
-                    return inner_range && inner_range->next ();
+                    current = upcoming;
+                    return true;
                 }
 
-                inner_range.clear ();
-
+                current = sorted_values.size ();
                 return false;
             }
-        };
 
-        template<typename TPredicate>
-        struct select_many_builder : base_builder
-        {
-            typedef                 select_many_builder<TPredicate> this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                if (!sorted)
+                {
+                    return forwarding_size_hint ();
+                }
 
-            predicate_type          predicate   ;
+                return remaining ();
+            }
 
-            CPPLINQ_INLINEMETHOD explicit select_many_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD size_type size ()
             {
+                sort_values ();
+                return remaining ();
             }
 
-            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder const & v)
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD return_type at (size_type index)
             {
+                sort_values ();
+                CPPLINQ_ASSERT (index < remaining ());
+                return sorted_values[current + 1U + index];
             }
 
-            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD void advance (size_type steps)
             {
+                sort_values ();
+                CPPLINQ_ASSERT (steps <= remaining ());
+                current += steps;
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD select_many_range<TRange, TPredicate> build (TRange range) const
+        private:
+            CPPLINQ_INLINEMETHOD size_type remaining () const CPPLINQ_NOEXCEPT
             {
-                return select_many_range<TRange, TPredicate>(std::move (range), predicate);
+                auto upcoming = current + 1U;
+                return upcoming < sorted_values.size () ? sorted_values.size () - upcoming : 0U;
             }
 
-        };
+            CPPLINQ_METHOD void sort_values ()
+            {
+                if (sorted)
+                {
+                    return;
+                }
 
-        // -------------------------------------------------------------------------
+                sorted = true;
 
-        template<
-                typename TRange
-            ,   typename TOtherRange
-            ,   typename TKeySelector
-            ,   typename TOtherKeySelector
-            ,   typename TCombiner
-            >
-        struct join_range : base_range
-        {
-            static typename TRange::value_type      get_source ()               ;
-            static typename TOtherRange::value_type get_other_source ()         ;
-            static          TKeySelector            get_key_selector ()         ;
-            static          TOtherKeySelector       get_other_key_selector ()   ;
-            static          TCombiner               get_combiner ()             ;
-
-            typedef         decltype (get_key_selector () (get_source ()))      raw_key_type    ;
-            typedef         typename cleanup_type<raw_key_type>::type           key_type        ;
-
-            typedef         decltype (get_other_key_selector () (get_other_source ()))
-                                                                                raw_other_key_type  ;
-            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
-
-            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
-                                                                                raw_value_type  ;
-            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
-            typedef                 value_type                                  return_type     ;
-            enum
-            {
-                returns_reference   = 0   ,
-            };
-
-            typedef                 join_range<
-                    TRange
-                ,   TOtherRange
-                ,   TKeySelector
-                ,   TOtherKeySelector
-                ,   TCombiner
-                >                                               this_type               ;
-            typedef                 TRange                      range_type              ;
-            typedef                 TOtherRange                 other_range_type        ;
-            typedef                 TKeySelector                key_selector_type       ;
-            typedef                 TOtherKeySelector           other_key_selector_type ;
-            typedef                 TCombiner                   combiner_type           ;
-            typedef                 std::multimap<
-                                            other_key_type
-                                        ,   typename TOtherRange::value_type
-                                        >                       map_type                ;
-            typedef     typename    map_type::const_iterator    map_iterator_type       ;
-
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            key_selector_type           key_selector        ;
-            other_key_selector_type     other_key_selector  ;
-            combiner_type               combiner            ;
-
-            bool                        start               ;
-            map_type                    map                 ;
-            map_iterator_type           current             ;
-
-            CPPLINQ_INLINEMETHOD join_range (
-                    range_type              range
-                ,   other_range_type        other_range
-                ,   key_selector_type       key_selector
-                ,   other_key_selector_type other_key_selector
-                ,   combiner_type           combiner
-                ) CPPLINQ_NOEXCEPT
-                :   range              (std::move (range))
-                ,   other_range        (std::move (other_range))
-                ,   key_selector       (std::move (key_selector))
-                ,   other_key_selector (std::move (other_key_selector))
-                ,   combiner           (std::move (combiner))
-                ,   start              (true)
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD join_range (join_range const & v)
-                :   range              (v.range)
-                ,   other_range        (v.other_range)
-                ,   key_selector       (v.key_selector)
-                ,   other_key_selector (v.other_key_selector)
-                ,   combiner           (v.combiner)
-                ,   start              (v.start)
-                ,   map                (v.map)
-                ,   current            (v.current)
-            {
-            }
-
-            CPPLINQ_INLINEMETHOD join_range (join_range && v) CPPLINQ_NOEXCEPT
-                :   range              (std::move (v.range))
-                ,   other_range        (std::move (v.other_range))
-                ,   key_selector       (std::move (v.key_selector))
-                ,   other_key_selector (std::move (v.other_key_selector))
-                ,   combiner           (std::move (v.combiner))
-                ,   start              (std::move (v.start))
-                ,   map                (std::move (v.map))
-                ,   current            (std::move (v.current))
-            {
-            }
-
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-            {
-                return range_builder.build (*this);
-            }
-
-            CPPLINQ_INLINEMETHOD return_type front () const
-            {
-                CPPLINQ_ASSERT (current != map.end ());
-                return combiner (range.front (), current->second);
-            }
+                sorted_values.clear ();
 
-            CPPLINQ_INLINEMETHOD bool next ()
-            {
-                if (start)
+                if (forward_size_hint_kind == size_hint_exact)
                 {
-                    start = false;
-                    while (other_range.next ())
-                    {
-                        auto other_value    = other_range.front ();
-                        auto other_key      = other_key_selector (other_value);
-                        map.insert (typename map_type::value_type (std::move (other_key), std::move (other_value)));
-                    }
-
-                    current = map.end ();
-                    if (map.size () == 0U)
-                    {
-                        return false;
-                    }
+                    sorted_values.reserve (forwarding_size_hint ());
                 }
 
-                if (current != map.end ())
+                try
                 {
-                    auto previous = current;
-                    ++current;
-                    if (current != map.end () && !(previous->first < current->first))
+                    while (range.next ())
                     {
-                        return true;
+                        sorted_values.push_back (range.front ());
                     }
-                }
 
-                while (range.next ())
+                    sort_with_policy (
+                            policy
+                        ,   sorted_values
+                        ,   [this] (value_type const & l, value_type const & r)
+                            {
+                                return this->compare_values (l,r);
+                            }
+                        ,   sort_cancellation ()
+                        );
+                }
+                catch (operation_cancelled_exception const &)
                 {
-                    auto value  = range.front ();
-                    auto key    = key_selector (value);
-
-                    current     = map.find (key);
-                    if (current != map.end ())
-                    {
-                        return true;
-                    }
+                    release_buffer (sorted_values);
+                    throw;
                 }
-
-                return false;
             }
         };
 
-        template<
-                typename TOtherRange
-            ,   typename TKeySelector
-            ,   typename TOtherKeySelector
-            ,   typename TCombiner
-            >
-        struct join_builder : base_builder
+        template<typename TPredicate>
+        struct orderby_builder : base_builder
         {
-            typedef                 join_builder<
-                    TOtherRange
-                ,   TKeySelector
-                ,   TOtherKeySelector
-                ,   TCombiner
-                >                                               this_type               ;
-
-            typedef                 TOtherRange                 other_range_type        ;
-            typedef                 TKeySelector                key_selector_type       ;
-            typedef                 TOtherKeySelector           other_key_selector_type ;
-            typedef                 TCombiner                   combiner_type           ;
+            typedef                 orderby_builder<TPredicate> this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
 
-            other_range_type        other_range         ;
-            key_selector_type       key_selector        ;
-            other_key_selector_type other_key_selector  ;
-            combiner_type           combiner            ;
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
 
-            CPPLINQ_INLINEMETHOD join_builder (
-                    other_range_type        other_range
-                ,   key_selector_type       key_selector
-                ,   other_key_selector_type other_key_selector
-                ,   combiner_type           combiner
-                ) CPPLINQ_NOEXCEPT
-                :   other_range        (std::move (other_range))
-                ,   key_selector       (std::move (key_selector))
-                ,   other_key_selector (std::move (other_key_selector))
-                ,   combiner           (std::move (combiner))
+            CPPLINQ_INLINEMETHOD explicit orderby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
             {
             }
 
-            CPPLINQ_INLINEMETHOD join_builder (join_builder const & v)
-                :   other_range        (v.other_range)
-                ,   key_selector       (v.key_selector)
-                ,   other_key_selector (v.other_key_selector)
-                ,   combiner           (v.combiner)
+            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder const & v)
+                :   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
             {
             }
 
-            CPPLINQ_INLINEMETHOD join_builder (join_builder && v) CPPLINQ_NOEXCEPT
-                :   other_range        (std::move (v.other_range))
-                ,   key_selector       (std::move (v.key_selector))
-                ,   other_key_selector (std::move (v.other_key_selector))
-                ,   combiner           (std::move (v.combiner))
+            CPPLINQ_INLINEMETHOD orderby_builder (orderby_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> build (TRange range) const
+            CPPLINQ_INLINEMETHOD orderby_range<TRange, TPredicate> build (TRange range) const
             {
-                return join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> (
-                        std::move (range)
-                    ,   other_range
-                    ,   key_selector
-                    ,   other_key_selector
-                    ,   combiner
-                    );
+                return orderby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
             }
-        };
 
+        };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange>
-        struct distinct_range : base_range
+        template<typename TRange, typename TPredicate>
+        struct thenby_range : sorting_range
         {
-            typedef             distinct_range<TRange>                          this_type           ;
-            typedef             TRange                                          range_type          ;
+            typedef                 thenby_range<TRange, TPredicate>        this_type               ;
+            typedef                 TRange                                  range_type              ;
+            typedef                 TPredicate                              predicate_type          ;
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
+            typedef                 typename TRange::value_type             value_type              ;
+            typedef                 typename TRange::forwarding_return_type forwarding_return_type  ;
+            typedef                 value_type const &                      return_type             ;
             enum
             {
-                returns_reference   = 1 ,
+                forward_returns_reference   = TRange::forward_returns_reference ,
+                returns_reference           = 1                                 ,
+                forward_size_hint_kind      = TRange::forward_size_hint_kind    ,
+                size_hint_kind              = forward_size_hint_kind            ,
+                supports_random_access      = 1                                 ,
             };
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
+            range_type              range           ;
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+            sort_policy             policy          ;
+            cancellation_poll       cancellation    ;   // Set by a following with_cancellation
 
-            range_type                  range               ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
+            bool                    sorted          ;
+            size_type               current         ;
+            std::vector<value_type> sorted_values   ;
 
-            CPPLINQ_INLINEMETHOD distinct_range (
-                        range_type          range
+            // A policy given before thenby carries over
+            CPPLINQ_INLINEMETHOD thenby_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ,   bool            sort_ascending
                 ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
+                :   range           (std::move (range))
+                ,   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+                ,   policy          (this->range.policy)
+                ,   sorted          (false)
+                ,   current         (invalid_size)
             {
+                static_assert (
+                        std::is_convertible<range_type, sorting_range>::value
+                    ,   "thenby may only follow orderby or thenby"
+                    );
             }
 
-            CPPLINQ_INLINEMETHOD distinct_range (distinct_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
+            CPPLINQ_INLINEMETHOD thenby_range (thenby_range const & v)
+                :   range           (v.range)
+                ,   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+                ,   policy          (v.policy)
+                ,   cancellation    (v.cancellation)
+                ,   sorted          (v.sorted)
+                ,   current         (v.current)
+                ,   sorted_values   (v.sorted_values)
             {
             }
 
-            CPPLINQ_INLINEMETHOD distinct_range (distinct_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
-            {
+            CPPLINQ_INLINEMETHOD thenby_range (thenby_range && v) CPPLINQ_NOEXCEPT
+                :   range           (std::move (v.range))
+                ,   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+                ,   policy          (std::move (v.policy))
+                ,   cancellation    (std::move (v.cancellation))
+                ,   sorted          (std::move (v.sorted))
+                ,   current         (std::move (v.current))
+                ,   sorted_values   (std::move (v.sorted_values))
+            {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return *current;
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_INLINEMETHOD forwarding_return_type forwarding_front () const
             {
-                while (range.next ())
-                {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
-                    {
-                        current = result.first;
-                        return true;
-                    }
-                }
-
-                return false;
+                return range.front ();
             }
-        };
-
-        struct distinct_builder : base_builder
-        {
-            typedef                 distinct_builder                    this_type               ;
 
-            CPPLINQ_INLINEMETHOD distinct_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD bool forwarding_next ()
             {
+                return range.next ();
             }
 
-            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD size_type forwarding_size_hint () const CPPLINQ_NOEXCEPT
             {
+                return range.forwarding_size_hint ();
             }
 
-            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD void set_cancellation (cancellation_poll const & poll) CPPLINQ_NOEXCEPT
             {
+                cancellation = poll;
             }
 
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD distinct_range<TRange> build (TRange range) const
+            CPPLINQ_INLINEMETHOD cancellation_poll sort_cancellation () const CPPLINQ_NOEXCEPT
             {
-                return distinct_range<TRange> (std::move (range));
+                return cancellation.is_set () ? cancellation : range.sort_cancellation ();
             }
-        };
 
-        // -------------------------------------------------------------------------
+            CPPLINQ_INLINEMETHOD bool compare_values (value_type const & l, value_type const & r) const
+            {
+                auto pless = range.compare_values (l,r);
+                if (pless)
+                {
+                    return true;
+                }
 
-        template<typename TRange, typename TOtherRange>
-        struct union_range : base_range
-        {
-            typedef             union_range<TRange, TOtherRange>                this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
+                auto pgreater = range.compare_values (r,l);
+                if (pgreater)
+                {
+                    return false;
+                }
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
-            enum
+                if (sort_ascending)
+                {
+                    return predicate (l) < predicate (r);
+                }
+                else
+                {
+                    return predicate (r) < predicate (l);
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD return_type front () const
             {
-                returns_reference   = 1 ,
-            };
+                return sorted_values[current];
+            }
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                sort_values ();
 
+                // current is invalid_size before the first call so current + 1U wraps to 0
+                auto upcoming = current + 1U;
+                if (upcoming < sorted_values.size ())
+                {
+                    current = upcoming;
+                    return true;
+                }
 
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
+                current = sorted_values.size ();
+                return false;
+            }
 
-            CPPLINQ_INLINEMETHOD union_range (
-                        range_type          range
-                    ,   other_range_type    other_range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
             {
+                if (!sorted)
+                {
+                    return forwarding_size_hint ();
+                }
+
+                return remaining ();
             }
 
-            CPPLINQ_INLINEMETHOD union_range (union_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
+            CPPLINQ_INLINEMETHOD size_type size ()
             {
+                sort_values ();
+                return remaining ();
             }
 
-            CPPLINQ_INLINEMETHOD union_range (union_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
+            CPPLINQ_INLINEMETHOD return_type at (size_type index)
             {
+                sort_values ();
+                CPPLINQ_ASSERT (index < remaining ());
+                return sorted_values[current + 1U + index];
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD void advance (size_type steps)
             {
-                return range_builder.build (*this);
+                sort_values ();
+                CPPLINQ_ASSERT (steps <= remaining ());
+                current += steps;
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+        private:
+            CPPLINQ_INLINEMETHOD size_type remaining () const CPPLINQ_NOEXCEPT
             {
-                return *current;
+                auto upcoming = current + 1U;
+                return upcoming < sorted_values.size () ? sorted_values.size () - upcoming : 0U;
             }
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_METHOD void sort_values ()
             {
-                while (range.next ())
+                if (sorted)
                 {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
-                    {
-                        current = result.first;
-                        return true;
-                    }
+                    return;
                 }
 
-                while (other_range.next ())
+                sorted = true;
+
+                sorted_values.clear ();
+
+                if (forward_size_hint_kind == size_hint_exact)
                 {
-                    auto result = set.insert (other_range.front ());
-                    if (result.second)
+                    sorted_values.reserve (forwarding_size_hint ());
+                }
+
+                try
+                {
+                    while (range.forwarding_next ())
                     {
-                        current = result.first;
-                        return true;
+                        sorted_values.push_back (range.forwarding_front ());
                     }
+
+                    sort_with_policy (
+                            policy
+                        ,   sorted_values
+                        ,   [this] (value_type const & l, value_type const & r)
+                            {
+                                return this->compare_values (l,r);
+                            }
+                        ,   sort_cancellation ()
+                        );
                 }
+                catch (operation_cancelled_exception const &)
+                {
+                    release_buffer (sorted_values);
+                    throw;
+                }
+            }
+        };
 
-                return false;
+        template<typename TPredicate>
+        struct thenby_builder : base_builder
+        {
+            typedef                 thenby_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate       ;
+            bool                    sort_ascending  ;
+
+            CPPLINQ_INLINEMETHOD explicit thenby_builder (predicate_type predicate, bool sort_ascending) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (predicate))
+                ,   sort_ascending  (sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder const & v)
+                :   predicate       (v.predicate)
+                ,   sort_ascending  (v.sort_ascending)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD thenby_builder (thenby_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate       (std::move (v.predicate))
+                ,   sort_ascending  (std::move (v.sort_ascending))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD thenby_range<TRange, TPredicate> build (TRange range) const
+            {
+                return thenby_range<TRange, TPredicate>(std::move (range), predicate, sort_ascending);
             }
+
         };
 
-        template <typename TOtherRange>
-        struct union_builder : base_builder
+        struct sort_policy_builder : base_builder
         {
-            typedef                 union_builder<TOtherRange>              this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            typedef                 sort_policy_builder         this_type       ;
 
-            other_range_type        other_range         ;
+            sort_policy             policy          ;
 
-            CPPLINQ_INLINEMETHOD union_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD explicit sort_policy_builder (sort_policy policy) CPPLINQ_NOEXCEPT
+                :   policy          (std::move (policy))
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_builder (union_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD sort_policy_builder (sort_policy_builder const & v) CPPLINQ_NOEXCEPT
+                :   policy          (v.policy)
             {
             }
 
-            CPPLINQ_INLINEMETHOD union_builder (union_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD sort_policy_builder (sort_policy_builder && v) CPPLINQ_NOEXCEPT
+                :   policy          (std::move (v.policy))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD union_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD TRange build (TRange range) const
             {
-                return union_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                static_assert (
+                        std::is_convertible<TRange, sorting_range>::value
+                    ,   "parallel_sort and sequential_sort may only follow orderby or thenby"
+                    );
+
+                range.policy = policy;
+                return range;
             }
+
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TOtherRange>
-        struct intersect_range : base_range
+        template<typename TRange>
+        struct reverse_range : base_range
         {
-            typedef             intersect_range<TRange, TOtherRange>            this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
+            typedef                 reverse_range<TRange>                       this_type           ;
+            typedef                 TRange                                      range_type          ;
+
+            typedef                 typename TRange::value_type                 value_type          ;
+            typedef                 value_type const &                          return_type         ;
+
+            typedef                 std::vector<value_type>                     stack_type          ;
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
             enum
             {
-                returns_reference   = 1 ,
+                returns_reference       = 1                                 ,
+                size_hint_kind          = size_hint_traits<TRange>::kind    ,
+                supports_random_access  = 1                                 ,
             };
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
-
 
             range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
-            bool                        start               ;
+            size_type                   capacity            ;
+            std::vector<value_type>     reversed            ;
+            bool                        materialized        ;
+            size_type                   remaining           ;
 
-            CPPLINQ_INLINEMETHOD intersect_range (
-                        range_type          range
-                    ,   other_range_type    other_range
+            CPPLINQ_INLINEMETHOD reverse_range (
+                    range_type          range
+                ,   size_type           capacity
                 ) CPPLINQ_NOEXCEPT
                 :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   start               (true)
+                ,   capacity            (capacity)
+                ,   materialized        (false)
+                ,   remaining           (0U)
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_range (intersect_range const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD reverse_range (reverse_range const & v) CPPLINQ_NOEXCEPT
                 :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
-                ,   start               (v.start)
+                ,   capacity            (v.capacity)
+                ,   reversed            (v.reversed)
+                ,   materialized        (v.materialized)
+                ,   remaining           (v.remaining)
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_range (intersect_range && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD reverse_range (reverse_range && v) CPPLINQ_NOEXCEPT
                 :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
-                ,   start               (std::move (v.start))
+                ,   capacity            (std::move (v.capacity))
+                ,   reversed            (std::move (v.reversed))
+                ,   materialized        (std::move (v.materialized))
+                ,   remaining           (std::move (v.remaining))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                CPPLINQ_ASSERT (!start);
-                return *current;
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (materialized);
+                CPPLINQ_ASSERT (remaining < reversed.size ());
+                return reversed[remaining];
             }
 
             CPPLINQ_INLINEMETHOD bool next ()
             {
-                if (start)
-                {
-                    start = false;
+                materialize ();
 
-                    while (other_range.next ())
-                    {
-                        set.insert (other_range.front ());
-                    }
+                if (remaining == 0U)
+                {
+                    return false;
+                }
 
-                    while (range.next ())
-                    {
-                        current = set.find (range.front ());
-                        if (current != set.end ())
-                        {
-                            return true;
-                        }
-                    }
+                --remaining;
 
-                    set.clear ();
+                return true;
+            }
 
-                    return false;
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                if (!materialized)
+                {
+                    return size_hint_traits<TRange>::size_hint (range);
                 }
 
-                if (set.empty ())
+                return remaining;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                materialize ();
+                return remaining;
+            }
+
+            CPPLINQ_INLINEMETHOD return_type at (size_type index)
+            {
+                materialize ();
+                CPPLINQ_ASSERT (index < remaining);
+                return reversed[remaining - 1U - index];
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type steps)
+            {
+                materialize ();
+                CPPLINQ_ASSERT (steps <= remaining);
+                remaining -= steps;
+            }
+
+        private:
+            CPPLINQ_INLINEMETHOD void materialize ()
+            {
+                if (materialized)
                 {
-                    return false;
+                    return;
                 }
 
-                set.erase (current);
+                materialized = true;
 
-                while (range.next ())
+                reversed.clear ();
+                reversed.reserve (get_reserve_capacity (range, capacity));
+
+                try
                 {
-                    current = set.find (range.front ());
-                    if (current != set.end ())
+                    while (range.next ())
                     {
-                        return true;
+                        reversed.push_back (range.front ());
                     }
                 }
+                catch (operation_cancelled_exception const &)
+                {
+                    release_buffer (reversed);
+                    throw;
+                }
 
-                return false;
+                remaining = reversed.size ();
             }
         };
 
-        template <typename TOtherRange>
-        struct intersect_builder : base_builder
+        struct reverse_builder : base_builder
         {
-            typedef                 intersect_builder<TOtherRange>          this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            typedef             reverse_builder     this_type   ;
 
-            other_range_type        other_range         ;
+            size_type           capacity                        ;
 
-            CPPLINQ_INLINEMETHOD intersect_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+            CPPLINQ_INLINEMETHOD reverse_builder (size_type capacity) CPPLINQ_NOEXCEPT
+                :   capacity (capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder const & v) CPPLINQ_NOEXCEPT
+                :   capacity (v.capacity)
             {
             }
 
-            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD reverse_builder (reverse_builder && v) CPPLINQ_NOEXCEPT
+                :   capacity (std::move (v.capacity))
             {
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD intersect_range<TRange, TOtherRange> build (TRange range) const
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD reverse_range<TRange> build (TRange range) const
             {
-                return intersect_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                return reverse_range<TRange> (std::move (range), capacity);
             }
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TRange, typename TOtherRange>
-        struct except_range : base_range
+        template<typename TSink, typename TPredicate>
+        struct where_sink
         {
-            typedef             except_range<TRange, TOtherRange>               this_type           ;
-            typedef             TRange                                          range_type          ;
-            typedef             TOtherRange                                     other_range_type    ;
+            TSink &                 sink        ;
+            TPredicate &            predicate   ;
 
-            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
-            typedef             value_type const &                              return_type         ;
+            CPPLINQ_CONSTEXPR where_sink (TSink & sink, TPredicate & predicate) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+                ,   predicate   (predicate)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_CONSTEXPR bool operator() (TValue && v)
+            {
+                return !predicate (v) || sink (std::forward<TValue> (v));
+            }
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct where_range : base_range
+        {
+            typedef                 where_range<TRange, TPredicate> this_type       ;
+            typedef                 TRange                          range_type      ;
+            typedef                 TPredicate                      predicate_type  ;
+            typedef                 batch_traits<TRange>            source_traits   ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            typedef        typename source_traits::batch_type       batch_type      ;
+            typedef                 where_range<
+                    typename split_traits<TRange>::split_type
+                ,   TPredicate
+                >                                                   split_type      ;
             enum
             {
-                returns_reference   = 1 ,
+                returns_reference   = TRange::returns_reference   ,
+                supports_batch      = source_traits::is_native    ,
+                prefers_batch       = source_traits::is_native    ,
+                supports_push       = 1                           ,
+                supports_split      = split_traits<TRange>::is_native,
             };
 
-            typedef             std::set<value_type>               set_type                         ;
-            typedef    typename set_type::const_iterator           set_iterator_type                ;
-
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            set_type                    set                 ;
-            set_iterator_type           current             ;
-            bool                        start               ;
+            range_type              range       ;
+            predicate_type          predicate   ;
 
-            CPPLINQ_INLINEMETHOD except_range (
-                        range_type          range
-                    ,   other_range_type    other_range
+            CPPLINQ_CONSTEXPR where_range (
+                    range_type      range
+                ,   predicate_type  predicate
                 ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   start               (true)
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD except_range (except_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   set                 (v.set)
-                ,   current             (v.current)
-                ,   start               (v.start)
+            CPPLINQ_CONSTEXPR where_range (where_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD except_range (except_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   set                 (std::move (v.set))
-                ,   current             (std::move (v.current))
-                ,   start               (std::move (v.start))
+            CPPLINQ_CONSTEXPR where_range (where_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
             {
-                return *current;
+                return range_builder.build (std::move (*this));
             }
+#endif
 
-            CPPLINQ_INLINEMETHOD bool next ()
+            CPPLINQ_CONSTEXPR return_type front () const
             {
-                if (start)
-                {
-                    start = false;
-                    while (other_range.next ())
-                    {
-                        set.insert (other_range.front ());
-                    }
-                }
+                return range.front ();
+            }
 
+            CPPLINQ_CONSTEXPR bool next ()
+            {
                 while (range.next ())
                 {
-                    auto result = set.insert (range.front ());
-                    if (result.second)
+                    if (predicate (range.front ()))
                     {
-                        current = result.first;
                         return true;
                     }
                 }
 
                 return false;
             }
-        };
 
-        template <typename TOtherRange>
-        struct except_builder : base_builder
-        {
-            typedef                 union_builder<TOtherRange>              this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+            template<typename TSink>
+            CPPLINQ_CONSTEXPR bool push (TSink & sink)
+            {
+                where_sink<TSink, predicate_type> s (sink, predicate);
+                return push_traits<TRange>::push (range, s);
+            }
 
-            other_range_type        other_range         ;
+            CPPLINQ_CONSTEXPR size_type next_batch (batch_type * batch, size_type capacity)
+            {
+                size_type count;
+                while ((count = source_traits::next_batch (range, batch, capacity)) > 0U)
+                {
+                    auto kept = compact (batch, count, std::is_scalar<batch_type> ());
+                    if (kept > 0U)
+                    {
+                        return kept;
+                    }
+                }
 
-            CPPLINQ_INLINEMETHOD except_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
+                return 0U;
+            }
+
+            // Scalar batches (values or pointers) are compacted without branching
+            // on the predicate as the outcome is often unpredictable
+            CPPLINQ_CONSTEXPR size_type compact (batch_type * batch, size_type count, std::true_type)
             {
+                size_type kept = 0U;
+                for (size_type iter = 0U; iter < count; ++iter)
+                {
+                    auto v      = batch[iter];
+                    batch[kept] = v;
+                    kept        += predicate (source_traits::batch_value (v)) ? 1U : 0U;
+                }
+                return kept;
             }
 
-            CPPLINQ_INLINEMETHOD except_builder (except_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_CONSTEXPR size_type compact (batch_type * batch, size_type count, std::false_type)
             {
+                size_type kept = 0U;
+                for (size_type iter = 0U; iter < count; ++iter)
+                {
+                    if (predicate (source_traits::batch_value (batch[iter])))
+                    {
+                        if (kept != iter)
+                        {
+                            batch[kept] = std::move (batch[iter]);
+                        }
+                        ++kept;
+                    }
+                }
+                return kept;
             }
 
-            CPPLINQ_INLINEMETHOD except_builder (except_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v)
             {
+                return source_traits::batch_value (v);
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD except_range<TRange, TOtherRange> build (TRange range) const
+            CPPLINQ_CONSTEXPR size_type split_size () const CPPLINQ_NOEXCEPT
             {
-                return except_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                return range.split_size ();
             }
-        };
 
-        // -------------------------------------------------------------------------
+            CPPLINQ_CONSTEXPR split_type split (size_type count)
+            {
+                return split_type (range.split (count), predicate);
+            }
+        };
 
-        template<typename TRange, typename TOtherRange>
-        struct concat_range : base_range
+        template<typename TPredicate>
+        struct where_builder : base_builder
         {
-            typedef             concat_range<TRange, TOtherRange>                       this_type           ;
-            typedef             TRange                                                  range_type          ;
-            typedef             TOtherRange                                             other_range_type    ;
-
-            typedef typename    cleanup_type<typename TRange::value_type>::type         value_type          ;
-            typedef typename    cleanup_type<typename TOtherRange::value_type>::type    other_value_type    ;
-            typedef             value_type                                              return_type         ;
+            typedef                 where_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
 
-            enum
-            {
-                returns_reference   = 0         ,
-            };
+            predicate_type          predicate   ;
 
-            enum state
+            CPPLINQ_CONSTEXPR explicit where_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
-                state_initial                   ,
-                state_iterating_range           ,
-                state_iterating_other_range     ,
-                state_end                       ,
-            };
-
-            range_type                  range               ;
-            other_range_type            other_range         ;
-            state                       state               ;
+            }
 
-            CPPLINQ_INLINEMETHOD concat_range (
-                        range_type          range
-                    ,   other_range_type    other_range
-                ) CPPLINQ_NOEXCEPT
-                :   range               (std::move (range))
-                ,   other_range         (std::move (other_range))
-                ,   state               (state_initial)
+            CPPLINQ_CONSTEXPR where_builder (where_builder const & v)
+                :   predicate (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD concat_range (concat_range const & v) CPPLINQ_NOEXCEPT
-                :   range               (v.range)
-                ,   other_range         (v.other_range)
-                ,   state               (v.state)
+            CPPLINQ_CONSTEXPR where_builder (where_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD concat_range (concat_range && v) CPPLINQ_NOEXCEPT
-                :   range               (std::move (v.range))
-                ,   other_range         (std::move (v.other_range))
-                ,   state               (std::move (v.state))
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR where_range<TRange, TPredicate> build (TRange range) const
             {
+                return where_range<TRange, TPredicate>(std::move (range), predicate);
             }
 
-            template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+        };
+
+        // -------------------------------------------------------------------------
+
+        // -------------------------------------------------------------------------
+
+        template<typename TSink>
+        struct take_sink
+        {
+            TSink &                 sink        ;
+            size_type               remaining   ;
+            bool                    stopped     ;
+
+            CPPLINQ_INLINEMETHOD take_sink (TSink & sink, size_type remaining) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+                ,   remaining   (remaining)
+                ,   stopped     (false)
             {
-                return range_builder.build (*this);
             }
 
-            CPPLINQ_INLINEMETHOD return_type front () const
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue && v)
             {
-                switch (state)
+                --remaining;
+
+                if (!sink (std::forward<TValue> (v)))
                 {
-                case state_initial:
-                case state_end:
-                default:
-                    CPPLINQ_ASSERT (false);       // Intentionally falls through
-                case state_iterating_range:
-                    return range.front ();
-                case state_iterating_other_range:
-                    return other_range.front ();
-                };
+                    stopped = true;
+                    return false;
+                }
+
+                // Stops as soon as the last element is taken, no element is pulled in vain
+                return remaining > 0U;
+            }
+        };
+
+        template<typename TRange>
+        struct take_range : base_range
+        {
+            typedef                 take_range<TRange>              this_type       ;
+            typedef                 TRange                          range_type      ;
+            typedef                 batch_traits<TRange>            source_traits   ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            typedef        typename source_traits::batch_type       batch_type      ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                supports_batch      = source_traits::is_native    ,
+                prefers_batch       = source_traits::prefers_batch,
+                size_hint_kind      =
+                        size_hint_traits<TRange>::kind == size_hint_none
+                    ?   size_hint_upper_bound
+                    :   size_hint_traits<TRange>::kind
+                    ,
+                supports_push       = 1                           ,
+                supports_random_access  = is_random_access_range<TRange>::value,
+            };
+
+            range_type              range       ;
+            size_type               count       ;
+            size_type               current     ;
+
+
+            CPPLINQ_INLINEMETHOD take_range (
+                    range_type      range
+                ,   size_type       count
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   count       (std::move (count))
+                ,   current     (0)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_range (take_range const & v)
+                :   range       (v.range)
+                ,   count       (v.count)
+                ,   current     (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_range (take_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   count       (std::move (v.count))
+                ,   current     (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
             }
 
             CPPLINQ_INLINEMETHOD bool next ()
             {
-                switch (state)
+                if (current >= count)
                 {
-                case state_initial:
-                    if (range.next ())
-                    {
-                        state = state_iterating_range;
-                        return true;
-                    }
+                    return false;
+                }
 
-                    if (other_range.next ())
-                    {
-                        state = state_iterating_other_range;
-                        return true;
-                    }
+                ++current;
+                return range.next ();
+            }
 
-                    state = state_end;
-                    return false;
-                case state_iterating_range:
-                    if (range.next ())
-                    {
-                        return true;
-                    }
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                auto remaining  = current < count ? count - current : 0U;
+                auto size       = range.size ();
+                return size < remaining ? size : remaining;
+            }
 
-                    if (other_range.next ())
-                    {
-                        state = state_iterating_other_range;
-                        return true;
-                    }
+            CPPLINQ_INLINEMETHOD value_type at (size_type index)
+            {
+                return range.at (index);
+            }
 
-                    state = state_end;
+            CPPLINQ_INLINEMETHOD void advance (size_type steps)
+            {
+                range.advance (steps);
+                current += steps;
+            }
+
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
+            {
+                if (current >= count)
+                {
+                    return true;
+                }
+
+                take_sink<TSink> s (sink, count - current);
+                push_traits<TRange>::push (range, s);
+                current = count - s.remaining;
+
+                return !s.stopped;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                auto remaining  = current < count ? count - current : 0U;
+                auto hint       = size_hint_traits<TRange>::size_hint (range);
+                return hint < remaining ? hint : remaining;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity)
+            {
+                if (current >= count)
+                {
+                    return 0U;
+                }
+
+                auto remaining  = count - current;
+                auto result     = source_traits::next_batch (
+                        range
+                    ,   batch
+                    ,   remaining < capacity ? remaining : capacity
+                    );
+
+                current = result > 0U ? current + result : count;
+
+                return result;
+            }
+
+            static CPPLINQ_INLINEMETHOD return_type batch_value (batch_type const & v)
+            {
+                return source_traits::batch_value (v);
+            }
+        };
+
+        struct take_builder : base_builder
+        {
+            typedef                 take_builder        this_type       ;
+
+            size_type               count       ;
+
+            CPPLINQ_INLINEMETHOD explicit take_builder (size_type count) CPPLINQ_NOEXCEPT
+                :   count (std::move (count))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_builder (take_builder const & v) CPPLINQ_NOEXCEPT
+                :   count (v.count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_builder (take_builder && v) CPPLINQ_NOEXCEPT
+                :   count (std::move (v.count))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD take_range<TRange> build (TRange range) const
+            {
+                return take_range<TRange>(std::move (range), count);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TSink, typename TPredicate>
+        struct take_while_sink
+        {
+            TSink &                 sink        ;
+            TPredicate &            predicate   ;
+            bool                    stopped     ;
+
+            CPPLINQ_INLINEMETHOD take_while_sink (TSink & sink, TPredicate & predicate) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+                ,   predicate   (predicate)
+                ,   stopped     (false)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue && v)
+            {
+                if (!predicate (v))
+                {
                     return false;
-                case state_iterating_other_range:
-                    if (other_range.next ())
-                    {
-                        return true;
-                    }
+                }
 
-                    state = state_end;
+                if (!sink (std::forward<TValue> (v)))
+                {
+                    stopped = true;
                     return false;
-                case state_end:
-                default:
+                }
+
+                return true;
+            }
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct take_while_range : base_range
+        {
+            typedef                 take_while_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 TPredicate                              predicate_type  ;
+
+            typedef                 typename TRange::value_type             value_type      ;
+            typedef                 typename TRange::return_type            return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                supports_push       = 1                           ,
+            };
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+            bool                    done        ;
+
+
+            CPPLINQ_INLINEMETHOD take_while_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+                ,   done        (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_range (take_while_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   done        (v.done)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_range (take_while_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   done        (std::move (v.done))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (done)
+                {
                     return false;
                 }
-            }
-        };
 
-        template <typename TOtherRange>
-        struct concat_builder : base_builder
-        {
-            typedef                 concat_builder<TOtherRange>             this_type       ;
-            typedef                 TOtherRange                             other_range_type;
+                if (!range.next ())
+                {
+                    done = true;
+                    return false;
+                }
+
+                if (!predicate (range.front ()))
+                {
+                    done = true;
+                    return false;
+                }
+
+                return true;
+            }
+
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
+            {
+                if (done)
+                {
+                    return true;
+                }
+
+                take_while_sink<TSink, predicate_type> s (sink, predicate);
+                push_traits<TRange>::push (range, s);
+
+                // Unless sink stopped, either the predicate failed or range is exhausted
+                done = !s.stopped;
+
+                return !s.stopped;
+            }
+        };
+
+        template<typename TPredicate>
+        struct take_while_builder : base_builder
+        {
+            typedef                 take_while_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD take_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD take_while_builder (take_while_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD take_while_range<TRange, TPredicate> build (TRange range) const
+            {
+                return take_while_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct skip_range : base_range
+        {
+            typedef                 skip_range<TRange>              this_type       ;
+            typedef                 TRange                          range_type      ;
+            typedef                 batch_traits<TRange>            source_traits   ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            typedef        typename source_traits::batch_type       batch_type      ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                supports_batch      = source_traits::is_native    ,
+                prefers_batch       = source_traits::prefers_batch,
+                size_hint_kind      = size_hint_traits<TRange>::kind,
+                supports_push       = 1                           ,
+                supports_random_access  = is_random_access_range<TRange>::value,
+            };
+
+            range_type              range       ;
+            size_type               count       ;
+            size_type               current     ;
+
+            CPPLINQ_INLINEMETHOD skip_range (
+                    range_type      range
+                ,   size_type       count
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   count       (std::move (count))
+                ,   current     (0)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_range (skip_range const & v)
+                :   range       (v.range)
+                ,   count       (v.count)
+                ,   current     (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_range (skip_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   count       (std::move (v.count))
+                ,   current     (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            // Random access ranges skip in O(1)
+            CPPLINQ_INLINEMETHOD void skip_ahead (std::true_type)
+            {
+                if (current == invalid_size || current >= count)
+                {
+                    return;
+                }
+
+                auto skipping   = count - current;
+                auto size       = range.size ();
+
+                if (size < skipping)
+                {
+                    range.advance (size);
+                    current = invalid_size;
+                }
+                else
+                {
+                    range.advance (skipping);
+                    current = count;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD void skip_ahead (std::false_type) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                skip_ahead (is_random_access_range<TRange> ());
+
+                if (current == invalid_size)
+                {
+                    return false;
+                }
+
+                while (current < count && range.next ())
+                {
+                    ++current;
+                }
+
+                if (current < count)
+                {
+                    current = invalid_size;
+                    return false;
+                }
+
+                return range.next ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                if (current == invalid_size)
+                {
+                    return 0U;
+                }
+
+                auto skipping   = current < count ? count - current : 0U;
+                auto hint       = size_hint_traits<TRange>::size_hint (range);
+                return hint > skipping ? hint - skipping : 0U;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size ()
+            {
+                skip_ahead (std::true_type ());
+                return current == invalid_size ? 0U : range.size ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type at (size_type index)
+            {
+                skip_ahead (std::true_type ());
+                return range.at (index);
+            }
+
+            CPPLINQ_INLINEMETHOD void advance (size_type steps)
+            {
+                skip_ahead (std::true_type ());
+                range.advance (steps);
+            }
+
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
+            {
+                // Skipping is done by next (), the rest is pushed from range
+                if (!next ())
+                {
+                    return true;
+                }
+
+                if (!sink (range.front ()))
+                {
+                    return false;
+                }
+
+                return push_traits<TRange>::push (range, sink);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity)
+            {
+                skip_ahead (is_random_access_range<TRange> ());
+
+                if (current == invalid_size)
+                {
+                    return 0U;
+                }
+
+                // The caller's buffer doubles as scratch space for the skipped elements
+                while (current < count)
+                {
+                    auto remaining  = count - current;
+                    auto skipped    = source_traits::next_batch (
+                            range
+                        ,   batch
+                        ,   remaining < capacity ? remaining : capacity
+                        );
+
+                    if (skipped == 0U)
+                    {
+                        current = invalid_size;
+                        return 0U;
+                    }
+
+                    current += skipped;
+                }
+
+                return source_traits::next_batch (range, batch, capacity);
+            }
+
+            static CPPLINQ_INLINEMETHOD return_type batch_value (batch_type const & v)
+            {
+                return source_traits::batch_value (v);
+            }
+        };
+
+        struct skip_builder : base_builder
+        {
+            typedef                 skip_builder        this_type       ;
+
+            size_type               count       ;
+
+            CPPLINQ_INLINEMETHOD explicit skip_builder (size_type count) CPPLINQ_NOEXCEPT
+                :   count (std::move (count))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_builder (skip_builder const & v) CPPLINQ_NOEXCEPT
+                :   count (v.count)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_builder (skip_builder && v) CPPLINQ_NOEXCEPT
+                :   count (std::move (v.count))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD skip_range<TRange> build (TRange range) const
+            {
+                return skip_range<TRange>(std::move (range), count);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TPredicate>
+        struct skip_while_range : base_range
+        {
+            typedef                 skip_while_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 TPredicate                              predicate_type  ;
+
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+                supports_push       = 1                           ,
+            };
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+            bool                    skipping    ;
+
+            CPPLINQ_INLINEMETHOD skip_while_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+                ,   skipping    (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   skipping    (v.skipping)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_range (skip_while_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   skipping    (std::move (v.skipping))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (!skipping)
+                {
+                    return range.next ();
+                }
+
+                while (range.next ())
+                {
+                    if (!predicate (range.front ()))
+                    {
+                        skipping = false;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
+            {
+                // Skipping is done by next (), the rest is pushed from range
+                if (!next ())
+                {
+                    return true;
+                }
+
+                if (!sink (range.front ()))
+                {
+                    return false;
+                }
+
+                return push_traits<TRange>::push (range, sink);
+            }
+        };
+
+        template <typename TPredicate>
+        struct skip_while_builder : base_builder
+        {
+            typedef                 skip_while_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD skip_while_builder (skip_while_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD skip_while_range<TRange, TPredicate> build (TRange range) const
+            {
+                return skip_while_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct ref_range : base_range
+        {
+            typedef        std::reference_wrapper<
+                                typename TRange::value_type const>  value_type  ;
+            typedef                 value_type                      return_type ;
+            enum
+            {
+                returns_reference   = 0   ,
+            };
+
+            typedef                 ref_range<TRange>               this_type   ;
+            typedef                 TRange                          range_type  ;
+
+            range_type              range       ;
+
+            CPPLINQ_INLINEMETHOD ref_range (
+                    range_type      range
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+            {
+                static_assert (
+                        TRange::returns_reference
+                    ,   "ref may only follow a range that returns references"
+                    );
+            }
+
+            CPPLINQ_INLINEMETHOD ref_range (ref_range const & v)
+                :   range       (v.range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_range (ref_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return value_type (range.front ());
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                return range.next ();
+            }
+        };
+
+        struct ref_builder : base_builder
+        {
+            typedef                 ref_builder this_type   ;
+
+            CPPLINQ_INLINEMETHOD ref_builder () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_builder (ref_builder const & v)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD ref_builder (ref_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD ref_range<TRange> build (TRange range) const
+            {
+                return ref_range<TRange>(std::move (range));
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // -------------------------------------------------------------------------
+
+        template<typename TSink, typename TPredicate>
+        struct select_sink
+        {
+            TSink &                 sink        ;
+            TPredicate &            predicate   ;
+
+            CPPLINQ_CONSTEXPR select_sink (TSink & sink, TPredicate & predicate) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+                ,   predicate   (predicate)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_CONSTEXPR bool operator() (TValue && v)
+            {
+                return sink (predicate (std::forward<TValue> (v)));
+            }
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct select_range : base_range
+        {
+            static typename TRange::value_type get_source ();
+            static          TPredicate get_predicate ();
+
+
+            typedef        decltype (get_predicate ()(get_source ()))   raw_value_type  ;
+            typedef        typename cleanup_type<raw_value_type>::type  value_type      ;
+            typedef                 value_type const &                  return_type     ;
+            typedef                 value_type                          batch_type      ;
+            typedef                 batch_traits<TRange>                source_traits   ;
+            enum
+            {
+                returns_reference   = 1   ,
+                supports_batch      =
+                        source_traits::is_native
+                    &&  std::is_default_constructible<value_type>::value
+                    ,
+                prefers_batch       = source_traits::prefers_batch,
+                size_hint_kind      = size_hint_traits<TRange>::kind,
+                supports_push       = 1                           ,
+                supports_random_access  = is_random_access_range<TRange>::value,
+                supports_split      = split_traits<TRange>::is_native,
+            };
+
+            typedef                 select_range<TRange, TPredicate>    this_type       ;
+            typedef                 TRange                              range_type      ;
+            typedef                 TPredicate                          predicate_type  ;
+            typedef                 select_range<
+                    typename split_traits<TRange>::split_type
+                ,   TPredicate
+                >                                                       split_type      ;
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+
+            opt<value_type>         cache_value ;
+
+            CPPLINQ_CONSTEXPR select_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_CONSTEXPR select_range (select_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   cache_value (v.cache_value)
+            {
+            }
+
+            CPPLINQ_CONSTEXPR select_range (select_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   cache_value (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_CONSTEXPR typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_CONSTEXPR return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_CONSTEXPR bool next ()
+            {
+                if (range.next ())
+                {
+                    cache_value = predicate (range.front ());
+                    return true;
+                }
+
+                cache_value.clear ();
+
+                return false;
+            }
+
+            CPPLINQ_CONSTEXPR size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return size_hint_traits<TRange>::size_hint (range);
+            }
+
+            CPPLINQ_CONSTEXPR size_type size ()
+            {
+                return range.size ();
+            }
+
+            CPPLINQ_CONSTEXPR value_type at (size_type index)
+            {
+                return predicate (range.at (index));
+            }
+
+            CPPLINQ_CONSTEXPR void advance (size_type steps)
+            {
+                cache_value.clear ();
+                range.advance (steps);
+            }
+
+            template<typename TSink>
+            CPPLINQ_CONSTEXPR bool push (TSink & sink)
+            {
+                cache_value.clear ();
+
+                select_sink<TSink, predicate_type> s (sink, predicate);
+                return push_traits<TRange>::push (range, s);
+            }
+
+            CPPLINQ_CONSTEXPR size_type next_batch (batch_type * batch, size_type capacity)
+            {
+                typename source_traits::batch_type source[batch_size];
+
+                cache_value.clear ();
+
+                auto count = source_traits::next_batch (
+                        range
+                    ,   source
+                    ,   capacity < batch_size ? capacity : batch_size
+                    );
+
+                for (size_type iter = 0U; iter < count; ++iter)
+                {
+                    batch[iter] = predicate (source_traits::batch_value (source[iter]));
+                }
+
+                return count;
+            }
+
+            static CPPLINQ_CONSTEXPR return_type batch_value (batch_type const & v) CPPLINQ_NOEXCEPT
+            {
+                return v;
+            }
+
+            CPPLINQ_CONSTEXPR size_type split_size () const CPPLINQ_NOEXCEPT
+            {
+                return range.split_size ();
+            }
+
+            CPPLINQ_CONSTEXPR split_type split (size_type count)
+            {
+                cache_value.clear ();
+                return split_type (range.split (count), predicate);
+            }
+        };
+
+        template<typename TPredicate>
+        struct select_builder : base_builder
+        {
+            typedef                 select_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                  predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_CONSTEXPR explicit select_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_CONSTEXPR select_builder (select_builder const & v)
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_CONSTEXPR select_builder (select_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR select_range<TRange, TPredicate> build (TRange range) const
+            {
+                return select_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Some trickery in order to force the code to compile on VS2012
+        template<typename TRange, typename TPredicate>
+        struct select_many_range_helper
+        {
+            static typename TRange::value_type get_source ();
+            static          TPredicate get_predicate ();
+
+            typedef        decltype (get_predicate ()(get_source ()))           raw_inner_range_type    ;
+            typedef        typename cleanup_type<raw_inner_range_type>::type    inner_range_type        ;
+
+            static         inner_range_type get_inner_range ();
+
+            typedef        decltype (get_inner_range ().front ())               raw_value_type          ;
+            typedef        typename cleanup_type<raw_value_type>::type          value_type              ;
+
+        };
+
+        template<typename TRange, typename TPredicate>
+        struct select_many_range : base_range
+        {
+            typedef select_many_range_helper<TRange, TPredicate>    helper_type         ;
+
+            typedef        typename helper_type::inner_range_type   inner_range_type    ;
+            typedef        typename helper_type::value_type         value_type          ;
+            typedef                 value_type                      return_type         ;
+            enum
+            {
+                returns_reference   = 0   ,
+            };
+
+            typedef                 select_many_range<TRange, TPredicate>       this_type               ;
+            typedef                 TRange                                      range_type              ;
+            typedef                 TPredicate                                  predicate_type          ;
+
+            range_type              range       ;
+            predicate_type          predicate   ;
+
+            opt<inner_range_type>   inner_range ;
+
+
+            CPPLINQ_INLINEMETHOD select_many_range (
+                    range_type      range
+                ,   predicate_type  predicate
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   predicate   (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_range (select_many_range const & v)
+                :   range       (v.range)
+                ,   predicate   (v.predicate)
+                ,   inner_range (v.inner_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_range (select_many_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   predicate   (std::move (v.predicate))
+                ,   inner_range (std::move (v.inner_range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (inner_range);
+                return inner_range->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (inner_range && inner_range->next ())
+                {
+                    return true;
+                }
+
+                if (range.next ())
+                {
+                    inner_range = predicate (range.front ());
+                    return inner_range && inner_range->next ();
+                }
+
+                inner_range.clear ();
+
+                return false;
+            }
+        };
+
+        template<typename TPredicate>
+        struct select_many_builder : base_builder
+        {
+            typedef                 select_many_builder<TPredicate> this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
+
+            predicate_type          predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit select_many_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder const & v)
+                :   predicate (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD select_many_builder (select_many_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD select_many_range<TRange, TPredicate> build (TRange range) const
+            {
+                return select_many_range<TRange, TPredicate>(std::move (range), predicate);
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<
+                typename TRange
+            ,   typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct join_range : base_range
+        {
+            static typename TRange::value_type      get_source ()               ;
+            static typename TOtherRange::value_type get_other_source ()         ;
+            static          TKeySelector            get_key_selector ()         ;
+            static          TOtherKeySelector       get_other_key_selector ()   ;
+            static          TCombiner               get_combiner ()             ;
+
+            typedef         decltype (get_key_selector () (get_source ()))      raw_key_type    ;
+            typedef         typename cleanup_type<raw_key_type>::type           key_type        ;
+
+            typedef         decltype (get_other_key_selector () (get_other_source ()))
+                                                                                raw_other_key_type  ;
+            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+
+            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type const &                          return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            typedef                 join_range<
+                    TRange
+                ,   TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef                 std::multimap<
+                                            other_key_type
+                                        ,   typename TOtherRange::value_type
+                                        >                       map_type                ;
+            typedef     typename    map_type::const_iterator    map_iterator_type       ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            key_selector_type           key_selector        ;
+            other_key_selector_type     other_key_selector  ;
+            combiner_type               combiner            ;
+
+            bool                        start               ;
+            map_type                    map                 ;
+            map_iterator_type           current             ;
+
+            opt<value_type>             cache_value         ;
+
+            CPPLINQ_INLINEMETHOD join_range (
+                    range_type              range
+                ,   other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   range              (std::move (range))
+                ,   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   start              (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_range (join_range const & v)
+                :   range              (v.range)
+                ,   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   start              (v.start)
+                ,   map                (v.map)
+                ,   current            (v.current)
+                ,   cache_value        (v.cache_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_range (join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   start              (std::move (v.start))
+                ,   map                (std::move (v.map))
+                ,   current            (std::move (v.current))
+                ,   cache_value        (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                // The combined value is computed once per element, front () may be
+                // invoked any number of times by the consumer
+                if (next_match ())
+                {
+                    cache_value = combiner (range.front (), current->second);
+                    return true;
+                }
+
+                cache_value.clear ();
+
+                return false;
+            }
+
+        private:
+            CPPLINQ_INLINEMETHOD bool next_match ()
+            {
+                if (start)
+                {
+                    start = false;
+
+                    // The map is built from other_range, a with_cancellation on
+                    // range is polled while doing so
+                    auto cancellation   = cancellation_traits<TRange>::get (range);
+                    auto countdown      = size_type (0U);
+                    try
+                    {
+                        while (other_range.next ())
+                        {
+                            cancellation.check_counted (countdown);
+                            auto other_value    = other_range.front ();
+                            auto other_key      = other_key_selector (other_value);
+                            map.insert (typename map_type::value_type (std::move (other_key), std::move (other_value)));
+                        }
+                    }
+                    catch (operation_cancelled_exception const &)
+                    {
+                        map.clear ();
+                        throw;
+                    }
+
+                    current = map.end ();
+                    if (map.size () == 0U)
+                    {
+                        return false;
+                    }
+                }
+
+                if (current != map.end ())
+                {
+                    auto previous = current;
+                    ++current;
+                    if (current != map.end () && !(previous->first < current->first))
+                    {
+                        return true;
+                    }
+                }
+
+                while (range.next ())
+                {
+                    auto const & value  = range.front ();
+                    auto key            = key_selector (value);
+
+                    current     = map.find (key);
+                    if (current != map.end ())
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct join_builder : base_builder
+        {
+            typedef                 join_builder<
+                    TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+
+            other_range_type        other_range         ;
+            key_selector_type       key_selector        ;
+            other_key_selector_type other_key_selector  ;
+            combiner_type           combiner            ;
+
+            CPPLINQ_INLINEMETHOD join_builder (
+                    other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_builder (join_builder const & v)
+                :   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD join_builder (join_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> build (TRange range) const
+            {
+                return join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> (
+                        std::move (range)
+                    ,   other_range
+                    ,   key_selector
+                    ,   other_key_selector
+                    ,   combiner
+                    );
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<
+                typename TRange
+            ,   typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct merge_join_range : base_range
+        {
+            static typename TRange::value_type      get_source ()               ;
+            static typename TOtherRange::value_type get_other_source ()         ;
+            static          TKeySelector            get_key_selector ()         ;
+            static          TOtherKeySelector       get_other_key_selector ()   ;
+            static          TCombiner               get_combiner ()             ;
+
+            typedef         decltype (get_key_selector () (get_source ()))      raw_key_type    ;
+            typedef         typename cleanup_type<raw_key_type>::type           key_type        ;
+
+            typedef         decltype (get_other_key_selector () (get_other_source ()))
+                                                                                raw_other_key_type  ;
+            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+
+            typedef         typename cleanup_type<typename TOtherRange::value_type>::type
+                                                                                other_value_type    ;
+
+            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type const &                          return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            typedef                 merge_join_range<
+                    TRange
+                ,   TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+
+            range_type                      range               ;
+            other_range_type                other_range         ;
+            key_selector_type               key_selector        ;
+            other_key_selector_type         other_key_selector  ;
+            combiner_type                   combiner            ;
+
+            bool                            start               ;
+            // The run of other elements sharing run_key, kept while elements
+            // of range match it
+            std::vector<other_value_type>   run                 ;
+            opt<other_key_type>             run_key             ;
+            size_type                       run_position        ;
+            // The first other element after the run
+            opt<other_value_type>           ahead               ;
+            opt<other_key_type>             ahead_key           ;
+
+            opt<value_type>                 cache_value         ;
+
+            CPPLINQ_INLINEMETHOD merge_join_range (
+                    range_type              range
+                ,   other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   range              (std::move (range))
+                ,   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   start              (true)
+                ,   run_position       (0U)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD merge_join_range (merge_join_range const & v)
+                :   range              (v.range)
+                ,   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   start              (v.start)
+                ,   run                (v.run)
+                ,   run_key            (v.run_key)
+                ,   run_position       (v.run_position)
+                ,   ahead              (v.ahead)
+                ,   ahead_key          (v.ahead_key)
+                ,   cache_value        (v.cache_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD merge_join_range (merge_join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   start              (std::move (v.start))
+                ,   run                (std::move (v.run))
+                ,   run_key            (std::move (v.run_key))
+                ,   run_position       (std::move (v.run_position))
+                ,   ahead              (std::move (v.ahead))
+                ,   ahead_key          (std::move (v.ahead_key))
+                ,   cache_value        (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (next_match ())
+                {
+                    cache_value = combiner (range.front (), run[run_position]);
+                    return true;
+                }
+
+                cache_value.clear ();
+
+                return false;
+            }
+
+        private:
+            CPPLINQ_INLINEMETHOD void next_ahead ()
+            {
+                if (other_range.next ())
+                {
+                    auto other_value    = other_range.front ();
+                    auto other_key      = other_key_selector (other_value);
+                    CPPLINQ_ASSERT (!ahead_key || !(other_key < *ahead_key));
+                    ahead_key   = opt<other_key_type> (std::move (other_key));
+                    ahead       = opt<other_value_type> (std::move (other_value));
+                }
+                else
+                {
+                    ahead_key.clear ();
+                    ahead.clear ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool next_match ()
+            {
+                if (start)
+                {
+                    start = false;
+                    next_ahead ();
+                }
+                else if (run_position + 1U < run.size ())
+                {
+                    ++run_position;
+                    return true;
+                }
+
+                // When both the run and other_range are exhausted no element
+                // of range can match, range is left unread from there
+                while ((run_key || ahead) && range.next ())
+                {
+                    auto key = key_selector (range.front ());
+
+                    // Equal keys in range match the same run
+                    if (run_key && !(*run_key < key) && !(key < *run_key))
+                    {
+                        run_position = 0U;
+                        return true;
+                    }
+
+                    run.clear ();
+                    run_key.clear ();
+
+                    while (ahead && *ahead_key < key)
+                    {
+                        next_ahead ();
+                    }
+
+                    if (ahead && !(key < *ahead_key))
+                    {
+                        run_key = ahead_key;
+                        do
+                        {
+                            run.push_back (std::move (*ahead));
+                            next_ahead ();
+                        }
+                        while (ahead && !(*run_key < *ahead_key));
+
+                        run_position = 0U;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+        struct merge_join_builder : base_builder
+        {
+            typedef                 merge_join_builder<
+                    TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                >                                               this_type               ;
+
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+
+            other_range_type        other_range         ;
+            key_selector_type       key_selector        ;
+            other_key_selector_type other_key_selector  ;
+            combiner_type           combiner            ;
+
+            CPPLINQ_INLINEMETHOD merge_join_builder (
+                    other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD merge_join_builder (merge_join_builder const & v)
+                :   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD merge_join_builder (merge_join_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD merge_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> build (TRange range) const
+            {
+                return merge_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner> (
+                        std::move (range)
+                    ,   other_range
+                    ,   key_selector
+                    ,   other_key_selector
+                    ,   combiner
+                    );
+            }
+        };
+
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange>
+        struct distinct_range : base_range
+        {
+            typedef             distinct_range<TRange>                          this_type           ;
+            typedef             TRange                                          range_type          ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             std::set<value_type>               set_type                         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+            range_type                  range               ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+
+            CPPLINQ_INLINEMETHOD distinct_range (
+                        range_type          range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_range (distinct_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_range (distinct_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                try
+                {
+                    while (range.next ())
+                    {
+                        auto result = set.insert (range.front ());
+                        if (result.second)
+                        {
+                            current = result.first;
+                            return true;
+                        }
+                    }
+                }
+                catch (operation_cancelled_exception const &)
+                {
+                    release_buffer (set);
+                    throw;
+                }
+
+                return false;
+            }
+        };
+
+        struct distinct_builder : base_builder
+        {
+            typedef                 distinct_builder                    this_type               ;
+
+            CPPLINQ_INLINEMETHOD distinct_builder () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder const & v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD distinct_builder (distinct_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD distinct_range<TRange> build (TRange range) const
+            {
+                return distinct_range<TRange> (std::move (range));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // default_hasher and default_equality defer to std::hash and operator==
+        // of the type they are given
+        struct default_hasher
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD size_type operator() (TValue const & v) const
+            {
+                return std::hash<TValue> () (v);
+            }
+        };
+
+        struct default_equality
+        {
+            template<typename TValue, typename TOther>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue const & l, TOther const & r) const
+            {
+                return l == r;
+            }
+        };
+
+        // flat_hash_set keeps its values in insertion order in a vector and finds
+        // them through an open addressing table of indices with linear probing.
+        // Slots cache the hash of their value so probing seldom touches the
+        // values and growing never hashes again. The slot of a hash is picked
+        // from the top bits of the hash times a large odd constant as std::hash
+        // is often the identity.
+        template<typename TValue, typename THasher, typename TEqual>
+        struct flat_hash_set
+        {
+            typedef                 TValue                          value_type      ;
+            typedef                 THasher                         hasher_type     ;
+            typedef                 TEqual                          equality_type   ;
+
+            struct slot
+            {
+                size_type           hash        ;
+                size_type           index       ;   // invalid_size for empty slots
+            };
+
+            typedef                 std::vector<value_type>         values_type     ;
+            typedef                 std::vector<slot>               slots_type      ;
+
+            enum
+            {
+                size_type_bits  = sizeof (size_type) * CHAR_BIT ,
+                min_slots_bits  = 3                             ,
+            };
+
+            hasher_type             hasher      ;
+            equality_type           equality    ;
+            values_type             values      ;
+            slots_type              slots       ;
+            size_type               shift       ;
+
+            CPPLINQ_INLINEMETHOD flat_hash_set (
+                    hasher_type     hasher
+                ,   equality_type   equality
+                )
+                :   hasher      (std::move (hasher))
+                ,   equality    (std::move (equality))
+                ,   shift       (size_type_bits)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD flat_hash_set (flat_hash_set const & v)
+                :   hasher      (v.hasher)
+                ,   equality    (v.equality)
+                ,   values      (v.values)
+                ,   slots       (v.slots)
+                ,   shift       (v.shift)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD flat_hash_set (flat_hash_set && v) CPPLINQ_NOEXCEPT
+                :   hasher      (std::move (v.hasher))
+                ,   equality    (std::move (v.equality))
+                ,   values      (std::move (v.values))
+                ,   slots       (std::move (v.slots))
+                ,   shift       (std::move (v.shift))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size () const CPPLINQ_NOEXCEPT
+            {
+                return values.size ();
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & operator[] (size_type index) const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (index < values.size ());
+                return values[index];
+            }
+
+            // Makes room for count values without growing the table
+            CPPLINQ_METHOD void reserve (size_type count)
+            {
+                if (count <= slots.size () / 4U * 3U)
+                {
+                    return;
+                }
+
+                auto bits = static_cast<size_type> (min_slots_bits);
+                // Grows beyond a load factor of 3/4
+                while (bits < size_type_bits - 1U && (static_cast<size_type> (1U) << bits) / 4U * 3U < count)
+                {
+                    ++bits;
+                }
+
+                if (size_type_bits - bits < shift)
+                {
+                    rehash (bits);
+                }
+            }
+
+            // Returns the index of value and if it was inserted, value is only
+            // copied or moved into the set when it isn't in it yet
+            CPPLINQ_INLINEMETHOD std::pair<size_type, bool> insert (value_type const & value)
+            {
+                return insert_value (value);
+            }
+
+            CPPLINQ_INLINEMETHOD std::pair<size_type, bool> insert (value_type && value)
+            {
+                return insert_value (std::move (value));
+            }
+
+            // Other types are converted first so they hash as value_type does
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD std::pair<size_type, bool> insert (TOther const & value)
+            {
+                return insert_value (value_type (value));
+            }
+
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD size_type hash_of (TOther const & value) const
+            {
+                return static_cast<size_type> (hasher (value));
+            }
+
+            // Returns the index of value or invalid_size
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD size_type find (TOther const & value) const
+            {
+                return find_hashed (hash_of (value), value);
+            }
+
+            // As find but with the hash of value already computed
+            template<typename TOther>
+            CPPLINQ_METHOD size_type find_hashed (size_type hash, TOther const & value) const
+            {
+                if (slots.empty ())
+                {
+                    return invalid_size;
+                }
+
+                auto mask       = slots.size () - 1U;
+                auto position   = slot_of (hash);
+
+                for (;;)
+                {
+                    auto & s = slots[position];
+                    if (s.index == invalid_size)
+                    {
+                        return invalid_size;
+                    }
+
+                    if (s.hash == hash && equality (values[s.index], value))
+                    {
+                        return s.index;
+                    }
+
+                    position = (position + 1U) & mask;
+                }
+            }
+
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD bool contains (TOther const & value) const
+            {
+                return find (value) != invalid_size;
+            }
+
+            // Hints that the slot of hash is about to be probed
+            CPPLINQ_INLINEMETHOD void prefetch (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                if (!slots.empty ())
+                {
+                    CPPLINQ_PREFETCH (&slots[slot_of (hash)]);
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD void release ()
+            {
+                release_buffer (values);
+                release_buffer (slots);
+                shift = size_type_bits;
+            }
+
+        private:
+            template<typename TArg>
+            CPPLINQ_METHOD std::pair<size_type, bool> insert_value (TArg && value)
+            {
+                reserve (values.size () + 1U);
+
+                auto hash       = static_cast<size_type> (hasher (value));
+                auto mask       = slots.size () - 1U;
+                auto position   = slot_of (hash);
+
+                for (;;)
+                {
+                    auto & s = slots[position];
+                    if (s.index == invalid_size)
+                    {
+                        auto index = values.size ();
+                        values.push_back (std::forward<TArg> (value));
+                        s.hash  = hash;
+                        s.index = index;
+                        return std::make_pair (index, true);
+                    }
+
+                    if (s.hash == hash && equality (values[s.index], value))
+                    {
+                        return std::make_pair (s.index, false);
+                    }
+
+                    position = (position + 1U) & mask;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD size_type slot_of (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                // 2^64 divided by the golden ratio, truncated when size_type is narrower
+                auto const scramble = static_cast<size_type> (0x9E3779B97F4A7C15ULL);
+                return (hash * scramble) >> shift;
+            }
+
+            CPPLINQ_METHOD void rehash (size_type bits)
+            {
+                slot empty_slot;
+                empty_slot.hash     = 0U;
+                empty_slot.index    = invalid_size;
+
+                slots_type new_slots (static_cast<size_type> (1U) << bits, empty_slot);
+                slots.swap (new_slots);
+                shift = size_type_bits - bits;
+
+                auto mask = slots.size () - 1U;
+                for (auto & s : new_slots)
+                {
+                    if (s.index == invalid_size)
+                    {
+                        continue;
+                    }
+
+                    auto position = slot_of (s.hash);
+                    while (slots[position].index != invalid_size)
+                    {
+                        position = (position + 1U) & mask;
+                    }
+                    slots[position] = s;
+                }
+            }
+        };
+
+        // hash_distinct_range is distinct_range on a flat_hash_set, it needs a
+        // hasher and an equality instead of operator<
+        template<typename TRange, typename THasher, typename TEqual>
+        struct hash_distinct_range : base_range
+        {
+            typedef             hash_distinct_range<TRange, THasher, TEqual>    this_type           ;
+            typedef             TRange                                          range_type          ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             flat_hash_set<value_type, THasher, TEqual>      set_type            ;
+
+            range_type                  range               ;
+            set_type                    set                 ;
+            size_type                   current             ;
+
+            CPPLINQ_INLINEMETHOD hash_distinct_range (
+                        range_type          range
+                    ,   THasher             hasher
+                    ,   TEqual              equality
+                )
+                :   range               (std::move (range))
+                ,   set                 (std::move (hasher), std::move (equality))
+                ,   current             (invalid_size)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_distinct_range (hash_distinct_range const & v)
+                :   range               (v.range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_distinct_range (hash_distinct_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return set[current];
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                try
+                {
+                    while (range.next ())
+                    {
+                        auto result = set.insert (range.front ());
+                        if (result.second)
+                        {
+                            current = result.first;
+                            return true;
+                        }
+                    }
+                }
+                catch (operation_cancelled_exception const &)
+                {
+                    set.release ();
+                    throw;
+                }
+
+                return false;
+            }
+        };
+
+        template<typename THasher, typename TEqual>
+        struct hash_distinct_builder : base_builder
+        {
+            typedef                 hash_distinct_builder<THasher, TEqual>  this_type       ;
+            typedef                 THasher                             hasher_type     ;
+            typedef                 TEqual                              equality_type   ;
+
+            hasher_type             hasher      ;
+            equality_type           equality    ;
+
+            CPPLINQ_INLINEMETHOD hash_distinct_builder (hasher_type hasher, equality_type equality) CPPLINQ_NOEXCEPT
+                :   hasher      (std::move (hasher))
+                ,   equality    (std::move (equality))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_distinct_builder (hash_distinct_builder const & v)
+                :   hasher      (v.hasher)
+                ,   equality    (v.equality)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_distinct_builder (hash_distinct_builder && v) CPPLINQ_NOEXCEPT
+                :   hasher      (std::move (v.hasher))
+                ,   equality    (std::move (v.equality))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD hash_distinct_range<TRange, THasher, TEqual> build (TRange range) const
+            {
+                return hash_distinct_range<TRange, THasher, TEqual> (std::move (range), hasher, equality);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange>
+        struct union_range : base_range
+        {
+            typedef             union_range<TRange, TOtherRange>                this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             std::set<value_type>               set_type                         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+
+            CPPLINQ_INLINEMETHOD union_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_range (union_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_range (union_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                while (range.next ())
+                {
+                    auto result = set.insert (range.front ());
+                    if (result.second)
+                    {
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                while (other_range.next ())
+                {
+                    auto result = set.insert (other_range.front ());
+                    if (result.second)
+                    {
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange>
+        struct union_builder : base_builder
+        {
+            typedef                 union_builder<TOtherRange>              this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD union_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_builder (union_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD union_builder (union_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD union_range<TRange, TOtherRange> build (TRange range) const
+            {
+                return union_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange>
+        struct intersect_range : base_range
+        {
+            typedef             intersect_range<TRange, TOtherRange>            this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             std::set<value_type>               set_type                         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+            bool                        start               ;
+
+            CPPLINQ_INLINEMETHOD intersect_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   start               (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_range (intersect_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+                ,   start               (v.start)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_range (intersect_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+                ,   start               (std::move (v.start))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (!start);
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+
+                    while (other_range.next ())
+                    {
+                        set.insert (other_range.front ());
+                    }
+
+                    while (range.next ())
+                    {
+                        current = set.find (range.front ());
+                        if (current != set.end ())
+                        {
+                            return true;
+                        }
+                    }
+
+                    set.clear ();
+
+                    return false;
+                }
+
+                if (set.empty ())
+                {
+                    return false;
+                }
+
+                set.erase (current);
+
+                while (range.next ())
+                {
+                    current = set.find (range.front ());
+                    if (current != set.end ())
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange>
+        struct intersect_builder : base_builder
+        {
+            typedef                 intersect_builder<TOtherRange>          this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD intersect_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD intersect_builder (intersect_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD intersect_range<TRange, TOtherRange> build (TRange range) const
+            {
+                return intersect_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TRange, typename TOtherRange>
+        struct except_range : base_range
+        {
+            typedef             except_range<TRange, TOtherRange>               this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             std::set<value_type>               set_type                         ;
+            typedef    typename set_type::const_iterator           set_iterator_type                ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            set_iterator_type           current             ;
+            bool                        start               ;
+
+            CPPLINQ_INLINEMETHOD except_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   start               (true)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_range (except_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+                ,   start               (v.start)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_range (except_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+                ,   start               (std::move (v.start))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return *current;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    while (other_range.next ())
+                    {
+                        set.insert (other_range.front ());
+                    }
+                }
+
+                while (range.next ())
+                {
+                    auto result = set.insert (range.front ());
+                    if (result.second)
+                    {
+                        current = result.first;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange>
+        struct except_builder : base_builder
+        {
+            typedef                 union_builder<TOtherRange>              this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD except_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_builder (except_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD except_builder (except_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD except_range<TRange, TOtherRange> build (TRange range) const
+            {
+                return except_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // Returns true if a hash set operator should build its table on range
+        // rather than on other_range
+        template<typename TRange, typename TOtherRange>
+        CPPLINQ_INLINEMETHOD bool build_on_range (
+                hash_build_side     side
+            ,   TRange const &      range
+            ,   TOtherRange const & other_range
+            ) CPPLINQ_NOEXCEPT
+        {
+            return
+                    side == build_smaller
+                &&  size_hint_traits<TRange>::size_hint (range) < size_hint_traits<TOtherRange>::size_hint (other_range)
+                ;
+        }
+
+        // Builds set from the distinct elements of range
+        template<typename TSet, typename TRange>
+        CPPLINQ_METHOD void insert_all (TSet & set, TRange & range)
+        {
+            while (range.next ())
+            {
+                set.insert (range.front ());
+            }
+        }
+
+        // Marks the elements of set that are found in range
+        template<typename TSet, typename TRange>
+        CPPLINQ_METHOD void mark_found (TSet const & set, std::vector<bool> & found, TRange & range)
+        {
+            typedef typename TSet::value_type value_type;
+
+            found.assign (set.size (), false);
+
+            while (range.next ())
+            {
+                value_type const & value = range.front ();
+                auto index = set.find (value);
+                if (index != invalid_size)
+                {
+                    found[index] = true;
+                }
+            }
+        }
+
+        template<typename TRange, typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_union_range : base_range
+        {
+            typedef             hash_union_range<TRange, TOtherRange, THasher, TEqual>  this_type           ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             flat_hash_set<value_type, THasher, TEqual>      set_type            ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            size_type                   current             ;
+
+            CPPLINQ_INLINEMETHOD hash_union_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                    ,   THasher             hasher
+                    ,   TEqual              equality
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (std::move (hasher), std::move (equality))
+                ,   current             (invalid_size)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_union_range (hash_union_range const & v)
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   current             (v.current)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_union_range (hash_union_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   current             (std::move (v.current))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return set[current];
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                try
+                {
+                    while (range.next ())
+                    {
+                        auto result = set.insert (range.front ());
+                        if (result.second)
+                        {
+                            current = result.first;
+                            return true;
+                        }
+                    }
+
+                    while (other_range.next ())
+                    {
+                        auto result = set.insert (other_range.front ());
+                        if (result.second)
+                        {
+                            current = result.first;
+                            return true;
+                        }
+                    }
+                }
+                catch (operation_cancelled_exception const &)
+                {
+                    set.release ();
+                    throw;
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_union_builder : base_builder
+        {
+            typedef                 hash_union_builder<TOtherRange, THasher, TEqual>    this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+            THasher                 hasher              ;
+            TEqual                  equality            ;
+
+            CPPLINQ_INLINEMETHOD hash_union_builder (TOtherRange other_range, THasher hasher, TEqual equality) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (other_range))
+                ,   hasher      (std::move (hasher))
+                ,   equality    (std::move (equality))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_union_builder (hash_union_builder const & v)
+                :   other_range (v.other_range)
+                ,   hasher      (v.hasher)
+                ,   equality    (v.equality)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_union_builder (hash_union_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (v.other_range))
+                ,   hasher      (std::move (v.hasher))
+                ,   equality    (std::move (v.equality))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD hash_union_range<TRange, TOtherRange, THasher, TEqual> build (TRange range) const
+            {
+                return hash_union_range<TRange, TOtherRange, THasher, TEqual> (std::move (range), other_range, hasher, equality);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // hash_intersect_range either builds its table on other_range and
+        // streams range, found marks the elements already yielded, or builds it
+        // on the distinct elements of range, marks those found in other_range
+        // and yields the marked ones in first occurrence order
+        template<typename TRange, typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_intersect_range : base_range
+        {
+            typedef             hash_intersect_range<TRange, TOtherRange, THasher, TEqual>  this_type   ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             flat_hash_set<value_type, THasher, TEqual>      set_type            ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            std::vector<bool>           found               ;
+            size_type                   current             ;
+            hash_build_side             side                ;
+            bool                        start               ;
+            bool                        built_on_range      ;
+
+            CPPLINQ_INLINEMETHOD hash_intersect_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                    ,   THasher             hasher
+                    ,   TEqual              equality
+                    ,   hash_build_side     side
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (std::move (hasher), std::move (equality))
+                ,   current             (invalid_size)
+                ,   side                (side)
+                ,   start               (true)
+                ,   built_on_range      (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_intersect_range (hash_intersect_range const & v)
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   found               (v.found)
+                ,   current             (v.current)
+                ,   side                (v.side)
+                ,   start               (v.start)
+                ,   built_on_range      (v.built_on_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_intersect_range (hash_intersect_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   found               (std::move (v.found))
+                ,   current             (std::move (v.current))
+                ,   side                (std::move (v.side))
+                ,   start               (std::move (v.start))
+                ,   built_on_range      (std::move (v.built_on_range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (!start);
+                return set[current];
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                try
+                {
+                    if (start)
+                    {
+                        start           = false;
+                        built_on_range  = build_on_range (side, range, other_range);
+
+                        if (built_on_range)
+                        {
+                            insert_all (set, range);
+                            mark_found (set, found, other_range);
+                        }
+                        else
+                        {
+                            insert_all (set, other_range);
+                            found.assign (set.size (), false);
+                        }
+                    }
+
+                    if (built_on_range)
+                    {
+                        // current is invalid_size before the first call so current + 1U wraps to 0
+                        while (++current < set.size ())
+                        {
+                            if (found[current])
+                            {
+                                return true;
+                            }
+                        }
+
+                        current = set.size ();
+                        return false;
+                    }
+
+                    while (range.next ())
+                    {
+                        value_type const & value = range.front ();
+                        auto index = set.find (value);
+                        if (index != invalid_size && !found[index])
+                        {
+                            found[index]    = true;
+                            current         = index;
+                            return true;
+                        }
+                    }
+                }
+                catch (operation_cancelled_exception const &)
+                {
+                    set.release ();
+                    release_buffer (found);
+                    throw;
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_intersect_builder : base_builder
+        {
+            typedef                 hash_intersect_builder<TOtherRange, THasher, TEqual>    this_type   ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+            THasher                 hasher              ;
+            TEqual                  equality            ;
+            hash_build_side         side                ;
+
+            CPPLINQ_INLINEMETHOD hash_intersect_builder (
+                    TOtherRange         other_range
+                ,   THasher             hasher
+                ,   TEqual              equality
+                ,   hash_build_side     side
+                ) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (other_range))
+                ,   hasher      (std::move (hasher))
+                ,   equality    (std::move (equality))
+                ,   side        (side)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_intersect_builder (hash_intersect_builder const & v)
+                :   other_range (v.other_range)
+                ,   hasher      (v.hasher)
+                ,   equality    (v.equality)
+                ,   side        (v.side)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_intersect_builder (hash_intersect_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (v.other_range))
+                ,   hasher      (std::move (v.hasher))
+                ,   equality    (std::move (v.equality))
+                ,   side        (std::move (v.side))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD hash_intersect_range<TRange, TOtherRange, THasher, TEqual> build (TRange range) const
+            {
+                return hash_intersect_range<TRange, TOtherRange, THasher, TEqual> (std::move (range), other_range, hasher, equality, side);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // hash_except_range either puts other_range in its table and then adds
+        // the elements of range, yielding those that are new, or builds the
+        // table on the distinct elements of range, marks those found in
+        // other_range and yields the unmarked ones in first occurrence order
+        template<typename TRange, typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_except_range : base_range
+        {
+            typedef             hash_except_range<TRange, TOtherRange, THasher, TEqual> this_type   ;
+            typedef             TRange                                          range_type          ;
+            typedef             TOtherRange                                     other_range_type    ;
+
+            typedef    typename cleanup_type<typename TRange::value_type>::type value_type          ;
+            typedef             value_type const &                              return_type         ;
+            enum
+            {
+                returns_reference   = 1 ,
+            };
+
+            typedef             flat_hash_set<value_type, THasher, TEqual>      set_type            ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            set_type                    set                 ;
+            std::vector<bool>           found               ;
+            size_type                   current             ;
+            hash_build_side             side                ;
+            bool                        start               ;
+            bool                        built_on_range      ;
+
+            CPPLINQ_INLINEMETHOD hash_except_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                    ,   THasher             hasher
+                    ,   TEqual              equality
+                    ,   hash_build_side     side
+                )
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   set                 (std::move (hasher), std::move (equality))
+                ,   current             (invalid_size)
+                ,   side                (side)
+                ,   start               (true)
+                ,   built_on_range      (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_except_range (hash_except_range const & v)
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   set                 (v.set)
+                ,   found               (v.found)
+                ,   current             (v.current)
+                ,   side                (v.side)
+                ,   start               (v.start)
+                ,   built_on_range      (v.built_on_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_except_range (hash_except_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   set                 (std::move (v.set))
+                ,   found               (std::move (v.found))
+                ,   current             (std::move (v.current))
+                ,   side                (std::move (v.side))
+                ,   start               (std::move (v.start))
+                ,   built_on_range      (std::move (v.built_on_range))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (!start);
+                return set[current];
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                try
+                {
+                    if (start)
+                    {
+                        start           = false;
+                        built_on_range  = build_on_range (side, range, other_range);
+
+                        if (built_on_range)
+                        {
+                            insert_all (set, range);
+                            mark_found (set, found, other_range);
+                        }
+                        else
+                        {
+                            insert_all (set, other_range);
+                        }
+                    }
+
+                    if (built_on_range)
+                    {
+                        // current is invalid_size before the first call so current + 1U wraps to 0
+                        while (++current < set.size ())
+                        {
+                            if (!found[current])
+                            {
+                                return true;
+                            }
+                        }
+
+                        current = set.size ();
+                        return false;
+                    }
+
+                    while (range.next ())
+                    {
+                        auto result = set.insert (range.front ());
+                        if (result.second)
+                        {
+                            current = result.first;
+                            return true;
+                        }
+                    }
+                }
+                catch (operation_cancelled_exception const &)
+                {
+                    set.release ();
+                    release_buffer (found);
+                    throw;
+                }
+
+                return false;
+            }
+        };
+
+        template <typename TOtherRange, typename THasher, typename TEqual>
+        struct hash_except_builder : base_builder
+        {
+            typedef                 hash_except_builder<TOtherRange, THasher, TEqual>   this_type   ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+            THasher                 hasher              ;
+            TEqual                  equality            ;
+            hash_build_side         side                ;
+
+            CPPLINQ_INLINEMETHOD hash_except_builder (
+                    TOtherRange         other_range
+                ,   THasher             hasher
+                ,   TEqual              equality
+                ,   hash_build_side     side
+                ) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (other_range))
+                ,   hasher      (std::move (hasher))
+                ,   equality    (std::move (equality))
+                ,   side        (side)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_except_builder (hash_except_builder const & v)
+                :   other_range (v.other_range)
+                ,   hasher      (v.hasher)
+                ,   equality    (v.equality)
+                ,   side        (v.side)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_except_builder (hash_except_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range (std::move (v.other_range))
+                ,   hasher      (std::move (v.hasher))
+                ,   equality    (std::move (v.equality))
+                ,   side        (std::move (v.side))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD hash_except_range<TRange, TOtherRange, THasher, TEqual> build (TRange range) const
+            {
+                return hash_except_range<TRange, TOtherRange, THasher, TEqual> (std::move (range), other_range, hasher, equality, side);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // hash_group_range walks the rows of a key in a hash_index in the style
+        // of lookup::lookup_range. It points into the buffers of the index so
+        // it stays valid when the index is moved but not once it's gone.
+        template<typename TValue>
+        struct hash_group_range : base_range
+        {
+            typedef         hash_group_range<TValue>    this_type       ;
+
+            enum
+            {
+                returns_reference = 1 ,
+            };
+
+            typedef         TValue                      value_type      ;
+            typedef         value_type const &          return_type     ;
+
+            value_type const *      rows        ;
+            size_type const *       row_indices ;
+            size_type               iter        ;
+            size_type               end         ;
+            bool                    started     ;
+
+            CPPLINQ_INLINEMETHOD hash_group_range (
+                    value_type const *      rows
+                ,   size_type const *       row_indices
+                ,   size_type               iter
+                ,   size_type               end
+                ) CPPLINQ_NOEXCEPT
+                :   rows        (rows)
+                ,   row_indices (row_indices)
+                ,   iter        (iter)
+                ,   end         (end)
+                ,   started     (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_group_range (hash_group_range const & v) CPPLINQ_NOEXCEPT
+                :   rows        (v.rows)
+                ,   row_indices (v.row_indices)
+                ,   iter        (v.iter)
+                ,   end         (v.end)
+                ,   started     (v.started)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_group_range (hash_group_range && v) CPPLINQ_NOEXCEPT
+                :   rows        (std::move (v.rows))
+                ,   row_indices (std::move (v.row_indices))
+                ,   iter        (std::move (v.iter))
+                ,   end         (std::move (v.end))
+                ,   started     (std::move (v.started))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (started);
+                CPPLINQ_ASSERT (iter < end);
+
+                return rows[row_indices[iter]];
+            }
+
+            CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+            {
+                if (started && iter < end)
+                {
+                    ++iter;
+                }
+
+                started = true;
+
+                return iter < end;
+            }
+        };
+
+        // hash_index groups the rows of a range by key for the hash joins. The
+        // distinct keys are kept in a flat_hash_set and the rows in the order
+        // they came. row_indices lists the rows grouped by key, the rows of the
+        // key with index k are found from row_indices[offsets[k]] up to
+        // row_indices[offsets[k + 1U]] so duplicates need no chains of nodes.
+        //
+        // The optional bloom filter sets two bits per key in about a byte per
+        // key, keys that miss it are known not to be in the index without
+        // probing the table.
+        template<typename TKey, typename TValue, typename THasher, typename TEqual>
+        struct hash_index
+        {
+            typedef                 TKey                                key_type        ;
+            typedef                 TValue                              value_type      ;
+            typedef                 flat_hash_set<TKey, THasher, TEqual>    keys_type   ;
+
+            enum
+            {
+                size_type_bits  = sizeof (size_type) * CHAR_BIT ,
+            };
+
+            keys_type               keys        ;
+            std::vector<value_type> rows        ;
+            std::vector<size_type>  row_indices ;
+            std::vector<size_type>  offsets     ;
+            std::vector<size_type>  bloom       ;
+            size_type               bloom_shift ;
+
+            CPPLINQ_INLINEMETHOD hash_index (THasher hasher, TEqual equality)
+                :   keys        (std::move (hasher), std::move (equality))
+                ,   bloom_shift (0U)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_index (hash_index const & v)
+                :   keys        (v.keys)
+                ,   rows        (v.rows)
+                ,   row_indices (v.row_indices)
+                ,   offsets     (v.offsets)
+                ,   bloom       (v.bloom)
+                ,   bloom_shift (v.bloom_shift)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_index (hash_index && v) CPPLINQ_NOEXCEPT
+                :   keys        (std::move (v.keys))
+                ,   rows        (std::move (v.rows))
+                ,   row_indices (std::move (v.row_indices))
+                ,   offsets     (std::move (v.offsets))
+                ,   bloom       (std::move (v.bloom))
+                ,   bloom_shift (std::move (v.bloom_shift))
+            {
+            }
+
+            // cancellation is polled while range is pulled
+            template<typename TRange, typename TKeySelector>
+            CPPLINQ_METHOD void build (
+                    TRange &                    range
+                ,   TKeySelector &              key_selector
+                ,   probe_filter                filter
+                ,   cancellation_poll const &   cancellation
+                )
+            {
+                std::vector<size_type> key_indices;
+
+                auto capacity = get_reserve_capacity (range, 16U);
+                rows.reserve (capacity);
+                key_indices.reserve (capacity);
+
+                auto countdown = size_type (0U);
+                while (range.next ())
+                {
+                    cancellation.check_counted (countdown);
+                    rows.push_back (range.front ());
+                    auto result = keys.insert (key_selector (rows.back ()));
+                    key_indices.push_back (result.first);
+                }
+
+                // A counting sort of the row indices on key index keeps the rows
+                // of each key in the order they came
+                offsets.assign (keys.size () + 1U, 0U);
+                for (auto key_index : key_indices)
+                {
+                    ++offsets[key_index + 1U];
+                }
+
+                for (size_type iter = 1U; iter < offsets.size (); ++iter)
+                {
+                    offsets[iter] += offsets[iter - 1U];
+                }
+
+                row_indices.resize (rows.size ());
+                {
+                    std::vector<size_type> positions (offsets.begin (), offsets.end () - 1);
+                    for (size_type iter = 0U; iter < key_indices.size (); ++iter)
+                    {
+                        row_indices[positions[key_indices[iter]]++] = iter;
+                    }
+                }
+
+                if (filter == bloom_probe_filter)
+                {
+                    build_bloom ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool empty () const CPPLINQ_NOEXCEPT
+            {
+                return rows.empty ();
+            }
+
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD size_type hash_of (TOther const & key) const
+            {
+                return keys.hash_of (key);
+            }
+
+            // Returns false if no key with hash is in the index, true if one
+            // might be
+            CPPLINQ_INLINEMETHOD bool may_contain (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                if (bloom.empty ())
+                {
+                    return true;
+                }
+
+                auto first  = first_bit (hash);
+                auto second = second_bit (hash);
+
+                return
+                        (bloom[first / size_type_bits] & (static_cast<size_type> (1U) << (first % size_type_bits))) != 0U
+                    &&  (bloom[second / size_type_bits] & (static_cast<size_type> (1U) << (second % size_type_bits))) != 0U
+                    ;
+            }
+
+            CPPLINQ_INLINEMETHOD void prefetch (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                keys.prefetch (hash);
+            }
+
+            // Returns the index of key or invalid_size
+            template<typename TOther>
+            CPPLINQ_INLINEMETHOD size_type find_hashed (size_type hash, TOther const & key) const
+            {
+                return keys.find_hashed (hash, key);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type rows_begin (size_type key_index) const CPPLINQ_NOEXCEPT
+            {
+                return offsets[key_index];
+            }
+
+            CPPLINQ_INLINEMETHOD size_type rows_end (size_type key_index) const CPPLINQ_NOEXCEPT
+            {
+                return offsets[key_index + 1U];
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & row (size_type position) const CPPLINQ_NOEXCEPT
+            {
+                return rows[row_indices[position]];
+            }
+
+            typedef                 hash_group_range<TValue>    group_range     ;
+
+            // Returns the rows of the key with index key_index, no rows for
+            // invalid_size
+            CPPLINQ_INLINEMETHOD group_range group (size_type key_index) const CPPLINQ_NOEXCEPT
+            {
+                if (key_index == invalid_size)
+                {
+                    return group_range (rows.data (), row_indices.data (), 0U, 0U);
+                }
+
+                return group_range (rows.data (), row_indices.data (), rows_begin (key_index), rows_end (key_index));
+            }
+
+            CPPLINQ_INLINEMETHOD void release ()
+            {
+                keys.release ();
+                release_buffer (rows);
+                release_buffer (row_indices);
+                release_buffer (offsets);
+                release_buffer (bloom);
+            }
+
+        private:
+            // The two bits of a key are picked from the top bits of its hash
+            // times two large odd constants
+            CPPLINQ_INLINEMETHOD size_type first_bit (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                return (hash * static_cast<size_type> (0x9E3779B97F4A7C15ULL)) >> bloom_shift;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type second_bit (size_type hash) const CPPLINQ_NOEXCEPT
+            {
+                return (hash * static_cast<size_type> (0xC2B2AE3D27D4EB4FULL)) >> bloom_shift;
+            }
+
+            CPPLINQ_METHOD void build_bloom ()
+            {
+                // At least 8 bits per key and never less than a word
+                auto bits = static_cast<size_type> (6U);
+                while (bits < size_type_bits - 1U && (static_cast<size_type> (1U) << bits) < keys.size () * 8U)
+                {
+                    ++bits;
+                }
+
+                bloom_shift = size_type_bits - bits;
+                bloom.assign ((static_cast<size_type> (1U) << bits) / size_type_bits, 0U);
+
+                for (auto & s : keys.slots)
+                {
+                    if (s.index == invalid_size)
+                    {
+                        continue;
+                    }
+
+                    auto first  = first_bit (s.hash);
+                    auto second = second_bit (s.hash);
+                    bloom[first / size_type_bits]   |= static_cast<size_type> (1U) << (first % size_type_bits);
+                    bloom[second / size_type_bits]  |= static_cast<size_type> (1U) << (second % size_type_bits);
+                }
+            }
+        };
+
+        size_type const probe_batch_size = 32U;
+
+        // hash_join_range builds a hash_index on other_range and streams range.
+        // Keys of range are probed in batches, the keys and hashes of a batch
+        // are computed first and their slots prefetched, so that the cache
+        // misses of the batch overlap before the slots are searched.
+        //
+        // With a missing row it's a left join, elements of range without
+        // matches are combined with the missing row.
+        template<
+                typename TRange
+            ,   typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THasher
+            ,   typename TEqual
+            >
+        struct hash_join_range : base_range
+        {
+            static typename TRange::value_type      get_source ()               ;
+            static typename TOtherRange::value_type get_other_source ()         ;
+            static          TOtherKeySelector       get_other_key_selector ()   ;
+            static          TCombiner               get_combiner ()             ;
+
+            typedef         typename cleanup_type<typename TRange::value_type>::type        source_type         ;
+            typedef         typename cleanup_type<typename TOtherRange::value_type>::type   other_source_type   ;
+
+            typedef         decltype (get_other_key_selector () (get_other_source ()))
+                                                                                raw_other_key_type  ;
+            typedef         typename cleanup_type<raw_other_key_type>::type     other_key_type      ;
+
+            typedef         decltype (get_combiner () (get_source (), get_other_source ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type const &                          return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            typedef                 hash_join_range<
+                    TRange
+                ,   TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                ,   THasher
+                ,   TEqual
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef                 hash_index<
+                    other_key_type
+                ,   other_source_type
+                ,   THasher
+                ,   TEqual
+                >                                               index_type              ;
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            key_selector_type           key_selector        ;
+            other_key_selector_type     other_key_selector  ;
+            combiner_type               combiner            ;
+            probe_filter                filter              ;
+            opt<other_source_type>      missing             ;
+
+            bool                        start               ;
+            index_type                  index               ;
+
+            // The batch of range being probed
+            std::vector<source_type>    sources             ;
+            std::vector<other_key_type> keys                ;
+            std::vector<size_type>      hashes              ;
+            std::vector<size_type>      matches             ;
+            size_type                   position            ;
+            size_type                   row_position        ;
+            size_type                   row_end             ;
+
+            opt<value_type>             cache_value         ;
+
+            CPPLINQ_INLINEMETHOD hash_join_range (
+                    range_type              range
+                ,   other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ,   THasher                 hasher
+                ,   TEqual                  equality
+                ,   probe_filter            filter
+                ,   opt<other_source_type>  missing
+                )
+                :   range              (std::move (range))
+                ,   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   filter             (filter)
+                ,   missing            (std::move (missing))
+                ,   start              (true)
+                ,   index              (std::move (hasher), std::move (equality))
+                ,   position           (invalid_size)
+                ,   row_position       (0U)
+                ,   row_end            (0U)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_range (hash_join_range const & v)
+                :   range              (v.range)
+                ,   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   filter             (v.filter)
+                ,   missing            (v.missing)
+                ,   start              (v.start)
+                ,   index              (v.index)
+                ,   sources            (v.sources)
+                ,   keys               (v.keys)
+                ,   hashes             (v.hashes)
+                ,   matches            (v.matches)
+                ,   position           (v.position)
+                ,   row_position       (v.row_position)
+                ,   row_end            (v.row_end)
+                ,   cache_value        (v.cache_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_range (hash_join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   filter             (std::move (v.filter))
+                ,   missing            (std::move (v.missing))
+                ,   start              (std::move (v.start))
+                ,   index              (std::move (v.index))
+                ,   sources            (std::move (v.sources))
+                ,   keys               (std::move (v.keys))
+                ,   hashes             (std::move (v.hashes))
+                ,   matches            (std::move (v.matches))
+                ,   position           (std::move (v.position))
+                ,   row_position       (std::move (v.row_position))
+                ,   row_end            (std::move (v.row_end))
+                ,   cache_value        (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    try
+                    {
+                        index.build (other_range, other_key_selector, filter, cancellation_traits<TRange>::get (range));
+                    }
+                    catch (operation_cancelled_exception const &)
+                    {
+                        index.release ();
+                        throw;
+                    }
+                }
+
+                if (index.empty () && !missing)
+                {
+                    return false;
+                }
+
+                for (;;)
+                {
+                    if (row_position < row_end)
+                    {
+                        cache_value = combiner (sources[position], index.row (row_position));
+                        ++row_position;
+                        return true;
+                    }
+
+                    // position is invalid_size before the first call so position + 1U wraps to 0
+                    ++position;
+                    if (position >= sources.size ())
+                    {
+                        if (!probe_batch ())
+                        {
+                            cache_value.clear ();
+                            return false;
+                        }
+                        position = 0U;
+                    }
+
+                    auto key_index = matches[position];
+                    if (key_index != invalid_size)
+                    {
+                        row_position    = index.rows_begin (key_index);
+                        row_end         = index.rows_end (key_index);
+                    }
+                    else if (missing)
+                    {
+                        cache_value = combiner (sources[position], *missing);
+                        return true;
+                    }
+                }
+            }
+
+        private:
+            CPPLINQ_METHOD bool probe_batch ()
+            {
+                sources.clear ();
+                keys.clear ();
+                hashes.clear ();
+                matches.clear ();
+
+                while (sources.size () < probe_batch_size && range.next ())
+                {
+                    sources.push_back (range.front ());
+                    keys.push_back (other_key_type (key_selector (sources.back ())));
+
+                    auto hash = index.hash_of (keys.back ());
+                    hashes.push_back (hash);
+                    if (index.may_contain (hash))
+                    {
+                        index.prefetch (hash);
+                    }
+                }
+
+                for (size_type iter = 0U; iter < sources.size (); ++iter)
+                {
+                    auto hash = hashes[iter];
+                    matches.push_back (
+                            index.may_contain (hash)
+                        ?   index.find_hashed (hash, keys[iter])
+                        :   invalid_size
+                        );
+                }
+
+                return !sources.empty ();
+            }
+        };
+
+        template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THasher
+            ,   typename TEqual
+            >
+        struct hash_join_builder : base_builder
+        {
+            typedef                 hash_join_builder<
+                    TOtherRange
+                ,   TKeySelector
+                ,   TOtherKeySelector
+                ,   TCombiner
+                ,   THasher
+                ,   TEqual
+                >                                               this_type               ;
+
+            typedef                 TOtherRange                 other_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TOtherKeySelector           other_key_selector_type ;
+            typedef                 TCombiner                   combiner_type           ;
+            typedef        typename cleanup_type<typename TOtherRange::value_type>::type missing_type;
+
+            other_range_type        other_range         ;
+            key_selector_type       key_selector        ;
+            other_key_selector_type other_key_selector  ;
+            combiner_type           combiner            ;
+            THasher                 hasher              ;
+            TEqual                  equality            ;
+            probe_filter            filter              ;
+            opt<missing_type>       missing             ;
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (
+                    other_range_type        other_range
+                ,   key_selector_type       key_selector
+                ,   other_key_selector_type other_key_selector
+                ,   combiner_type           combiner
+                ,   THasher                 hasher
+                ,   TEqual                  equality
+                ,   probe_filter            filter
+                ,   opt<missing_type>       missing             = opt<missing_type> ()
+                )
+                :   other_range        (std::move (other_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   other_key_selector (std::move (other_key_selector))
+                ,   combiner           (std::move (combiner))
+                ,   hasher             (std::move (hasher))
+                ,   equality           (std::move (equality))
+                ,   filter             (filter)
+                ,   missing            (std::move (missing))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (hash_join_builder const & v)
+                :   other_range        (v.other_range)
+                ,   key_selector       (v.key_selector)
+                ,   other_key_selector (v.other_key_selector)
+                ,   combiner           (v.combiner)
+                ,   hasher             (v.hasher)
+                ,   equality           (v.equality)
+                ,   filter             (v.filter)
+                ,   missing            (v.missing)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD hash_join_builder (hash_join_builder && v) CPPLINQ_NOEXCEPT
+                :   other_range        (std::move (v.other_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   other_key_selector (std::move (v.other_key_selector))
+                ,   combiner           (std::move (v.combiner))
+                ,   hasher             (std::move (v.hasher))
+                ,   equality           (std::move (v.equality))
+                ,   filter             (std::move (v.filter))
+                ,   missing            (std::move (v.missing))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD hash_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner, THasher, TEqual> build (TRange range) const
+            {
+                return hash_join_range<TRange, TOtherRange, TKeySelector, TOtherKeySelector, TCombiner, THasher, TEqual> (
+                        std::move (range)
+                    ,   other_range
+                    ,   key_selector
+                    ,   other_key_selector
+                    ,   combiner
+                    ,   hasher
+                    ,   equality
+                    ,   filter
+                    ,   missing
+                    );
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // group_join_range builds a hash_index on inner_range once and streams
+        // range, each element is passed to the result selector with the
+        // hash_group_range of its matches
+        template<
+                typename TRange
+            ,   typename TInnerRange
+            ,   typename TKeySelector
+            ,   typename TInnerKeySelector
+            ,   typename TResultSelector
+            ,   typename THasher
+            ,   typename TEqual
+            >
+        struct group_join_range : base_range
+        {
+            typedef         typename cleanup_type<typename TRange::value_type>::type        source_type         ;
+            typedef         typename cleanup_type<typename TInnerRange::value_type>::type   inner_source_type   ;
+
+            static          source_type             get_source ()               ;
+            static          inner_source_type       get_inner_source ()         ;
+            static          TInnerKeySelector       get_inner_key_selector ()   ;
+            static          TResultSelector         get_result_selector ()      ;
+
+            typedef         decltype (get_inner_key_selector () (get_inner_source ()))
+                                                                                raw_inner_key_type  ;
+            typedef         typename cleanup_type<raw_inner_key_type>::type     inner_key_type      ;
+
+            typedef                 hash_index<
+                    inner_key_type
+                ,   inner_source_type
+                ,   THasher
+                ,   TEqual
+                >                                               index_type              ;
+            typedef         typename index_type::group_range    group_range_type        ;
+
+            static          group_range_type        get_group ()                ;
+
+            typedef         decltype (get_result_selector () (get_source (), get_group ()))
+                                                                                raw_value_type  ;
+            typedef         typename cleanup_type<raw_value_type>::type         value_type      ;
+            typedef                 value_type const &                          return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            typedef                 group_join_range<
+                    TRange
+                ,   TInnerRange
+                ,   TKeySelector
+                ,   TInnerKeySelector
+                ,   TResultSelector
+                ,   THasher
+                ,   TEqual
+                >                                               this_type               ;
+            typedef                 TRange                      range_type              ;
+            typedef                 TInnerRange                 inner_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TInnerKeySelector           inner_key_selector_type ;
+            typedef                 TResultSelector             result_selector_type    ;
+
+            range_type                  range               ;
+            inner_range_type            inner_range         ;
+            key_selector_type           key_selector        ;
+            inner_key_selector_type     inner_key_selector  ;
+            result_selector_type        result_selector     ;
+
+            bool                        start               ;
+            index_type                  index               ;
+
+            opt<value_type>             cache_value         ;
+
+            CPPLINQ_INLINEMETHOD group_join_range (
+                    range_type              range
+                ,   inner_range_type        inner_range
+                ,   key_selector_type       key_selector
+                ,   inner_key_selector_type inner_key_selector
+                ,   result_selector_type    result_selector
+                ,   THasher                 hasher
+                ,   TEqual                  equality
+                )
+                :   range              (std::move (range))
+                ,   inner_range        (std::move (inner_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   inner_key_selector (std::move (inner_key_selector))
+                ,   result_selector    (std::move (result_selector))
+                ,   start              (true)
+                ,   index              (std::move (hasher), std::move (equality))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD group_join_range (group_join_range const & v)
+                :   range              (v.range)
+                ,   inner_range        (v.inner_range)
+                ,   key_selector       (v.key_selector)
+                ,   inner_key_selector (v.inner_key_selector)
+                ,   result_selector    (v.result_selector)
+                ,   start              (v.start)
+                ,   index              (v.index)
+                ,   cache_value        (v.cache_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD group_join_range (group_join_range && v) CPPLINQ_NOEXCEPT
+                :   range              (std::move (v.range))
+                ,   inner_range        (std::move (v.inner_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   inner_key_selector (std::move (v.inner_key_selector))
+                ,   result_selector    (std::move (v.result_selector))
+                ,   start              (std::move (v.start))
+                ,   index              (std::move (v.index))
+                ,   cache_value        (std::move (v.cache_value))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (start)
+                {
+                    start = false;
+                    try
+                    {
+                        index.build (inner_range, inner_key_selector, no_probe_filter, cancellation_traits<TRange>::get (range));
+                    }
+                    catch (operation_cancelled_exception const &)
+                    {
+                        index.release ();
+                        throw;
+                    }
+                }
+
+                if (!range.next ())
+                {
+                    cache_value.clear ();
+                    return false;
+                }
+
+                auto && value = range.front ();
+                inner_key_type key (key_selector (value));
+
+                auto key_index = index.empty ()
+                    ?   invalid_size
+                    :   index.find_hashed (index.hash_of (key), key)
+                    ;
+
+                cache_value = result_selector (value, index.group (key_index));
+
+                return true;
+            }
+        };
+
+        template<
+                typename TInnerRange
+            ,   typename TKeySelector
+            ,   typename TInnerKeySelector
+            ,   typename TResultSelector
+            ,   typename THasher
+            ,   typename TEqual
+            >
+        struct group_join_builder : base_builder
+        {
+            typedef                 group_join_builder<
+                    TInnerRange
+                ,   TKeySelector
+                ,   TInnerKeySelector
+                ,   TResultSelector
+                ,   THasher
+                ,   TEqual
+                >                                               this_type               ;
+
+            typedef                 TInnerRange                 inner_range_type        ;
+            typedef                 TKeySelector                key_selector_type       ;
+            typedef                 TInnerKeySelector           inner_key_selector_type ;
+            typedef                 TResultSelector             result_selector_type    ;
+
+            inner_range_type        inner_range         ;
+            key_selector_type       key_selector        ;
+            inner_key_selector_type inner_key_selector  ;
+            result_selector_type    result_selector     ;
+            THasher                 hasher              ;
+            TEqual                  equality            ;
+
+            CPPLINQ_INLINEMETHOD group_join_builder (
+                    inner_range_type        inner_range
+                ,   key_selector_type       key_selector
+                ,   inner_key_selector_type inner_key_selector
+                ,   result_selector_type    result_selector
+                ,   THasher                 hasher
+                ,   TEqual                  equality
+                ) CPPLINQ_NOEXCEPT
+                :   inner_range        (std::move (inner_range))
+                ,   key_selector       (std::move (key_selector))
+                ,   inner_key_selector (std::move (inner_key_selector))
+                ,   result_selector    (std::move (result_selector))
+                ,   hasher             (std::move (hasher))
+                ,   equality           (std::move (equality))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD group_join_builder (group_join_builder const & v)
+                :   inner_range        (v.inner_range)
+                ,   key_selector       (v.key_selector)
+                ,   inner_key_selector (v.inner_key_selector)
+                ,   result_selector    (v.result_selector)
+                ,   hasher             (v.hasher)
+                ,   equality           (v.equality)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD group_join_builder (group_join_builder && v) CPPLINQ_NOEXCEPT
+                :   inner_range        (std::move (v.inner_range))
+                ,   key_selector       (std::move (v.key_selector))
+                ,   inner_key_selector (std::move (v.inner_key_selector))
+                ,   result_selector    (std::move (v.result_selector))
+                ,   hasher             (std::move (v.hasher))
+                ,   equality           (std::move (v.equality))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD group_join_range<TRange, TInnerRange, TKeySelector, TInnerKeySelector, TResultSelector, THasher, TEqual> build (TRange range) const
+            {
+                return group_join_range<TRange, TInnerRange, TKeySelector, TInnerKeySelector, TResultSelector, THasher, TEqual> (
+                        std::move (range)
+                    ,   inner_range
+                    ,   key_selector
+                    ,   inner_key_selector
+                    ,   result_selector
+                    ,   hasher
+                    ,   equality
+                    );
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // concat_sink hands values of either range on as the return_type of
+        // the concat_range
+        template<typename TSink, typename TReturn>
+        struct concat_sink
+        {
+            TSink &                 sink        ;
+
+            CPPLINQ_CONSTEXPR explicit concat_sink (TSink & sink) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_CONSTEXPR bool operator() (TValue && v)
+            {
+                return sink (static_cast<TReturn> (std::forward<TValue> (v)));
+            }
+        };
+
+        template<typename TRange, typename TOtherRange>
+        struct concat_range : base_range
+        {
+            typedef             concat_range<TRange, TOtherRange>                       this_type           ;
+            typedef             TRange                                                  range_type          ;
+            typedef             TOtherRange                                             other_range_type    ;
+
+            typedef typename    cleanup_type<typename TRange::value_type>::type         value_type          ;
+            typedef typename    cleanup_type<typename TOtherRange::value_type>::type    other_value_type    ;
+
+            enum
+            {
+                // References are passed through when both ranges agree on them
+                returns_reference   =
+                        TRange::returns_reference
+                    &&  TOtherRange::returns_reference
+                    &&  std::is_same<value_type, other_value_type>::value
+                    ,
+                supports_push       = 1 ,
+            };
+
+            typedef typename    std::conditional<
+                    returns_reference
+                ,   value_type const &
+                ,   value_type
+                >::type                                                                 return_type         ;
+
+            enum state
+            {
+                state_initial                   ,
+                state_iterating_range           ,
+                state_iterating_other_range     ,
+                state_end                       ,
+            };
+
+            range_type                  range               ;
+            other_range_type            other_range         ;
+            state                       state               ;
+
+            CPPLINQ_INLINEMETHOD concat_range (
+                        range_type          range
+                    ,   other_range_type    other_range
+                ) CPPLINQ_NOEXCEPT
+                :   range               (std::move (range))
+                ,   other_range         (std::move (other_range))
+                ,   state               (state_initial)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_range (concat_range const & v) CPPLINQ_NOEXCEPT
+                :   range               (v.range)
+                ,   other_range         (v.other_range)
+                ,   state               (v.state)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_range (concat_range && v) CPPLINQ_NOEXCEPT
+                :   range               (std::move (v.range))
+                ,   other_range         (std::move (v.other_range))
+                ,   state               (std::move (v.state))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                switch (state)
+                {
+                case state_initial:
+                case state_end:
+                default:
+                    CPPLINQ_ASSERT (false);       // Intentionally falls through
+                case state_iterating_range:
+                    return range.front ();
+                case state_iterating_other_range:
+                    return other_range.front ();
+                };
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                switch (state)
+                {
+                case state_initial:
+                    if (range.next ())
+                    {
+                        state = state_iterating_range;
+                        return true;
+                    }
+
+                    if (other_range.next ())
+                    {
+                        state = state_iterating_other_range;
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_iterating_range:
+                    if (range.next ())
+                    {
+                        return true;
+                    }
+
+                    if (other_range.next ())
+                    {
+                        state = state_iterating_other_range;
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_iterating_other_range:
+                    if (other_range.next ())
+                    {
+                        return true;
+                    }
+
+                    state = state_end;
+                    return false;
+                case state_end:
+                default:
+                    return false;
+                }
+            }
+
+            template<typename TSink>
+            CPPLINQ_CONSTEXPR bool push (TSink & sink)
+            {
+                concat_sink<TSink, return_type> s (sink);
+
+                switch (state)
+                {
+                case state_initial:
+                case state_iterating_range:
+                    state = state_iterating_range;
+                    if (!push_traits<TRange>::push (range, s))
+                    {
+                        return false;
+                    }
+                    state = state_iterating_other_range;
+                    // Intentionally falls through
+                case state_iterating_other_range:
+                    if (!push_traits<TOtherRange>::push (other_range, s))
+                    {
+                        return false;
+                    }
+                    state = state_end;
+                    return true;
+                case state_end:
+                default:
+                    return true;
+                }
+            }
+        };
+
+        template <typename TOtherRange>
+        struct concat_builder : base_builder
+        {
+            typedef                 concat_builder<TOtherRange>             this_type       ;
+            typedef                 TOtherRange                             other_range_type;
+
+            other_range_type        other_range         ;
+
+            CPPLINQ_INLINEMETHOD concat_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
+                : other_range (std::move (other_range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_builder (concat_builder const & v) CPPLINQ_NOEXCEPT
+                : other_range (v.other_range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD concat_builder (concat_builder && v) CPPLINQ_NOEXCEPT
+                : other_range (std::move (v.other_range))
+            {
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD concat_range<TRange, TOtherRange> build (TRange range) const
+            {
+                return concat_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+        // token_condition and deadline_condition tell a cancellation_range when
+        // to give up, both are safe to call from several threads at once
+        struct token_condition
+        {
+            cancellation_token const *  token   ;
+
+            CPPLINQ_INLINEMETHOD explicit token_condition (cancellation_token const & token) CPPLINQ_NOEXCEPT
+                :   token   (std::addressof (token))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD bool operator() () const CPPLINQ_NOEXCEPT
+            {
+                return token->is_cancelled ();
+            }
+        };
+
+        template<typename TClock, typename TDuration>
+        struct deadline_condition
+        {
+            typedef                 std::chrono::time_point<TClock, TDuration>  time_point_type ;
+
+            time_point_type         deadline    ;
+
+            CPPLINQ_INLINEMETHOD explicit deadline_condition (time_point_type deadline) CPPLINQ_NOEXCEPT
+                :   deadline    (deadline)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD bool operator() () const
+            {
+                return TClock::now () >= deadline;
+            }
+        };
+
+        template<typename TSink, typename TOwner>
+        struct cancellation_sink
+        {
+            TSink &                 sink        ;
+            TOwner &                owner       ;
+
+            CPPLINQ_INLINEMETHOD cancellation_sink (TSink & sink, TOwner & owner) CPPLINQ_NOEXCEPT
+                :   sink        (sink)
+                ,   owner       (owner)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue && v)
+            {
+                owner.check (1U);
+                return sink (std::forward<TValue> (v));
+            }
+        };
+
+        // cancellation_range throws operation_cancelled_exception once its
+        // condition holds. The condition is checked before the first element
+        // and then once every batch_size elements, split parts check on their
+        // own so parallel workers stop as well. An orderby or thenby right in
+        // front of it is handed the condition so the sort polls it too.
+        template<typename TRange, typename TCondition>
+        struct cancellation_range : base_range
+        {
+            typedef                 batch_traits<TRange>                source_traits   ;
+            typedef        typename TRange::value_type                  value_type      ;
+            typedef        typename TRange::return_type                 return_type     ;
+            typedef        typename source_traits::batch_type           batch_type      ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference     ,
+                supports_batch      = source_traits::is_native      ,
+                prefers_batch       = source_traits::prefers_batch  ,
+                size_hint_kind      = size_hint_traits<TRange>::kind,
+                supports_push       = 1                             ,
+                supports_split      = split_traits<TRange>::is_native,
+                supports_cancellation = 1                           ,
+            };
+
+            typedef                 cancellation_range<TRange, TCondition>  this_type   ;
+            typedef                 TRange                              range_type      ;
+            typedef                 TCondition                          condition_type  ;
+            typedef                 cancellation_range<
+                    typename split_traits<TRange>::split_type
+                ,   TCondition
+                >                                                       split_type      ;
+
+            range_type              range       ;
+            condition_type          condition   ;
+            size_type               countdown   ;
+
+            CPPLINQ_INLINEMETHOD cancellation_range (
+                    range_type      range
+                ,   condition_type  condition
+                ) CPPLINQ_NOEXCEPT
+                :   range       (std::move (range))
+                ,   condition   (std::move (condition))
+                ,   countdown   (0U)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD cancellation_range (cancellation_range const & v)
+                :   range       (v.range)
+                ,   condition   (v.condition)
+                ,   countdown   (v.countdown)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD cancellation_range (cancellation_range && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   condition   (std::move (v.condition))
+                ,   countdown   (std::move (v.countdown))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return range.front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                check (1U);
+                attach_sort ();
+                return range.next ();
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                return size_hint_traits<TRange>::size_hint (range);
+            }
+
+            template<typename TSink>
+            CPPLINQ_INLINEMETHOD bool push (TSink & sink)
+            {
+                check (0U);
+                attach_sort ();
+
+                cancellation_sink<TSink, this_type> s (sink, *this);
+                return push_traits<TRange>::push (range, s);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type next_batch (batch_type * batch, size_type capacity)
+            {
+                check (capacity);
+                attach_sort ();
+                return source_traits::next_batch (range, batch, capacity);
+            }
+
+            static CPPLINQ_INLINEMETHOD typename source_traits::return_type batch_value (batch_type const & v)
+            {
+                return source_traits::batch_value (v);
+            }
+
+            CPPLINQ_INLINEMETHOD size_type split_size () const CPPLINQ_NOEXCEPT
+            {
+                return range.split_size ();
+            }
+
+            CPPLINQ_INLINEMETHOD split_type split (size_type count)
+            {
+                return split_type (range.split (count), condition);
+            }
+
+            // Counts count elements against the countdown, the condition is
+            // only evaluated when the countdown runs out
+            CPPLINQ_INLINEMETHOD void check (size_type count)
+            {
+                if (count < countdown)
+                {
+                    countdown -= count;
+                    return;
+                }
+
+                if (condition ())
+                {
+                    throw operation_cancelled_exception ();
+                }
+
+                countdown = batch_size;
+            }
+
+            CPPLINQ_INLINEMETHOD cancellation_poll get_cancellation () const CPPLINQ_NOEXCEPT
+            {
+                return cancellation_poll (condition);
+            }
+
+        private:
+            // Attached on every call as the poll refers to condition, which
+            // moves along with this range
+            CPPLINQ_INLINEMETHOD void attach_sort () CPPLINQ_NOEXCEPT
+            {
+                attach_sort (std::is_base_of<sorting_range, TRange> ());
+            }
+
+            CPPLINQ_INLINEMETHOD void attach_sort (std::true_type) CPPLINQ_NOEXCEPT
+            {
+                range.set_cancellation (get_cancellation ());
+            }
+
+            CPPLINQ_INLINEMETHOD void attach_sort (std::false_type) CPPLINQ_NOEXCEPT
+            {
+            }
+        };
+
+        template<typename TCondition>
+        struct cancellation_builder : base_builder
+        {
+            typedef                 cancellation_builder<TCondition>    this_type       ;
+            typedef                 TCondition                          condition_type  ;
+
+            condition_type          condition   ;
+
+            CPPLINQ_INLINEMETHOD explicit cancellation_builder (condition_type condition) CPPLINQ_NOEXCEPT
+                :   condition   (std::move (condition))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD cancellation_builder (cancellation_builder const & v)
+                :   condition   (v.condition)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD cancellation_builder (cancellation_builder && v) CPPLINQ_NOEXCEPT
+                :   condition   (std::move (v.condition))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD cancellation_range<TRange, TCondition> build (TRange range) const
+            {
+                return cancellation_range<TRange, TCondition> (std::move (range), condition);
+            }
+        };
+
+        // -------------------------------------------------------------------------
+
+#ifndef CPPLINQ_NO_PARALLEL
+        // async_buffer_state runs a range on a thread of its own and hands the
+        // elements over through a ring of at least capacity slots, a power of
+        // two so that positions wrap with a mask. The producer only
+        // writes tail and the consumer only writes head so the ring needs no
+        // lock. The consumer reads elements in place and gives slots back in
+        // batches, each side rereads the index of the other only when it ran
+        // out of elements or slots. A side that finds the ring full or empty
+        // spins a little and then sleeps; the other side only takes the lock
+        // to wake it when it announced that it sleeps.
+        template<typename TRange>
+        struct async_buffer_state
+        {
+            typedef                 TRange                                  range_type      ;
+            typedef     typename    cleanup_type<typename TRange::value_type>::type value_type;
+
+            range_type                  range               ;
+            size_type                   capacity            ;
+            std::vector<opt<value_type>> slots              ;
+            size_type                   mask                ;
+            size_type                   batch               ;
+            std::atomic<size_type>      head                ;   // Slots given back by the consumer
+            std::atomic<size_type>      tail                ;   // Elements put by the producer
+            std::atomic<bool>           finished            ;
+            std::atomic<bool>           cancelled           ;
+            std::atomic<bool>           consumer_sleeps     ;
+            std::atomic<bool>           producer_sleeps     ;
+            std::exception_ptr          error               ;
+            std::mutex                  sleep_lock          ;
+            std::condition_variable     sleep_signal        ;
+
+            // Only used by the consumer
+            size_type                   position            ;   // The element front () returns
+            size_type                   available           ;   // tail as last read
+            bool                        has_current         ;
+
+            std::thread                 producer            ;
+
+            CPPLINQ_INLINEMETHOD async_buffer_state (range_type range, size_type capacity)
+                :   range           (std::move (range))
+                ,   capacity        (capacity)
+                ,   mask            (0U)
+                ,   batch           (1U)
+                ,   head            (0U)
+                ,   tail            (0U)
+                ,   finished        (false)
+                ,   cancelled       (false)
+                ,   consumer_sleeps (false)
+                ,   producer_sleeps (false)
+                ,   position        (0U)
+                ,   available       (0U)
+                ,   has_current     (false)
+            {
+            }
+
+            // Stops the producer when the consumer is done with the range before
+            // the end, the producer finishes the element it's on first
+            CPPLINQ_INLINEMETHOD ~async_buffer_state () CPPLINQ_NOEXCEPT
+            {
+                if (started ())
+                {
+                    cancelled = true;
+                    wake (producer_sleeps);
+                    producer.join ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool started () const CPPLINQ_NOEXCEPT
+            {
+                return producer.joinable ();
+            }
+
+            CPPLINQ_METHOD void start ()
+            {
+                slots.resize (round_up (capacity));
+                mask    = slots.size () - 1U;
+                batch   = slots.size () > 4U ? slots.size () / 4U : 1U;
+
+                producer = std::thread (&async_buffer_state::produce, this);
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & front () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (has_current);
+                return slots[position & mask].get ();
+            }
+
+            // Moves on to the next element, false at the end of the range. An
+            // exception thrown by the range is rethrown here.
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (has_current)
+                {
+                    slots[position & mask].clear ();
+                    ++position;
+                    has_current = false;
+
+                    // The current element keeps its slot until the next call
+                    if (position - head.load (std::memory_order_relaxed) >= batch)
+                    {
+                        give_back ();
+                    }
+                }
+
+                if (position == available)
+                {
+                    give_back ();
+
+                    auto taken = position;
+                    wait (consumer_sleeps, [&] () {return tail.load () != taken || finished.load ();});
+
+                    available = tail.load ();
+                    if (available == position)
+                    {
+                        if (error)
+                        {
+                            auto e = error;
+                            error = nullptr;
+                            std::rethrow_exception (e);
+                        }
+                        return false;
+                    }
+                }
+
+                has_current = true;
+                return true;
+            }
+
+        private:
+            async_buffer_state (async_buffer_state const &);
+            async_buffer_state & operator= (async_buffer_state const &);
+
+            static CPPLINQ_INLINEMETHOD size_type round_up (size_type capacity) CPPLINQ_NOEXCEPT
+            {
+                size_type size = 1U;
+                while (size < capacity)
+                {
+                    size *= 2U;
+                }
+                return size;
+            }
+
+            CPPLINQ_INLINEMETHOD void give_back ()
+            {
+                if (head.load (std::memory_order_relaxed) != position)
+                {
+                    head.store (position);
+                    wake (producer_sleeps);
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD void produce () CPPLINQ_NOEXCEPT
+            {
+                try
+                {
+                    auto put    = tail.load (std::memory_order_relaxed);
+                    auto free   = head.load () + slots.size ();
+                    while (!cancelled.load () && range.next ())
+                    {
+                        if (put == free)
+                        {
+                            wait (producer_sleeps, [&] () {return head.load () + slots.size () != put || cancelled.load ();});
+                            if (cancelled.load ())
+                            {
+                                break;
+                            }
+                            free = head.load () + slots.size ();
+                        }
+
+                        slots[put & mask] = range.front ();
+
+                        ++put;
+                        tail.store (put);
+                        wake (consumer_sleeps);
+                    }
+                }
+                catch (...)
+                {
+                    error = std::current_exception ();
+                }
+
+                finished = true;
+                wake (consumer_sleeps);
+            }
+
+            template<typename TCondition>
+            CPPLINQ_INLINEMETHOD void wait (std::atomic<bool> & sleeps, TCondition condition)
+            {
+                for (auto spin = 0U; spin < 64U; ++spin)
+                {
+                    if (condition ())
+                    {
+                        return;
+                    }
+                    std::this_thread::yield ();
+                }
+
+                std::unique_lock<std::mutex> guard (sleep_lock);
+                sleeps = true;
+                sleep_signal.wait (guard, condition);
+                sleeps = false;
+            }
+
+            CPPLINQ_INLINEMETHOD void wake (std::atomic<bool> & sleeps)
+            {
+                if (sleeps.load ())
+                {
+                    std::lock_guard<std::mutex> guard (sleep_lock);
+                    sleep_signal.notify_all ();
+                }
+            }
+        };
+
+        // async_buffer_range runs the range before it on a thread of its own,
+        // up to capacity elements ahead of the ranges after it. The thread is
+        // started by the first call to next () and stopped when the range is
+        // destroyed. The range may be copied until next () is called, the
+        // state is held on the heap so moving the range is cheap.
+        template<typename TRange>
+        struct async_buffer_range : base_range
+        {
+            typedef                 async_buffer_range<TRange>              this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 async_buffer_state<TRange>              state_type      ;
+
+            typedef     typename    state_type::value_type                  value_type      ;
+            typedef                 value_type const &                      return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            std::unique_ptr<state_type> state       ;
+            bool                        done        ;
+
+            CPPLINQ_INLINEMETHOD async_buffer_range (
+                    range_type      range
+                ,   size_type       capacity
+                )
+                :   state       (new state_type (std::move (range), capacity))
+                ,   done        (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD async_buffer_range (async_buffer_range const & v)
+                :   state       (copy_state (v))
+                ,   done        (v.done)
+            {
+            }
+
+            // Once started the producer thread advances the range, copying it
+            // then would race with the thread
+            static CPPLINQ_INLINEMETHOD state_type * copy_state (async_buffer_range const & v)
+            {
+                if (!v.state)
+                {
+                    return nullptr;
+                }
+
+                if (v.state->started ())
+                {
+                    throw programming_error_exception ();
+                }
+
+                return new state_type (v.state->range, v.state->capacity);
+            }
+
+            CPPLINQ_INLINEMETHOD async_buffer_range (async_buffer_range && v) CPPLINQ_NOEXCEPT
+                :   state       (std::move (v.state))
+                ,   done        (std::move (v.done))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return state->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (done)
+                {
+                    return false;
+                }
+
+                if (!state->started ())
+                {
+                    state->start ();
+                }
+
+                try
+                {
+                    if (state->next ())
+                    {
+                        return true;
+                    }
+                }
+                catch (...)
+                {
+                    done = true;
+                    state.reset ();
+                    throw;
+                }
+
+                // The thread is done, there's no need to wait for the destructor
+                done = true;
+                state.reset ();
+                return false;
+            }
+        };
+
+        struct async_buffer_builder : base_builder
+        {
+            typedef                 async_buffer_builder                    this_type       ;
+
+            size_type               capacity    ;
+
+            CPPLINQ_INLINEMETHOD explicit async_buffer_builder (size_type capacity) CPPLINQ_NOEXCEPT
+                :   capacity    (capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD async_buffer_builder (async_buffer_builder const & v) CPPLINQ_NOEXCEPT
+                :   capacity    (v.capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD async_buffer_builder (async_buffer_builder && v) CPPLINQ_NOEXCEPT
+                :   capacity    (std::move (v.capacity))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD async_buffer_range<TRange> build (TRange range) const
+            {
+                return async_buffer_range<TRange> (std::move (range), capacity);
+            }
+        };
+
+        // par_select_state maps a range on an executor while the range itself
+        // is read on the consumer's thread. The window is split in chunks of
+        // adjacent elements, each chunk is selected by one task. Chunks are
+        // posted and consumed in order so results come out in source order,
+        // a chunk is refilled from the range once all of it is consumed. When
+        // the selector throws the elements before come out first.
+        template<typename TRange, typename TSelector>
+        struct par_select_state
+        {
+            typedef                 TRange                                          range_type      ;
+            typedef                 TSelector                                       selector_type   ;
+            typedef     typename    cleanup_type<typename TRange::value_type>::type source_type     ;
+
+            static source_type      get_source ();
+            static selector_type    get_selector ();
+
+            typedef     typename    cleanup_type<decltype (get_selector ()(get_source ()))>::type value_type;
+
+            struct chunk : executor_task
+            {
+                par_select_state *  owner       ;
+                size_type           begin       ;
+                size_type           count       ;
+                size_type           selected    ;
+
+                CPPLINQ_INLINEMETHOD chunk () CPPLINQ_NOEXCEPT
+                    :   owner       (nullptr)
+                    ,   begin       (0U)
+                    ,   count       (0U)
+                    ,   selected    (0U)
+                {
+                }
+
+                virtual void execute ()
+                {
+                    for (selected = 0U; selected < count; ++selected)
+                    {
+                        owner->select (begin + selected);
+                    }
+                }
+            };
+
+            range_type                      range           ;
+            selector_type                   selector        ;
+            executor &                      pool            ;
+            size_type                       window          ;
+
+            std::vector<opt<source_type>>   sources         ;
+            std::vector<opt<value_type>>    values          ;
+            std::unique_ptr<chunk[]>        chunks          ;
+            size_type                       chunk_count     ;
+            size_type                       first           ;   // The oldest chunk in flight
+            size_type                       posted          ;   // Chunks in flight
+            size_type                       position        ;   // Within the oldest chunk
+            bool                            has_current     ;
+            bool                            exhausted       ;
+            std::exception_ptr              error           ;
+
+            CPPLINQ_INLINEMETHOD par_select_state (
+                    range_type      range
+                ,   selector_type   selector
+                ,   executor &      pool
+                ,   size_type       window
+                )
+                :   range           (std::move (range))
+                ,   selector        (std::move (selector))
+                ,   pool            (pool)
+                ,   window          (window > 0U ? window : 1U)
+                ,   chunk_count     (0U)
+                ,   first           (0U)
+                ,   posted          (0U)
+                ,   position        (0U)
+                ,   has_current     (false)
+                ,   exhausted       (false)
+            {
+            }
+
+            // Chunks still in flight when the consumer stops early are waited
+            // for, what they throw is of no interest anymore
+            CPPLINQ_INLINEMETHOD ~par_select_state () CPPLINQ_NOEXCEPT
+            {
+                for (auto index = 0U; index < posted; ++index)
+                {
+                    try
+                    {
+                        pool.wait (chunks[(first + index) % chunk_count]);
+                    }
+                    catch (...)
+                    {
+                    }
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD bool started () const CPPLINQ_NOEXCEPT
+            {
+                return chunks != nullptr;
+            }
+
+            // A few chunks per thread, so that threads that are done with one
+            // chunk find another while the consumer works through the oldest
+            CPPLINQ_METHOD void start ()
+            {
+                auto chunk_size = (std::max) (window / (4U * pool.concurrency ()), static_cast<size_type> (1U));
+                chunk_count     = (std::max) (window / chunk_size, static_cast<size_type> (1U));
+
+                sources.resize (chunk_count * chunk_size);
+                values.resize (chunk_count * chunk_size);
+                chunks.reset (new chunk[chunk_count]);
+
+                for (auto index = 0U; index < chunk_count; ++index)
+                {
+                    chunks[index].owner = this;
+                    chunks[index].begin = index * chunk_size;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD value_type const & front () const CPPLINQ_NOEXCEPT
+            {
+                CPPLINQ_ASSERT (has_current);
+                return values[chunks[first].begin + position].get ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (has_current)
+                {
+                    values[chunks[first].begin + position].clear ();
+                    has_current = false;
+
+                    if (++position == chunks[first].count)
+                    {
+                        first       = (first + 1U) % chunk_count;
+                        position    = 0U;
+                        --posted;
+                    }
+                }
+
+                if (position == 0U)
+                {
+                    if (error)
+                    {
+                        auto e = error;
+                        error = nullptr;
+                        std::rethrow_exception (e);
+                    }
+
+                    post ();
+                    if (posted == 0U)
+                    {
+                        return false;
+                    }
+
+                    wait_for_first ();
+                }
+
+                has_current = true;
+                return true;
+            }
+
+        private:
+            par_select_state (par_select_state const &);
+            par_select_state & operator= (par_select_state const &);
+
+            // Fills the free chunks from the range and posts them
+            CPPLINQ_METHOD void post ()
+            {
+                auto chunk_size = sources.size () / chunk_count;
+                while (!exhausted && posted < chunk_count)
+                {
+                    auto & c = chunks[(first + posted) % chunk_count];
+
+                    c.count = 0U;
+                    while (c.count < chunk_size)
+                    {
+                        if (!range.next ())
+                        {
+                            exhausted = true;
+                            break;
+                        }
+
+                        sources[c.begin + c.count] = range.front ();
+                        ++c.count;
+                    }
+
+                    if (c.count == 0U)
+                    {
+                        return;
+                    }
+
+                    c.reset ();
+                    ++posted;
+                    pool.post (c);
+                }
+            }
+
+            // The elements a failed chunk selected are consumed before its
+            // exception is rethrown
+            CPPLINQ_METHOD void wait_for_first ()
+            {
+                auto & c = chunks[first];
+                try
+                {
+                    pool.wait (c);
+                }
+                catch (...)
+                {
+                    if (c.selected == 0U)
+                    {
+                        throw;
+                    }
+
+                    c.count = c.selected;
+                    error   = std::current_exception ();
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD void select (size_type index)
+            {
+                values[index] = selector (sources[index].get ());
+                sources[index].clear ();
+            }
+        };
+
+        // par_select_range is select with the selector running on an executor,
+        // up to window elements ahead of the ranges after it. It reads the range
+        // before it as it goes so it works for endless ranges too, and keeps
+        // the order of the elements. The range may be copied until next () is
+        // called.
+        template<typename TRange, typename TSelector>
+        struct par_select_range : base_range
+        {
+            typedef                 par_select_range<TRange, TSelector>     this_type       ;
+            typedef                 TRange                                  range_type      ;
+            typedef                 TSelector                               selector_type   ;
+            typedef                 par_select_state<TRange, TSelector>     state_type      ;
+
+            typedef     typename    state_type::value_type                  value_type      ;
+            typedef                 value_type const &                      return_type     ;
+            enum
+            {
+                returns_reference   = 1   ,
+            };
+
+            std::unique_ptr<state_type> state       ;
+            bool                        done        ;
+
+            CPPLINQ_INLINEMETHOD par_select_range (
+                    range_type      range
+                ,   selector_type   selector
+                ,   executor &      pool
+                ,   size_type       window
+                )
+                :   state       (new state_type (std::move (range), std::move (selector), pool, window))
+                ,   done        (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_select_range (par_select_range const & v)
+                :   state       (copy_state (v))
+                ,   done        (v.done)
+            {
+            }
+
+            // Once started chunks in flight read the range and the selector,
+            // copying them then would race with the tasks
+            static CPPLINQ_INLINEMETHOD state_type * copy_state (par_select_range const & v)
+            {
+                if (!v.state)
+                {
+                    return nullptr;
+                }
+
+                if (v.state->started ())
+                {
+                    throw programming_error_exception ();
+                }
+
+                return new state_type (v.state->range, v.state->selector, v.state->pool, v.state->window);
+            }
+
+            CPPLINQ_INLINEMETHOD par_select_range (par_select_range && v) CPPLINQ_NOEXCEPT
+                :   state       (std::move (v.state))
+                ,   done        (std::move (v.done))
+            {
+            }
+
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+            {
+                return range_builder.build (*this);
+            }
+
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
+            CPPLINQ_INLINEMETHOD return_type front () const
+            {
+                return state->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD bool next ()
+            {
+                if (done)
+                {
+                    return false;
+                }
+
+                if (!state->started ())
+                {
+                    state->start ();
+                }
+
+                try
+                {
+                    if (state->next ())
+                    {
+                        return true;
+                    }
+                }
+                catch (...)
+                {
+                    done = true;
+                    state.reset ();
+                    throw;
+                }
+
+                done = true;
+                state.reset ();
+                return false;
+            }
+        };
+
+        template<typename TSelector>
+        struct par_select_builder : base_builder
+        {
+            typedef                 par_select_builder<TSelector>           this_type       ;
+            typedef                 TSelector                               selector_type   ;
+
+            selector_type           selector    ;
+            size_type               window      ;
+            executor *              pool        ;
+
+            CPPLINQ_INLINEMETHOD par_select_builder (selector_type selector, size_type window, executor & pool) CPPLINQ_NOEXCEPT
+                :   selector    (std::move (selector))
+                ,   window      (window)
+                ,   pool        (std::addressof (pool))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_select_builder (par_select_builder const & v)
+                :   selector    (v.selector)
+                ,   window      (v.window)
+                ,   pool        (v.pool)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_select_builder (par_select_builder && v) CPPLINQ_NOEXCEPT
+                :   selector    (std::move (v.selector))
+                ,   window      (std::move (v.window))
+                ,   pool        (std::move (v.pool))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD par_select_range<TRange, TSelector> build (TRange range) const
+            {
+                return par_select_range<TRange, TSelector> (std::move (range), selector, *pool, window);
+            }
+        };
+#endif
+
+        // -------------------------------------------------------------------------
+
+        // container adapts a range to begin ()/end () so that it can be used with
+        // range-for and <algorithm>. The range is held once by the container,
+        // iterators only refer to it so copying them is cheap. The end iterator
+        // doubles as the sentinel: an iterator compares equal to end () once the
+        // range is exhausted. The iterator keeps the result of next () in a flag
+        // so that comparing against end () is a single test the optimizer can
+        // fold into the loop over the range.
+        //
+        // Like the range it adapts a container is single pass, begin () starts
+        // the iteration and should be called once. Iterators are invalidated
+        // when the container is copied or moved.
+
+        template<typename TRange>
+        struct container_iterator
+        {
+            typedef                 std::input_iterator_tag     iterator_category   ;
+            typedef     typename    TRange::value_type          value_type          ;
+            typedef     typename    TRange::return_type         return_type         ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+            };
+
+            typedef                 std::ptrdiff_t              difference_type     ;
+            typedef                 value_type const *          pointer             ;
+            typedef                 return_type                 reference           ;
+
+            typedef                 container_iterator<TRange>  this_type   ;
+            typedef                 TRange                      range_type  ;
+
+            // Returned by postfix ++, holds the element the iterator was at
+            struct postfix_proxy
+            {
+                value_type          value   ;
+
+                CPPLINQ_INLINEMETHOD value_type const & operator* () const CPPLINQ_NOEXCEPT
+                {
+                    return value;
+                }
+            };
+
+            range_type *            range       ;
+            bool                    has_value   ;
+
+            CPPLINQ_INLINEMETHOD container_iterator () CPPLINQ_NOEXCEPT
+                :   range       (nullptr)
+                ,   has_value   (false)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD explicit container_iterator (range_type * range)
+                :   range       (range)
+                ,   has_value   (range->next ())
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container_iterator (range_type * range, bool has_value) CPPLINQ_NOEXCEPT
+                :   range       (range)
+                ,   has_value   (has_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container_iterator (container_iterator const & v) CPPLINQ_NOEXCEPT
+                :   range       (v.range)
+                ,   has_value   (v.has_value)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container_iterator (container_iterator && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+                ,   has_value   (std::move (v.has_value))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD this_type & operator= (container_iterator const & v) CPPLINQ_NOEXCEPT
+            {
+                range       = v.range;
+                has_value   = v.has_value;
+                return *this;
+            }
+
+            CPPLINQ_INLINEMETHOD return_type operator* () const
+            {
+                CPPLINQ_ASSERT (has_value);
+                return range->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD pointer operator-> () const
+            {
+                static_assert (
+                        returns_reference
+                    ,   "operator-> requires a range that returns a reference, typically select causes ranges to return values not references"
+                    );
+                CPPLINQ_ASSERT (has_value);
+                return &range->front ();
+            }
+
+            CPPLINQ_INLINEMETHOD this_type & operator++ ()
+            {
+                CPPLINQ_ASSERT (has_value);
+                has_value = range->next ();
+                return *this;
+            }
+
+            CPPLINQ_INLINEMETHOD postfix_proxy operator++ (int)
+            {
+                postfix_proxy proxy = { **this };
+                ++*this;
+                return proxy;
+            }
+
+            // Exhausted iterators of a range compare equal, they are the
+            // sentinel. end () points to the range as well so range == v.range
+            // doesn't change in a loop and only has_value is tested each step
+            CPPLINQ_INLINEMETHOD bool operator== (this_type const & v) const CPPLINQ_NOEXCEPT
+            {
+                return has_value == v.has_value && range == v.range;
+            }
+
+            CPPLINQ_INLINEMETHOD bool operator!= (this_type const & v) const CPPLINQ_NOEXCEPT
+            {
+                return !(*this == v);
+            }
+        };
+
+        template<typename TRange>
+        struct container
+        {
+            typedef                 container<TRange>               this_type       ;
+            typedef                 TRange                          range_type      ;
+            typedef                 typename TRange::value_type     value_type      ;
+            typedef                 typename TRange::return_type    return_type     ;
+            typedef                 container_iterator<TRange>      iterator        ;
+            typedef                 container_iterator<TRange>      const_iterator  ;
+            enum
+            {
+                returns_reference   = TRange::returns_reference   ,
+            };
+
+            range_type              range   ;
+
+            CPPLINQ_INLINEMETHOD explicit container (TRange range)
+                :   range (std::move (range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container (container const & v)
+                :   range       (v.range)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container (container && v) CPPLINQ_NOEXCEPT
+                :   range       (std::move (v.range))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD iterator begin ()
+            {
+                return iterator (std::addressof (range));
+            }
+
+            CPPLINQ_INLINEMETHOD iterator end () CPPLINQ_NOEXCEPT
+            {
+                return iterator (std::addressof (range), false);
+            }
+        };
+
+        struct container_builder : base_builder
+        {
+            typedef                 container_builder       this_type       ;
+
+            CPPLINQ_INLINEMETHOD container_builder () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container_builder (container_builder const & v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD container_builder (container_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD container<TRange> build (TRange range) const
+            {
+                return container<TRange> (std::move (range));
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TAction>
+        struct action_sink
+        {
+            TAction &               action      ;
+
+            CPPLINQ_CONSTEXPR explicit action_sink (TAction & action) CPPLINQ_NOEXCEPT
+                :   action      (action)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_CONSTEXPR bool operator() (TValue && v)
+            {
+                action (std::forward<TValue> (v));
+                return true;
+            }
+        };
+
+        // Stops at the first element satisfying predicate
+        template<typename TPredicate>
+        struct find_sink
+        {
+            TPredicate &            predicate   ;
+            bool                    found       ;
+
+            CPPLINQ_INLINEMETHOD explicit find_sink (TPredicate & predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (predicate)
+                ,   found       (false)
+            {
+            }
+
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TValue && v)
+            {
+                if (predicate (v))
+                {
+                    found = true;
+                    return false;
+                }
+
+                return true;
+            }
+        };
+
+        // Stops at the first element satisfying predicate and keeps a copy of it
+        template<typename TPredicate, typename TValue>
+        struct find_value_sink
+        {
+            TPredicate &            predicate   ;
+            opt<TValue>             value       ;
+
+            CPPLINQ_INLINEMETHOD explicit find_value_sink (TPredicate & predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (predicate)
+            {
+            }
+
+            template<typename TForwardValue>
+            CPPLINQ_INLINEMETHOD bool operator() (TForwardValue && v)
+            {
+                if (predicate (v))
+                {
+                    value = std::forward<TForwardValue> (v);
+                    return false;
+                }
+
+                return true;
+            }
+        };
+
+        // Returns true if any element of range satisfies predicate
+        template<typename TRange, typename TPredicate>
+        CPPLINQ_INLINEMETHOD bool find_element (TRange & range, TPredicate & predicate)
+        {
+            find_sink<TPredicate> sink (predicate);
+            push_traits<TRange>::push (range, sink);
+            return sink.found;
+        }
+
+        // Returns the first element of range satisfying predicate, if any
+        template<typename TRange, typename TPredicate>
+        CPPLINQ_INLINEMETHOD opt<typename TRange::value_type> find_element_value (TRange & range, TPredicate & predicate)
+        {
+            find_value_sink<TPredicate, typename TRange::value_type> sink (predicate);
+            push_traits<TRange>::push (range, sink);
+            return std::move (sink.value);
+        }
+
+        template<typename TRange, typename TAction>
+        CPPLINQ_CONSTEXPR void for_each_element (TRange & range, TAction & action, std::false_type)
+        {
+            action_sink<TAction> sink (action);
+            push_traits<TRange>::push (range, sink);
+        }
+
+        template<typename TRange, typename TAction>
+        CPPLINQ_CONSTEXPR void for_each_element (TRange & range, TAction & action, std::true_type)
+        {
+            typedef batch_traits<TRange> traits;
+
+            typename traits::batch_type batch[batch_size];
+
+            size_type count;
+            while ((count = traits::next_batch (range, batch, batch_size)) > 0U)
+            {
+                for (size_type iter = 0U; iter < count; ++iter)
+                {
+                    action (traits::batch_value (batch[iter]));
+                }
+            }
+        }
+
+        // Invokes action on each element of range, draining it in batches if
+        // preferred, otherwise pushing the elements in a single fused loop
+        template<typename TRange, typename TAction>
+        CPPLINQ_CONSTEXPR void for_each_element (TRange & range, TAction & action)
+        {
+            for_each_element (
+                    range
+                ,   action
+                ,   std::integral_constant<bool, batch_traits<TRange>::prefers_batch != 0> ()
+                );
+        }
+
+        // -------------------------------------------------------------------------
+
+        struct to_vector_builder : base_builder
+        {
+            typedef                 to_vector_builder       this_type       ;
+
+            size_type               capacity;
+
+            CPPLINQ_INLINEMETHOD explicit to_vector_builder (size_type capacity = 16U) CPPLINQ_NOEXCEPT
+                :   capacity    (capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder const & v) CPPLINQ_NOEXCEPT
+                :   capacity (v.capacity)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder && v) CPPLINQ_NOEXCEPT
+                :   capacity (std::move (v.capacity))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange range) const
+            {
+                return build (range, is_contiguous_range<TRange> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange & range, std::false_type) const
+            {
+                typedef typename TRange::value_type value_type;
+
+                std::vector<value_type> result;
+                result.reserve (get_reserve_capacity (range, capacity));
+
+                auto action = [&result] (value_type const & v)
+                {
+                    result.push_back (v);
+                };
+
+                for_each_element (range, action);
+
+                return result;
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange & range, std::true_type) const
+            {
+                auto begin  = range.span_begin ();
+                auto size   = range.span_size ();
+
+                std::vector<typename TRange::value_type> result;
+                result.reserve (size < capacity ? capacity : size);
+                result.insert (result.end (), begin, begin + size);
+
+                return result;
+            }
+
+        };
+
+#ifndef CPPLINQ_NO_PARALLEL
+        // Appends the elements of a part to the last buffer, the parts a task
+        // works through are adjacent so a task needs just the one buffer
+        template<typename TValue>
+        struct append_to_buffers
+        {
+            typedef                 std::vector<TValue>             buffer_type     ;
+            typedef                 std::list<buffer_type>          buffers_type    ;
+
+            template<typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (buffers_type & buffers, TPart & part) const
+            {
+                if (buffers.empty ())
+                {
+                    buffers.push_back (buffer_type ());
+                    buffers.back ().reserve (get_reserve_capacity (part, part.split_size ()));
+                }
+
+                append_action action = { buffers.back () };
+                for_each_element (part, action);
+            }
+
+        private:
+            // Values produced by the part, such as projections, are moved
+            // into the buffer rather than copied
+            struct append_action
+            {
+                buffer_type &       buffer  ;
+
+                template<typename TOther>
+                CPPLINQ_INLINEMETHOD void operator() (TOther && v) const
+                {
+                    buffer.push_back (std::forward<TOther> (v));
+                }
+            };
+        };
+
+        // par_to_vector_builder materializes a splittable range in parallel. Each
+        // task collects its elements in a local buffer, the buffers are spliced
+        // together in source order, a prefix sum of their sizes gives where they
+        // go and they are moved into a vector sized once. Ranges that can't split
+        // are materialized by to_vector.
+        struct par_to_vector_builder : base_builder
+        {
+            typedef                 par_to_vector_builder   this_type       ;
+
+            executor *              pool    ;
+
+            CPPLINQ_INLINEMETHOD explicit par_to_vector_builder (executor & pool) CPPLINQ_NOEXCEPT
+                :   pool    (std::addressof (pool))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_to_vector_builder (par_to_vector_builder const & v) CPPLINQ_NOEXCEPT
+                :   pool    (v.pool)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_to_vector_builder (par_to_vector_builder && v) CPPLINQ_NOEXCEPT
+                :   pool    (std::move (v.pool))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange range) const
+            {
+                return build (range, std::integral_constant<bool, split_traits<TRange>::is_native != 0> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange & range, std::false_type) const
+            {
+                return to_vector_builder ().build (std::move (range));
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange & range, std::true_type) const
+            {
+                typedef typename TRange::value_type             value_type      ;
+                typedef          append_to_buffers<value_type>  append_type     ;
+                typedef typename append_type::buffers_type      buffers_type    ;
+                typedef typename append_type::buffer_type       buffer_type     ;
+
+                auto list = split_reduce (
+                        *pool
+                    ,   range
+                    ,   0U
+                    ,   [] () {return buffers_type ();}
+                    ,   append_type ()
+                    ,   [] (buffers_type & buffers, buffers_type && other) {buffers.splice (buffers.end (), other);}
+                    );
+
+                std::vector<typename buffer_type::iterator> buffers ;
+                std::vector<size_type>                      offsets ;
+                buffers.reserve (list.size ());
+                offsets.reserve (list.size () + 1U);
+
+                size_type total = 0U;
+                for (auto & buffer : list)
+                {
+                    buffers.push_back (buffer.begin ());
+                    offsets.push_back (total);
+                    total += buffer.size ();
+                }
+                offsets.push_back (total);
+
+                if (buffers.size () == 1U)
+                {
+                    return std::move (list.front ());
+                }
+
+                return gather (buffers, offsets, total, std::is_default_constructible<value_type> ());
+            }
+
+        private:
+            // Moves buffers into a presized vector, each thread fills a slice of it
+            template<typename TIterator>
+            CPPLINQ_METHOD std::vector<typename std::iterator_traits<TIterator>::value_type> gather (
+                    std::vector<TIterator> const &  buffers
+                ,   std::vector<size_type> const &  offsets
+                ,   size_type                       total
+                ,   std::true_type
+                ) const
+            {
+                typedef typename std::iterator_traits<TIterator>::difference_type difference_type;
+
+                std::vector<typename std::iterator_traits<TIterator>::value_type> result (total);
+                auto target = result.begin ();
+
+                pool->parallel_for (
+                        0U
+                    ,   total
+                    ,   0U
+                    ,   [&] (size_type begin, size_type end)
+                        {
+                            // The buffer that holds begin
+                            auto index = static_cast<size_type> (std::upper_bound (offsets.begin (), offsets.end (), begin) - offsets.begin ()) - 1U;
+                            while (begin < end)
+                            {
+                                auto buffer_end = offsets[index + 1U] < end ? offsets[index + 1U] : end;
+                                auto source     = buffers[index] + static_cast<difference_type> (begin - offsets[index]);
+                                std::move (
+                                        source
+                                    ,   source + static_cast<difference_type> (buffer_end - begin)
+                                    ,   target + static_cast<difference_type> (begin)
+                                    );
+                                begin = buffer_end;
+                                ++index;
+                            }
+                        }
+                    );
+
+                return result;
+            }
+
+            // Values that can't be default constructed are moved in sequentially
+            template<typename TIterator>
+            CPPLINQ_METHOD std::vector<typename std::iterator_traits<TIterator>::value_type> gather (
+                    std::vector<TIterator> const &  buffers
+                ,   std::vector<size_type> const &  offsets
+                ,   size_type                       total
+                ,   std::false_type
+                ) const
+            {
+                typedef typename std::iterator_traits<TIterator>::difference_type difference_type;
+
+                std::vector<typename std::iterator_traits<TIterator>::value_type> result;
+                result.reserve (total);
+
+                for (auto index = 0U; index < buffers.size (); ++index)
+                {
+                    auto source = buffers[index];
+                    auto size   = static_cast<difference_type> (offsets[index + 1U] - offsets[index]);
+                    result.insert (result.end (), std::make_move_iterator (source), std::make_move_iterator (source + size));
+                }
+
+                return result;
+            }
+
+        };
+#endif
+
+        struct to_list_builder : base_builder
+        {
+            typedef                 to_list_builder       this_type       ;
+
+            CPPLINQ_INLINEMETHOD explicit to_list_builder () CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder const & v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::list<typename TRange::value_type> build (TRange range) const
+            {
+                std::list<typename TRange::value_type> result;
+
+                while (range.next ())
+                {
+                    result.push_back (range.front ());
+                }
+
+                return result;
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TKeyPredicate>
+        struct to_map_builder : base_builder
+        {
+            static TKeyPredicate get_key_predicate ();
+
+            typedef                     to_map_builder<TKeyPredicate>   this_type           ;
+            typedef                     TKeyPredicate                   key_predicate_type  ;
+
+            key_predicate_type          key_predicate   ;
+
+            CPPLINQ_INLINEMETHOD explicit to_map_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (key_predicate))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder const & v)
+                :   key_predicate (v.key_predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder && v) CPPLINQ_NOEXCEPT
+                :   key_predicate (std::move (v.key_predicate))
+            {
+            }
+
+            template<typename TRange>
+            CPPLINQ_METHOD std::map<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                > build (TRange range) const
+            {
+                typedef std::map<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                >   result_type;
+
+                result_type result;
+
+                while (range.next ())
+                {
+                    typename TRange::return_type v = range.front ();
+                    auto k = key_predicate (v);
+
+                    result.insert (typename result_type::value_type (std::move (k), std::move (v)));
+                }
+
+                return result;
+            }
+
+        };
+
+        // -------------------------------------------------------------------------
+
+        template<typename TKey, typename TValue>
+        struct lookup
+        {
+            typedef             TKey    key_type    ;
+            typedef             TValue  value_type  ;
+
+            typedef             std::vector<std::pair<key_type, size_type>>     keys_type           ;
+            typedef             std::vector<value_type>                         values_type         ;
+
+            typedef typename    values_type::const_iterator                     values_iterator_type;
+
+            template<typename TRange, typename TSelector>
+            CPPLINQ_METHOD lookup (size_type capacity, TRange range, TSelector selector)
+            {
+                keys_type   k;
+                values_type v;
+                k.reserve (capacity);
+                v.reserve (capacity);
+
+                auto index = 0U;
+                while (range.next ())
+                {
+                    typename TRange::return_type value = range.front ();
+                    auto key = selector (value);
+                    v.push_back (std::move (value));
+                    k.push_back (typename keys_type::value_type (std::move (key), index));
+                    ++index;
+                }
+
+                if (v.size () == 0)
+                {
+                    return;
+                }
+
+                std::sort (
+                        k.begin ()
+                    ,   k.end ()
+                    ,   [] (typename keys_type::value_type const & l, typename keys_type::value_type const & r)
+                        {
+                            return l.first < r.first;
+                        }
+                    );
+
+                keys.reserve (k.size ());
+                values.reserve (v.size ());
+
+                auto iter       = k.begin ();
+                auto end        = k.end ();
+
+                index = 0U;
+
+                if (iter != end)
+                {
+                    values.push_back (std::move (v[iter->second]));
+                    keys.push_back (typename keys_type::value_type (iter->first, index));
+                }
+
+                auto previous   = iter;
+                ++iter;
+                ++index;
+
+                while (iter != end)
+                {
+                    values.push_back (v[iter->second]);
+
+                    if (previous->first < iter->first)
+                    {
+                        keys.push_back (typename keys_type::value_type (iter->first, index));
+                    }
+
+                    previous = iter;
+                    ++iter;
+                    ++index;
+                }
+            }
+
+            CPPLINQ_INLINEMETHOD lookup (lookup const & v)
+                :   values  (v.values)
+                ,   keys    (v.keys)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD lookup (lookup && v) CPPLINQ_NOEXCEPT
+                :   values  (std::move (v.values))
+                ,   keys    (std::move (v.keys))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD void swap (lookup & v) CPPLINQ_NOEXCEPT
+            {
+                values.swap (v.values);
+                keys.swap (v.keys);
+            }
+
+            CPPLINQ_INLINEMETHOD lookup & operator= (lookup const & v)
+            {
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
+
+                lookup tmp (v);
+
+                swap (tmp);
+
+                return *this;
+            }
+
+            CPPLINQ_INLINEMETHOD lookup & operator= (lookup && v) CPPLINQ_NOEXCEPT
+            {
+                if (this == std::addressof (v))
+                {
+                    return *this;
+                }
+
+                swap (v);
+
+                return *this;
+            }
+
+            struct lookup_range : base_range
+            {
+                typedef         lookup_range                this_type       ;
+
+                enum
+                {
+                    returns_reference = 1 ,
+                };
+
+                typedef         TValue                      value_type      ;
+                typedef         value_type const &          return_type     ;
+
+                enum state
+                {
+                    state_initial   ,
+                    state_iterating ,
+                    state_end       ,
+                };
+
+                values_type const *     values  ;
+                size_type               iter    ;
+                size_type               end     ;
+                state                   state   ;
+
+                CPPLINQ_INLINEMETHOD lookup_range (
+                        values_type const *     values
+                    ,   size_type               iter
+                    ,   size_type               end
+                    ) CPPLINQ_NOEXCEPT
+                    :   values  (values)
+                    ,   iter    (iter)
+                    ,   end     (end)
+                    ,   state   (state_initial)
+                {
+                    CPPLINQ_ASSERT (values);
+                }
+
+                CPPLINQ_INLINEMETHOD lookup_range (lookup_range const & v) CPPLINQ_NOEXCEPT
+                    :   values  (v.values)
+                    ,   iter    (v.iter)
+                    ,   end     (v.end)
+                    ,   state   (v.state)
+                {
+                }
+
+                CPPLINQ_INLINEMETHOD lookup_range (lookup_range && v) CPPLINQ_NOEXCEPT
+                    :   values  (std::move (v.values))
+                    ,   iter    (std::move (v.iter))
+                    ,   end     (std::move (v.end))
+                    ,   state   (std::move (v.state))
+                {
+                }
+
+                template<typename TRangeBuilder>
+                CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
+                {
+                    return range_builder.build (*this);
+                }
+
+#if CPPLINQ_RVALUE_OPERATORS
+                template<typename TRangeBuilder>
+                CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+                {
+                    return range_builder.build (std::move (*this));
+                }
+#endif
+
+                CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
+                {
+                    CPPLINQ_ASSERT (state == state_iterating);
+                    CPPLINQ_ASSERT (iter < end);
+
+                    return (*values)[iter];
+                }
+
+                CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
+                {
+                    switch (state)
+                    {
+                    case state_initial:
+                        {
+                            auto has_elements = iter < end;
+                            state = has_elements ? state_iterating : state_end;
+                            return has_elements;
+                        }
+                        break;
+                    case state_iterating:
+                        {
+                            ++iter;
+
+                            auto has_elements = iter < end;
+                            state = has_elements ? state_iterating : state_end;
+                            return has_elements;
+                        }
+                        break;
+                    case state_end:
+                    default:
+                        return false;
+                    }
+                }
+
+            };
+
+            CPPLINQ_METHOD lookup_range operator[](key_type const & key) const CPPLINQ_NOEXCEPT
+            {
+                if (values.empty ())
+                {
+                    return lookup_range (std::addressof (values), 0U, 0U);
+                }
+
+                auto find = std::lower_bound (
+                        keys.begin ()
+                    ,   keys.end  ()
+                    ,   typename keys_type::value_type (key, 0U)
+                    ,   [](typename keys_type::value_type const & l, typename keys_type::value_type const & r)
+                        {
+                            return l.first < r.first;
+                        });
 
-            other_range_type        other_range         ;
+                // lower_bound finds the first key not less than key, that key
+                // may be a greater one
+                if (find == keys.end () || key < find->first)
+                {
+                    return lookup_range (std::addressof (values), 0U, 0U);
+                }
 
-            CPPLINQ_INLINEMETHOD concat_builder (TOtherRange other_range) CPPLINQ_NOEXCEPT
-                : other_range (std::move (other_range))
-            {
+                auto next = find + 1;
+                if (next == keys.end ())
+                {
+                    return lookup_range (std::addressof (values), find->second, values.size ());
+                }
+
+                return lookup_range (std::addressof (values), find->second, next->second);
             }
 
-            CPPLINQ_INLINEMETHOD concat_builder (concat_builder const & v) CPPLINQ_NOEXCEPT
-                : other_range (v.other_range)
+            CPPLINQ_INLINEMETHOD size_type size_of_keys () const CPPLINQ_NOEXCEPT
             {
+                return keys.size ();
             }
 
-            CPPLINQ_INLINEMETHOD concat_builder (concat_builder && v) CPPLINQ_NOEXCEPT
-                : other_range (std::move (v.other_range))
+            CPPLINQ_INLINEMETHOD size_type size_of_values () const CPPLINQ_NOEXCEPT
             {
+                return values.size ();
             }
 
-            template <typename TRange>
-            CPPLINQ_INLINEMETHOD concat_range<TRange, TOtherRange> build (TRange range) const
+            CPPLINQ_INLINEMETHOD from_range<values_iterator_type> range_of_values () const CPPLINQ_NOEXCEPT
             {
-                return concat_range<TRange, TOtherRange> (std::move (range), std::move (other_range));
+                return from_range<values_iterator_type> (
+                        values.begin ()
+                    ,   values.end ()
+                    );
             }
-        };
 
-        // -------------------------------------------------------------------------
+        private:
+            values_type values  ;
+            keys_type   keys    ;
+        };
 
-        namespace experimental
+        template<typename TKeyPredicate>
+        struct to_lookup_builder : base_builder
         {
-            // -------------------------------------------------------------------------
+            static TKeyPredicate get_key_predicate ();
+
+            typedef                     to_lookup_builder<TKeyPredicate>    this_type           ;
+            typedef                     TKeyPredicate                       key_predicate_type  ;
 
-            // TODO: Verify that container range aggregator has the right semantics
+            key_predicate_type          key_predicate   ;
 
-            template<typename TRange>
-            struct container_iterator
+            CPPLINQ_INLINEMETHOD explicit to_lookup_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
+                :   key_predicate   (std::move (key_predicate))
             {
-                typedef                 std::forward_iterator_tag   iterator_category   ;
-                typedef     typename    TRange::value_type          value_type          ;
-                typedef     typename    TRange::return_type         return_type         ;
-                enum
-                {
-                    returns_reference   = TRange::returns_reference   ,
-                };
+            }
 
-                typedef                 std::ptrdiff_t              difference_type     ;
-                typedef                 value_type*                 pointer             ;
-                typedef                 value_type&                 reference           ;
+            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder const & v)
+                :   key_predicate (v.key_predicate)
+            {
+            }
 
-                typedef                 container_iterator<TRange>  this_type   ;
-                typedef                 TRange                      range_type  ;
+            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder && v) CPPLINQ_NOEXCEPT
+                :   key_predicate (std::move (v.key_predicate))
+            {
+            }
 
-                bool                    has_value                               ;
-                opt<range_type>         range                                   ;
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                > build (TRange range) const
+            {
+                typedef lookup<
+                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
+                ,   typename TRange::value_type
+                >   result_type;
 
-                CPPLINQ_INLINEMETHOD container_iterator ()   CPPLINQ_NOEXCEPT
-                    :   has_value   (false)
-                {
-                }
+                result_type result (get_reserve_capacity (range, 16U), range, key_predicate);
 
-                CPPLINQ_INLINEMETHOD container_iterator (range_type r)   CPPLINQ_NOEXCEPT
-                    :   range      (std::move (r))
-                {
-                    has_value = range && range->next ();
-                }
+                return result;
+            }
 
-                CPPLINQ_INLINEMETHOD container_iterator (container_iterator const & v) CPPLINQ_NOEXCEPT
-                    :   has_value   (v.has_value)
-                    ,   range       (v.range)
-                {
-                }
+        };
 
-                CPPLINQ_INLINEMETHOD container_iterator (container_iterator && v) CPPLINQ_NOEXCEPT
-                    :   has_value   (std::move (v.has_value))
-                    ,   range       (std::move (v.range))
-                {
-                }
+        // -------------------------------------------------------------------------
 
-                CPPLINQ_INLINEMETHOD return_type        operator* () const
-                {
-                    CPPLINQ_ASSERT (has_value);
-                    CPPLINQ_ASSERT (range);
-                    return range->front ();
-                }
+        template<typename TPredicate>
+        struct for_each_builder : base_builder
+        {
+            typedef                 for_each_builder<TPredicate>    this_type       ;
+            typedef                 TPredicate                      predicate_type  ;
 
-                CPPLINQ_INLINEMETHOD value_type const * operator-> () const
-                {
-                    static_assert (
-                            returns_reference
-                        ,   "operator-> requires a range that returns a reference, typically select causes ranges to return values not references"
-                        );
-                    return &range->front ();
-                }
+            predicate_type          predicate;
 
-                CPPLINQ_INLINEMETHOD this_type & operator++()
-                {
-                    if (has_value && range)
-                    {
-                        has_value = range->next ();
-                    }
+            CPPLINQ_INLINEMETHOD explicit for_each_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate    (std::move (predicate))
+            {
+            }
 
-                    return *this;
-                }
+            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD bool operator== (this_type const & v) const CPPLINQ_NOEXCEPT
-                {
-                    if (!has_value && !v.has_value)
-                    {
-                        return true;
-                    }
-                    else if (has_value && has_value && range.get_ptr () == v.range.get_ptr ())
-                    {
-                        return true;
-                    }
-                    else
-                    {
-                        return false;
-                    }
-                }
+            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD bool operator!= (this_type const & v) const CPPLINQ_NOEXCEPT
-                {
-                    return !(*this == v);
-                }
-            };
 
             template<typename TRange>
-            struct container
+            CPPLINQ_INLINEMETHOD void build (TRange range) const
             {
-                typedef                 container<TRange>   this_type                   ;
-                typedef                 TRange              range_type                  ;
-                typedef                 typename TRange::value_type     value_type      ;
-                typedef                 typename TRange::return_type    return_type     ;
-                enum
-                {
-                    returns_reference   = TRange::returns_reference   ,
-                };
-
-                range_type              range   ;
-
-                CPPLINQ_INLINEMETHOD explicit container (TRange range)
-                    :   range (std::move (range))
-                {
-                }
-
-                CPPLINQ_INLINEMETHOD container (container const & v) CPPLINQ_NOEXCEPT
-                    :   range       (v.range)
-                {
-                }
+                for_each_element (range, predicate);
+            }
 
-                CPPLINQ_INLINEMETHOD container (container && v) CPPLINQ_NOEXCEPT
-                    :   range       (std::move (v.range))
-                {
-                }
+        };
 
-                CPPLINQ_INLINEMETHOD container_iterator<TRange>  begin () CPPLINQ_NOEXCEPT
-                {
-                    return container_iterator<TRange>(range);
-                }
+        // -------------------------------------------------------------------------
 
-                CPPLINQ_INLINEMETHOD container_iterator<TRange>  end () CPPLINQ_NOEXCEPT
-                {
-                    return container_iterator<TRange>();
-                }
+        template<typename TPredicate>
+        struct first_predicate_builder : base_builder
+        {
+            typedef                 first_predicate_builder<TPredicate>     this_type           ;
+            typedef                 TPredicate                              predicate_type      ;
 
-            };
+            predicate_type          predicate   ;
 
-            struct container_builder : base_builder
+            CPPLINQ_INLINEMETHOD first_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
-                typedef                 container_builder       this_type       ;
+            }
 
-                CPPLINQ_INLINEMETHOD container_builder () CPPLINQ_NOEXCEPT
-                {
-                }
+            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD container_builder (container_builder const & v) CPPLINQ_NOEXCEPT
-                {
-                }
+            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder && v) CPPLINQ_NOEXCEPT
+                : predicate (std::move (v.predicate))
+            {
+            }
 
-                CPPLINQ_INLINEMETHOD container_builder (container_builder && v) CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
+            {
+                auto first = find_element_value (range, predicate);
+                if (first)
                 {
+                    return std::move (first.get ());
                 }
 
-                template<typename TRange>
-                CPPLINQ_METHOD container<TRange> build (TRange range) const
-                {
-                    return container<TRange> (std::move (range));
-                }
+                throw sequence_empty_exception ();
+            }
 
-            };
-        }
+        };
 
         // -------------------------------------------------------------------------
 
-        struct to_vector_builder : base_builder
+        struct first_builder : base_builder
         {
-            typedef                 to_vector_builder       this_type       ;
-
-            size_type               capacity;
+            typedef                 first_builder                   this_type       ;
 
-            CPPLINQ_INLINEMETHOD explicit to_vector_builder (size_type capacity = 16U) CPPLINQ_NOEXCEPT
-                :   capacity    (capacity)
+            CPPLINQ_INLINEMETHOD first_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder const & v) CPPLINQ_NOEXCEPT
-                :   capacity (v.capacity)
+            CPPLINQ_INLINEMETHOD first_builder (first_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_vector_builder (to_vector_builder && v) CPPLINQ_NOEXCEPT
-                :   capacity (std::move (v.capacity))
+            CPPLINQ_INLINEMETHOD first_builder (first_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::vector<typename TRange::value_type> build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
             {
-                std::vector<typename TRange::value_type> result;
-                result.reserve (capacity);
-
-                while (range.next ())
+                if (range.next ())
                 {
-                    result.push_back (range.front ());
+                    return range.front ();
                 }
 
-                return result;
+                throw sequence_empty_exception ();
             }
 
         };
 
-        struct to_list_builder : base_builder
+        // -------------------------------------------------------------------------
+
+        template<typename TPredicate>
+        struct first_or_default_predicate_builder : base_builder
         {
-            typedef                 to_list_builder       this_type       ;
+            typedef                 first_or_default_predicate_builder<TPredicate>  this_type       ;
+            typedef                 TPredicate                                      predicate_type  ;
 
-            CPPLINQ_INLINEMETHOD explicit to_list_builder () CPPLINQ_NOEXCEPT
+            predicate_type          predicate;
+
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_list_builder (to_list_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
+                : predicate (std::move (v.predicate))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::list<typename TRange::value_type> build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                std::list<typename TRange::value_type> result;
-
-                while (range.next ())
+                auto first = find_element_value (range, predicate);
+                if (first)
                 {
-                    result.push_back (range.front ());
+                    return std::move (first.get ());
                 }
 
-                return result;
+                return typename TRange::value_type ();
             }
 
         };
 
-        // -------------------------------------------------------------------------
 
-        template<typename TKeyPredicate>
-        struct to_map_builder : base_builder
+        struct first_or_default_builder : base_builder
         {
-            static TKeyPredicate get_key_predicate ();
-
-            typedef                     to_map_builder<TKeyPredicate>   this_type           ;
-            typedef                     TKeyPredicate                   key_predicate_type  ;
-
-            key_predicate_type          key_predicate   ;
+            typedef                 first_or_default_builder                   this_type       ;
 
-            CPPLINQ_INLINEMETHOD explicit to_map_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
-                :   key_predicate   (std::move (key_predicate))
+            CPPLINQ_INLINEMETHOD first_or_default_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder const & v)
-                :   key_predicate (v.key_predicate)
+            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_map_builder (to_map_builder && v) CPPLINQ_NOEXCEPT
-                :   key_predicate (std::move (v.key_predicate))
+            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
             template<typename TRange>
-            CPPLINQ_METHOD std::map<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                > build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                typedef std::map<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                >   result_type;
-
-                result_type result;
-
-                while (range.next ())
+                if (range.next ())
                 {
-                    auto v = range.front ();
-                    auto k = key_predicate (v);
-
-                    result.insert (typename result_type::value_type (std::move (k), std::move (v)));
+                    return range.front ();
                 }
 
-                return result;
+                return typename TRange::value_type ();
             }
 
         };
 
         // -------------------------------------------------------------------------
-
-        template<typename TKey, typename TValue>
-        struct lookup
+        template<typename TPredicate>
+        struct last_or_default_predicate_builder : base_builder
         {
-            typedef             TKey    key_type    ;
-            typedef             TValue  value_type  ;
-
-            typedef             std::vector<std::pair<key_type, size_type>>     keys_type           ;
-            typedef             std::vector<value_type>                         values_type         ;
+            typedef                 last_or_default_predicate_builder<TPredicate>   this_type       ;
+            typedef                 TPredicate                                      predicate_type  ;
 
-            typedef typename    values_type::const_iterator                     values_iterator_type;
+            predicate_type          predicate;
 
-            template<typename TRange, typename TSelector>
-            CPPLINQ_METHOD lookup (size_type capacity, TRange range, TSelector selector)
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (predicate))
             {
-                keys_type   k;
-                values_type v;
-                k.reserve (capacity);
-                v.reserve (capacity);
-
-                auto index = 0U;
-                while (range.next ())
-                {
-                    auto value  = range.front ();
-                    auto key    = selector (value);
-                    v.push_back (std::move (value));
-                    k.push_back (typename keys_type::value_type (std::move (key), index));
-                    ++index;
-                }
-
-                if (v.size () == 0)
-                {
-                    return;
-                }
-
-                std::sort (
-                        k.begin ()
-                    ,   k.end ()
-                    ,   [] (typename keys_type::value_type const & l, typename keys_type::value_type const & r)
-                        {
-                            return l.first < r.first;
-                        }
-                    );
-
-                keys.reserve (k.size ());
-                values.reserve (v.size ());
-
-                auto iter       = k.begin ();
-                auto end        = k.end ();
+            }
 
-                index = 0U;
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate (v.predicate)
+            {
+            }
 
-                if (iter != end)
-                {
-                    values.push_back (std::move (v[iter->second]));
-                    keys.push_back (typename keys_type::value_type (iter->first, index));
-                }
+            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate (std::move (v.predicate))
+            {
+            }
 
-                auto previous   = iter;
-                ++iter;
-                ++index;
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            {
+                auto current = typename TRange::value_type ();
 
-                while (iter != end)
+                while (range.next ())
                 {
-                    values.push_back (v[iter->second]);
-
-                    if (previous->first < iter->first)
+                    if (predicate (range.front ()))
                     {
-                        keys.push_back (typename keys_type::value_type (iter->first, index));
+                        current = std::move (range.front ());
                     }
-
-                    previous = iter;
-                    ++iter;
-                    ++index;
                 }
+
+                return current;
             }
 
-            CPPLINQ_INLINEMETHOD lookup (lookup const & v)
-                :   values  (v.values)
-                ,   keys    (v.keys)
+        };
+
+        struct last_or_default_builder : base_builder
+        {
+            typedef                 last_or_default_builder                   this_type       ;
+
+            CPPLINQ_INLINEMETHOD last_or_default_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD lookup (lookup && v) CPPLINQ_NOEXCEPT
-                :   values  (std::move (v.values))
-                ,   keys    (std::move (v.keys))
+            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD void swap (lookup & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder && v) CPPLINQ_NOEXCEPT
             {
-                values.swap (v.values);
-                keys.swap (v.keys);
             }
 
-            CPPLINQ_INLINEMETHOD lookup & operator= (lookup const & v)
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                if (this == std::addressof (v))
-                {
-                    return *this;
-                }
-
-                lookup tmp (v);
-
-                swap (tmp);
-
-                return *this;
+                return build (range, is_random_access_range<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD lookup & operator= (lookup && v) CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange & range, std::true_type) const
             {
-                if (this == std::addressof (v))
+                auto size = range.size ();
+                if (size > 0U)
                 {
-                    return *this;
+                    return range.at (size - 1U);
                 }
 
-                swap (v);
-
-                return *this;
+                return typename TRange::value_type ();
             }
 
-            struct lookup_range : base_range
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange & range, std::false_type) const
             {
-                typedef         lookup_range                this_type       ;
-
-                enum
-                {
-                    returns_reference = 1 ,
-                };
-
-                typedef         TValue                      value_type      ;
-                typedef         value_type const &          return_type     ;
-
-                enum state
-                {
-                    state_initial   ,
-                    state_iterating ,
-                    state_end       ,
-                };
-
-                values_type const *     values  ;
-                size_type               iter    ;
-                size_type               end     ;
-                state                   state   ;
+                auto current = typename TRange::value_type ();
 
-                CPPLINQ_INLINEMETHOD lookup_range (
-                        values_type const *     values
-                    ,   size_type               iter
-                    ,   size_type               end
-                    ) CPPLINQ_NOEXCEPT
-                    :   values  (values)
-                    ,   iter    (iter)
-                    ,   end     (end)
-                    ,   state   (state_initial)
+                while (range.next ())
                 {
-                    CPPLINQ_ASSERT (values);
+                    current = std::move (range.front ());
                 }
 
-                CPPLINQ_INLINEMETHOD lookup_range (lookup_range const & v) CPPLINQ_NOEXCEPT
-                    :   values  (v.values)
-                    ,   iter    (v.iter)
-                    ,   end     (v.end)
-                    ,   state   (v.state)
-                {
-                }
+                return current;
+            }
 
-                CPPLINQ_INLINEMETHOD lookup_range (lookup_range && v) CPPLINQ_NOEXCEPT
-                    :   values  (std::move (v.values))
-                    ,   iter    (std::move (v.iter))
-                    ,   end     (std::move (v.end))
-                    ,   state   (std::move (v.state))
-                {
-                }
+        };
 
-                template<typename TRangeBuilder>
-                CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
-                {
-                    return range_builder.build (*this);
-                }
+        // -------------------------------------------------------------------------
 
-                CPPLINQ_INLINEMETHOD return_type front () const CPPLINQ_NOEXCEPT
-                {
-                    CPPLINQ_ASSERT (state == state_iterating);
-                    CPPLINQ_ASSERT (iter < end);
+        template <typename TPredicate>
+        struct count_predicate_builder : base_builder
+        {
+            typedef                 count_predicate_builder<TPredicate>     this_type       ;
+            typedef                 TPredicate                              predicate_type  ;
 
-                    return (*values)[iter];
-                }
+            predicate_type          predicate   ;
 
-                CPPLINQ_INLINEMETHOD bool next () CPPLINQ_NOEXCEPT
-                {
-                    switch (state)
-                    {
-                    case state_initial:
-                        {
-                            auto has_elements = iter < end;
-                            state = has_elements ? state_iterating : state_end;
-                            return has_elements;
-                        }
-                        break;
-                    case state_iterating:
-                        {
-                            ++iter;
+            CPPLINQ_INLINEMETHOD count_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (predicate))
+            {
+            }
 
-                            auto has_elements = iter < end;
-                            state = has_elements ? state_iterating : state_end;
-                            return has_elements;
-                        }
-                        break;
-                    case state_end:
-                    default:
-                        return false;
-                    }
-                }
+            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder const & v) CPPLINQ_NOEXCEPT
+                :   predicate   (v.predicate)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder && v) CPPLINQ_NOEXCEPT
+                :   predicate   (std::move (v.predicate))
+            {
+            }
 
-            };
 
-            CPPLINQ_METHOD lookup_range operator[](key_type const & key) const CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
             {
-                if (values.empty ())
+                size_type count = 0U;
+                while (range.next ())
                 {
-                    return lookup_range (std::addressof (values), 0U, 0U);
+                    if (predicate (range.front ()))
+                    {
+                        ++count;
+                    }
                 }
+                return count;
+            }
 
-                auto find = std::lower_bound (
-                        keys.begin ()
-                    ,   keys.end  ()
-                    ,   typename keys_type::value_type (key, 0U)
-                    ,   [](typename keys_type::value_type const & l, typename keys_type::value_type const & r)
-                        {
-                            return l.first < r.first;
-                        });
+        };
 
-                if (find == keys.end ())
-                {
-                    return lookup_range (std::addressof (values), 0U, 0U);
-                }
+        struct count_builder : base_builder
+        {
+            typedef                 count_builder                   this_type       ;
 
-                auto next = find + 1;
-                if (next == keys.end ())
-                {
-                    return lookup_range (std::addressof (values), find->second, values.size ());
-                }
+            CPPLINQ_CONSTEXPR count_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-                return lookup_range (std::addressof (values), find->second, next->second);
+            CPPLINQ_CONSTEXPR count_builder (count_builder const & v) CPPLINQ_NOEXCEPT
+            {
             }
 
-            CPPLINQ_INLINEMETHOD size_type size_of_keys () const CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR count_builder (count_builder && v) CPPLINQ_NOEXCEPT
             {
-                return keys.size ();
             }
 
-            CPPLINQ_INLINEMETHOD size_type size_of_values () const CPPLINQ_NOEXCEPT
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build (TRange range) const
             {
-                return values.size ();
+                return build_indexed (range, is_random_access_range<TRange> ());
             }
 
-            CPPLINQ_INLINEMETHOD from_range<values_iterator_type> range_of_values () const CPPLINQ_NOEXCEPT
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build_indexed (TRange & range, std::true_type) const
             {
-                return from_range<values_iterator_type> (
-                        values.begin ()
-                    ,   values.end ()
-                    );
+                return range.size ();
+            }
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build_indexed (TRange & range, std::false_type) const
+            {
+                return build (range, std::integral_constant<bool, batch_traits<TRange>::prefers_batch != 0> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build (TRange & range, std::false_type) const
+            {
+                return build_push (range, std::integral_constant<bool, push_traits<TRange>::is_native != 0> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build_push (TRange & range, std::true_type) const
+            {
+                size_type count = 0U;
+                auto increment = [&count] (typename TRange::value_type const &)
+                {
+                    ++count;
+                };
+
+                action_sink<decltype (increment)> sink (increment);
+                push_traits<TRange>::push (range, sink);
+
+                return count;
+            }
+
+            // Without native push, counting doesn't need front ()
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build_push (TRange & range, std::false_type) const
+            {
+                size_type count = 0U;
+                while (range.next ())
+                {
+                    ++count;
+                }
+                return count;
+            }
+
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR size_type build (TRange & range, std::true_type) const
+            {
+                typename batch_traits<TRange>::batch_type batch[batch_size];
+
+                size_type count = 0U;
+                size_type batch_count;
+                while ((batch_count = batch_traits<TRange>::next_batch (range, batch, batch_size)) > 0U)
+                {
+                    count += batch_count;
+                }
+                return count;
             }
 
-        private:
-            values_type values  ;
-            keys_type   keys    ;
         };
 
-        template<typename TKeyPredicate>
-        struct to_lookup_builder : base_builder
-        {
-            static TKeyPredicate get_key_predicate ();
+        // -------------------------------------------------------------------------
 
-            typedef                     to_lookup_builder<TKeyPredicate>    this_type           ;
-            typedef                     TKeyPredicate                       key_predicate_type  ;
+        template <typename TSelector>
+        struct sum_selector_builder : base_builder
+        {
+            typedef                 sum_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-            key_predicate_type          key_predicate   ;
+            selector_type           selector;
 
-            CPPLINQ_INLINEMETHOD explicit to_lookup_builder (key_predicate_type key_predicate) CPPLINQ_NOEXCEPT
-                :   key_predicate   (std::move (key_predicate))
+            CPPLINQ_INLINEMETHOD sum_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder const & v)
-                :   key_predicate (v.key_predicate)
+            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD to_lookup_builder (to_lookup_builder && v) CPPLINQ_NOEXCEPT
-                :   key_predicate (std::move (v.key_predicate))
+            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD lookup<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                > build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
-                typedef lookup<
-                    typename get_transformed_type<key_predicate_type, typename TRange::value_type>::type
-                ,   typename TRange::value_type
-                >   result_type;
-
-                result_type result (16U, range, key_predicate);
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                return result;
+                auto sum = value_type ();
+                while (range.next ())
+                {
+                    sum += selector (range.front ());
+                }
+                return sum;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        template<typename TPredicate>
-        struct for_each_builder : base_builder
+        struct sum_builder : base_builder
         {
-            typedef                 for_each_builder<TPredicate>    this_type       ;
-            typedef                 TPredicate                      predicate_type  ;
+            typedef                 sum_builder                     this_type       ;
 
-            predicate_type          predicate;
+            CPPLINQ_CONSTEXPR sum_builder () CPPLINQ_NOEXCEPT
+            {
+            }
 
-            CPPLINQ_INLINEMETHOD explicit for_each_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate    (std::move (predicate))
+            CPPLINQ_CONSTEXPR sum_builder (sum_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_CONSTEXPR sum_builder (sum_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD for_each_builder (for_each_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR typename TRange::value_type build (TRange range) const
             {
+                return build (range, is_contiguous_range<TRange> ());
             }
 
+            template<typename TRange>
+            CPPLINQ_CONSTEXPR typename TRange::value_type build (TRange & range, std::false_type) const
+            {
+                typedef typename TRange::value_type value_type;
+
+                auto sum    = value_type ();
+                auto action = [&sum] (value_type const & v)
+                {
+                    sum += v;
+                };
+
+                for_each_element (range, action);
+
+                return sum;
+            }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD void build (TRange range) const
+            CPPLINQ_CONSTEXPR typename TRange::value_type build (TRange & range, std::true_type) const
             {
-                while (range.next ())
+                auto begin  = range.span_begin ();
+                auto size   = range.span_size ();
+
+                auto sum = typename TRange::value_type ();
+                for (size_type iter = 0U; iter < size; ++iter)
                 {
-                    predicate (range.front ());
+                    sum += begin[iter];
                 }
+                return sum;
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TPredicate>
-        struct first_predicate_builder : base_builder
+        template <typename TSelector>
+        struct max_selector_builder : base_builder
         {
-            typedef                 first_predicate_builder<TPredicate>     this_type           ;
-            typedef                 TPredicate                              predicate_type      ;
+            typedef                 max_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-            predicate_type          predicate   ;
+            selector_type           selector;
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD max_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_predicate_builder (first_predicate_builder && v) CPPLINQ_NOEXCEPT
-                : predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+
+                auto current = std::numeric_limits<value_type>::lowest ();
                 while (range.next ())
                 {
-                    if (predicate (range.front ()))
+                    auto v = selector (range.front ());
+                    if (current < v)
                     {
-                        return range.front ();
+                        current = std::move (v);
                     }
                 }
 
-                throw sequence_empty_exception ();
+                return current;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
-        struct first_builder : base_builder
+        struct max_builder : base_builder
         {
-            typedef                 first_builder                   this_type       ;
+            typedef                 max_builder                         this_type       ;
 
-            CPPLINQ_INLINEMETHOD first_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR max_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_builder (first_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR max_builder (max_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_builder (first_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR max_builder (max_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range)
+            CPPLINQ_CONSTEXPR typename TRange::value_type build (TRange range) const
             {
-                if (range.next ())
+                auto current = std::numeric_limits<typename TRange::value_type>::lowest ();
+                while (range.next ())
                 {
-                    return range.front ();
+                    typename TRange::return_type v = range.front ();
+                    if (current < v)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                throw sequence_empty_exception ();
+                return current;
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template<typename TPredicate>
-        struct first_or_default_predicate_builder : base_builder
+        template <typename TSelector>
+        struct min_selector_builder : base_builder
         {
-            typedef                 first_or_default_predicate_builder<TPredicate>  this_type       ;
-            typedef                 TPredicate                                      predicate_type  ;
+            typedef                 min_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-            predicate_type          predicate;
+            selector_type           selector;
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD min_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_predicate_builder (first_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
-                : predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+
+                auto current = std::numeric_limits<value_type>::max ();
                 while (range.next ())
                 {
-                    if (predicate (range.front ()))
+                    auto v = selector (range.front ());
+                    if (v < current)
                     {
-                        return range.front ();
+                        current = std::move (v);
                     }
                 }
 
-                return typename TRange::value_type ();
+                return current;
             }
 
         };
 
-
-        struct first_or_default_builder : base_builder
+        struct min_builder : base_builder
         {
-            typedef                 first_or_default_builder                   this_type       ;
+            typedef                 min_builder                         this_type       ;
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR min_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR min_builder (min_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD first_or_default_builder (first_or_default_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_CONSTEXPR min_builder (min_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_CONSTEXPR typename TRange::value_type build (TRange range) const
             {
-                if (range.next ())
+                auto current = std::numeric_limits<typename TRange::value_type>::max ();
+                while (range.next ())
                 {
-                    return range.front ();
+                    typename TRange::return_type v = range.front ();
+                    if (v < current)
+                    {
+                        current = std::move (v);
+                    }
                 }
 
-                return typename TRange::value_type ();
+                return current;
             }
 
         };
 
         // -------------------------------------------------------------------------
-        template<typename TPredicate>
-        struct last_or_default_predicate_builder : base_builder
+
+        template <typename TSelector>
+        struct avg_selector_builder : base_builder
         {
-            typedef                 last_or_default_predicate_builder<TPredicate>   this_type       ;
-            typedef                 TPredicate                                      predicate_type  ;
+            typedef                 avg_selector_builder<TSelector>     this_type       ;
+            typedef                 TSelector                           selector_type   ;
 
-            predicate_type          predicate;
+            selector_type           selector;
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (predicate_type predicate) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (predicate))
+            CPPLINQ_INLINEMETHOD avg_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+                :   selector (std::move (selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate (v.predicate)
+            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   selector (v.selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_predicate_builder (last_or_default_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   selector (std::move (v.selector))
             {
             }
 
+
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
             {
-                auto current = typename TRange::value_type ();
+                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
+                auto sum = value_type ();
+                int count = 0;
                 while (range.next ())
                 {
-                    if (predicate (range.front ()))
-                    {
-                        current = std::move (range.front ());
-                    }
+                    sum += selector (range.front ());
+                    ++count;
                 }
 
-                return current;
+                if (count == 0)
+                {
+                    return sum;
+                }
+
+                return sum/count;
             }
 
         };
 
-        struct last_or_default_builder : base_builder
+        struct avg_builder : base_builder
         {
-            typedef                 last_or_default_builder                   this_type       ;
+            typedef                 avg_builder                         this_type       ;
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD avg_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD avg_builder (avg_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD last_or_default_builder (last_or_default_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD avg_builder (avg_builder && v) CPPLINQ_NOEXCEPT
             {
             }
 
+
             template<typename TRange>
             CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
             {
-                auto current = typename TRange::value_type ();
-
+                auto sum = typename TRange::value_type ();
+                int  count = 0;
                 while (range.next ())
                 {
-                    current = std::move (range.front ());
+                    sum += range.front ();
+                    ++count;
                 }
 
-                return current;
+                if (count == 0)
+                {
+                    return sum;
+                }
+
+                return sum/count;
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TPredicate>
-        struct count_predicate_builder : base_builder
+#ifndef CPPLINQ_NO_PARALLEL
+        // Combiners merge the result of a part into the result of the parts
+        // before it
+
+        struct add_combiner
         {
-            typedef                 count_predicate_builder<TPredicate>     this_type       ;
-            typedef                 TPredicate                              predicate_type  ;
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD void operator() (TValue & result, TValue && other) const
+            {
+                result += other;
+            }
+        };
 
-            predicate_type          predicate   ;
+        struct max_combiner
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD void operator() (TValue & result, TValue && other) const
+            {
+                if (result < other)
+                {
+                    result = std::move (other);
+                }
+            }
+        };
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (predicate_type  predicate) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (predicate))
+        struct min_combiner
+        {
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD void operator() (TValue & result, TValue && other) const
+            {
+                if (other < result)
+                {
+                    result = std::move (other);
+                }
+            }
+        };
+
+        // Reduces a part with a sequential builder and combines the result
+        template<typename TBuilder, typename TCombiner>
+        struct part_reducer
+        {
+            TBuilder const *        builder     ;
+            TCombiner const *       combiner    ;
+
+            template<typename TResult, typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (TResult & result, TPart & part) const
             {
+                (*combiner) (result, builder->build (std::move (part)));
             }
+        };
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder const & v) CPPLINQ_NOEXCEPT
-                :   predicate   (v.predicate)
+        // par_reduce_builder reduces the parts of a splittable range with a
+        // sequential builder on an executor and combines the results of the
+        // parts. The result of an empty part seeds each part so the identity
+        // of the reduction is whatever the sequential builder yields for an
+        // empty range. Ranges that can't split are reduced by the sequential
+        // builder on the calling thread.
+        template<typename TBuilder, typename TCombiner>
+        struct par_reduce_builder : base_builder
+        {
+            typedef                 par_reduce_builder<TBuilder, TCombiner>     this_type       ;
+            typedef                 TBuilder                                    builder_type    ;
+            typedef                 TCombiner                                   combiner_type   ;
+
+            builder_type            builder     ;
+            combiner_type           combiner    ;
+            executor *              pool        ;
+
+            CPPLINQ_INLINEMETHOD par_reduce_builder (
+                    builder_type    builder
+                ,   combiner_type   combiner
+                ,   executor &      pool
+                ) CPPLINQ_NOEXCEPT
+                :   builder     (std::move (builder))
+                ,   combiner    (std::move (combiner))
+                ,   pool        (std::addressof (pool))
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_predicate_builder (count_predicate_builder && v) CPPLINQ_NOEXCEPT
-                :   predicate   (std::move (v.predicate))
+            CPPLINQ_INLINEMETHOD par_reduce_builder (par_reduce_builder const & v)
+                :   builder     (v.builder)
+                ,   combiner    (v.combiner)
+                ,   pool        (v.pool)
             {
             }
 
+            CPPLINQ_INLINEMETHOD par_reduce_builder (par_reduce_builder && v) CPPLINQ_NOEXCEPT
+                :   builder     (std::move (v.builder))
+                ,   combiner    (std::move (v.combiner))
+                ,   pool        (std::move (v.pool))
+            {
+            }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TBuilder, TRange>::type build (TRange range) const
             {
-                size_type count = 0U;
-                while (range.next ())
-                {
-                    if (predicate (range.front ()))
-                    {
-                        ++count;
-                    }
-                }
-                return count;
+                return build (range, std::integral_constant<bool, split_traits<TRange>::is_native != 0> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TBuilder, TRange>::type build (TRange & range, std::false_type) const
+            {
+                return builder.build (std::move (range));
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TBuilder, TRange>::type build (TRange & range, std::true_type) const
+            {
+                auto const empty = range.split (0U);
+
+                part_reducer<TBuilder, TCombiner> reducer = { std::addressof (builder), std::addressof (combiner) };
+
+                return split_reduce (
+                        *pool
+                    ,   range
+                    ,   0U
+                    ,   [&] () {return builder.build (empty);}
+                    ,   reducer
+                    ,   combiner
+                    );
             }
 
         };
 
-        struct count_builder : base_builder
+        template<typename TValue>
+        struct sum_count
         {
-            typedef                 count_builder                   this_type       ;
+            typedef                 TValue                  value_type  ;
 
-            CPPLINQ_INLINEMETHOD count_builder () CPPLINQ_NOEXCEPT
+            TValue                  sum     ;
+            int                     count   ;
+
+            CPPLINQ_INLINEMETHOD sum_count & operator+= (sum_count const & v)
             {
+                sum     += v.sum;
+                count   += v.count;
+                return *this;
             }
+        };
+
+        // Parts of par_avg, sums and counts in one pass like avg_builder does
 
-            CPPLINQ_INLINEMETHOD count_builder (count_builder const & v) CPPLINQ_NOEXCEPT
+        struct sum_count_builder : base_builder
+        {
+            typedef                 sum_count_builder                   this_type       ;
+
+            CPPLINQ_INLINEMETHOD sum_count_builder () CPPLINQ_NOEXCEPT
             {
             }
 
-            CPPLINQ_INLINEMETHOD count_builder (count_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sum_count_builder (sum_count_builder const & v) CPPLINQ_NOEXCEPT
             {
             }
 
+            CPPLINQ_INLINEMETHOD sum_count_builder (sum_count_builder && v) CPPLINQ_NOEXCEPT
+            {
+            }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD size_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD sum_count<typename TRange::value_type> build (TRange range) const
             {
-                size_type count = 0U;
+                sum_count<typename TRange::value_type> result = { typename TRange::value_type (), 0 };
                 while (range.next ())
                 {
-                    ++count;
+                    result.sum += range.front ();
+                    ++result.count;
                 }
-                return count;
+                return result;
             }
 
         };
 
-        // -------------------------------------------------------------------------
-
         template <typename TSelector>
-        struct sum_selector_builder : base_builder
+        struct sum_count_selector_builder : base_builder
         {
-            typedef                 sum_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 sum_count_selector_builder<TSelector>   this_type       ;
+            typedef                 TSelector                               selector_type   ;
 
             selector_type           selector;
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sum_count_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
                 :   selector (std::move (selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sum_count_selector_builder (sum_count_selector_builder const & v) CPPLINQ_NOEXCEPT
                 :   selector (v.selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_selector_builder (sum_selector_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD sum_count_selector_builder (sum_count_selector_builder && v) CPPLINQ_NOEXCEPT
                 :   selector (std::move (v.selector))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD sum_count<typename get_transformed_type<selector_type, typename TRange::value_type>::type> build (TRange range) const
             {
                 typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
 
-                auto sum = value_type ();
+                sum_count<value_type> result = { value_type (), 0 };
                 while (range.next ())
                 {
-                    sum += selector (range.front ());
+                    result.sum += selector (range.front ());
+                    ++result.count;
                 }
-                return sum;
+                return result;
             }
 
         };
 
-        struct sum_builder : base_builder
+        template <typename TPartBuilder>
+        struct par_avg_builder : base_builder
         {
-            typedef                 sum_builder                     this_type       ;
+            typedef                 par_avg_builder<TPartBuilder>                   this_type       ;
+            typedef                 par_reduce_builder<TPartBuilder, add_combiner>  reduce_type     ;
 
-            CPPLINQ_INLINEMETHOD sum_builder () CPPLINQ_NOEXCEPT
+            reduce_type             reduce  ;
+
+            CPPLINQ_INLINEMETHOD par_avg_builder (TPartBuilder part_builder, executor & pool) CPPLINQ_NOEXCEPT
+                :   reduce (std::move (part_builder), add_combiner (), pool)
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_builder (sum_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD par_avg_builder (par_avg_builder const & v)
+                :   reduce (v.reduce)
             {
             }
 
-            CPPLINQ_INLINEMETHOD sum_builder (sum_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD par_avg_builder (par_avg_builder && v) CPPLINQ_NOEXCEPT
+                :   reduce (std::move (v.reduce))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPartBuilder, TRange>::type::value_type build (TRange range) const
             {
-                auto sum = typename TRange::value_type ();
-                while (range.next ())
+                auto result = reduce.build (std::move (range));
+
+                if (result.count == 0)
                 {
-                    sum += range.front ();
+                    return result.sum;
                 }
-                return sum;
+
+                return result.sum/result.count;
             }
 
         };
+#endif
 
         // -------------------------------------------------------------------------
 
-        template <typename TSelector>
-        struct max_selector_builder : base_builder
+        template <typename TAccumulate, typename TAccumulator>
+        struct aggregate_builder : base_builder
         {
-            typedef                 max_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
+            typedef                 aggregate_builder<TAccumulate, TAccumulator>    this_type       ;
+            typedef                 TAccumulator                                    accumulator_type;
+            typedef                 TAccumulate                                     seed_type;
 
-            selector_type           selector;
+            seed_type               seed;
+            accumulator_type        accumulator;
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD aggregate_builder (seed_type seed, accumulator_type accumulator) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (seed))
+                ,   accumulator (std::move (accumulator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder const & v) CPPLINQ_NOEXCEPT
+                :   seed        (v.seed)
+                ,   accumulator (v.accumulator)
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_selector_builder (max_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder && v) CPPLINQ_NOEXCEPT
+                :   seed        (std::move (v.seed))
+                ,   accumulator (std::move (v.accumulator))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
-
-                auto current = std::numeric_limits<value_type>::lowest ();
+                auto sum = seed;
                 while (range.next ())
                 {
-                    auto v = selector (range.front ());
-                    if (current < v)
-                    {
-                        current = std::move (v);
-                    }
+                    sum = accumulator (sum, range.front ());
                 }
-
-                return current;
+                return sum;
             }
 
         };
 
-        struct max_builder : base_builder
+        template <typename TAccumulate, typename TAccumulator, typename TSelector>
+        struct aggregate_result_selector_builder : base_builder
         {
-            typedef                 max_builder                         this_type       ;
+            typedef                 aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> this_type       ;
+            typedef                 TAccumulator                                                            accumulator_type;
+            typedef                 TAccumulate                                                             seed_type;
+            typedef                 TSelector                                                               result_selector_type;
+
+            seed_type               seed;
+            accumulator_type        accumulator;
+            result_selector_type    result_selector;
 
-            CPPLINQ_INLINEMETHOD max_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (seed_type seed, accumulator_type accumulator, result_selector_type result_selector) CPPLINQ_NOEXCEPT
+                :   seed            (std::move (seed))
+                ,   accumulator     (std::move (accumulator))
+                ,   result_selector (std::move (result_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_builder (max_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder const & v) CPPLINQ_NOEXCEPT
+                :   seed            (v.seed)
+                ,   accumulator     (v.accumulator)
+                ,   result_selector (v.result_selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD max_builder (max_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   seed            (std::move (v.seed))
+                ,   accumulator     (std::move (v.accumulator))
+                ,   result_selector (std::move (v.result_selector))
             {
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD auto build (TRange range) const -> decltype (result_selector (seed))
             {
-                auto current = std::numeric_limits<typename TRange::value_type>::lowest ();
+                auto sum = seed;
                 while (range.next ())
                 {
-                    auto v = range.front ();
-                    if (current < v)
-                    {
-                        current = std::move (v);
-                    }
+                    sum = accumulator (sum, range.front ());
                 }
 
-                return current;
+                return result_selector (sum);
             }
 
         };
 
+#ifndef CPPLINQ_NO_PARALLEL
         // -------------------------------------------------------------------------
 
-        template <typename TSelector>
-        struct min_selector_builder : base_builder
+        // Folds the elements of a part into an accumulator like aggregate does
+        template<typename TAccumulator>
+        struct accumulate_elements
         {
-            typedef                 min_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
-
-            selector_type           selector;
+            TAccumulator const *    accumulator ;
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            template<typename TAccumulate, typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (TAccumulate & sum, TPart & part) const
             {
+                while (part.next ())
+                {
+                    sum = (*accumulator) (sum, part.front ());
+                }
             }
+        };
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
-            {
-            }
+        // A slot per thread that takes part in a parallel operation, created by
+        // factory the first time the thread asks for it. Threads look up theirs
+        // once per part.
+        template<typename TSlot, typename TFactory>
+        struct thread_slots
+        {
+            typedef                 std::pair<std::thread::id, TSlot>           slot_type   ;
 
-            CPPLINQ_INLINEMETHOD min_selector_builder (min_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            TFactory const *        factory         ;
+            std::mutex              lock            ;
+            std::list<slot_type>    slots           ;
+
+            CPPLINQ_INLINEMETHOD explicit thread_slots (TFactory const & factory) CPPLINQ_NOEXCEPT
+                :   factory         (std::addressof (factory))
             {
             }
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD TSlot & get_slot ()
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+                auto id = std::this_thread::get_id ();
 
-                auto current = std::numeric_limits<value_type>::max ();
-                while (range.next ())
+                std::lock_guard<std::mutex> guard (lock);
+                for (auto & slot : slots)
                 {
-                    auto v = selector (range.front ());
-                    if (v < current)
+                    if (slot.first == id)
                     {
-                        current = std::move (v);
+                        return slot.second;
                     }
                 }
 
-                return current;
+                slots.push_back (slot_type (id, (*factory) ()));
+                return slots.back ().second;
             }
 
+        private:
+            thread_slots (thread_slots const &);
+            thread_slots & operator= (thread_slots const &);
         };
 
-        struct min_builder : base_builder
+        // An accumulator per thread that takes part in a parallel_unordered
+        // aggregate
+        template<typename TAccumulate, typename TSeedFactory, typename TAccumulator>
+        struct thread_accumulators : thread_slots<TAccumulate, TSeedFactory>
         {
-            typedef                 min_builder                         this_type       ;
+            TAccumulator const *    accumulator     ;
 
-            CPPLINQ_INLINEMETHOD min_builder () CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD thread_accumulators (
+                    TSeedFactory const &    seed_factory
+                ,   TAccumulator const &    accumulator
+                ) CPPLINQ_NOEXCEPT
+                :   thread_slots<TAccumulate, TSeedFactory> (seed_factory)
+                ,   accumulator     (std::addressof (accumulator))
             {
             }
 
-            CPPLINQ_INLINEMETHOD min_builder (min_builder const & v) CPPLINQ_NOEXCEPT
+            template<typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (bool &, TPart & part)
             {
+                accumulate_elements<TAccumulator> accumulate = { accumulator };
+                accumulate (this->get_slot (), part);
             }
+        };
 
-            CPPLINQ_INLINEMETHOD min_builder (min_builder && v) CPPLINQ_NOEXCEPT
+        // Aggregates a range with an accumulator per part or per thread (see
+        // parallel_mode) and merges them with combiner (sum, other). Ranges that
+        // can't split are aggregated on the calling thread.
+        template <typename TSeedFactory, typename TAccumulator, typename TCombiner>
+        struct parallel_aggregate_builder : base_builder
+        {
+            typedef                 parallel_aggregate_builder<TSeedFactory, TAccumulator, TCombiner>   this_type           ;
+            typedef                 TSeedFactory                                                        seed_factory_type   ;
+            typedef                 TAccumulator                                                        accumulator_type    ;
+            typedef                 TCombiner                                                           combiner_type       ;
+
+            static TSeedFactory get_seed_factory ();
+
+            typedef        typename cleanup_type<decltype (get_seed_factory () ())>::type                  seed_type           ;
+
+            seed_factory_type       seed_factory    ;
+            accumulator_type        accumulator     ;
+            combiner_type           combiner        ;
+            parallel_mode           mode            ;
+            executor *              pool            ;
+
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (
+                    seed_factory_type   seed_factory
+                ,   accumulator_type    accumulator
+                ,   combiner_type       combiner
+                ,   parallel_mode       mode
+                ,   executor &          pool
+                ) CPPLINQ_NOEXCEPT
+                :   seed_factory    (std::move (seed_factory))
+                ,   accumulator     (std::move (accumulator))
+                ,   combiner        (std::move (combiner))
+                ,   mode            (mode)
+                ,   pool            (std::addressof (pool))
             {
             }
 
-
-            template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (parallel_aggregate_builder const & v)
+                :   seed_factory    (v.seed_factory)
+                ,   accumulator     (v.accumulator)
+                ,   combiner        (v.combiner)
+                ,   mode            (v.mode)
+                ,   pool            (v.pool)
             {
-                auto current = std::numeric_limits<typename TRange::value_type>::max ();
-                while (range.next ())
-                {
-                    auto v = range.front ();
-                    if (v < current)
-                    {
-                        current = std::move (v);
-                    }
-                }
-
-                return current;
             }
 
-        };
-
-        // -------------------------------------------------------------------------
-
-        template <typename TSelector>
-        struct avg_selector_builder : base_builder
-        {
-            typedef                 avg_selector_builder<TSelector>     this_type       ;
-            typedef                 TSelector                           selector_type   ;
-
-            selector_type           selector;
-
-            CPPLINQ_INLINEMETHOD avg_selector_builder (selector_type selector) CPPLINQ_NOEXCEPT
-                :   selector (std::move (selector))
+            CPPLINQ_INLINEMETHOD parallel_aggregate_builder (parallel_aggregate_builder && v) CPPLINQ_NOEXCEPT
+                :   seed_factory    (std::move (v.seed_factory))
+                ,   accumulator     (std::move (v.accumulator))
+                ,   combiner        (std::move (v.combiner))
+                ,   mode            (std::move (v.mode))
+                ,   pool            (std::move (v.pool))
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   selector (v.selector)
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
             {
+                return build (range, std::integral_constant<bool, split_traits<TRange>::is_native != 0> ());
             }
 
-            CPPLINQ_INLINEMETHOD avg_selector_builder (avg_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   selector (std::move (v.selector))
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD seed_type build (TRange & range, std::false_type) const
             {
+                auto sum = seed_factory ();
+                accumulate_elements<TAccumulator> accumulate = { std::addressof (accumulator) };
+                accumulate (sum, range);
+                return sum;
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename get_transformed_type<selector_type, typename TRange::value_type>::type build (TRange range) const
+            CPPLINQ_INLINEMETHOD seed_type build (TRange & range, std::true_type) const
             {
-                typedef typename get_transformed_type<selector_type, typename TRange::value_type>::type value_type;
+                if (mode == parallel_ordered)
+                {
+                    accumulate_elements<TAccumulator> accumulate = { std::addressof (accumulator) };
+                    return split_reduce (
+                            *pool
+                        ,   range
+                        ,   0U
+                        ,   [this] () {return seed_factory ();}
+                        ,   accumulate
+                        ,   [this] (seed_type & sum, seed_type && other) {sum = combiner (sum, std::move (other));}
+                        );
+                }
 
-                auto sum = value_type ();
-                int count = 0;
-                while (range.next ())
+                // The parts accumulate into the slots, there is nothing to reduce
+                thread_accumulators<seed_type, TSeedFactory, TAccumulator> accumulators (seed_factory, accumulator);
+                split_reduce (
+                        *pool
+                    ,   range
+                    ,   0U
+                    ,   [] () {return false;}
+                    ,   std::ref (accumulators)
+                    ,   [] (bool &, bool &&) {}
+                    );
+
+                auto & slots = accumulators.slots;
+                if (slots.empty ())
                 {
-                    sum += selector (range.front ());
-                    ++count;
+                    return seed_factory ();
                 }
 
-                if (count == 0)
+                auto sum = std::move (slots.front ().second);
+                for (auto iter = std::next (slots.begin ()); iter != slots.end (); ++iter)
                 {
-                    return sum;
+                    sum = combiner (sum, std::move (iter->second));
                 }
 
-                return sum/count;
+                return sum;
             }
 
         };
 
-        struct avg_builder : base_builder
+        template <typename TSeedFactory, typename TAccumulator, typename TCombiner, typename TSelector>
+        struct parallel_aggregate_result_selector_builder : base_builder
         {
-            typedef                 avg_builder                         this_type       ;
+            typedef                 parallel_aggregate_result_selector_builder<TSeedFactory, TAccumulator, TCombiner, TSelector>    this_type           ;
+            typedef                 parallel_aggregate_builder<TSeedFactory, TAccumulator, TCombiner>                               aggregate_type      ;
+            typedef                 TSelector                                                                                       result_selector_type;
 
-            CPPLINQ_INLINEMETHOD avg_builder () CPPLINQ_NOEXCEPT
+            static TSelector get_result_selector ();
+            static typename aggregate_type::seed_type get_seed ();
+
+            typedef                 decltype (get_result_selector () (get_seed ()))                                                result_type         ;
+
+            aggregate_type          aggregate       ;
+            result_selector_type    result_selector ;
+
+            CPPLINQ_INLINEMETHOD parallel_aggregate_result_selector_builder (aggregate_type aggregate, result_selector_type result_selector) CPPLINQ_NOEXCEPT
+                :   aggregate       (std::move (aggregate))
+                ,   result_selector (std::move (result_selector))
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_builder (avg_builder const & v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD parallel_aggregate_result_selector_builder (parallel_aggregate_result_selector_builder const & v)
+                :   aggregate       (v.aggregate)
+                ,   result_selector (v.result_selector)
             {
             }
 
-            CPPLINQ_INLINEMETHOD avg_builder (avg_builder && v) CPPLINQ_NOEXCEPT
+            CPPLINQ_INLINEMETHOD parallel_aggregate_result_selector_builder (parallel_aggregate_result_selector_builder && v) CPPLINQ_NOEXCEPT
+                :   aggregate       (std::move (v.aggregate))
+                ,   result_selector (std::move (v.result_selector))
             {
             }
 
-
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD result_type build (TRange range) const
             {
-                auto sum = typename TRange::value_type ();
-                int  count = 0;
-                while (range.next ())
-                {
-                    sum += range.front ();
-                    ++count;
-                }
-
-                if (count == 0)
-                {
-                    return sum;
-                }
-
-                return sum/count;
+                return result_selector (aggregate.build (std::move (range)));
             }
 
         };
 
         // -------------------------------------------------------------------------
 
-        template <typename TAccumulate, typename TAccumulator>
-        struct aggregate_builder : base_builder
+        // Calls action for the elements of a part
+        template<typename TAction>
+        struct apply_action
         {
-            typedef                 aggregate_builder<TAccumulate, TAccumulator>    this_type       ;
-            typedef                 TAccumulator                                    accumulator_type;
-            typedef                 TAccumulate                                     seed_type;
+            TAction const *         action      ;
 
-            seed_type               seed;
-            accumulator_type        accumulator;
+            template<typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (bool &, TPart & part) const
+            {
+                for_each_element (part, *action);
+            }
+        };
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (seed_type seed, accumulator_type accumulator) CPPLINQ_NOEXCEPT
-                :   seed        (std::move (seed))
-                ,   accumulator (std::move (accumulator))
+        template<typename TAction>
+        struct par_for_each_builder : base_builder
+        {
+            typedef                 par_for_each_builder<TAction>   this_type       ;
+            typedef                 TAction                         action_type     ;
+
+            action_type             action      ;
+            executor *              pool        ;
+
+            CPPLINQ_INLINEMETHOD par_for_each_builder (action_type action, executor & pool) CPPLINQ_NOEXCEPT
+                :   action      (std::move (action))
+                ,   pool        (std::addressof (pool))
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder const & v) CPPLINQ_NOEXCEPT
-                :   seed        (v.seed)
-                ,   accumulator (v.accumulator)
+            CPPLINQ_INLINEMETHOD par_for_each_builder (par_for_each_builder const & v)
+                :   action      (v.action)
+                ,   pool        (v.pool)
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_builder (aggregate_builder && v) CPPLINQ_NOEXCEPT
-                :   seed        (std::move (v.seed))
-                ,   accumulator (std::move (v.accumulator))
+            CPPLINQ_INLINEMETHOD par_for_each_builder (par_for_each_builder && v) CPPLINQ_NOEXCEPT
+                :   action      (std::move (v.action))
+                ,   pool        (std::move (v.pool))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD seed_type build (TRange range) const
+            CPPLINQ_INLINEMETHOD void build (TRange range) const
             {
-                auto sum = seed;
-                while (range.next ())
-                {
-                    sum = accumulator (sum, range.front ());
-                }
-                return sum;
+                build (range, std::integral_constant<bool, split_traits<TRange>::is_native != 0> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD void build (TRange & range, std::false_type) const
+            {
+                for_each_element (range, action);
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD void build (TRange & range, std::true_type) const
+            {
+                apply_action<TAction> apply = { std::addressof (action) };
+                split_reduce (
+                        *pool
+                    ,   range
+                    ,   0U
+                    ,   [] () {return false;}
+                    ,   apply
+                    ,   [] (bool &, bool &&) {}
+                    );
             }
 
         };
 
-        template <typename TAccumulate, typename TAccumulator, typename TSelector>
-        struct aggregate_result_selector_builder : base_builder
+        // Passes the state of a thread along with each element to action
+        template<typename TState, typename TAction>
+        struct state_action
         {
-            typedef                 aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> this_type       ;
-            typedef                 TAccumulator                                                            accumulator_type;
-            typedef                 TAccumulate                                                             seed_type;
-            typedef                 TSelector                                                               result_selector_type;
+            TState &                state       ;
+            TAction const &         action      ;
 
-            seed_type               seed;
-            accumulator_type        accumulator;
-            result_selector_type    result_selector;
+            template<typename TValue>
+            CPPLINQ_INLINEMETHOD void operator() (TValue && v) const
+            {
+                action (state, std::forward<TValue> (v));
+            }
+        };
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (seed_type seed, accumulator_type accumulator, result_selector_type result_selector) CPPLINQ_NOEXCEPT
-                :   seed            (std::move (seed))
-                ,   accumulator     (std::move (accumulator))
-                ,   result_selector (std::move (result_selector))
+        // A state per thread that takes part in a par_for_each, action is
+        // called with the state of the thread and an element
+        template<typename TState, typename TInit, typename TAction>
+        struct thread_states : thread_slots<TState, TInit>
+        {
+            TAction const *         action          ;
+
+            CPPLINQ_INLINEMETHOD thread_states (
+                    TInit const &       init
+                ,   TAction const &     action
+                ) CPPLINQ_NOEXCEPT
+                :   thread_slots<TState, TInit> (init)
+                ,   action          (std::addressof (action))
             {
             }
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder const & v) CPPLINQ_NOEXCEPT
-                :   seed            (v.seed)
-                ,   accumulator     (v.accumulator)
-                ,   result_selector (v.result_selector)
+            template<typename TPart>
+            CPPLINQ_INLINEMETHOD void operator() (bool &, TPart & part)
             {
+                state_action<TState, TAction> apply = { this->get_slot (), *action };
+                for_each_element (part, apply);
             }
+        };
 
-            CPPLINQ_INLINEMETHOD aggregate_result_selector_builder (aggregate_result_selector_builder && v) CPPLINQ_NOEXCEPT
-                :   seed            (std::move (v.seed))
-                ,   accumulator     (std::move (v.accumulator))
-                ,   result_selector (std::move (v.result_selector))
+        // par_for_each with a state per thread, init creates the state of a
+        // thread when it gets its first part. Once all elements are done the
+        // states are passed to finalize on the calling thread, also when an
+        // action threw so that resources held by the states are released.
+        template<typename TInit, typename TAction, typename TFinalize>
+        struct par_for_each_state_builder : base_builder
+        {
+            typedef                 par_for_each_state_builder<TInit, TAction, TFinalize>  this_type       ;
+            typedef                 TInit                                                   init_type       ;
+            typedef                 TAction                                                 action_type     ;
+            typedef                 TFinalize                                               finalize_type   ;
+
+            static TInit get_init ();
+
+            typedef        typename cleanup_type<decltype (get_init () ())>::type          state_type      ;
+
+            init_type               init        ;
+            action_type             action      ;
+            finalize_type           finalize    ;
+            executor *              pool        ;
+
+            CPPLINQ_INLINEMETHOD par_for_each_state_builder (
+                    init_type       init
+                ,   action_type     action
+                ,   finalize_type   finalize
+                ,   executor &      pool
+                ) CPPLINQ_NOEXCEPT
+                :   init        (std::move (init))
+                ,   action      (std::move (action))
+                ,   finalize    (std::move (finalize))
+                ,   pool        (std::addressof (pool))
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_for_each_state_builder (par_for_each_state_builder const & v)
+                :   init        (v.init)
+                ,   action      (v.action)
+                ,   finalize    (v.finalize)
+                ,   pool        (v.pool)
+            {
+            }
+
+            CPPLINQ_INLINEMETHOD par_for_each_state_builder (par_for_each_state_builder && v) CPPLINQ_NOEXCEPT
+                :   init        (std::move (v.init))
+                ,   action      (std::move (v.action))
+                ,   finalize    (std::move (v.finalize))
+                ,   pool        (std::move (v.pool))
             {
             }
 
             template<typename TRange>
-            CPPLINQ_INLINEMETHOD auto build (TRange range) const -> decltype (result_selector (seed))
+            CPPLINQ_INLINEMETHOD void build (TRange range) const
             {
-                auto sum = seed;
-                while (range.next ())
+                thread_states<state_type, TInit, TAction> states (init, action);
+
+                try
                 {
-                    sum = accumulator (sum, range.front ());
+                    run (range, states, std::integral_constant<bool, split_traits<TRange>::is_native != 0> ());
+                }
+                catch (...)
+                {
+                    for (auto & slot : states.slots)
+                    {
+                        try
+                        {
+                            finalize (slot.second);
+                        }
+                        catch (...)
+                        {
+                        }
+                    }
+                    throw;
                 }
 
-                return result_selector (sum);
+                for (auto & slot : states.slots)
+                {
+                    finalize (slot.second);
+                }
+            }
+
+        private:
+            // Ranges that can't split run on the calling thread with one state
+            template<typename TRange, typename TStates>
+            CPPLINQ_INLINEMETHOD void run (TRange & range, TStates & states, std::false_type) const
+            {
+                auto unused = false;
+                states (unused, range);
+            }
+
+            template<typename TRange, typename TStates>
+            CPPLINQ_INLINEMETHOD void run (TRange & range, TStates & states, std::true_type) const
+            {
+                split_reduce (
+                        *pool
+                    ,   range
+                    ,   0U
+                    ,   [] () {return false;}
+                    ,   std::ref (states)
+                    ,   [] (bool &, bool &&) {}
+                    );
             }
 
         };
+#endif
 
         // -------------------------------------------------------------------------
 
@@ -4425,6 +11629,19 @@ namespace cpplinq
 
             template <typename TRange>
             CPPLINQ_INLINEMETHOD bool build (TRange range) const
+            {
+                return build (
+                        range
+                    ,   std::integral_constant<
+                                bool
+                            ,   is_contiguous_range<TRange>::value
+                            &&  is_contiguous_range<other_range_type>::value
+                            > ()
+                    );
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange & range, std::false_type) const
             {
                 auto copy = other_range;
                 for (;;)
@@ -4438,17 +11655,77 @@ namespace cpplinq
                         return false;
                     }
 
-                    // both sequences are over, next1 = next2 = false
-                    if (!next1)
-                    {
-                        return true;
-                    }
+                    // both sequences are over, next1 = next2 = false
+                    if (!next1)
+                    {
+                        return true;
+                    }
+
+                    if (range.front () != copy.front ())
+                    {
+                        return false;
+                    }
+                }
+            }
+
+            template <typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange & range, std::true_type) const
+            {
+                typedef typename TRange::value_type             value_type          ;
+                typedef typename other_range_type::value_type   other_value_type    ;
+
+                auto size = range.span_size ();
+
+                // sequences are not of same length
+                if (size != other_range.span_size ())
+                {
+                    return false;
+                }
+
+                auto begin          = range.span_begin ();
+                auto other_begin    = other_range.span_begin ();
+
+                return compare_spans (
+                        begin
+                    ,   other_begin
+                    ,   size
+                    ,   std::integral_constant<
+                                bool
+                            ,   std::is_same<value_type, other_value_type>::value
+                            &&  std::is_integral<value_type>::value
+                            > ()
+                    );
+            }
 
-                    if (range.front () != copy.front ())
+            // Integral elements have no padding, so equality is bytewise
+            template <typename TValue>
+            static CPPLINQ_INLINEMETHOD bool compare_spans (
+                    TValue const *  begin
+                ,   TValue const *  other_begin
+                ,   size_type       size
+                ,   std::true_type
+                ) CPPLINQ_NOEXCEPT
+            {
+                return size == 0U || std::memcmp (begin, other_begin, size * sizeof (TValue)) == 0;
+            }
+
+            template <typename TValue, typename TOtherValue>
+            static CPPLINQ_INLINEMETHOD bool compare_spans (
+                    TValue const *      begin
+                ,   TOtherValue const * other_begin
+                ,   size_type           size
+                ,   std::false_type
+                )
+            {
+                for (size_type iter = 0U; iter < size; ++iter)
+                {
+                    if (begin[iter] != other_begin[iter])
                     {
                         return false;
                     }
                 }
+
+                return true;
             }
         };
 
@@ -4507,7 +11784,7 @@ namespace cpplinq
                             );
                     }
 
-                    auto v = range.front ();
+                    auto const & v = range.front ();
 
                     buffer.insert (
                             buffer.end ()
@@ -4552,12 +11829,7 @@ namespace cpplinq
             template<typename TRange>
             CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                bool any = false;
-                while (range.next () && !any)
-                {
-                    any = predicate (range.front ());
-                }
-                return any;
+                return find_element (range, predicate);
             }
         };
 
@@ -4614,15 +11886,12 @@ namespace cpplinq
             template<typename TRange>
             CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                while (range.next ())
+                auto fails = [this] (typename TRange::value_type const & v)
                 {
-                    if (!predicate (range.front ()))
-                    {
-                        return false;
-                    }
-                }
+                    return !predicate (v);
+                };
 
-                return true;
+                return !find_element (range, fails);
             }
         };
 
@@ -4655,15 +11924,27 @@ namespace cpplinq
             template<typename TRange>
             CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                while (range.next ())
+                return build (range, is_contiguous_range<TRange> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange & range, std::false_type) const
+            {
+                auto equals = [this] (typename TRange::value_type const & v)
                 {
-                    if (range.front () == value)
-                    {
-                        return true;
-                    }
-                }
+                    return v == value;
+                };
 
-                return false;
+                return find_element (range, equals);
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD bool build (TRange & range, std::true_type) const
+            {
+                auto begin  = range.span_begin ();
+                auto end    = begin + range.span_size ();
+
+                return std::find (begin, end, value) != end;
             }
 
         };
@@ -4700,15 +11981,12 @@ namespace cpplinq
             template<typename TRange>
             CPPLINQ_INLINEMETHOD bool build (TRange range) const
             {
-                while (range.next ())
+                auto equals = [this] (typename TRange::value_type const & v)
                 {
-                    if (predicate (range.front (), value))
-                    {
-                        return true;
-                    }
-                }
+                    return predicate (v, value);
+                };
 
-                return false;
+                return find_element (range, equals);
             }
 
         };
@@ -4739,6 +12017,23 @@ namespace cpplinq
 
             template<typename TRange>
             CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange range) const
+            {
+                return build (range, is_random_access_range<TRange> ());
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange & range, std::true_type) const
+            {
+                if (index < range.size ())
+                {
+                    return range.at (index);
+                }
+
+                return typename TRange::value_type ();
+            }
+
+            template<typename TRange>
+            CPPLINQ_INLINEMETHOD typename TRange::value_type build (TRange & range, std::false_type) const
             {
                 size_type current = 0U;
 
@@ -4770,17 +12065,16 @@ namespace cpplinq
 
             typedef                 typename TRange::value_type                 element_type        ;
             typedef                 std::pair<element_type,element_type>        value_type          ;
-            typedef                 value_type                                  return_type         ;
+            typedef                 value_type const &                          return_type         ;
 
             enum
             {
-                returns_reference   = 0     ,
+                returns_reference   = 1     ,
             };
 
 
             range_type                   range               ;
-            opt<element_type>            previous            ;
-            opt<element_type>            current             ;
+            opt<value_type>              current             ;
 
             CPPLINQ_INLINEMETHOD pairwise_range (
                     range_type          range
@@ -4791,57 +12085,69 @@ namespace cpplinq
 
             CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range const & v) CPPLINQ_NOEXCEPT
                 :   range               (v.range)
-                ,   previous            (v.previous)
                 ,   current             (v.current)
             {
             }
 
             CPPLINQ_INLINEMETHOD pairwise_range (pairwise_range && v) CPPLINQ_NOEXCEPT
                 :   range               (std::move (v.range))
-                ,   previous            (std::move (v.previous))
                 ,   current             (std::move (v.current))
             {
             }
 
             template<typename TPairwiseBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPairwiseBuilder, this_type>::type operator>>(TPairwiseBuilder pairwise_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPairwiseBuilder, this_type>::type operator>>(TPairwiseBuilder pairwise_builder) CPPLINQ_LVALUE_THIS
             {
                 return pairwise_builder.build (*this);
             }
 
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TPairwiseBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TPairwiseBuilder, this_type>::type operator>>(TPairwiseBuilder pairwise_builder) &&
+            {
+                return pairwise_builder.build (std::move (*this));
+            }
+#endif
+
             CPPLINQ_INLINEMETHOD return_type front () const
             {
-                CPPLINQ_ASSERT (previous.has_value ());
                 CPPLINQ_ASSERT (current.has_value ());
-                return std::make_pair (previous.get (), current.get ());
+                return current.get ();
             }
 
             CPPLINQ_INLINEMETHOD bool next ()
             {
-                if (!previous.has_value ())
+                // Each element is copied once, into second, and then moved into first
+                if (current.has_value ())
                 {
                     if (range.next ())
                     {
-                        current = range.front ();
-                    }
-                    else
-                    {
-                        return false;
+                        auto & pair = current.get ();
+                        pair.first  = std::move (pair.second);
+                        pair.second = range.front ();
+                        return true;
                     }
+
+                    current.clear ();
+
+                    return false;
                 }
 
-                previous.swap (current);
+                if (!range.next ())
+                {
+                    return false;
+                }
 
-                if (range.next ())
+                element_type first = range.front ();
+
+                if (!range.next ())
                 {
-                    current = range.front ();
-                    return true;
+                    return false;
                 }
 
-                previous.clear ();
-                current.clear ();
+                current = value_type (std::move (first), range.front ());
 
-                return false;
+                return true;
             }
         };
 
@@ -4880,14 +12186,27 @@ namespace cpplinq
             typedef    typename cleanup_type<typename TRange::value_type>::type         left_element_type  ;
             typedef    typename cleanup_type<typename TOtherRange::value_type>::type    right_element_type ;
             typedef             std::pair<left_element_type,right_element_type>         value_type         ;
-            typedef             value_type                                              return_type        ;
+            typedef             value_type const &                                      return_type        ;
+            typedef             zip_with_range<
+                    typename split_traits<TRange>::split_type
+                ,   typename split_traits<TOtherRange>::split_type
+                >                                                                       split_type         ;
             enum
             {
-                returns_reference   = 0 ,
+                returns_reference   = 1 ,
+                supports_split      = split_traits<TRange>::is_native && split_traits<TOtherRange>::is_native,
+                size_hint_kind      =
+                        size_hint_traits<TRange>::kind == size_hint_exact && size_hint_traits<TOtherRange>::kind == size_hint_exact
+                    ?   size_hint_exact
+                    :   size_hint_traits<TRange>::kind == size_hint_none && size_hint_traits<TOtherRange>::kind == size_hint_none
+                    ?   size_hint_none
+                    :   size_hint_upper_bound
+                    ,
             };
 
             range_type                  range               ;
             other_range_type            other_range         ;
+            opt<value_type>             cache_value         ;
 
             CPPLINQ_INLINEMETHOD zip_with_range (
                         range_type          range
@@ -4901,29 +12220,70 @@ namespace cpplinq
             CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range const & v) CPPLINQ_NOEXCEPT
                 :   range               (v.range)
                 ,   other_range         (v.other_range)
+                ,   cache_value         (v.cache_value)
             {
             }
 
             CPPLINQ_INLINEMETHOD zip_with_range (zip_with_range && v) CPPLINQ_NOEXCEPT
                 :   range               (std::move (v.range))
                 ,   other_range         (std::move (v.other_range))
+                ,   cache_value         (std::move (v.cache_value))
             {
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
             CPPLINQ_INLINEMETHOD return_type front () const
             {
-                return std::make_pair (range.front (), other_range.front ());
+                CPPLINQ_ASSERT (cache_value);
+                return *cache_value;
             }
 
             CPPLINQ_INLINEMETHOD bool next ()
             {
-                return range.next () && other_range.next ();
+                if (range.next () && other_range.next ())
+                {
+                    cache_value = value_type (range.front (), other_range.front ());
+                    return true;
+                }
+
+                cache_value.clear ();
+
+                return false;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type size_hint () const CPPLINQ_NOEXCEPT
+            {
+                // Ranges without a size hint report invalid_size which never wins
+                auto hint       = size_hint_traits<TRange>::size_hint (range);
+                auto other_hint = size_hint_traits<TOtherRange>::size_hint (other_range);
+                return hint < other_hint ? hint : other_hint;
+            }
+
+            CPPLINQ_INLINEMETHOD size_type split_size () const CPPLINQ_NOEXCEPT
+            {
+                auto size       = range.split_size ();
+                auto other_size = other_range.split_size ();
+                return size < other_size ? size : other_size;
+            }
+
+            // Both sides split at the same position so the parts stay aligned
+            CPPLINQ_INLINEMETHOD split_type split (size_type count)
+            {
+                cache_value.clear ();
+                return split_type (range.split (count), other_range.split (count));
             }
         };
 
@@ -5002,11 +12362,19 @@ namespace cpplinq
             }
 
             template<typename TRangeBuilder>
-            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) const
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) CPPLINQ_LVALUE_THIS
             {
                 return range_builder.build (*this);
             }
 
+#if CPPLINQ_RVALUE_OPERATORS
+            template<typename TRangeBuilder>
+            CPPLINQ_INLINEMETHOD typename get_builtup_type<TRangeBuilder, this_type>::type operator>>(TRangeBuilder range_builder) &&
+            {
+                return range_builder.build (std::move (*this));
+            }
+#endif
+
             CPPLINQ_INLINEMETHOD return_type front () const
             {
                 CPPLINQ_ASSERT (current_value);
@@ -5090,34 +12458,247 @@ namespace cpplinq
     // Restriction operators
 
     template<typename TPredicate>
-    CPPLINQ_INLINEMETHOD detail::where_builder<TPredicate> where (
+    CPPLINQ_CONSTEXPR detail::where_builder<TPredicate> where (
+            TPredicate      predicate
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::where_builder<TPredicate> (std::move (predicate));
+    }
+
+    // Projection operators
+
+    CPPLINQ_INLINEMETHOD detail::ref_builder ref () CPPLINQ_NOEXCEPT
+    {
+        return detail::ref_builder ();
+    }
+
+    template<typename TPredicate>
+    CPPLINQ_CONSTEXPR detail::select_builder<TPredicate> select (
+            TPredicate      predicate
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::select_builder<TPredicate> (std::move (predicate));
+    }
+
+#ifndef CPPLINQ_NO_PARALLEL
+    // select with selector running on pool for up to window elements ahead,
+    // the elements keep source order
+    template<typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::par_select_builder<TSelector> par_select (
+            TSelector       selector
+        ,   size_type       window  = 1024U
+        ,   executor &      pool    = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_select_builder<TSelector> (std::move (selector), window, pool);
+    }
+#endif
+
+    template<typename TPredicate>
+    CPPLINQ_INLINEMETHOD detail::select_many_builder<TPredicate> select_many (
             TPredicate      predicate
         ) CPPLINQ_NOEXCEPT
     {
-        return detail::where_builder<TPredicate> (std::move (predicate));
-    }
-
-    // Projection operators
-
-    CPPLINQ_INLINEMETHOD detail::ref_builder ref () CPPLINQ_NOEXCEPT
-    {
-        return detail::ref_builder ();
+        return detail::select_many_builder<TPredicate> (std::move (predicate));
+    }
+
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+    CPPLINQ_INLINEMETHOD detail::join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            > join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            );
+    }
+
+    // As join but both ranges must already be ordered by key (operator<).
+    // The ranges are read in lockstep, only the current run of equal keys
+    // in other_range is buffered.
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+    CPPLINQ_INLINEMETHOD detail::merge_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            > merge_join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::merge_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            );
+    }
+
+    // As join but on a hash index of other_range, keys need std::hash and
+    // operator== rather than operator<. Matches come in the same order as
+    // from join.
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+    CPPLINQ_INLINEMETHOD detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            > hash_join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+            ,   probe_filter        filter              = no_probe_filter
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            ,   filter
+            );
+    }
+
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            ,   typename THasher
+            ,   typename TEqual
+            >
+    CPPLINQ_INLINEMETHOD detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   THasher
+            ,   TEqual
+            > hash_join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+            ,   THasher             hasher
+            ,   TEqual              equality
+            ,   probe_filter        filter              = no_probe_filter
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   THasher
+            ,   TEqual
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            ,   std::move (hasher)
+            ,   std::move (equality)
+            ,   filter
+            );
     }
 
-    template<typename TPredicate>
-    CPPLINQ_INLINEMETHOD detail::select_builder<TPredicate> select (
-            TPredicate      predicate
-        ) CPPLINQ_NOEXCEPT
+    // As hash_join but elements of the range without matches are combined
+    // with default_value
+    template<
+                typename TOtherRange
+            ,   typename TKeySelector
+            ,   typename TOtherKeySelector
+            ,   typename TCombiner
+            >
+    CPPLINQ_INLINEMETHOD detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            > left_join (
+                TOtherRange         other_range
+            ,   TKeySelector        key_selector
+            ,   TOtherKeySelector   other_key_selector
+            ,   TCombiner           combiner
+            ,   typename detail::cleanup_type<typename TOtherRange::value_type>::type default_value
+        )
     {
-        return detail::select_builder<TPredicate> (std::move (predicate));
-    }
+        typedef typename detail::cleanup_type<typename TOtherRange::value_type>::type missing_type;
 
-    template<typename TPredicate>
-    CPPLINQ_INLINEMETHOD detail::select_many_builder<TPredicate> select_many (
-            TPredicate      predicate
-        ) CPPLINQ_NOEXCEPT
-    {
-        return detail::select_many_builder<TPredicate> (std::move (predicate));
+        return detail::hash_join_builder<
+                TOtherRange
+            ,   TKeySelector
+            ,   TOtherKeySelector
+            ,   TCombiner
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            >
+            (
+                std::move (other_range)
+            ,   std::move (key_selector)
+            ,   std::move (other_key_selector)
+            ,   std::move (combiner)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            ,   no_probe_filter
+            ,   detail::opt<missing_type> (std::move (default_value))
+            );
     }
 
     template<
@@ -5125,30 +12706,133 @@ namespace cpplinq
             ,   typename TKeySelector
             ,   typename TOtherKeySelector
             ,   typename TCombiner
+            ,   typename THasher
+            ,   typename TEqual
             >
-    CPPLINQ_INLINEMETHOD detail::join_builder<
+    CPPLINQ_INLINEMETHOD detail::hash_join_builder<
                 TOtherRange
             ,   TKeySelector
             ,   TOtherKeySelector
             ,   TCombiner
-            > join (
+            ,   THasher
+            ,   TEqual
+            > left_join (
                 TOtherRange         other_range
             ,   TKeySelector        key_selector
             ,   TOtherKeySelector   other_key_selector
             ,   TCombiner           combiner
-        ) CPPLINQ_NOEXCEPT
+            ,   typename detail::cleanup_type<typename TOtherRange::value_type>::type default_value
+            ,   THasher             hasher
+            ,   TEqual              equality
+        )
     {
-        return detail::join_builder<
+        typedef typename detail::cleanup_type<typename TOtherRange::value_type>::type missing_type;
+
+        return detail::hash_join_builder<
                 TOtherRange
             ,   TKeySelector
             ,   TOtherKeySelector
             ,   TCombiner
+            ,   THasher
+            ,   TEqual
             >
             (
                 std::move (other_range)
             ,   std::move (key_selector)
             ,   std::move (other_key_selector)
             ,   std::move (combiner)
+            ,   std::move (hasher)
+            ,   std::move (equality)
+            ,   no_probe_filter
+            ,   detail::opt<missing_type> (std::move (default_value))
+            );
+    }
+
+    // The range of matches group_join passes to its result selector, a
+    // result selector may take it as hash_group<inner value type>
+    template<typename TValue>
+    using hash_group = detail::hash_group_range<TValue>;
+
+    // Passes each element of the range with a range of its matches in
+    // inner_range, a hash_group, to result_selector. The matches are only
+    // valid while the group_join range lives.
+    template<
+                typename TInnerRange
+            ,   typename TKeySelector
+            ,   typename TInnerKeySelector
+            ,   typename TResultSelector
+            >
+    CPPLINQ_INLINEMETHOD detail::group_join_builder<
+                TInnerRange
+            ,   TKeySelector
+            ,   TInnerKeySelector
+            ,   TResultSelector
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            > group_join (
+                TInnerRange         inner_range
+            ,   TKeySelector        key_selector
+            ,   TInnerKeySelector   inner_key_selector
+            ,   TResultSelector     result_selector
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_join_builder<
+                TInnerRange
+            ,   TKeySelector
+            ,   TInnerKeySelector
+            ,   TResultSelector
+            ,   detail::default_hasher
+            ,   detail::default_equality
+            >
+            (
+                std::move (inner_range)
+            ,   std::move (key_selector)
+            ,   std::move (inner_key_selector)
+            ,   std::move (result_selector)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            );
+    }
+
+    template<
+                typename TInnerRange
+            ,   typename TKeySelector
+            ,   typename TInnerKeySelector
+            ,   typename TResultSelector
+            ,   typename THasher
+            ,   typename TEqual
+            >
+    CPPLINQ_INLINEMETHOD detail::group_join_builder<
+                TInnerRange
+            ,   TKeySelector
+            ,   TInnerKeySelector
+            ,   TResultSelector
+            ,   THasher
+            ,   TEqual
+            > group_join (
+                TInnerRange         inner_range
+            ,   TKeySelector        key_selector
+            ,   TInnerKeySelector   inner_key_selector
+            ,   TResultSelector     result_selector
+            ,   THasher             hasher
+            ,   TEqual              equality
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::group_join_builder<
+                TInnerRange
+            ,   TKeySelector
+            ,   TInnerKeySelector
+            ,   TResultSelector
+            ,   THasher
+            ,   TEqual
+            >
+            (
+                std::move (inner_range)
+            ,   std::move (key_selector)
+            ,   std::move (inner_key_selector)
+            ,   std::move (result_selector)
+            ,   std::move (hasher)
+            ,   std::move (equality)
             );
     }
 
@@ -5160,6 +12844,42 @@ namespace cpplinq
         return detail::concat_builder<TOtherRange> (std::move (other_range));
     }
 
+#ifndef CPPLINQ_NO_PARALLEL
+    // Runs the range before it on a thread of its own, up to capacity elements
+    // ahead of the ranges after it
+    CPPLINQ_INLINEMETHOD detail::async_buffer_builder async_buffer (size_type capacity = 1024U) CPPLINQ_NOEXCEPT
+    {
+        return detail::async_buffer_builder (capacity);
+    }
+#endif
+
+    // Cancellation operators
+
+    // Makes the range before it throw operation_cancelled_exception once token
+    // is cancelled, operators that materialize the range (orderby, reverse,
+    // distinct, to_lookup, ...) free what they buffered so far. The token is
+    // checked while elements are pulled through it, by the sort of an orderby
+    // or thenby right before or after it and by join, hash_join and group_join
+    // while they index the other range. Other work, such as a long running
+    // selector or aggregate, doesn't check it.
+    CPPLINQ_INLINEMETHOD detail::cancellation_builder<detail::token_condition> with_cancellation (
+            cancellation_token const &  token
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::cancellation_builder<detail::token_condition> (detail::token_condition (token));
+    }
+
+    // As with_cancellation but gives up once TClock reaches deadline
+    template<typename TClock, typename TDuration>
+    CPPLINQ_INLINEMETHOD detail::cancellation_builder<detail::deadline_condition<TClock, TDuration>> with_deadline (
+            std::chrono::time_point<TClock, TDuration>  deadline
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::cancellation_builder<detail::deadline_condition<TClock, TDuration>> (
+                detail::deadline_condition<TClock, TDuration> (deadline)
+            );
+    }
+
     // Partitioning operators
 
     template<typename TPredicate>
@@ -5244,6 +12964,29 @@ namespace cpplinq
         return detail::thenby_builder<TPredicate> (std::move (predicate), false);
     }
 
+    // The sorts of orderby and thenby run on the calling thread unless there
+    // are at least CPPLINQ_PARALLEL_SORT_THRESHOLD values, sequential_sort
+    // and parallel_sort after either of them override that. Either way the
+    // sort is stable, values with equal keys keep source order
+
+    CPPLINQ_INLINEMETHOD detail::sort_policy_builder sequential_sort () CPPLINQ_NOEXCEPT
+    {
+        detail::sort_policy policy;
+        policy.mode = detail::sort_sequential;
+        return detail::sort_policy_builder (policy);
+    }
+
+#ifndef CPPLINQ_NO_PARALLEL
+    // A stable merge sort on pool, values that compare equal keep source order
+    CPPLINQ_INLINEMETHOD detail::sort_policy_builder parallel_sort (executor & pool = default_executor ()) CPPLINQ_NOEXCEPT
+    {
+        detail::sort_policy policy;
+        policy.mode = detail::sort_parallel;
+        policy.pool = std::addressof (pool);
+        return detail::sort_policy_builder (policy);
+    }
+#endif
+
     CPPLINQ_INLINEMETHOD detail::reverse_builder reverse (size_type capacity = 16U) CPPLINQ_NOEXCEPT
     {
         return detail::reverse_builder (capacity);
@@ -5252,12 +12995,15 @@ namespace cpplinq
 
     // Conversion operators
 
+    CPPLINQ_INLINEMETHOD detail::container_builder container () CPPLINQ_NOEXCEPT
+    {
+        return detail::container_builder ();
+    }
+
     namespace experimental
     {
-        CPPLINQ_INLINEMETHOD detail::experimental::container_builder container () CPPLINQ_NOEXCEPT
-        {
-            return detail::experimental::container_builder ();
-        }
+        // Kept for code written against the experimental container
+        using cpplinq::container;
     }
 
     template<typename TValue>
@@ -5277,6 +13023,14 @@ namespace cpplinq
         return detail::to_vector_builder (capacity);
     }
 
+#ifndef CPPLINQ_NO_PARALLEL
+    // Materializes a splittable range on pool, the elements keep source order
+    CPPLINQ_INLINEMETHOD detail::par_to_vector_builder par_to_vector (executor & pool = default_executor ()) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_to_vector_builder (pool);
+    }
+#endif
+
     CPPLINQ_INLINEMETHOD detail::to_list_builder to_list () CPPLINQ_NOEXCEPT
     {
         return detail::to_list_builder ();
@@ -5359,7 +13113,7 @@ namespace cpplinq
 
     // Generation operators
 
-    CPPLINQ_INLINEMETHOD detail::int_range range (
+    CPPLINQ_CONSTEXPR detail::int_range range (
             int         start
         ,   int         count
         ) CPPLINQ_NOEXCEPT
@@ -5370,7 +13124,7 @@ namespace cpplinq
     }
 
     template <typename TValue>
-    CPPLINQ_INLINEMETHOD detail::repeat_range<TValue> repeat (
+    CPPLINQ_CONSTEXPR detail::repeat_range<TValue> repeat (
             TValue      element
         ,   int         count
         ) CPPLINQ_NOEXCEPT
@@ -5380,13 +13134,13 @@ namespace cpplinq
     }
 
     template <typename TValue>
-    CPPLINQ_INLINEMETHOD detail::empty_range<TValue> empty () CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::empty_range<TValue> empty () CPPLINQ_NOEXCEPT
     {
         return detail::empty_range<TValue> ();
     }
 
     template<typename TValue>
-    CPPLINQ_INLINEMETHOD detail::singleton_range<typename detail::cleanup_type<TValue>::type> singleton (TValue&& value) CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::singleton_range<typename detail::cleanup_type<TValue>::type> singleton (TValue&& value) CPPLINQ_NOEXCEPT
     {
         return detail::singleton_range<typename detail::cleanup_type<TValue>::type> (std::forward<TValue> (value));
     }
@@ -5441,7 +13195,7 @@ namespace cpplinq
         return detail::count_predicate_builder<TPredicate> (std::move (predicate));
     }
 
-    CPPLINQ_INLINEMETHOD detail::count_builder count () CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::count_builder count () CPPLINQ_NOEXCEPT
     {
         return detail::count_builder ();
     }
@@ -5454,7 +13208,7 @@ namespace cpplinq
         return detail::sum_selector_builder<TSelector> (std::move (selector));
     }
 
-    CPPLINQ_INLINEMETHOD detail::sum_builder sum () CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::sum_builder sum () CPPLINQ_NOEXCEPT
     {
         return detail::sum_builder ();
     }
@@ -5467,7 +13221,7 @@ namespace cpplinq
         return detail::max_selector_builder<TSelector> (std::move (selector));
     }
 
-    CPPLINQ_INLINEMETHOD detail::max_builder max () CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::max_builder max () CPPLINQ_NOEXCEPT
     {
         return detail::max_builder ();
     }
@@ -5480,7 +13234,7 @@ namespace cpplinq
         return detail::min_selector_builder<TSelector> (std::move (selector));
     }
 
-    CPPLINQ_INLINEMETHOD detail::min_builder min () CPPLINQ_NOEXCEPT
+    CPPLINQ_CONSTEXPR detail::min_builder min () CPPLINQ_NOEXCEPT
     {
         return detail::min_builder ();
     }
@@ -5498,6 +13252,131 @@ namespace cpplinq
         return detail::avg_builder ();
     }
 
+#ifndef CPPLINQ_NO_PARALLEL
+    // Parallel aggregate operators reduce parts of splittable ranges on pool and
+    // give the same results as their sequential counterparts, though floating
+    // point sums are added up in a different order. Ranges that can't split are
+    // reduced on the calling thread.
+
+    template <typename TPredicate>
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::count_predicate_builder<TPredicate>, detail::add_combiner> par_count (
+            TPredicate  predicate
+        ,   executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::count_predicate_builder<TPredicate>, detail::add_combiner> (
+                detail::count_predicate_builder<TPredicate> (std::move (predicate))
+            ,   detail::add_combiner ()
+            ,   pool
+            );
+    }
+
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::count_builder, detail::add_combiner> par_count (
+            executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::count_builder, detail::add_combiner> (
+                detail::count_builder ()
+            ,   detail::add_combiner ()
+            ,   pool
+            );
+    }
+
+    template<typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::sum_selector_builder<TSelector>, detail::add_combiner> par_sum (
+            TSelector   selector
+        ,   executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::sum_selector_builder<TSelector>, detail::add_combiner> (
+                detail::sum_selector_builder<TSelector> (std::move (selector))
+            ,   detail::add_combiner ()
+            ,   pool
+            );
+    }
+
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::sum_builder, detail::add_combiner> par_sum (
+            executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::sum_builder, detail::add_combiner> (
+                detail::sum_builder ()
+            ,   detail::add_combiner ()
+            ,   pool
+            );
+    }
+
+    template<typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::max_selector_builder<TSelector>, detail::max_combiner> par_max (
+            TSelector   selector
+        ,   executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::max_selector_builder<TSelector>, detail::max_combiner> (
+                detail::max_selector_builder<TSelector> (std::move (selector))
+            ,   detail::max_combiner ()
+            ,   pool
+            );
+    }
+
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::max_builder, detail::max_combiner> par_max (
+            executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::max_builder, detail::max_combiner> (
+                detail::max_builder ()
+            ,   detail::max_combiner ()
+            ,   pool
+            );
+    }
+
+    template<typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::min_selector_builder<TSelector>, detail::min_combiner> par_min (
+            TSelector   selector
+        ,   executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::min_selector_builder<TSelector>, detail::min_combiner> (
+                detail::min_selector_builder<TSelector> (std::move (selector))
+            ,   detail::min_combiner ()
+            ,   pool
+            );
+    }
+
+    CPPLINQ_INLINEMETHOD detail::par_reduce_builder<detail::min_builder, detail::min_combiner> par_min (
+            executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_reduce_builder<detail::min_builder, detail::min_combiner> (
+                detail::min_builder ()
+            ,   detail::min_combiner ()
+            ,   pool
+            );
+    }
+
+    template<typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::par_avg_builder<detail::sum_count_selector_builder<TSelector>> par_avg (
+            TSelector   selector
+        ,   executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_avg_builder<detail::sum_count_selector_builder<TSelector>> (
+                detail::sum_count_selector_builder<TSelector> (std::move (selector))
+            ,   pool
+            );
+    }
+
+    CPPLINQ_INLINEMETHOD detail::par_avg_builder<detail::sum_count_builder> par_avg (
+            executor &  pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_avg_builder<detail::sum_count_builder> (
+                detail::sum_count_builder ()
+            ,   pool
+            );
+    }
+#endif
+
     template <typename TAccumulate, typename TAccumulator>
     CPPLINQ_INLINEMETHOD detail::aggregate_builder<TAccumulate, TAccumulator> aggregate (
             TAccumulate seed
@@ -5517,12 +13396,88 @@ namespace cpplinq
         return detail::aggregate_result_selector_builder<TAccumulate, TAccumulator, TSelector> (seed, accumulator, result_selector);
     }
 
+#ifndef CPPLINQ_NO_PARALLEL
+    // seed_factory () gives each thread (parallel_unordered) or each part
+    // (parallel_ordered) an accumulator of its own, they are merged by
+    // combiner (sum, other). Combiners that aren't commutative need
+    // parallel_ordered.
+    template <typename TSeedFactory, typename TAccumulator, typename TCombiner>
+    CPPLINQ_INLINEMETHOD detail::parallel_aggregate_builder<TSeedFactory, TAccumulator, TCombiner> parallel_aggregate (
+            TSeedFactory    seed_factory
+        ,   TAccumulator    accumulator
+        ,   TCombiner       combiner
+        ,   parallel_mode   mode        = parallel_unordered
+        ,   executor &      pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::parallel_aggregate_builder<TSeedFactory, TAccumulator, TCombiner> (
+                std::move (seed_factory)
+            ,   std::move (accumulator)
+            ,   std::move (combiner)
+            ,   mode
+            ,   pool
+            );
+    }
+
+    template <typename TSeedFactory, typename TAccumulator, typename TCombiner, typename TSelector>
+    CPPLINQ_INLINEMETHOD detail::parallel_aggregate_result_selector_builder<TSeedFactory, TAccumulator, TCombiner, TSelector> parallel_aggregate (
+            TSeedFactory    seed_factory
+        ,   TAccumulator    accumulator
+        ,   TCombiner       combiner
+        ,   TSelector       result_selector
+        ,   parallel_mode   mode        = parallel_unordered
+        ,   executor &      pool        = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::parallel_aggregate_result_selector_builder<TSeedFactory, TAccumulator, TCombiner, TSelector> (
+                detail::parallel_aggregate_builder<TSeedFactory, TAccumulator, TCombiner> (
+                        std::move (seed_factory)
+                    ,   std::move (accumulator)
+                    ,   std::move (combiner)
+                    ,   mode
+                    ,   pool
+                    )
+            ,   std::move (result_selector)
+            );
+    }
+#endif
+
     // set operators
     CPPLINQ_INLINEMETHOD detail::distinct_builder distinct () CPPLINQ_NOEXCEPT
     {
         return detail::distinct_builder ();
     }
 
+    // As distinct but finds seen elements in a hash table, elements need
+    // std::hash and operator== rather than operator<
+    CPPLINQ_INLINEMETHOD detail::hash_distinct_builder<detail::default_hasher, detail::default_equality> hash_distinct () CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_distinct_builder<detail::default_hasher, detail::default_equality> (
+                detail::default_hasher ()
+            ,   detail::default_equality ()
+            );
+    }
+
+    template<typename THasher>
+    CPPLINQ_INLINEMETHOD detail::hash_distinct_builder<THasher, detail::default_equality> hash_distinct (
+            THasher hasher
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_distinct_builder<THasher, detail::default_equality> (
+                std::move (hasher)
+            ,   detail::default_equality ()
+            );
+    }
+
+    template<typename THasher, typename TEqual>
+    CPPLINQ_INLINEMETHOD detail::hash_distinct_builder<THasher, TEqual> hash_distinct (
+            THasher hasher
+        ,   TEqual  equality
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_distinct_builder<THasher, TEqual> (std::move (hasher), std::move (equality));
+    }
+
     template <typename TOtherRange>
     CPPLINQ_INLINEMETHOD detail::union_builder<TOtherRange> union_with (TOtherRange other_range) CPPLINQ_NOEXCEPT
     {
@@ -5541,6 +13496,97 @@ namespace cpplinq
         return detail::except_builder<TOtherRange> (std::move (other_range));
     }
 
+    // Hash based set operators, as union_with, intersect_with and except but
+    // on a flat hash table. side picks the range intersect and except build
+    // their table on, union_with keeps every distinct element of both ranges
+    // so it has no side to pick.
+
+    template <typename TOtherRange>
+    CPPLINQ_INLINEMETHOD detail::hash_union_builder<TOtherRange, detail::default_hasher, detail::default_equality> hash_union_with (
+            TOtherRange     other_range
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_union_builder<TOtherRange, detail::default_hasher, detail::default_equality> (
+                std::move (other_range)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            );
+    }
+
+    template <typename TOtherRange, typename THasher, typename TEqual>
+    CPPLINQ_INLINEMETHOD detail::hash_union_builder<TOtherRange, THasher, TEqual> hash_union_with (
+            TOtherRange     other_range
+        ,   THasher         hasher
+        ,   TEqual          equality
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_union_builder<TOtherRange, THasher, TEqual> (
+                std::move (other_range)
+            ,   std::move (hasher)
+            ,   std::move (equality)
+            );
+    }
+
+    template <typename TOtherRange>
+    CPPLINQ_INLINEMETHOD detail::hash_intersect_builder<TOtherRange, detail::default_hasher, detail::default_equality> hash_intersect_with (
+            TOtherRange     other_range
+        ,   hash_build_side side        = build_other
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_intersect_builder<TOtherRange, detail::default_hasher, detail::default_equality> (
+                std::move (other_range)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            ,   side
+            );
+    }
+
+    template <typename TOtherRange, typename THasher, typename TEqual>
+    CPPLINQ_INLINEMETHOD detail::hash_intersect_builder<TOtherRange, THasher, TEqual> hash_intersect_with (
+            TOtherRange     other_range
+        ,   THasher         hasher
+        ,   TEqual          equality
+        ,   hash_build_side side        = build_other
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_intersect_builder<TOtherRange, THasher, TEqual> (
+                std::move (other_range)
+            ,   std::move (hasher)
+            ,   std::move (equality)
+            ,   side
+            );
+    }
+
+    template <typename TOtherRange>
+    CPPLINQ_INLINEMETHOD detail::hash_except_builder<TOtherRange, detail::default_hasher, detail::default_equality> hash_except (
+            TOtherRange     other_range
+        ,   hash_build_side side        = build_other
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_except_builder<TOtherRange, detail::default_hasher, detail::default_equality> (
+                std::move (other_range)
+            ,   detail::default_hasher ()
+            ,   detail::default_equality ()
+            ,   side
+            );
+    }
+
+    template <typename TOtherRange, typename THasher, typename TEqual>
+    CPPLINQ_INLINEMETHOD detail::hash_except_builder<TOtherRange, THasher, TEqual> hash_except (
+            TOtherRange     other_range
+        ,   THasher         hasher
+        ,   TEqual          equality
+        ,   hash_build_side side        = build_other
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::hash_except_builder<TOtherRange, THasher, TEqual> (
+                std::move (other_range)
+            ,   std::move (hasher)
+            ,   std::move (equality)
+            ,   side
+            );
+    }
+
     // other operators
 
     template<typename TPredicate>
@@ -5551,6 +13597,37 @@ namespace cpplinq
         return detail::for_each_builder<TPredicate> (std::move (predicate));
     }
 
+#ifndef CPPLINQ_NO_PARALLEL
+    // Calls action for the elements of a splittable range on pool, in no
+    // particular order
+    template<typename TAction>
+    CPPLINQ_INLINEMETHOD detail::par_for_each_builder<TAction> par_for_each (
+            TAction         action
+        ,   executor &      pool    = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_for_each_builder<TAction> (std::move (action), pool);
+    }
+
+    // par_for_each with a state per thread: init () creates it, action (state, v)
+    // is called for the elements and finalize (state) once all elements are done
+    template<typename TInit, typename TAction, typename TFinalize>
+    CPPLINQ_INLINEMETHOD detail::par_for_each_state_builder<TInit, TAction, TFinalize> par_for_each (
+            TInit           init
+        ,   TAction         action
+        ,   TFinalize       finalize
+        ,   executor &      pool    = default_executor ()
+        ) CPPLINQ_NOEXCEPT
+    {
+        return detail::par_for_each_state_builder<TInit, TAction, TFinalize> (
+                std::move (init)
+            ,   std::move (action)
+            ,   std::move (finalize)
+            ,   pool
+            );
+    }
+#endif
+
     CPPLINQ_INLINEMETHOD detail::concatenate_builder<char> concatenate (
             std::string separator
         ,   size_type capacity = 16U
@@ -22,7 +22,11 @@
 // ----------------------------------------------------------------------------------------------
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <list>
 #include <map>
 #include <numeric>
 #include <set>
@@ -114,6 +118,101 @@ namespace
 
     };
 
+    std::size_t order_copies = 0U;
+
+    // An order record that is expensive to copy, moving it is as expensive
+    // as copying so both are counted
+    struct  order
+    {
+        std::size_t     id          ;
+        std::size_t     customer_id ;
+        double          amount      ;
+        char            payload[376];
+
+        order (std::size_t id = 0, std::size_t customer_id = 0, double amount = 0.0)
+            :   id          (id)
+            ,   customer_id (customer_id)
+            ,   amount      (amount)
+        {
+            memset (payload, 0, sizeof (payload));
+        }
+
+        order (order const & o)
+            :   id          (o.id)
+            ,   customer_id (o.customer_id)
+            ,   amount      (o.amount)
+        {
+            ++order_copies;
+            memcpy (payload, o.payload, sizeof (payload));
+        }
+
+        order & operator= (order const & o)
+        {
+            ++order_copies;
+            id          = o.id          ;
+            customer_id = o.customer_id ;
+            amount      = o.amount      ;
+            memcpy (payload, o.payload, sizeof (payload));
+            return *this;
+        }
+
+        bool operator<(order const & o) const
+        {
+            return id < o.id;
+        }
+    };
+
+    std::vector<order> get_orders (std::size_t count)
+    {
+        std::vector<order> orders;
+        orders.reserve (count);
+        for (auto iter = 0U; iter < count; ++iter)
+        {
+            orders.push_back (order (iter, iter % 7, static_cast<double> ((iter * 37) % 101)));
+        }
+        return orders;
+    }
+
+    std::size_t counted_allocations = 0U;
+
+    template<typename TValue>
+    struct counting_allocator
+    {
+        typedef TValue value_type;
+
+        counting_allocator ()
+        {
+        }
+
+        template<typename TOther>
+        counting_allocator (counting_allocator<TOther> const &)
+        {
+        }
+
+        TValue * allocate (std::size_t n)
+        {
+            ++counted_allocations;
+            return static_cast<TValue *> (::operator new (n * sizeof (TValue)));
+        }
+
+        void deallocate (TValue * p, std::size_t)
+        {
+            ::operator delete (p);
+        }
+
+        template<typename TOther>
+        bool operator== (counting_allocator<TOther> const &) const
+        {
+            return true;
+        }
+
+        template<typename TOther>
+        bool operator!= (counting_allocator<TOther> const &) const
+        {
+            return false;
+        }
+    };
+
     struct player
     {
         std::size_t id;
@@ -504,6 +603,33 @@ namespace
             TEST_ASSERT ("Test3", *o1);
             TEST_ASSERT (true, o2.has_value ());
             TEST_ASSERT ("Test2", *o2);
+
+            // Assigning the value held by the opt itself
+            std::string long_value (100, 'x');
+            o1 = long_value;
+            o1 = *o1;
+            TEST_ASSERT (long_value, *o1);
+            o1 = std::move (*o1);
+            TEST_ASSERT (long_value, *o1);
+        }
+
+        // Assigning a value copies or moves it once, straight into the opt
+        {
+            opt<order>  o;
+            order       value (1U, 2U, 3.0);
+
+            order_copies = 0U;
+            o = value;
+            TEST_ASSERT (1U, order_copies);
+            o = value;
+            TEST_ASSERT (2U, order_copies);
+            o = order (4U, 5U, 6.0);
+            TEST_ASSERT (3U, order_copies);
+            TEST_ASSERT (4U, o->id);
+
+            o = *o;
+            TEST_ASSERT (3U, order_copies);
+            TEST_ASSERT (4U, o->id);
         }
 
         {
@@ -624,6 +750,12 @@ namespace
                 }
             }
 
+            {
+                // A key between existing keys has no values
+                auto results = lookup[2] >> to_vector ();
+                TEST_ASSERT (0U, results.size ());
+            }
+
             {
                 auto results = lookup[999] >> to_vector ();
                 TEST_ASSERT (0U, results.size ());
@@ -1551,7 +1683,82 @@ namespace
             TEST_ASSERT (1U, begin->id);
             TEST_ASSERT (1U, (*begin).id);
 
+            // Input iterators, copies share the position in the range
+            auto copy = begin;
+            ++begin;
+            TEST_ASSERT (true, (copy == begin));
+            TEST_ASSERT (2U, begin->id);
+
+            auto before = begin++;
+            TEST_ASSERT (2U, (*before).id);
+            TEST_ASSERT (3U, begin->id);
+        }
+
+        {
+            auto index = 0U;
+            for (auto v : from_array (ints) >> container ())
+            {
+                test_int_at (index++, v);
+            }
+            TEST_ASSERT (count_of_ints, index);
+        }
+
+        {
+            auto index = 0U;
+            for (auto && v : from_array (ints) >> select ([] (int i) {return i * 2;}) >> container ())
+            {
+                if (TEST_ASSERT (ints[index] * 2, v))
+                {
+                    ++index;
+                }
+            }
+            TEST_ASSERT (count_of_ints, index);
+        }
+
+        {
+            auto empty_sum = 0;
+            for (auto v : from (empty_vector) >> container ())
+            {
+                empty_sum += v;
+            }
+            TEST_ASSERT (0, empty_sum);
+        }
+
+        {
+            auto container_result = from_array (ints) >> where (is_even) >> container ();
+            auto even_sum = std::accumulate (container_result.begin (), container_result.end (), 0);
+            TEST_ASSERT (from_array (ints) >> where (is_even) >> sum (), even_sum);
+        }
+
+        {
+            auto container_result   = from_array (ints) >> container ();
+            auto end                = container_result.end ();
+            auto found              = std::find (container_result.begin (), end, 9);
+            if (TEST_ASSERT (true, (found != end)))
+            {
+                TEST_ASSERT (9, *found);
+
+                // The remainder of the range picks up after the found element
+                ++found;
+                TEST_ASSERT (true, (found != end));
+                TEST_ASSERT (2, *found);
+            }
+
+            auto missing = container_result.end ();
+            TEST_ASSERT (true, (std::find (missing, end, 9) == end));
+        }
 
+        {
+            auto container_result   = from_array (customers) >> container ();
+            auto found              = std::find_if (
+                    container_result.begin ()
+                ,   container_result.end ()
+                ,   [] (customer const & c) {return c.last_name == "Cook";}
+                );
+            if (TEST_ASSERT (true, (found != container_result.end ())))
+            {
+                TEST_ASSERT (12U, found->id);
+            }
         }
     }
 
@@ -1646,6 +1853,20 @@ namespace
             TEST_ASSERT (count_of_customers, select_result.size ());
         }
 
+        {
+            // The projection runs once per element, however often the ranges
+            // after it read front ()
+            auto select_calls   = 0;
+            auto select_result  =
+                    range (0, 1000)
+                >>  select ([&] (int i) {++select_calls; return std::to_string (i);})
+                >>  where ([] (std::string const & s) {return s.find ('7') != std::string::npos;})
+                >>  select ([] (std::string const & s) {return s.size ();})
+                >>  sum ()
+                ;
+            TEST_ASSERT (true, (select_result > 0U));
+            TEST_ASSERT (1000, select_calls);
+        }
     }
 
     void test_join ()
@@ -1730,6 +1951,24 @@ namespace
                 }
             }
         }
+        {
+            // The combiner runs once per joined element
+            auto combiner_calls = 0;
+            auto joined_size    =
+                    range (0, 1000)
+                >>  join (
+                        range (0, 100)
+                    ,   [] (int i) {return i % 100;}
+                    ,   [] (int i) {return i;}
+                    ,   [&] (int l, int r) {++combiner_calls; return std::to_string (l * 1000 + r);}
+                    )
+                >>  where ([] (std::string const & s) {return s.find ('7') != std::string::npos;})
+                >>  select ([] (std::string const & s) {return s.size ();})
+                >>  sum ()
+                ;
+            TEST_ASSERT (true, (joined_size > 0U));
+            TEST_ASSERT (1000, combiner_calls);
+        }
     }
 
     void test_select_many ()
@@ -1778,6 +2017,313 @@ namespace
 
     }
 
+    void test_hash_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        auto customer_id    = [](customer const & c) {return c.id;};
+        auto address_owner  = [](customer_address const & ca) {return ca.customer_id;};
+        auto ids            = [](customer const & c, customer_address const & ca) {return std::make_pair (c.id, ca.id);};
+
+        {
+            auto join_result = empty<customer> ()
+                >> hash_join (from_array (customer_addresses), customer_id, address_owner, ids)
+                >> to_vector ()
+                ;
+            TEST_ASSERT (0U, join_result.size ());
+
+            join_result = from_array (customers)
+                >> hash_join (empty<customer_address> (), customer_id, address_owner, ids, bloom_probe_filter)
+                >> to_vector ()
+                ;
+            TEST_ASSERT (0U, join_result.size ());
+        }
+
+        {
+            auto expected = from_array (customers)
+                >> join (from_array (customer_addresses), customer_id, address_owner, ids)
+                >> to_vector ()
+                ;
+
+            auto result = from_array (customers)
+                >> hash_join (from_array (customer_addresses), customer_id, address_owner, ids)
+                >> to_vector ()
+                ;
+            TEST_ASSERT (3U, result.size ());
+            TEST_ASSERT (true, (expected == result));
+
+            result = from_array (customers)
+                >> hash_join (from_array (customer_addresses), customer_id, address_owner, ids, bloom_probe_filter)
+                >> to_vector ()
+                ;
+            TEST_ASSERT (true, (expected == result));
+        }
+
+        // Duplicate keys on both sides, most keys of the range without a match
+        // and keys of different types on the two sides
+        {
+            srand (19740531);
+            auto orders     = range (0, 20000) >> select ([] (int i) {return std::make_pair (rand () % 10000, i);}) >> to_vector ();
+            auto customers  = range (0, 3000) >> select ([] (int i) {return std::make_pair ((long long)(rand () % 2000), i);}) >> to_vector ();
+
+            typedef std::pair<int, int>         order_type      ;
+            typedef std::pair<long long, int>   customer_type   ;
+
+            auto order_key      = [] (order_type const & o) {return o.first;};
+            auto customer_key   = [] (customer_type const & c) {return c.first;};
+            auto combine        = [] (order_type const & o, customer_type const & c) {return std::make_pair (o.second, c.second);};
+
+            auto expected = from (orders) >> join (from (customers), order_key, customer_key, combine) >> to_vector ();
+            TEST_ASSERT (true, (expected.size () > orders.size ()/10));
+
+            probe_filter const filters[] = {no_probe_filter, bloom_probe_filter};
+            for (auto filter : filters)
+            {
+                auto result = from (orders) >> hash_join (from (customers), order_key, customer_key, combine, filter) >> to_vector ();
+                TEST_ASSERT (true, (expected == result));
+
+                auto modulo_hasher  = [] (long long k) {return (std::size_t)(k % 7);};
+                auto same_key       = [] (long long l, long long r) {return l == r;};
+                result = from (orders) >> hash_join (from (customers), order_key, customer_key, combine, modulo_hasher, same_key, filter) >> to_vector ();
+                TEST_ASSERT (true, (expected == result));
+            }
+        }
+
+        // Cancelling the build frees the index
+        {
+            cancellation_token token;
+            auto joined = from_array (customers)
+                >>  hash_join (
+                            range (0, 10000) >> select ([&] (int i) {if (i == 5000) token.cancel (); return customer_address (i, i % 10, "Sweden");}) >> with_cancellation (token)
+                        ,   customer_id
+                        ,   address_owner
+                        ,   ids
+                        )
+                ;
+            auto caught = false;
+            try
+            {
+                joined.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, joined.index.rows.capacity ());
+        }
+    }
+
+    void test_group_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        auto customer_id    = [](customer const & c) {return c.id;};
+        auto address_owner  = [](customer_address const & ca) {return ca.customer_id;};
+
+        typedef std::pair<std::size_t, std::vector<std::size_t>> grouped_type;
+
+        auto address_ids    = [](customer const & c, hash_group<customer_address> addresses)
+            {
+                return grouped_type (c.id, addresses >> select ([](customer_address const & ca) {return ca.id;}) >> to_vector ());
+            };
+
+        {
+            auto result = empty<customer> () >> group_join (from_array (customer_addresses), customer_id, address_owner, address_ids) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // Every customer once, in order, with its addresses in order
+        {
+            auto result = from_array (customers) >> group_join (from_array (customer_addresses), customer_id, address_owner, address_ids) >> to_vector ();
+
+            std::vector<grouped_type> expected;
+            expected.push_back (grouped_type (1U , std::vector<std::size_t> (1U, 1U)));
+            expected.push_back (grouped_type (2U , std::vector<std::size_t> ()));
+            expected.push_back (grouped_type (3U , std::vector<std::size_t> ()));
+            expected.push_back (grouped_type (4U , std::vector<std::size_t> ()));
+            expected.back ().second.push_back (2U);
+            expected.back ().second.push_back (3U);
+            expected.push_back (grouped_type (11U, std::vector<std::size_t> ()));
+            expected.push_back (grouped_type (12U, std::vector<std::size_t> ()));
+            expected.push_back (grouped_type (21U, std::vector<std::size_t> ()));
+
+            TEST_ASSERT (true, (expected == result));
+
+            auto without_addresses = from_array (customers) >> group_join (empty<customer_address> (), customer_id, address_owner, address_ids) >> count ();
+            TEST_ASSERT (count_of_customers, without_addresses);
+        }
+
+        // Groups are ranges, aggregating them allocates nothing
+        {
+            srand (19740531);
+            auto orders = range (0, 20000) >> select ([] (int i) {return order (i, rand () % 1500, i % 100);}) >> to_vector ();
+
+            auto totals = range (0, 2000)
+                >>  group_join (
+                            from (orders)
+                        ,   [] (int c) {return (std::size_t)c;}
+                        ,   [] (order const & o) {return o.customer_id;}
+                        ,   [] (int, hash_group<order> g)
+                            {
+                                return g >> select ([] (order const & o) {return o.amount;}) >> sum ();
+                            }
+                        )
+                >>  to_vector ()
+                ;
+
+            auto lookup = from (orders) >> to_lookup ([] (order const & o) {return o.customer_id;});
+            auto expected = range (0, 2000)
+                >>  select ([&] (int c) {return lookup[(std::size_t)c] >> select ([] (order const & o) {return o.amount;}) >> sum ();})
+                >>  to_vector ()
+                ;
+
+            TEST_ASSERT (true, (expected == totals));
+        }
+    }
+
+    void test_left_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        auto customer_id    = [](customer const & c) {return c.id;};
+        auto address_owner  = [](customer_address const & ca) {return ca.customer_id;};
+        auto ids            = [](customer const & c, customer_address const & ca) {return std::make_pair (c.id, ca.id);};
+
+        auto no_address     = customer_address (0U, 0U, "");
+
+        {
+            auto result = empty<customer> () >> left_join (from_array (customer_addresses), customer_id, address_owner, ids, no_address) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+
+        // Customers without addresses get the default, the others their
+        // addresses in order
+        {
+            auto result = from_array (customers) >> left_join (from_array (customer_addresses), customer_id, address_owner, ids, no_address) >> to_vector ();
+
+            std::pair<std::size_t, std::size_t> expected[] =
+                {
+                    std::make_pair (1U  , 1U),
+                    std::make_pair (2U  , 0U),
+                    std::make_pair (3U  , 0U),
+                    std::make_pair (4U  , 2U),
+                    std::make_pair (4U  , 3U),
+                    std::make_pair (11U , 0U),
+                    std::make_pair (12U , 0U),
+                    std::make_pair (21U , 0U),
+                };
+
+            TEST_ASSERT (true, (from_array (expected) >> sequence_equal (from (result))));
+
+            auto everyone = from_array (customers) >> left_join (empty<customer_address> (), customer_id, address_owner, ids, no_address) >> to_vector ();
+            TEST_ASSERT (count_of_customers, everyone.size ());
+            TEST_ASSERT (true, (from (everyone) >> all ([] (std::pair<std::size_t, std::size_t> const & p) {return p.second == 0U;})));
+        }
+
+        // The inner join rows plus a default row per unmatched element
+        {
+            srand (19740531);
+            auto orders     = range (0, 20000) >> select ([] (int i) {return std::make_pair (rand () % 10000, i);}) >> to_vector ();
+            auto customers  = range (0, 3000) >> select ([] (int i) {return std::make_pair (rand () % 2000, i);}) >> to_vector ();
+
+            typedef std::pair<int, int> row_type;
+
+            auto key        = [] (row_type const & r) {return r.first;};
+            auto combine    = [] (row_type const & o, row_type const & c) {return std::make_pair (o.second, c.second);};
+
+            auto inner  = from (orders) >> hash_join (from (customers), key, key, combine) >> count ();
+            auto has_customer = from (customers) >> select (key) >> hash_distinct () >> to_vector ();
+            auto unmatched = from (orders) >> select (key) >> hash_except (from (has_customer)) >> count ();
+            auto unmatched_orders = from (orders) >> where ([&] (row_type const & o) {return !(from (has_customer) >> contains (o.first));}) >> count ();
+            TEST_ASSERT (true, (unmatched > 0U));
+
+            auto result = from (orders) >> left_join (from (customers), key, key, combine, row_type (-1, -1)) >> to_vector ();
+            TEST_ASSERT (inner + unmatched_orders, result.size ());
+
+            auto hasher = [] (int k) {return (std::size_t)(k % 13);};
+            auto equal  = [] (int l, int r) {return l == r;};
+            auto custom = from (orders) >> left_join (from (customers), key, key, combine, row_type (-1, -1), hasher, equal) >> to_vector ();
+            TEST_ASSERT (true, (result == custom));
+        }
+    }
+
+    void test_merge_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        auto customer_id    = [](customer const & c) {return c.id;};
+        auto address_owner  = [](customer_address const & ca) {return ca.customer_id;};
+        auto ids            = [](customer const & c, customer_address const & ca) {return std::make_pair (c.id, ca.id);};
+
+        auto sorted_addresses = from_array (customer_addresses)
+            >>  orderby_ascending (address_owner)
+            >>  thenby_ascending ([](customer_address const & ca) {return ca.id;})
+            >>  to_vector ()
+            ;
+
+        {
+            auto result = empty<customer> () >> merge_join (from (sorted_addresses), customer_id, address_owner, ids) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+        {
+            auto result = from_array (customers) >> merge_join (empty<customer_address> (), customer_id, address_owner, ids) >> to_vector ();
+            TEST_ASSERT (0U, result.size ());
+        }
+        {
+            auto result = from_array (customers) >> merge_join (from (sorted_addresses), customer_id, address_owner, ids) >> to_vector ();
+
+            std::pair<std::size_t, std::size_t> expected[] =
+                {
+                    std::make_pair (1U  , 1U),
+                    std::make_pair (4U  , 2U),
+                    std::make_pair (4U  , 3U),
+                };
+
+            TEST_ASSERT (true, (from_array (expected) >> sequence_equal (from (result))));
+        }
+
+        // Runs of equal keys on both sides give the same rows as join
+        {
+            srand (19740531);
+            auto orders     = range (0, 20000) >> select ([] (int i) {return std::make_pair (rand () % 10000, i);}) >> orderby_ascending ([] (std::pair<int, int> const & r) {return r.first;}) >> to_vector ();
+            auto customers  = range (0, 3000) >> select ([] (int i) {return std::make_pair (rand () % 2000, i);}) >> orderby_ascending ([] (std::pair<int, int> const & r) {return r.first;}) >> to_vector ();
+
+            typedef std::pair<int, int> row_type;
+
+            auto key        = [] (row_type const & r) {return r.first;};
+            auto combine    = [] (row_type const & o, row_type const & c) {return std::make_pair (o.second, c.second);};
+
+            auto expected   = from (orders) >> join (from (customers), key, key, combine) >> to_vector ();
+            auto result     = from (orders) >> merge_join (from (customers), key, key, combine) >> to_vector ();
+
+            TEST_ASSERT (true, (expected.size () > 0U));
+            TEST_ASSERT (true, (expected == result));
+        }
+
+        // Reading stops at the first element past the last key of the other
+        // range
+        {
+            int read = 0;
+            auto result = range (0, 100)
+                >>  select ([&] (int i) {++read; return i;})
+                >>  merge_join (range (10, 5), [] (int i) {return i;}, [] (int i) {return i;}, [] (int i, int) {return i;})
+                >>  to_vector ()
+                ;
+
+            TEST_ASSERT (5U, result.size ());
+            TEST_ASSERT (16, read);
+        }
+    }
+
     void test_orderby ()
     {
         using namespace cpplinq;
@@ -1925,6 +2471,17 @@ namespace
                 ;
 
             verify (expected, sequence);
+
+            // The policy carries over to thenby
+            auto sequential =
+                    from_array (customers)
+                >>  orderby ([] (customer const & c) {return c.last_name;}, true)
+                >>  sequential_sort ()
+                >>  thenby ([] (customer const & c) {return c.first_name;}, false)
+                >>  to_vector ()
+                ;
+
+            verify (expected, sequential);
         }
     }
 
@@ -2271,13 +2828,110 @@ namespace
 
     }
 
-    void test_union_with ()
+    void test_hash_distinct ()
     {
         using namespace cpplinq;
 
         TEST_PRELUDE ();
 
-        // union of two empty ranges
+        {
+            auto d = from (empty_vector) >> hash_distinct () >> to_vector ();
+            TEST_ASSERT (0U, d.size ());
+        }
+
+        {
+            int expected[] = {5,4,3,2,1};
+            auto expected_size = get_array_size (expected);
+
+            auto result = from_array (set1) >> hash_distinct () >> to_vector ();
+            auto result_size = result.size ();
+
+            TEST_ASSERT (expected_size, result_size);
+            for (auto i = 0U; i < expected_size && i < result_size; ++i)
+            {
+                TEST_ASSERT (expected[i], result[i]);
+            }
+        }
+
+        // Pluggable hasher and equality
+        {
+            auto by_id      = [] (customer const & c) {return c.id;};
+            auto same_id    = [] (customer const & l, customer const & r) {return l.id == r.id;};
+
+            auto d = from_array (customers_set1) >> hash_distinct (by_id, same_id) >> to_vector ();
+            TEST_ASSERT (4U, d.size ());
+            TEST_ASSERT (true, (from_array (customers_set1) >> take (4) >> sequence_equal (from (d))));
+
+            d = from_array (customers_set1) >> hash_distinct (by_id) >> to_vector ();
+            TEST_ASSERT (4U, d.size ());
+        }
+
+        // Keeps first occurrence order as distinct does, also when the table
+        // grows and when every hash collides
+        {
+            srand (19740531);
+            auto source = range (0, 100000) >> select ([] (int) {return rand () % 20000;}) >> to_vector ();
+
+            auto expected = from (source) >> distinct () >> to_vector ();
+
+            auto result = from (source) >> hash_distinct () >> to_vector ();
+            TEST_ASSERT (true, (expected == result));
+
+            auto strings = from (source) >> select ([] (int i) {return std::to_string (i);}) >> hash_distinct () >> to_vector ();
+            TEST_ASSERT (expected.size (), strings.size ());
+            TEST_ASSERT (true, (from (expected) >> select ([] (int i) {return std::to_string (i);}) >> sequence_equal (from (strings))));
+
+            auto colliding = from (source) >> take (5000) >> hash_distinct ([] (int) {return 0U;}) >> to_vector ();
+            auto expected_colliding = from (source) >> take (5000) >> distinct () >> to_vector ();
+            TEST_ASSERT (true, (expected_colliding == colliding));
+        }
+
+        // Only the elements that go into the table are copied, duplicates
+        // are compared in place
+        {
+            auto orders         = get_orders (700U);
+            auto by_customer    = [] (order const & o) {return o.customer_id;};
+            auto same_customer  = [] (order const & l, order const & r) {return l.customer_id == r.customer_id;};
+
+            order_copies = 0U;
+            auto customers = from (orders) >> hash_distinct (by_customer, same_customer) >> count ();
+            TEST_ASSERT (7U, customers);
+            TEST_ASSERT (true, (order_copies <= 2U * customers));
+
+            order_copies = 0U;
+            auto unioned = from (orders) >> hash_union_with (from (orders), by_customer, same_customer) >> count ();
+            TEST_ASSERT (7U, unioned);
+            TEST_ASSERT (true, (order_copies <= 2U * unioned));
+        }
+
+        // Cancelling frees the table
+        {
+            cancellation_token token;
+            auto d = range (0, 10000) >> select ([&] (int i) {if (i == 5000) token.cancel (); return i;}) >> with_cancellation (token) >> hash_distinct ();
+            auto caught = false;
+            try
+            {
+                while (d.next ())
+                {
+                }
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, d.set.size ());
+            TEST_ASSERT (0U, d.set.slots.capacity ());
+        }
+    }
+
+    void test_union_with ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // union of two empty ranges
         {
             auto result = from (empty_vector) >> union_with (from (empty_vector) ) >> to_vector ();
             TEST_ASSERT (0U, result.size ());
@@ -2539,6 +3193,68 @@ namespace
         }
     }
 
+    void test_hash_set_operators ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        // Empty ranges
+        {
+            TEST_ASSERT (0U, (from (empty_vector) >> hash_union_with (from (empty_vector)) >> count ()));
+            TEST_ASSERT (0U, (from (empty_vector) >> hash_intersect_with (from_array (set1)) >> count ()));
+            TEST_ASSERT (0U, (from_array (set1) >> hash_intersect_with (from (empty_vector), build_smaller) >> count ()));
+            TEST_ASSERT (0U, (from (empty_vector) >> hash_except (from_array (set1), build_smaller) >> count ()));
+        }
+
+        // Same elements in the same order as the std::set based operators
+        {
+            srand (19740531);
+            auto left   = range (0, 20000) >> select ([] (int) {return rand () % 5000;}) >> to_vector ();
+            auto right  = range (0, 5000) >> select ([] (int) {return rand () % 8000;}) >> to_vector ();
+
+            auto expected_union     = from (left) >> union_with (from (right)) >> to_vector ();
+            auto expected_intersect = from (left) >> intersect_with (from (right)) >> to_vector ();
+            auto expected_except    = from (left) >> except (from (right)) >> to_vector ();
+
+            TEST_ASSERT (true, (expected_union == (from (left) >> hash_union_with (from (right)) >> to_vector ())));
+
+            hash_build_side const sides[] = {build_other, build_smaller};
+            for (auto side : sides)
+            {
+                TEST_ASSERT (true, (expected_intersect == (from (left) >> hash_intersect_with (from (right), side) >> to_vector ())));
+                TEST_ASSERT (true, (expected_except == (from (left) >> hash_except (from (right), side) >> to_vector ())));
+
+                // Left is the smaller side this way around
+                auto expected_right_intersect   = from (right) >> intersect_with (from (left)) >> to_vector ();
+                auto expected_right_except      = from (right) >> except (from (left)) >> to_vector ();
+                TEST_ASSERT (true, (expected_right_intersect == (from (right) >> hash_intersect_with (from (left), side) >> to_vector ())));
+                TEST_ASSERT (true, (expected_right_except == (from (right) >> hash_except (from (left), side) >> to_vector ())));
+            }
+        }
+
+        // Pluggable hasher and equality, elements of the other range may
+        // have another type
+        {
+            auto by_id      = [] (customer const & c) {return c.id;};
+            auto same_id    = [] (customer const & l, customer const & r) {return l.id == r.id;};
+
+            auto u = from_array (customers_set1) >> hash_union_with (from_array (customers_set2), by_id, same_id) >> to_vector ();
+            TEST_ASSERT (6U, u.size ());
+
+            auto i = from_array (customers_set1) >> hash_intersect_with (from_array (customers_set2), by_id, same_id, build_smaller) >> to_vector ();
+            TEST_ASSERT (1U, i.size ());
+            TEST_ASSERT (1U, (i.size () > 0U ? i[0].id : 0U));
+
+            auto e = from_array (customers_set1) >> hash_except (from_array (customers_set2), by_id, same_id) >> to_vector ();
+            TEST_ASSERT (3U, e.size ());
+
+            double doubles[] = {1.0, 3.0};
+            auto mixed = from_array (set1) >> hash_intersect_with (from_array (doubles)) >> to_vector ();
+            TEST_ASSERT (2U, mixed.size ());
+        }
+    }
+
     void test_concat ()
     {
         using namespace cpplinq;
@@ -2620,6 +3336,25 @@ namespace
             TEST_ASSERT (false, q.next ());
             TEST_ASSERT (false, q.next ());
         }
+
+        // pushed concat resumes where next () left off and stops with the sink
+        {
+            int set1[] = {0,1,2,3,4,5};
+            int set2[] = {6,7,8,9};
+
+            TEST_ASSERT (45, from_array (set1) >> concat (from_array (set2)) >> sum ());
+            TEST_ASSERT (20, from_array (set1) >> concat (from_array (set2)) >> where ([] (int i) {return i % 2 == 0;}) >> sum ());
+
+            auto q = from_array (set1) >> concat (from_array (set2));
+            for (auto iter = 0; iter < 7; ++iter)
+            {
+                q.next ();
+            }
+            TEST_ASSERT (24, q >> sum ());
+
+            auto first_past_six = from_array (set1) >> concat (from_array (set2)) >> where ([] (int i) {return i > 6;}) >> first ();
+            TEST_ASSERT (7, first_past_six);
+        }
     }
 
     void test_sequence_equal ()
@@ -2887,195 +3622,3231 @@ namespace
         }
     }
 
-    template<typename TPredicate>
-    long long execute_testruns (
-            std::size_t test_runs
-        ,   TPredicate predicate
-        )
+    template<typename TRange>
+    std::vector<typename TRange::value_type> pull_to_vector (TRange range)
     {
-        auto then = std::chrono::high_resolution_clock::now ();
-
-        for (auto test_run = 0U; test_run < test_runs; ++test_run)
+        std::vector<typename TRange::value_type> result;
+        while (range.next ())
         {
-            predicate ();
+            result.push_back (range.front ());
         }
+        return result;
+    }
 
-        auto now = std::chrono::high_resolution_clock::now ();
+    template<typename TRange>
+    void test_batch_equivalence (std::string const & name, TRange range)
+    {
+        using namespace cpplinq;
 
-        auto diff = now - then;
+        auto expected   = pull_to_vector (range);
+        auto found      = range >> to_vector ();
+
+        if (!TEST_ASSERT (expected.size (), found.size ()))
+        {
+            printf ("  Batch mismatch in: %s\n", name.c_str ());
+            return;
+        }
 
-        auto diff_in_ms = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count ();
+        for (std::size_t iter = 0U; iter < expected.size (); ++iter)
+        {
+            if (!TEST_ASSERT (expected[iter], found[iter]))
+            {
+                PRINT_INDEX (iter);
+                return;
+            }
+        }
 
-        return diff_in_ms;
+        TEST_ASSERT (expected.size (), range >> count ());
     }
 
-    void test_performance_range_sum ()
+    void test_batch ()
     {
         using namespace cpplinq;
-
         TEST_PRELUDE ();
 
-        int         const test_repeat       = 80000     ;
-        int         const test_size         = 20000     ;
-        auto        expected_complete_sum   = 0         ;
-        auto        result_complete_sum     = 0         ;
-
-        auto expected = execute_testruns (
-                test_repeat
-            ,   [&] ()
-                {
-                    auto set_sum = 0;
-                    for (auto iter = 0; iter < test_size; ++iter)
-                    {
-                        set_sum += iter;
-                    }
-                    expected_complete_sum += set_sum;
-                }
-            );
-
-        auto result = execute_testruns (
-                test_repeat
-            ,   [&] ()
-                {
-                    auto set_sum =
-                            range(0, test_size)
-                        >>  sum ()
-                        ;
-                    result_complete_sum += set_sum;
-                }
-            );
+        std::vector<int> big_vector;
+        for (int iter = 0; iter < 1000; ++iter)
+        {
+            big_vector.push_back (iter);
+        }
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto never      = [] (int)   {return false;};
+        auto square     = [] (int i) {return i * i;};
+
+        test_batch_equivalence ("from"              , from (big_vector));
+        test_batch_equivalence ("from empty"        , from (empty_vector));
+        test_batch_equivalence ("from_array"        , from_array (ints));
+        test_batch_equivalence ("range"             , range (3, 1000));
+        test_batch_equivalence ("range empty"       , range (3, 0));
+        test_batch_equivalence ("repeat"            , repeat (7, 1000));
+        test_batch_equivalence ("repeat empty"      , repeat (7, 0));
+        test_batch_equivalence ("where"             , from (big_vector) >> where (is_odd));
+        test_batch_equivalence ("where none"        , range (0, 1000) >> where (never));
+        test_batch_equivalence ("select"            , range (0, 1000) >> select (square));
+        test_batch_equivalence ("take"              , range (0, 1000) >> take (300));
+        test_batch_equivalence ("take 0"            , range (0, 1000) >> take (0));
+        test_batch_equivalence ("take past end"     , range (0, 10) >> take (300));
+        test_batch_equivalence ("skip"              , range (0, 1000) >> skip (300));
+        test_batch_equivalence ("skip past end"     , range (0, 10) >> skip (300));
+        test_batch_equivalence ("skip/take/where"   , from (big_vector) >> skip (257) >> where (is_odd) >> take (400));
+        test_batch_equivalence ("where/select/skip" , range (0, 1000) >> where (is_odd) >> select (square) >> skip (1));
+
+        {
+            auto sum_result = range (0, 1000) >> where (is_odd) >> select (square) >> sum ();
+            auto expected   = 0;
+            for (auto iter = 1; iter < 1000; iter += 2)
+            {
+                expected += iter * iter;
+            }
+            TEST_ASSERT (expected, sum_result);
+        }
 
-        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+        {
+            auto for_each_result = 0;
+            from (big_vector) >> take (999) >> for_each ([&] (int i) {for_each_result += i;});
+            TEST_ASSERT (998 * 999 / 2, for_each_result);
+        }
 
-        auto ratio_limit    = 3.0;
-        auto ratio          = ((double)expected)/result;
-        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
-        printf (
-                "Performance numbers for simple sum over numbers, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
-            ,   expected
-            ,   result
-            ,   ratio_limit
-            ,   ratio
-            );
+        {
+            // An istream_iterator refers into itself, its values can't be
+            // batched by reference
+            std::istringstream words ("a bb ccc dddd");
+            auto total_size =
+                    from_iterators (std::istream_iterator<std::string> (words), std::istream_iterator<std::string> ())
+                >>  where ([] (std::string const & s) {return !s.empty ();})
+                >>  select ([] (std::string const & s) {return s.size ();})
+                >>  sum ()
+                ;
+            TEST_ASSERT (10U, total_size);
+        }
     }
 
-    void test_performance_sum ()
+    void test_contiguous ()
     {
         using namespace cpplinq;
-
         TEST_PRELUDE ();
 
-        int         const test_repeat       = 80000     ;
-        int         const test_size         = 20000     ;
-        auto        expected_complete_sum   = 0         ;
-        auto        result_complete_sum     = 0         ;
-
-        srand (19740531);
-
-        auto test_set =
-                range (0, test_size)
-            >>  select ([] (int i){return rand ();})
-            >>  to_vector (test_size)
-            ;
-
-        auto expected = execute_testruns (
-                test_repeat
-            ,   [&] ()
+        std::vector<int>    vector_ints (ints, ints + count_of_ints);
+        std::vector<bool>   vector_bools (3, true)  ;
+        std::list<int>      list_ints (ints, ints + count_of_ints);
+        std::string         hello ("hello")         ;
+
+        TEST_ASSERT (true   , detail::is_contiguous_range<decltype (from_array (ints))>::value);
+        TEST_ASSERT (true   , detail::is_contiguous_range<decltype (from (vector_ints))>::value);
+        TEST_ASSERT (true   , detail::is_contiguous_range<decltype (from (hello))>::value);
+        TEST_ASSERT (false  , detail::is_contiguous_range<decltype (from (vector_bools))>::value);
+        TEST_ASSERT (false  , detail::is_contiguous_range<decltype (from (list_ints))>::value);
+        TEST_ASSERT (false  , detail::is_contiguous_range<decltype (range (0, 10))>::value);
+        auto where_ints = from (vector_ints) >> where ([] (int) {return true;});
+        TEST_ASSERT (false  , detail::is_contiguous_range<decltype (where_ints)>::value);
+
+        auto expected_sum = 0;
+        for (auto i : vector_ints)
+        {
+            expected_sum += i;
+        }
+
+        TEST_ASSERT (expected_sum                   , from (vector_ints) >> sum ());
+        TEST_ASSERT (count_of_ints                  , from (vector_ints) >> count ());
+        TEST_ASSERT (true                           , from (vector_ints) >> contains (ints[count_of_ints - 1]));
+        TEST_ASSERT (false                          , from (vector_ints) >> contains (-1));
+        TEST_ASSERT (true                           , from (vector_ints) >> sequence_equal (from_array (ints)));
+        TEST_ASSERT (false                          , from (vector_ints) >> sequence_equal (from_array (simple_ints)));
+        TEST_ASSERT (true                           , from (empty_vector) >> sequence_equal (from (empty_vector)));
+        TEST_ASSERT (0U                             , from (empty_vector) >> count ());
+        TEST_ASSERT (0                              , from (empty_vector) >> sum ());
+        TEST_ASSERT (false                          , from (empty_vector) >> contains (0));
+        TEST_ASSERT (0U                             , (from (empty_vector) >> to_vector ()).size ());
+        TEST_ASSERT (true                           , from (hello) >> contains ('l'));
+        // The array includes the terminating zero
+        TEST_ASSERT (false                          , from (hello) >> sequence_equal (from_array ("hello")));
+
+        {
+            // The span starts at the first element not yet visited
+            auto q = from (vector_ints);
+            q.next ();
+            q.next ();
+
+            auto result = q >> to_vector ();
+            if (TEST_ASSERT (count_of_ints - 2, result.size ()))
+            {
+                for (std::size_t iter = 0U; iter < result.size (); ++iter)
                 {
-                    auto set_sum = 0;
-                    for (auto v : test_set)
-                    {
-                        set_sum += v;
-                    }
-                    expected_complete_sum += set_sum;
+                    TEST_ASSERT (ints[iter + 2], result[iter]);
                 }
-            );
+            }
 
-        auto result = execute_testruns (
-                test_repeat
-            ,   [&] ()
-                {
-                    auto set_sum =
-                            from (test_set)
-                        >>  sum ()
-                        ;
-                    result_complete_sum += set_sum;
-                }
-            );
+            TEST_ASSERT (count_of_ints - 2          , q >> count ());
+            TEST_ASSERT (expected_sum - ints[0] - ints[1], q >> sum ());
+            TEST_ASSERT (false                      , q >> contains (0));
+        }
 
-        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+        {
+            std::vector<double> doubles (3, 0.0);
+            std::vector<double> negated (3, -0.0);
 
-        auto ratio_limit    = 2.0;
-        auto ratio          = ((double)expected)/result;
-        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
-        printf (
-                "Performance numbers for simple sum over numbers, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
-            ,   expected
-            ,   result
-            ,   ratio_limit
-            ,   ratio
-            );
+            // -0.0 == 0.0 although their representations differ
+            TEST_ASSERT (true, from (doubles) >> sequence_equal (from (negated)));
+        }
     }
 
-    bool is_prime (int i)
+    template<typename TRange>
+    void test_push_equivalence (std::string const & name, TRange range)
     {
-        if (i < 2)
+        using namespace cpplinq;
+
+        auto expected = pull_to_vector (range);
+
+        std::vector<typename TRange::value_type> found;
+        auto append = [&found] (typename TRange::value_type const & v)
         {
-            return false;
-        }
-        else if (i == 2)
+            found.push_back (v);
+        };
+
+        detail::action_sink<decltype (append)> sink (append);
+        TEST_ASSERT (true, detail::push_traits<TRange>::push (range, sink));
+
+        if (!TEST_ASSERT (expected.size (), found.size ()))
         {
-            return true;
+            printf ("  Push mismatch in: %s\n", name.c_str ());
+            return;
         }
-        else
-        {
-            auto r = std::ceil (std::sqrt (i));
 
-            for (auto iter = 2; iter <= r; ++iter)
+        for (std::size_t iter = 0U; iter < expected.size (); ++iter)
+        {
+            if (!TEST_ASSERT (expected[iter], found[iter]))
             {
-                if (i % iter == 0)
-                {
-                    return false;
-                }
+                PRINT_INDEX (iter);
+                return;
             }
-
-            return true;
         }
     }
 
-    void test_performance_is_prime ()
+    void test_push ()
     {
         using namespace cpplinq;
-
         TEST_PRELUDE ();
 
-#if _DEBUG
-        int         const test_repeat   = 25        ;
-#else
-        int         const test_repeat   = 100       ;
-#endif
-        int         const test_size     = 10000     ;
+        std::list<int> list_ints (ints, ints + count_of_ints);
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto is_small   = [] (int i) {return i < 7;};
+        auto square     = [] (int i) {return i * i;};
+
+        test_push_equivalence ("from"               , from_array (ints));
+        test_push_equivalence ("from list"          , from (list_ints));
+        test_push_equivalence ("from empty"         , from (empty_vector));
+        test_push_equivalence ("range"              , range (3, 100));
+        test_push_equivalence ("repeat"             , repeat (7, 10));
+        test_push_equivalence ("where"              , from_array (ints) >> where (is_odd));
+        test_push_equivalence ("select"             , from_array (ints) >> select (square));
+        test_push_equivalence ("take"               , from_array (ints) >> take (5));
+        test_push_equivalence ("take 0"             , from_array (ints) >> take (0));
+        test_push_equivalence ("take past end"      , from_array (ints) >> take (500));
+        test_push_equivalence ("take_while"         , from_array (ints) >> take_while (is_small));
+        test_push_equivalence ("skip"               , from_array (ints) >> skip (5));
+        test_push_equivalence ("skip past end"      , from_array (ints) >> skip (500));
+        test_push_equivalence ("skip_while"         , from_array (ints) >> skip_while (is_small));
+        test_push_equivalence ("skip_while all"     , from_array (ints) >> skip_while ([] (int) {return true;}));
+        test_push_equivalence ("orderby where"      , from (list_ints) >> orderby ([] (int i) {return i;}) >> where (is_odd));
+        test_push_equivalence (
+                "5 stages"
+            ,       from (list_ints)
+                >>  where (is_small)
+                >>  select (square)
+                >>  skip (1)
+                >>  take_while ([] (int i) {return i < 30;})
+                >>  take (4)
+            );
 
-        auto        expected_complete_sum   = 0         ;
-        auto        result_complete_sum     = 0         ;
+        {
+            // Early termination, no element is produced in vain
+            auto calls      = 0;
+            auto counted    = [&calls] (int i) {++calls; return i;};
 
-        auto expected = execute_testruns (
-                test_repeat
-            ,   [&] ()
-                {
-                    auto        iter        = 3;
-                    auto        count       = 0;
-                    auto        expected_sum= 0;
-                    while (count < test_size)
-                    {
-                        if (is_prime (iter))
+            calls = 0;
+            auto take_result = range (0, 1000) >> select (counted) >> take (5) >> sum ();
+            TEST_ASSERT (10, take_result);
+            TEST_ASSERT (5, calls);
+
+            calls = 0;
+            auto take_while_result = range (0, 1000) >> select (counted) >> take_while ([] (int i) {return i < 5;}) >> sum ();
+            TEST_ASSERT (10, take_while_result);
+            TEST_ASSERT (6, calls);
+
+            calls = 0;
+            auto any_result = range (0, 1000) >> select (counted) >> any ([] (int i) {return i == 10;});
+            TEST_ASSERT (true, any_result);
+            TEST_ASSERT (11, calls);
+
+            calls = 0;
+            auto first_result = range (0, 1000) >> select (counted) >> first ([] (int i) {return i == 10;});
+            TEST_ASSERT (10, first_result);
+            TEST_ASSERT (11, calls);
+
+            calls = 0;
+            auto first_or_default_result = range (0, 1000) >> select (counted) >> first_or_default ([] (int i) {return i == 10;});
+            TEST_ASSERT (10, first_or_default_result);
+            TEST_ASSERT (11, calls);
+
+            calls = 0;
+            auto contains_result = range (0, 1000) >> select (counted) >> contains (10);
+            TEST_ASSERT (true, contains_result);
+            TEST_ASSERT (11, calls);
+
+            calls = 0;
+            auto all_result = range (0, 1000) >> select (counted) >> all ([] (int i) {return i < 10;});
+            TEST_ASSERT (false, all_result);
+            TEST_ASSERT (11, calls);
+        }
+    }
+
+    template<typename TRange>
+    void test_size_hint_of (
+            std::string const & name
+        ,   TRange const &      range
+        ,   int                 expected_kind
+        ,   std::size_t         expected_hint
+        )
+    {
+        using namespace cpplinq;
+
+        typedef detail::size_hint_traits<TRange> traits;
+
+        auto kind = static_cast<int> (traits::kind);
+        auto hint = traits::size_hint (range);
+
+        if (    !TEST_ASSERT (expected_kind, kind)
+            ||  !TEST_ASSERT (expected_hint, hint)
+            )
+        {
+            printf ("  Size hint mismatch in: %s\n", name.c_str ());
+        }
+    }
+
+    void test_size_hint ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        using detail::size_hint_none;
+        using detail::size_hint_upper_bound;
+        using detail::size_hint_exact;
+
+        std::vector<int>    vector_ints (ints, ints + count_of_ints);
+        std::list<int>      list_ints (ints, ints + count_of_ints);
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto square     = [] (int i) {return i * i;};
+        auto identity   = [] (int i) {return i;};
+
+        test_size_hint_of ("from"           , from (vector_ints)                        , size_hint_exact       , count_of_ints     );
+        test_size_hint_of ("from_array"     , from_array (ints)                         , size_hint_exact       , count_of_ints     );
+        test_size_hint_of ("from list"      , from (list_ints)                          , size_hint_none        , detail::invalid_size);
+        test_size_hint_of ("range"          , range (3, 10)                             , size_hint_exact       , 10U               );
+        test_size_hint_of ("range empty"    , range (3, 0)                              , size_hint_exact       , 0U                );
+        test_size_hint_of ("repeat"         , repeat (1, 7)                             , size_hint_exact       , 7U                );
+        test_size_hint_of ("where"          , range (0, 10) >> where (is_odd)           , size_hint_none        , detail::invalid_size);
+        test_size_hint_of ("select"         , range (0, 10) >> select (square)          , size_hint_exact       , 10U               );
+        test_size_hint_of ("take"           , range (0, 10) >> take (4)                 , size_hint_exact       , 4U                );
+        test_size_hint_of ("take past end"  , range (0, 10) >> take (40)                , size_hint_exact       , 10U               );
+        test_size_hint_of ("take where"     , range (0, 10) >> where (is_odd) >> take (4), size_hint_upper_bound, 4U                );
+        test_size_hint_of ("skip"           , range (0, 10) >> skip (4)                 , size_hint_exact       , 6U                );
+        test_size_hint_of ("skip past end"  , range (0, 10) >> skip (40)                , size_hint_exact       , 0U                );
+        test_size_hint_of ("skip where"     , range (0, 10) >> where (is_odd) >> skip (4), size_hint_none       , detail::invalid_size);
+        test_size_hint_of ("zip"            , range (0, 10) >> zip_with (range (0, 5))  , size_hint_exact       , 5U                );
+        test_size_hint_of ("zip where"      , range (0, 10) >> where (is_odd) >> zip_with (range (0, 5)), size_hint_upper_bound, 5U);
+        test_size_hint_of ("reverse"        , range (0, 10) >> reverse ()               , size_hint_exact       , 10U               );
+        test_size_hint_of ("orderby"        , from (vector_ints) >> orderby (identity)  , size_hint_exact       , count_of_ints     );
+        test_size_hint_of ("thenby"         , from (vector_ints) >> orderby (identity) >> thenby (square), size_hint_exact, count_of_ints);
+
+        {
+            // Hints follow the range as it's consumed
+            auto q = range (0, 10) >> skip (2) >> take (5);
+            q.next ();
+            q.next ();
+            test_size_hint_of ("skip take consumed", q, size_hint_exact, 3U);
+
+            auto o = from (vector_ints) >> orderby (identity);
+            o.next ();
+            test_size_hint_of ("orderby consumed", o, size_hint_exact, count_of_ints - 1);
+
+            auto r = range (0, 10) >> reverse ();
+            r.next ();
+            test_size_hint_of ("reverse consumed", r, size_hint_exact, 9U);
+        }
+
+        {
+            // Exact hints are reserved as is, upper bounds only cap the guess
+            auto exact = range (0, 1000) >> select (square) >> to_vector ();
+            TEST_ASSERT (1000U, exact.size ());
+            TEST_ASSERT (1000U, exact.capacity ());
+
+            auto upper_bound = range (0, 1000) >> where (is_odd) >> take (4) >> to_vector ();
+            TEST_ASSERT (4U, upper_bound.size ());
+            TEST_ASSERT (4U, upper_bound.capacity ());
+
+            auto sorted = from (vector_ints) >> orderby (identity);
+            sorted.next ();
+            TEST_ASSERT (count_of_ints, sorted.sorted_values.capacity ());
+        }
+    }
+
+    void test_random_access ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        using detail::is_random_access_range;
+
+        std::vector<int>    vector_ints (ints, ints + count_of_ints);
+        std::list<int>      list_ints (ints, ints + count_of_ints);
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto identity   = [] (int i) {return i;};
+
+        {
+            TEST_ASSERT (true , is_random_access_range<decltype (from (vector_ints))>::value);
+            TEST_ASSERT (false, is_random_access_range<decltype (from (list_ints))>::value);
+            TEST_ASSERT (true , is_random_access_range<decltype (range (0, 10) >> select (identity) >> skip (2) >> take (3))>::value);
+            TEST_ASSERT (true , is_random_access_range<decltype (repeat (1, 10) >> reverse ())>::value);
+            TEST_ASSERT (true , is_random_access_range<decltype (from (list_ints) >> orderby (identity) >> thenby (identity))>::value);
+            TEST_ASSERT (false, is_random_access_range<decltype (range (0, 10) >> where (is_odd) >> take (3))>::value);
+        }
+
+        {
+            // Indexed paths agree with the sequential ones
+            auto sorted_list    = from (list_ints) >> orderby (identity) >> to_vector ();
+            auto reversed_list  = from (list_ints) >> reverse () >> to_vector ();
+
+            for (auto index = 0U; index < count_of_ints + 2U; ++index)
+            {
+                auto expected_sorted    = index < count_of_ints ? sorted_list[index] : 0;
+                auto expected_reversed  = index < count_of_ints ? reversed_list[index] : 0;
+
+                auto sorted_result      = from (vector_ints) >> orderby (identity) >> element_at_or_default (index);
+                auto reversed_result    = from (vector_ints) >> reverse () >> element_at_or_default (index);
+
+                TEST_ASSERT (expected_sorted    , sorted_result);
+                TEST_ASSERT (expected_reversed  , reversed_result);
+            }
+
+            TEST_ASSERT (sorted_list.back ()  , from (vector_ints) >> orderby (identity) >> last_or_default ());
+            TEST_ASSERT (ints[0]              , from (vector_ints) >> reverse () >> last_or_default ());
+            TEST_ASSERT (0                    , from (empty_vector) >> reverse () >> last_or_default ());
+            TEST_ASSERT (count_of_ints - 3    , from (list_ints) >> orderby (identity) >> skip (3) >> count ());
+            TEST_ASSERT (2U                   , range (0, 10) >> skip (3) >> take (2) >> count ());
+            TEST_ASSERT (0U                   , range (0, 10) >> skip (30) >> take (2) >> count ());
+            TEST_ASSERT (9                    , range (0, 10) >> skip (3) >> take (20) >> last_or_default ());
+            TEST_ASSERT (4                    , range (0, 10) >> skip (3) >> take (2) >> skip (1) >> element_at_or_default (0));
+            TEST_ASSERT (0                    , range (0, 10) >> skip (3) >> take (2) >> element_at_or_default (2));
+            TEST_ASSERT (4                    , repeat (4, 10) >> skip (9) >> last_or_default ());
+        }
+
+        {
+            // Partially consumed ranges index from the upcoming element
+            auto sorted_list = from (list_ints) >> orderby (identity) >> to_vector ();
+
+            auto o = from (vector_ints) >> orderby (identity);
+            o.next ();
+            o.next ();
+            auto element_result = o >> element_at_or_default (0);
+            TEST_ASSERT (sorted_list[2], element_result);
+            auto count_result = o >> count ();
+            TEST_ASSERT (count_of_ints - 2, count_result);
+
+            auto r = range (0, 10) >> reverse ();
+            r.next ();
+            auto reverse_result = r >> element_at_or_default (0);
+            TEST_ASSERT (8, reverse_result);
+        }
+
+        {
+            // Paging sorted results, the skipped prefix isn't stepped through
+            std::vector<int> descending;
+            for (auto i = 0; i < 1000; ++i)
+            {
+                descending.push_back (999 - i);
+            }
+
+            auto page = from (descending) >> orderby (identity) >> skip (500) >> take (3) >> to_vector ();
+            TEST_ASSERT (3U, page.size ());
+            TEST_ASSERT (500, page[0]);
+            TEST_ASSERT (501, page[1]);
+            TEST_ASSERT (502, page[2]);
+        }
+
+        {
+            // Elements that aren't produced aren't projected
+            auto calls      = 0;
+            auto counted    = [&calls] (int i) {++calls; return i;};
+
+            calls = 0;
+            auto count_result = range (0, 1000) >> select (counted) >> count ();
+            TEST_ASSERT (1000U, count_result);
+            TEST_ASSERT (0, calls);
+
+            calls = 0;
+            auto element_result = range (0, 1000) >> select (counted) >> element_at_or_default (500);
+            TEST_ASSERT (500, element_result);
+            TEST_ASSERT (1, calls);
+
+            calls = 0;
+            auto last_result = range (0, 1000) >> select (counted) >> last_or_default ();
+            TEST_ASSERT (999, last_result);
+            TEST_ASSERT (1, calls);
+
+            calls = 0;
+            auto skip_result = range (0, 1000) >> select (counted) >> skip (990) >> sum ();
+            TEST_ASSERT (9945, skip_result);
+            TEST_ASSERT (10, calls);
+        }
+    }
+
+    void test_reference_preservation ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        auto orders     = get_orders (100);
+        auto is_large   = [] (order const & o) {return o.amount > 50.0;};
+        auto amount     = [] (order const & o) {return o.amount;};
+
+        std::vector<customer> customers;
+        for (auto iter = 0U; iter < 7U; ++iter)
+        {
+            customers.push_back (customer (iter));
+        }
+
+        // Elements are only inspected, no order is ever copied
+        {
+            order_copies = 0U;
+            auto max_result = from (orders) >> where (is_large) >> take (50) >> skip (2) >> max (amount);
+            TEST_ASSERT (100.0, max_result);
+            TEST_ASSERT (0U, order_copies);
+        }
+
+        {
+            order_copies = 0U;
+            auto concat_result = from (orders) >> concat (from (orders)) >> where (is_large) >> count ();
+            auto expected_result = 2U * (from (orders) >> where (is_large) >> count ());
+            TEST_ASSERT (expected_result, concat_result);
+            TEST_ASSERT (0U, order_copies);
+        }
+
+        {
+            order_copies = 0U;
+            auto join_result =
+                    from (orders)
+                >>  join (
+                        from (customers)
+                    ,   [] (order const & o) {return o.customer_id;}
+                    ,   [] (customer const & c) {return c.id;}
+                    ,   [] (order const & o, customer const &) {return o.amount;}
+                    )
+                >>  sum ()
+                ;
+            TEST_ASSERT (from (orders) >> sum (amount), join_result);
+            TEST_ASSERT (0U, order_copies);
+        }
+
+        // Materialization copies, once per element
+        {
+            order_copies = 0U;
+            auto first_result = from (orders) >> where (is_large) >> first_or_default ();
+            TEST_ASSERT (true, (is_large (first_result)));
+            TEST_ASSERT (1U, order_copies);
+        }
+
+        {
+            order_copies = 0U;
+            auto pairwise_result =
+                    from (orders)
+                >>  pairwise ()
+                >>  select ([] (std::pair<order, order> const & p) {return p.second.id - p.first.id;})
+                >>  sum ()
+                ;
+            TEST_ASSERT (orders.size () - 1U, pairwise_result);
+            // Each element is copied into the pair and moved along once, setting up
+            // the first pair costs a few extra moves
+            TEST_ASSERT (true, (order_copies <= 2U * orders.size () + 3U));
+        }
+    }
+
+#if CPPLINQ_CONSTEXPR_PIPELINES
+    void test_constexpr ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        // Evaluated by the compiler, TEST_ASSERT only reports they ran
+        constexpr auto square           = [] (int i) {return i * i;};
+        constexpr auto divisible_by_3   = [] (int i) {return i % 3 == 0;};
+        constexpr auto is_odd_square    = [] (int i) {return i % 2 == 1;};
+
+        constexpr auto sum_of_squares   = range (0, 10) >> select (square) >> sum ();
+        constexpr auto count_of_3s      = range (0, 100) >> where (divisible_by_3) >> count ();
+
+        static_assert (sum_of_squares == 285                                                        , "range >> select >> sum");
+        static_assert (count_of_3s == 34U                                                           , "range >> where >> count");
+        static_assert ((range (0, 100) >> where (divisible_by_3) >> sum ()) == 1683                 , "range >> where >> sum");
+        static_assert ((range (0, 10) >> select (square) >> where (is_odd_square) >> max ()) == 81  , "range >> select >> where >> max");
+        static_assert ((range (5, 10) >> min ()) == 5                                               , "range >> min");
+        static_assert ((repeat (7, 5) >> sum ()) == 35                                              , "repeat >> sum");
+        static_assert ((singleton (42) >> max ()) == 42                                             , "singleton >> max");
+        static_assert ((empty<int> () >> count ()) == 0U                                            , "empty >> count");
+
+        TEST_ASSERT (285, sum_of_squares);
+        TEST_ASSERT (34U, count_of_3s);
+    }
+#endif
+
+#if CPPLINQ_RVALUE_OPERATORS
+    void test_move_pipeline ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        typedef std::vector<int, counting_allocator<int>> counted_vector;
+
+        auto identity   = [] (int i) {return i;};
+        auto expected   = from_array (ints) >> where (is_odd) >> select (double_it) >> to_vector ();
+
+        {
+            // A temporary pipeline is moved stage by stage, the only allocation
+            // is the copy from_copy is asked to make
+            counted_vector source (ints, ints + count_of_ints);
+
+            counted_allocations = 0U;
+            auto result = from_copy (source) >> where (is_odd) >> select (double_it) >> to_vector ();
+            TEST_ASSERT (1U, counted_allocations);
+            TEST_ASSERT (true, (expected == result));
+
+            counted_allocations = 0U;
+            auto moved_result = from_copy (std::move (source)) >> where (is_odd) >> select (double_it) >> to_vector ();
+            TEST_ASSERT (0U, counted_allocations);
+            TEST_ASSERT (true, (expected == moved_result));
+        }
+
+        {
+            counted_vector source (ints, ints + count_of_ints);
+
+            counted_allocations = 0U;
+            auto sorted = from_copy (std::move (source)) >> orderby (identity) >> reverse () >> take (5) >> to_vector ();
+            TEST_ASSERT (0U, counted_allocations);
+            TEST_ASSERT (5U, sorted.size ());
+            TEST_ASSERT (9, sorted[0]);
+        }
+
+        {
+            // Named ranges are still copied, the copy iterates its own container
+            counted_vector source (ints, ints + count_of_ints);
+
+            auto q = from_copy (std::move (source));
+            q.next ();
+
+            counted_allocations = 0U;
+            auto copied = q >> where (is_odd) >> select (double_it) >> to_vector ();
+            TEST_ASSERT (1U, counted_allocations);
+
+            auto rest = from_array (ints) >> skip (1) >> where (is_odd) >> select (double_it) >> to_vector ();
+            TEST_ASSERT (true, (rest == copied));
+        }
+
+        {
+            // A moved range keeps its position, for node based containers as
+            // well as for strings short enough to be stored inline
+            auto list_range = from_copy (std::list<int> (ints, ints + count_of_ints));
+            list_range.next ();
+            auto moved_list = std::move (list_range);
+            TEST_ASSERT (ints[0], moved_list.front ());
+            TEST_ASSERT (true, (moved_list >> sequence_equal (from_array (ints) >> skip (1))));
+
+            auto set_range = from_copy (std::set<int> (ints, ints + count_of_ints));
+            while (set_range.next ())
+            {
+            }
+            auto moved_set = std::move (set_range);
+            TEST_ASSERT (false, moved_set.next ());
+
+            auto string_range = from_copy (std::string ("abc"));
+            string_range.next ();
+            auto moved_string = std::move (string_range);
+            TEST_ASSERT (true, (moved_string >> sequence_equal (from (std::string ("bc")))));
+        }
+    }
+#endif
+
+#ifndef CPPLINQ_NO_PARALLEL
+    long long parallel_fibonacci (cpplinq::executor & pool, int n)
+    {
+        if (n < 2)
+        {
+            return n;
+        }
+
+        long long left  = 0;
+        long long right = 0;
+        pool.fork_join (
+                [&] () {left = parallel_fibonacci (pool, n - 1);}
+            ,   [&] () {right = parallel_fibonacci (pool, n - 2);}
+            );
+        return left + right;
+    }
+
+    void test_executor ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        {
+            executor pool (0U);
+            TEST_ASSERT (0U, pool.worker_count ());
+            TEST_ASSERT (1U, pool.concurrency ());
+            TEST_ASSERT (true, pool.runs_inline (1000000U));
+
+            auto caller = std::this_thread::get_id ();
+            std::size_t inline_calls = 0U;
+            pool.parallel_for (
+                    0U
+                ,   1000U
+                ,   1U
+                ,   [&] (std::size_t begin, std::size_t end)
+                    {
+                        TEST_ASSERT (true, (caller == std::this_thread::get_id ()));
+                        TEST_ASSERT (0U, begin);
+                        TEST_ASSERT (1000U, end);
+                        ++inline_calls;
+                    }
+                );
+            TEST_ASSERT (1U, inline_calls);
+            TEST_ASSERT (6765, (int)parallel_fibonacci (pool, 20));
+        }
+
+        {
+            TEST_ASSERT (executor::default_worker_count () + 1U, default_executor ().concurrency ());
+            TEST_ASSERT (CPPLINQ_INLINE_THRESHOLD, (int)default_executor ().inline_threshold ());
+        }
+
+        std::size_t const worker_counts[] = {1U, 2U, 3U, 7U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+            TEST_ASSERT (worker_count, pool.worker_count ());
+
+            // Deeply nested fork/join
+            TEST_ASSERT (46368, (int)parallel_fibonacci (pool, 24));
+
+            // Every index visited exactly once
+            std::size_t const size = 1000000U;
+            std::vector<int> hits (size);
+            std::atomic<std::size_t> chunks (0U);
+            pool.parallel_for (
+                    0U
+                ,   size
+                ,   1000U
+                ,   [&] (std::size_t begin, std::size_t end)
+                    {
+                        for (auto index = begin; index < end; ++index)
                         {
-                            expected_sum += iter;
-                            ++count;
+                            ++hits[index];
                         }
-                        iter += 2;
+                        ++chunks;
                     }
-                    expected_complete_sum += expected_sum;
+                );
+            TEST_ASSERT (size, (std::size_t)std::count (hits.begin (), hits.end (), 1));
+            TEST_ASSERT (true, (chunks.load () >= size / 1000U));
+
+            // Below the inline threshold the caller runs the work
+            auto caller = std::this_thread::get_id ();
+            pool.parallel_for (
+                    0U
+                ,   63U
+                ,   1U
+                ,   [&] (std::size_t, std::size_t)
+                    {
+                        TEST_ASSERT (true, (caller == std::this_thread::get_id ()));
+                    }
+                );
+
+            // Exceptions are propagated to the caller once all work is done
+            std::atomic<std::size_t> visited (0U);
+            auto caught = false;
+            try
+            {
+                pool.parallel_for (
+                        0U
+                    ,   size
+                    ,   1000U
+                    ,   [&] (std::size_t begin, std::size_t end)
+                        {
+                            visited += end - begin;
+                            if (begin <= size / 2U && size / 2U < end)
+                            {
+                                throw programming_error_exception ();
+                            }
+                        }
+                    );
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (size, visited.load ());
+
+            // Several threads sharing the pool
+            std::vector<long long> results (4U);
+            std::vector<std::thread> clients;
+            for (auto client = 0U; client < results.size (); ++client)
+            {
+                clients.emplace_back (
+                    [&, client] ()
+                    {
+                        std::atomic<long long> sum (0);
+                        pool.parallel_for (
+                                0U
+                            ,   100000U
+                            ,   0U
+                            ,   [&] (std::size_t begin, std::size_t end)
+                                {
+                                    long long chunk_sum = 0;
+                                    for (auto index = begin; index < end; ++index)
+                                    {
+                                        chunk_sum += (long long)index;
+                                    }
+                                    sum += chunk_sum;
+                                }
+                            );
+                        results[client] = sum.load () + parallel_fibonacci (pool, 15);
+                    });
+            }
+            for (auto & client : clients)
+            {
+                client.join ();
+            }
+            for (auto result : results)
+            {
+                TEST_ASSERT (true, (result == 4999950000LL + 610LL));
+            }
+        }
+
+        {
+            // Joiners outlast their spin and sleep until the slow work is done
+            executor pool (1U, 1U);
+            std::atomic<std::size_t> slow_chunks (0U);
+            pool.parallel_for (
+                    0U
+                ,   4U
+                ,   1U
+                ,   [&] (std::size_t, std::size_t)
+                    {
+                        std::this_thread::sleep_for (std::chrono::milliseconds (20));
+                        ++slow_chunks;
+                    }
+                );
+            TEST_ASSERT (4U, slow_chunks.load ());
+            TEST_ASSERT (610, (int)parallel_fibonacci (pool, 15));
+        }
+
+        {
+            // Pools come and go
+            for (auto iteration = 0U; iteration < 20U; ++iteration)
+            {
+                executor pool (3U, 1U);
+                TEST_ASSERT (610, (int)parallel_fibonacci (pool, 15));
+            }
+        }
+    }
+#endif
+
+#ifndef CPPLINQ_NO_PARALLEL
+    // Appends the elements of a part, the parts of a split range have types of their own
+    struct append_elements
+    {
+        std::atomic<std::size_t> *  parts   ;
+
+        template<typename TRange>
+        void operator() (std::vector<int> & result, TRange & range) const
+        {
+            if (parts)
+            {
+                ++*parts;
+            }
+
+            while (range.next ())
+            {
+                result.push_back (range.front ());
+            }
+        }
+    };
+#endif
+
+    void test_split ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        using detail::split_traits;
+
+        std::vector<int>    vector_ints (ints, ints + count_of_ints);
+        std::list<int>      list_ints (ints, ints + count_of_ints);
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+
+        {
+            TEST_ASSERT (true , (bool)split_traits<decltype (from (vector_ints))>::is_native);
+            TEST_ASSERT (false, (bool)split_traits<decltype (from (list_ints))>::is_native);
+            TEST_ASSERT (true , (bool)split_traits<decltype (from_copy (vector_ints))>::is_native);
+            TEST_ASSERT (false, (bool)split_traits<decltype (from_copy (list_ints))>::is_native);
+            TEST_ASSERT (true , (bool)split_traits<decltype (range (0, 10) >> where (is_odd) >> select (double_it))>::is_native);
+            TEST_ASSERT (true , (bool)split_traits<decltype (repeat (1, 10) >> zip_with (from (vector_ints)))>::is_native);
+            TEST_ASSERT (false, (bool)split_traits<decltype (range (0, 10) >> zip_with (from (list_ints)))>::is_native);
+            TEST_ASSERT (false, (bool)split_traits<decltype (range (0, 10) >> take (3))>::is_native);
+        }
+
+        {
+            auto q      = from (vector_ints);
+            TEST_ASSERT (count_of_ints, q.split_size ());
+
+            auto lower  = q.split (10U);
+            TEST_ASSERT (10U, lower.split_size ());
+            TEST_ASSERT (count_of_ints - 10U, q.split_size ());
+            TEST_ASSERT (true, (std::vector<int> (ints, ints + 10) == (lower >> to_vector ())));
+            TEST_ASSERT (true, (std::vector<int> (ints + 10, ints + count_of_ints) == (q >> to_vector ())));
+        }
+
+        {
+            // Splitting picks up where a partly consumed range is
+            auto q = from (vector_ints);
+            q.next ();
+            q.next ();
+
+            auto lower = q.split (5U);
+            TEST_ASSERT (true, (std::vector<int> (ints + 2, ints + 7) == (lower >> to_vector ())));
+            TEST_ASSERT (true, (std::vector<int> (ints + 7, ints + count_of_ints) == (q >> to_vector ())));
+        }
+
+        {
+            auto q      = range (0, 10);
+            auto lower  = q.split (4U);
+            TEST_ASSERT (true, ((range (0, 4) >> to_vector ()) == (lower >> to_vector ())));
+            TEST_ASSERT (true, ((range (4, 6) >> to_vector ()) == (q >> to_vector ())));
+
+            auto empty_part = q.split (0U);
+            TEST_ASSERT (0U, empty_part >> count ());
+        }
+
+        {
+            auto q      = repeat (7, 10);
+            auto lower  = q.split (3U);
+            TEST_ASSERT (21, lower >> sum ());
+            TEST_ASSERT (49, q >> sum ());
+        }
+
+        {
+            auto q      = from_copy (vector_ints);
+            auto lower  = q.split (10U);
+            TEST_ASSERT (true, (std::vector<int> (ints, ints + 10) == (lower >> to_vector ())));
+
+            // A copy keeps the bounds of the original
+            auto copy = q;
+            TEST_ASSERT (true, (std::vector<int> (ints + 10, ints + count_of_ints) == (copy >> to_vector ())));
+
+            auto middle = q.split (10U);
+            TEST_ASSERT (true, (std::vector<int> (ints + 10, ints + 20) == (middle >> to_vector ())));
+            TEST_ASSERT (true, (std::vector<int> (ints + 20, ints + count_of_ints) == (q >> to_vector ())));
+        }
+
+        {
+            // Filtering and projecting parts split their source and copy the predicate
+            auto q      = from (vector_ints) >> where (is_odd) >> select (double_it);
+            auto lower  = q.split (count_of_ints / 2U);
+            TEST_ASSERT (count_of_ints - count_of_ints / 2U, q.split_size ());
+
+            auto parts = lower >> to_vector ();
+            auto upper = q >> to_vector ();
+            parts.insert (parts.end (), upper.begin (), upper.end ());
+            TEST_ASSERT (true, ((from (vector_ints) >> where (is_odd) >> select (double_it) >> to_vector ()) == parts));
+        }
+
+        {
+            auto q      = range (0, 5) >> zip_with (from (vector_ints));
+            TEST_ASSERT (5U, q.split_size ());
+
+            auto lower  = q.split (2U);
+            auto first  = lower >> to_vector ();
+            auto second = q >> to_vector ();
+            if (TEST_ASSERT (2U, first.size ()) && TEST_ASSERT (3U, second.size ()))
+            {
+                TEST_ASSERT (1, first[1].first);
+                TEST_ASSERT (ints[1], first[1].second);
+                TEST_ASSERT (2, second[0].first);
+                TEST_ASSERT (ints[2], second[0].second);
+            }
+        }
+
+#ifndef CPPLINQ_NO_PARALLEL
+        {
+            std::size_t const size = 100000U;
+            auto source     = range (0, (int)size) >> to_vector ();
+            auto expected   = from (source) >> where (is_odd) >> select (double_it) >> to_vector ();
+
+            auto seed       = [] () {return std::vector<int> ();};
+            auto combine    = [] (std::vector<int> & result, std::vector<int> && other)
+                {
+                    result.insert (result.end (), other.begin (), other.end ());
+                };
+
+            std::size_t const worker_counts[] = {0U, 1U, 3U};
+            for (auto worker_count : worker_counts)
+            {
+                executor pool (worker_count, 64U);
+
+                // Parts are combined in source order
+                std::atomic<std::size_t> parts (0U);
+                append_elements append = { &parts };
+
+                auto q      = from (source) >> where (is_odd) >> select (double_it);
+                auto result = detail::split_reduce (pool, q, 256U, seed, append, combine);
+                TEST_ASSERT (true, (expected == result));
+                TEST_ASSERT (0U, q.split_size ());
+
+                if (worker_count == 0U)
+                {
+                    TEST_ASSERT (1U, parts.load ());
+                }
+                else
+                {
+                    TEST_ASSERT (true, (parts.load () > 1U));
+                }
+
+                // Skewed costs, the first elements are expensive to filter
+                auto skewed = [] (int i)
+                    {
+                        auto work = i < 1000 ? 2000 : 1;
+                        auto hash = static_cast<unsigned> (i);
+                        for (auto iter = 0; iter < work; ++iter)
+                        {
+                            hash = hash * 31U + 7U;
+                        }
+                        return hash != static_cast<unsigned> (i) || i % 2 == 1;
+                    };
+                append_elements plain = { nullptr };
+                auto skewed_q       = from (source) >> where (skewed);
+                auto skewed_result  = detail::split_reduce (pool, skewed_q, 0U, seed, plain, combine);
+                TEST_ASSERT (true, ((from (source) >> where (skewed) >> to_vector ()) == skewed_result));
+            }
+        }
+#endif
+    }
+
+#ifndef CPPLINQ_NO_PARALLEL
+    void test_par_aggregates ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        std::size_t const size = 50000U;
+
+        srand (19740531);
+        auto source     = range (0, (int)size) >> select ([] (int) {return rand () % 20001 - 10000;}) >> to_vector ();
+        auto doubles    = from (source) >> select ([] (int i) {return i / 7.0;}) >> to_vector ();
+        std::list<int>      list_source (source.begin (), source.end ());
+        std::vector<int>    empty_source;
+
+        auto is_odd     = [] (int i) {return i % 2 != 0;};
+        auto square     = [] (int i) {return (long long)i * i;};
+        auto negate     = [] (int i) {return -i;};
+
+        {
+            // Without arguments the default executor is used
+            TEST_ASSERT (from (source) >> sum (), from (source) >> par_sum ());
+            TEST_ASSERT (size, from (source) >> par_count ());
+        }
+
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            TEST_ASSERT (from (source) >> sum ()                , from (source) >> par_sum (pool));
+            TEST_ASSERT (true, ((from (source) >> sum (square)) == (from (source) >> par_sum (square, pool))));
+            TEST_ASSERT (from (source) >> where (is_odd) >> select (negate) >> sum ()
+                        , from (source) >> where (is_odd) >> select (negate) >> par_sum (pool));
+            TEST_ASSERT ((range (0, 30000) >> sum ())           , range (0, 30000) >> par_sum (pool));
+            TEST_ASSERT (3 * 10000                              , repeat (3, 10000) >> par_sum (pool));
+            TEST_ASSERT (from (source) >> sum ()                , from_copy (source) >> par_sum (pool));
+
+            TEST_ASSERT (size                                   , from (source) >> par_count (pool));
+            TEST_ASSERT (from (source) >> count (is_odd)        , from (source) >> par_count (is_odd, pool));
+            TEST_ASSERT (from (source) >> where (is_odd) >> count ()
+                        , from (source) >> where (is_odd) >> par_count (pool));
+            TEST_ASSERT (1000U                                  , range (0, 1000) >> zip_with (from (source)) >> par_count (pool));
+
+            TEST_ASSERT (from (source) >> max ()                , from (source) >> par_max (pool));
+            TEST_ASSERT (from (source) >> min ()                , from (source) >> par_min (pool));
+            TEST_ASSERT (from (source) >> max (negate)          , from (source) >> par_max (negate, pool));
+            TEST_ASSERT (from (source) >> min (negate)          , from (source) >> par_min (negate, pool));
+            TEST_ASSERT (from (source) >> where (is_odd) >> max ()
+                        , from (source) >> where (is_odd) >> par_max (pool));
+
+            TEST_ASSERT (from (source) >> avg ()                , from (source) >> par_avg (pool));
+            TEST_ASSERT (from (source) >> avg (negate)          , from (source) >> par_avg (negate, pool));
+            TEST_ASSERT (true, (std::fabs ((from (doubles) >> avg ()) - (from (doubles) >> par_avg (pool))) < 1e-9));
+            TEST_ASSERT (true, (std::fabs ((from (doubles) >> sum ()) - (from (doubles) >> par_sum (pool))) < 1e-6));
+
+            // Empty ranges give what the sequential operators give
+            TEST_ASSERT (0                                      , from (empty_source) >> par_sum (pool));
+            TEST_ASSERT (0U                                     , from (empty_source) >> par_count (pool));
+            TEST_ASSERT (from (empty_source) >> max ()          , from (empty_source) >> par_max (pool));
+            TEST_ASSERT (from (empty_source) >> min ()          , from (empty_source) >> par_min (pool));
+            TEST_ASSERT (from (empty_source) >> avg ()          , from (empty_source) >> par_avg (pool));
+            TEST_ASSERT (from (source) >> where ([] (int) {return false;}) >> max ()
+                        , from (source) >> where ([] (int) {return false;}) >> par_max (pool));
+
+            // Ranges that can't split are reduced sequentially
+            TEST_ASSERT (from (source) >> sum ()                , from (list_source) >> par_sum (pool));
+            TEST_ASSERT (from (source) >> max ()                , from (list_source) >> par_max (pool));
+            TEST_ASSERT (from (source) >> avg ()                , from (list_source) >> par_avg (pool));
+            TEST_ASSERT (from (source) >> count (is_odd)        , from (source) >> take (size) >> par_count (is_odd, pool));
+
+            // Exceptions thrown by selectors reach the caller
+            auto caught = false;
+            try
+            {
+                from (source) >> par_sum ([] (int i) -> int {if (i == 10000) throw programming_error_exception (); return i;}, pool);
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT ((from (source) >> contains (10000)), caught);
+        }
+    }
+#endif
+
+#ifndef CPPLINQ_NO_PARALLEL
+    void test_parallel_aggregate ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        typedef std::vector<std::size_t> histogram;
+
+        std::size_t const size = 50000U;
+
+        srand (19740531);
+        auto source = range (0, (int)size) >> select ([] (int) {return rand () % 1000;}) >> to_vector ();
+        std::list<int> list_source (source.begin (), source.end ());
+
+        histogram expected_histogram (10U);
+        for (auto v : source)
+        {
+            ++expected_histogram[v % 10];
+        }
+
+        auto to_letter          = [] (int v) {return (char)('a' + v % 26);};
+        auto expected_letters   = from (source) >> aggregate (std::string (), [&] (std::string const & s, int v) {return s + to_letter (v);});
+
+        std::atomic<std::size_t> seeds (0U);
+
+        auto new_histogram  = [&] () {++seeds; return histogram (10U);};
+        auto count_digit    = [] (histogram & h, int v) -> histogram & {++h[v % 10]; return h;};
+        auto add_histograms = [] (histogram & h, histogram const & other) -> histogram &
+            {
+                for (auto index = 0U; index < h.size (); ++index)
+                {
+                    h[index] += other[index];
+                }
+                return h;
+            };
+
+        auto empty_string   = [] () {return std::string ();};
+        auto append_letter  = [&] (std::string & s, int v) -> std::string & {s += to_letter (v); return s;};
+        auto concat_strings = [] (std::string const & s, std::string const & other) {return s + other;};
+
+        {
+            // Without a mode and executor, unordered on the default executor
+            auto h = from (source) >> parallel_aggregate (new_histogram, count_digit, add_histograms);
+            TEST_ASSERT (true, (expected_histogram == h));
+        }
+
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            // One accumulator per thread at most
+            seeds = 0U;
+            auto h = from (source) >> parallel_aggregate (new_histogram, count_digit, add_histograms, parallel_unordered, pool);
+            TEST_ASSERT (true, (expected_histogram == h));
+            TEST_ASSERT (true, (seeds.load () <= pool.concurrency ()));
+
+            h = from (source) >> parallel_aggregate (new_histogram, count_digit, add_histograms, parallel_ordered, pool);
+            TEST_ASSERT (true, (expected_histogram == h));
+
+            // Concatenation isn't commutative, the ordered mode keeps source order
+            auto letters = from (source) >> parallel_aggregate (empty_string, append_letter, concat_strings, parallel_ordered, pool);
+            TEST_ASSERT (expected_letters, letters);
+
+            auto letters_count = from (source) >> parallel_aggregate (
+                    empty_string
+                ,   append_letter
+                ,   concat_strings
+                ,   [] (std::string const & s) {return s.size ();}
+                ,   parallel_ordered
+                ,   pool
+                );
+            TEST_ASSERT (size, letters_count);
+
+            auto total = range (0, (int)size) >> parallel_aggregate (
+                    [] () {return 0LL;}
+                ,   [] (long long sum, int v) {return sum + v;}
+                ,   [] (long long sum, long long other) {return sum + other;}
+                ,   [] (long long sum) {return (double)sum / 2;}
+                ,   parallel_unordered
+                ,   pool
+                );
+            TEST_ASSERT (((double)size * (size - 1U)) / 4, total);
+
+            // Ranges that can't split aggregate on the calling thread
+            auto list_letters = from (list_source) >> parallel_aggregate (empty_string, append_letter, concat_strings, parallel_ordered, pool);
+            TEST_ASSERT (expected_letters, list_letters);
+
+            std::vector<int> empty_source;
+            auto empty_letters = from (empty_source) >> parallel_aggregate (empty_string, append_letter, concat_strings, parallel_unordered, pool);
+            TEST_ASSERT (std::string (), empty_letters);
+        }
+    }
+#endif
+
+#ifndef CPPLINQ_NO_PARALLEL
+    struct boxed_int
+    {
+        int value;
+
+        explicit boxed_int (int value)
+            :   value (value)
+        {
+        }
+    };
+
+    void test_par_to_vector ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        std::size_t const size = 50000U;
+
+        srand (19740531);
+        auto source = range (0, (int)size) >> select ([] (int) {return rand () % 1000;}) >> to_vector ();
+        std::list<int> list_source (source.begin (), source.end ());
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto square     = [] (int i) {return (long long)i * i;};
+        auto to_string  = [] (int i) {std::ostringstream o; o << i; return o.str ();};
+
+        auto expected           = from (source) >> where (is_odd) >> select (square) >> to_vector ();
+        auto expected_strings   = from (source) >> where (is_odd) >> select (to_string) >> to_vector ();
+        auto expected_range     = range (0, (int)size) >> where (is_odd) >> to_vector ();
+
+        {
+            auto result = from (source) >> where (is_odd) >> select (square) >> par_to_vector ();
+            TEST_ASSERT (true, (expected == result));
+        }
+
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            auto result = from (source) >> where (is_odd) >> select (square) >> par_to_vector (pool);
+            TEST_ASSERT (true, (expected == result));
+
+            auto whole = from (source) >> par_to_vector (pool);
+            TEST_ASSERT (true, (source == whole));
+
+            auto copied = from_copy (source) >> par_to_vector (pool);
+            TEST_ASSERT (true, (source == copied));
+
+            auto range_result = range (0, (int)size) >> where (is_odd) >> par_to_vector (pool);
+            TEST_ASSERT (true, (expected_range == range_result));
+
+            auto repeated = repeat (7, (int)size) >> par_to_vector (pool);
+            TEST_ASSERT (size, repeated.size ());
+            TEST_ASSERT (true, (from (repeated) >> all ([] (int i) {return i == 7;})));
+
+            // Strings are moved from the buffers
+            auto strings = from (source) >> where (is_odd) >> select (to_string) >> par_to_vector (pool);
+            TEST_ASSERT (true, (expected_strings == strings));
+
+#if CPPLINQ_RVALUE_OPERATORS
+            // Projected values are moved into the buffers too, so values that
+            // can only be moved can be collected
+            auto owned = from (source) >> select ([] (int i) {return std::unique_ptr<int> (new int (i));}) >> par_to_vector (pool);
+            TEST_ASSERT (size, owned.size ());
+            TEST_ASSERT (true, (std::equal (source.begin (), source.end (), owned.begin (), [] (int i, std::unique_ptr<int> const & p) {return i == *p;})));
+#endif
+
+            // Values that can't be default constructed are gathered sequentially
+            auto boxed = from (source) >> select ([] (int i) {return boxed_int (i);}) >> par_to_vector (pool);
+            TEST_ASSERT (size, boxed.size ());
+            TEST_ASSERT (true, (std::equal (source.begin (), source.end (), boxed.begin (), [] (int i, boxed_int const & b) {return i == b.value;})));
+
+            std::vector<int> empty_source;
+            auto empty_result = from (empty_source) >> where (is_odd) >> par_to_vector (pool);
+            TEST_ASSERT (true, empty_result.empty ());
+
+            // Ranges that can't split are materialized by to_vector
+            auto list_result = from (list_source) >> where (is_odd) >> select (square) >> par_to_vector (pool);
+            TEST_ASSERT (true, (expected == list_result));
+        }
+    }
+
+    void test_parallel_sort ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        typedef std::pair<int, int> keyed;
+
+        std::size_t const size = 100000U;
+
+        srand (19740531);
+        auto source = range (0, (int)size) >> select ([] (int i) {return std::make_pair (rand () % 100, i);}) >> to_vector ();
+
+        auto by_key         = [] (keyed const & v) {return v.first;};
+        auto by_index       = [] (keyed const & v) {return v.second;};
+        auto by_last_digit  = [] (keyed const & v) {return v.first % 10;};
+        auto to_string      = [] (keyed const & v) {std::ostringstream o; o << v.first; return o.str ();};
+
+        // Values with equal keys stay in source order
+        auto expected_by_key = source;
+        std::stable_sort (
+                expected_by_key.begin ()
+            ,   expected_by_key.end ()
+            ,   [] (keyed const & l, keyed const & r) {return l.first < r.first;}
+            );
+
+        auto expected_by_digit = source;
+        std::stable_sort (
+                expected_by_digit.begin ()
+            ,   expected_by_digit.end ()
+            ,   [] (keyed const & l, keyed const & r)
+                {
+                    return l.first % 10 != r.first % 10 ? l.first % 10 < r.first % 10 : r.first < l.first;
+                }
+            );
+
+        auto expected_strings = from (source) >> select (to_string) >> to_vector ();
+        std::sort (expected_strings.begin (), expected_strings.end ());
+
+        {
+            auto result = from (source) >> orderby_ascending (by_key) >> parallel_sort () >> to_vector ();
+            TEST_ASSERT (true, (expected_by_key == result));
+        }
+
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            auto result = from (source) >> orderby_ascending (by_key) >> parallel_sort (pool) >> to_vector ();
+            TEST_ASSERT (true, (expected_by_key == result));
+
+            // thenby uses the whole compare chain
+            auto digits =
+                    from (source)
+                >>  orderby_ascending (by_last_digit)
+                >>  thenby_descending (by_key)
+                >>  parallel_sort (pool)
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (true, (expected_by_digit == digits));
+
+            auto carried =
+                    from (source)
+                >>  orderby_ascending (by_last_digit)
+                >>  parallel_sort (pool)
+                >>  thenby_descending (by_key)
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (true, (expected_by_digit == carried));
+
+            // Sorting by a unique key leaves the source
+            auto restored = from (expected_by_key) >> orderby_ascending (by_index) >> parallel_sort (pool) >> to_vector ();
+            TEST_ASSERT (true, (source == restored));
+
+            auto strings =
+                    from (source)
+                >>  select (to_string)
+                >>  orderby_ascending ([] (std::string const & s) {return s;})
+                >>  parallel_sort (pool)
+                >>  to_vector ()
+                ;
+            TEST_ASSERT (true, (expected_strings == strings));
+
+            auto sorted = from (source) >> orderby_descending (by_key) >> parallel_sort (pool);
+            TEST_ASSERT (size, sorted.size ());
+            TEST_ASSERT (99, sorted.at (0U).first);
+            TEST_ASSERT (0, sorted.at (size - 1U).first);
+
+            std::vector<keyed> empty_source;
+            auto empty_result = from (empty_source) >> orderby_ascending (by_key) >> parallel_sort (pool) >> to_vector ();
+            TEST_ASSERT (true, empty_result.empty ());
+
+            // Exceptions thrown by the key selector reach the caller
+            auto caught = false;
+            try
+            {
+                from (source)
+                    >>  orderby_ascending ([] (keyed const & v) -> int {if (v.second == 12345) throw programming_error_exception (); return v.first;})
+                    >>  parallel_sort (pool)
+                    >>  count ()
+                    ;
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+        }
+
+        {
+            // Above the threshold the default policy sorts in parallel
+            auto large = range (0, CPPLINQ_PARALLEL_SORT_THRESHOLD * 2) >> select ([] (int) {return rand ();}) >> to_vector ();
+            auto expected_large = large;
+            std::sort (expected_large.begin (), expected_large.end ());
+
+            auto result = from (large) >> orderby_ascending ([] (int i) {return i;}) >> to_vector ();
+            TEST_ASSERT (true, (expected_large == result));
+
+            auto sequential = from (large) >> orderby_ascending ([] (int i) {return i;}) >> sequential_sort () >> to_vector ();
+            TEST_ASSERT (true, (expected_large == sequential));
+        }
+
+        {
+            // Equal keys keep source order below and above the threshold, in
+            // every mode
+            auto small_source   = from (source) >> take (1000) >> to_vector ();
+            auto expected_small = small_source;
+            std::stable_sort (
+                    expected_small.begin ()
+                ,   expected_small.end ()
+                ,   [] (keyed const & l, keyed const & r) {return l.first < r.first;}
+                );
+
+            TEST_ASSERT (true, (expected_small == (from (small_source) >> orderby_ascending (by_key) >> to_vector ())));
+            TEST_ASSERT (true, (expected_small == (from (small_source) >> orderby_ascending (by_key) >> sequential_sort () >> to_vector ())));
+            TEST_ASSERT (true, (expected_by_key == (from (source) >> orderby_ascending (by_key) >> to_vector ())));
+            TEST_ASSERT (true, (expected_by_key == (from (source) >> orderby_ascending (by_key) >> sequential_sort () >> to_vector ())));
+        }
+    }
+
+    void test_async_buffer ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        int const size = 10000;
+
+        auto square     = [] (int i) {return (long long)i * i;};
+        auto to_string  = [] (int i) {std::ostringstream o; o << i; return o.str ();};
+
+        auto expected           = range (0, size) >> select (square) >> to_vector ();
+        auto expected_strings   = range (0, size) >> select (to_string) >> to_vector ();
+
+        std::size_t const capacities[] = {0U, 1U, 8U, 64U};
+        for (auto capacity : capacities)
+        {
+            auto result = range (0, size) >> select (square) >> async_buffer (capacity) >> to_vector ();
+            TEST_ASSERT (true, (expected == result));
+
+            auto strings = range (0, size) >> select (to_string) >> async_buffer (capacity) >> to_vector ();
+            TEST_ASSERT (true, (expected_strings == strings));
+        }
+
+        {
+            // The range before async_buffer runs on another thread
+            auto caller = std::this_thread::get_id ();
+            auto on_caller = range (0, size)
+                >>  select ([caller] (int) {return std::this_thread::get_id () == caller;})
+                >>  async_buffer ()
+                >>  any ([] (bool b) {return b;})
+                ;
+            TEST_ASSERT (false, on_caller);
+        }
+
+        {
+            std::vector<int> empty_source;
+            auto result = from (empty_source) >> async_buffer (4U) >> to_vector ();
+            TEST_ASSERT (true, result.empty ());
+        }
+
+        {
+            // Stopping early cancels the producer of an endless range
+            std::atomic<int> produced (0);
+            auto endless = generate ([&] () {return to_opt (produced++);});
+
+            auto first_five = endless >> async_buffer (8U) >> take (5U) >> to_vector ();
+            TEST_ASSERT (5U, first_five.size ());
+            TEST_ASSERT (4, first_five.back ());
+            TEST_ASSERT (true, (produced.load () <= 5 + 8 + 1));
+
+            produced = 0;
+            auto f = endless >> async_buffer (8U) >> first ();
+            TEST_ASSERT (0, f);
+        }
+
+        {
+            // Exceptions thrown by the range before async_buffer reach the consumer
+            auto caught = false;
+            try
+            {
+                range (0, size)
+                    >>  select ([] (int i) -> int {if (i == 500) throw programming_error_exception (); return i;})
+                    >>  async_buffer (8U)
+                    >>  to_vector ()
+                    ;
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+        }
+
+        {
+            // A range that is never iterated starts no thread, copies run independently
+            auto q = range (0, size) >> select (square) >> async_buffer (4U);
+            auto copy = q;
+            TEST_ASSERT (true, (expected == (copy >> to_vector ())));
+            TEST_ASSERT (true, (expected == (q >> to_vector ())));
+
+            auto unused = range (0, size) >> async_buffer (4U);
+            (void)unused;
+
+            // Once started a copy would race with the work in flight, it throws
+            auto started = range (0, size) >> select (square) >> async_buffer (4U);
+            started.next ();
+            auto copy_caught = false;
+            try
+            {
+                auto late_copy = started;
+                (void)late_copy;
+            }
+            catch (programming_error_exception const &)
+            {
+                copy_caught = true;
+            }
+            TEST_ASSERT (true, copy_caught);
+        }
+    }
+
+    void test_par_select ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        int const size = 10000;
+
+        auto square     = [] (int i) {return (long long)i * i;};
+        auto to_string  = [] (int i) {std::ostringstream o; o << i; return o.str ();};
+        auto odd_prime  = [] (int i)
+            {
+                for (auto d = 3; d * d <= i; d += 2)
+                {
+                    if (i % d == 0)
+                    {
+                        return 0;
+                    }
+                }
+                return i;
+            };
+
+        auto expected           = range (0, size) >> select (square) >> to_vector ();
+        auto expected_strings   = range (0, size) >> select (to_string) >> to_vector ();
+        auto expected_primes    =
+                range (1, INT_MAX)
+            >>  select ([] (int i) {return 2*i + 1;})
+            >>  select (odd_prime)
+            >>  where ([] (int i) {return i > 0;})
+            >>  take (1000U)
+            >>  sum ()
+            ;
+
+        {
+            auto result = range (0, size) >> par_select (square) >> to_vector ();
+            TEST_ASSERT (true, (expected == result));
+        }
+
+        std::size_t const worker_counts[]   = {0U, 1U, 3U};
+        std::size_t const windows[]         = {0U, 1U, 7U, 64U, 1024U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            for (auto window : windows)
+            {
+                auto result = range (0, size) >> par_select (square, window, pool) >> to_vector ();
+                TEST_ASSERT (true, (expected == result));
+
+                auto strings = range (0, size) >> par_select (to_string, window, pool) >> to_vector ();
+                TEST_ASSERT (true, (expected_strings == strings));
+            }
+
+            // Endless ranges are read as far as the window reaches
+            auto primes =
+                    range (1, INT_MAX)
+                >>  select ([] (int i) {return 2*i + 1;})
+                >>  par_select (odd_prime, 256U, pool)
+                >>  where ([] (int i) {return i > 0;})
+                >>  take (1000U)
+                >>  sum ()
+                ;
+            TEST_ASSERT (expected_primes, primes);
+
+            std::atomic<int> produced (0);
+            auto endless = generate ([&] () {return to_opt (produced++);});
+            auto first_five = endless >> par_select (square, 64U, pool) >> take (5U) >> to_vector ();
+            TEST_ASSERT (5U, first_five.size ());
+            TEST_ASSERT (true, (first_five.back () == 16LL));
+            TEST_ASSERT (true, (produced.load () <= 5 + 64 + 1));
+
+            std::vector<int> empty_source;
+            auto empty_result = from (empty_source) >> par_select (square, 64U, pool) >> to_vector ();
+            TEST_ASSERT (true, empty_result.empty ());
+
+            // Elements before the one the selector throws for are seen first
+            auto seen   = 0;
+            auto caught = false;
+            try
+            {
+                range (0, size)
+                    >>  par_select ([] (int i) -> int {if (i == 500) throw programming_error_exception (); return i;}, 64U, pool)
+                    >>  for_each ([&] (int) {++seen;})
+                    ;
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (500, seen);
+
+            // A range that is never iterated posts nothing, copies run independently
+            auto q = range (0, size) >> par_select (square, 64U, pool);
+            auto copy = q;
+            TEST_ASSERT (true, (expected == (copy >> to_vector ())));
+            TEST_ASSERT (true, (expected == (q >> to_vector ())));
+
+            // Once started a copy would race with the work in flight, it throws
+            auto started = range (0, size) >> par_select (square, 64U, pool);
+            started.next ();
+            auto copy_caught = false;
+            try
+            {
+                auto late_copy = started;
+                (void)late_copy;
+            }
+            catch (programming_error_exception const &)
+            {
+                copy_caught = true;
+            }
+            TEST_ASSERT (true, copy_caught);
+        }
+    }
+
+    void test_par_for_each ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        std::size_t const size = 50000U;
+
+        srand (19740531);
+        auto source = range (0, (int)size) >> select ([] (int) {return rand () % 1000;}) >> to_vector ();
+        std::list<int> list_source (source.begin (), source.end ());
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+
+        auto expected_sum   = from (source) >> where (is_odd) >> sum ();
+        auto expected_count = from (source) >> count (is_odd);
+        auto expected_odd   = from (source) >> where (is_odd) >> orderby_ascending ([] (int i) {return i;}) >> to_vector ();
+
+        {
+            std::atomic<int> total (0);
+            from (source) >> where (is_odd) >> par_for_each ([&] (int i) {total += i;});
+            TEST_ASSERT (expected_sum, total.load ());
+        }
+
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            std::atomic<int>            total   (0);
+            std::atomic<std::size_t>    calls   (0U);
+            from (source) >> where (is_odd) >> par_for_each ([&] (int i) {total += i; ++calls;}, pool);
+            TEST_ASSERT (expected_sum, total.load ());
+            TEST_ASSERT (expected_count, calls.load ());
+
+            // Ranges that can't split run on the calling thread
+            total = 0;
+            from (list_source) >> where (is_odd) >> par_for_each ([&] (int i) {total += i;}, pool);
+            TEST_ASSERT (expected_sum, total.load ());
+
+            // A private buffer per thread, finalized on the calling thread
+            auto caller = std::this_thread::get_id ();
+
+            std::atomic<std::size_t>    inits           (0U);
+            std::size_t                 finalizes       = 0U;
+            auto                        on_caller       = true;
+            std::vector<int>            collected       ;
+
+            auto new_buffer     = [&] () {++inits; return std::vector<int> ();};
+            auto append         = [] (std::vector<int> & buffer, int i) {buffer.push_back (i);};
+            auto flush          = [&] (std::vector<int> & buffer)
+                {
+                    ++finalizes;
+                    on_caller = on_caller && std::this_thread::get_id () == caller;
+                    collected.insert (collected.end (), buffer.begin (), buffer.end ());
+                };
+
+            from (source) >> where (is_odd) >> par_for_each (new_buffer, append, flush, pool);
+            std::sort (collected.begin (), collected.end ());
+            TEST_ASSERT (true, (expected_odd == collected));
+            TEST_ASSERT (true, (inits.load () <= pool.concurrency ()));
+            TEST_ASSERT (inits.load (), finalizes);
+            TEST_ASSERT (true, on_caller);
+
+            inits       = 0U;
+            finalizes   = 0U;
+            collected.clear ();
+            from (list_source) >> where (is_odd) >> par_for_each (new_buffer, append, flush, pool);
+            TEST_ASSERT (expected_count, collected.size ());
+            TEST_ASSERT (1U, finalizes);
+
+            // Every state is finalized, also for an empty range
+            inits       = 0U;
+            finalizes   = 0U;
+            std::vector<int> empty_source;
+            from (empty_source) >> par_for_each (new_buffer, append, flush, pool);
+            TEST_ASSERT (finalizes, inits.load ());
+
+            // The states are finalized when an action throws
+            inits       = 0U;
+            finalizes   = 0U;
+            auto caught = false;
+            try
+            {
+                range (0, (int)size) >> par_for_each (
+                        new_buffer
+                    ,   [] (std::vector<int> & buffer, int i) {if (i == 10000) throw programming_error_exception (); buffer.push_back (i);}
+                    ,   flush
+                    ,   pool
+                    );
+            }
+            catch (programming_error_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (inits.load (), finalizes);
+        }
+    }
+#endif
+
+    void test_cancellation ()
+    {
+        using namespace cpplinq;
+        TEST_PRELUDE ();
+
+        int const size = 10000;
+
+        auto expected = range (0, size) >> to_vector ();
+
+        // Queries that aren't cancelled are unchanged
+        {
+            cancellation_token token;
+
+            auto result = from (expected) >> with_cancellation (token) >> to_vector ();
+            TEST_ASSERT (true, (expected == result));
+
+            auto total = from (expected) >> with_cancellation (token) >> select ([] (int i) {return 2*i;}) >> sum ();
+            TEST_ASSERT (size*(size - 1), total);
+
+            auto reversed = from (expected) >> with_cancellation (token) >> reverse () >> to_vector ();
+            TEST_ASSERT (true, (std::equal (expected.rbegin (), expected.rend (), reversed.begin ())));
+
+            auto later = std::chrono::steady_clock::now () + std::chrono::hours (1);
+            auto count = from (expected) >> with_deadline (later) >> where ([] (int i) {return i % 2 == 0;}) >> cpplinq::count ();
+            TEST_ASSERT ((std::size_t)size/2, count);
+        }
+
+        // Counts the elements pulled from the source and cancels at element cancel_at
+        std::size_t pulled      = 0U;
+        std::size_t cancel_at   = 0U;
+        cancellation_token * to_cancel = nullptr;
+        auto source = [&] ()
+            {
+                return range (0, size) >> select ([&] (int i)
+                    {
+                        if (++pulled == cancel_at)
+                        {
+                            to_cancel->cancel ();
+                        }
+                        return i;
+                    });
+            };
+
+        // A token cancelled up front stops the query before any element
+        {
+            cancellation_token token;
+            token.cancel ();
+            TEST_ASSERT (true, token.is_cancelled ());
+
+            pulled = 0U;
+            auto caught = false;
+            try
+            {
+                source () >> with_cancellation (token) >> to_vector ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, pulled);
+        }
+
+        // A deadline that has passed stops the query as well
+        {
+            auto earlier = std::chrono::steady_clock::now () - std::chrono::seconds (1);
+            auto caught = false;
+            try
+            {
+                from (expected) >> with_deadline (earlier) >> sum ();
+            }
+            catch (base_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+        }
+
+        // Cancelling midway is noticed within a batch, both when the range
+        // is pushed and when it's pulled one element at a time
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+            cancel_at   = 1000U;
+
+            pulled = 0U;
+            auto caught = false;
+            try
+            {
+                source () >> with_cancellation (token) >> for_each ([] (int) {});
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (pulled <= cancel_at + detail::batch_size));
+
+            cancellation_token other_token;
+            to_cancel   = &other_token;
+
+            pulled = 0U;
+            caught = false;
+            auto q = source () >> with_cancellation (other_token);
+            try
+            {
+                while (q.next ())
+                {
+                }
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (pulled <= cancel_at + detail::batch_size));
+        }
+
+        // Materializing operators free what they buffered when cancelled
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+            cancel_at   = 5000U;
+
+            pulled = 0U;
+            auto caught = false;
+            auto ordered = source () >> with_cancellation (token) >> orderby_descending ([] (int i) {return i;}) >> thenby_ascending ([] (int i) {return i;});
+            try
+            {
+                ordered.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, ordered.sorted_values.capacity ());
+        }
+
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+
+            pulled = 0U;
+            auto caught = false;
+            auto reversed = source () >> with_cancellation (token) >> reverse ();
+            try
+            {
+                reversed.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, reversed.reversed.capacity ());
+        }
+
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+
+            pulled = 0U;
+            auto caught = false;
+            auto distinct_values = source () >> with_cancellation (token) >> distinct ();
+            try
+            {
+                while (distinct_values.next ())
+                {
+                }
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, distinct_values.set.size ());
+        }
+
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+
+            pulled = 0U;
+            auto caught = false;
+            try
+            {
+                source () >> with_cancellation (token) >> to_lookup ([] (int i) {return i % 10;});
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (pulled < (std::size_t)size));
+        }
+
+        // The sort of orderby and thenby checks the token, whether
+        // with_cancellation comes before or after them. keys counts the key
+        // selector calls, which the parallel sort makes from several threads,
+        // and cancels at call cancel_at.
+        std::atomic<std::size_t> keys (0U);
+        auto key_of = [&] (int i)
+            {
+                if (++keys == cancel_at)
+                {
+                    to_cancel->cancel ();
+                }
+                return -i;
+            };
+
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+            cancel_at   = 2U*size;
+
+            keys = 0U;
+            auto caught = false;
+            auto ordered = from (expected) >> orderby_ascending (key_of) >> with_cancellation (token);
+            try
+            {
+                ordered.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, ordered.range.sorted_values.capacity ());
+
+            cancellation_token other_token;
+            to_cancel   = &other_token;
+
+            keys = 0U;
+            caught = false;
+            auto then_ordered = from (expected) >> with_cancellation (other_token) >> orderby_ascending ([] (int) {return 0;}) >> thenby_ascending (key_of);
+            try
+            {
+                then_ordered.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, then_ordered.sorted_values.capacity ());
+        }
+
+        // Joins check the token of their range while indexing the other range
+        {
+            cancellation_token token;
+            to_cancel   = &token;
+            cancel_at   = 1000U;
+
+            pulled = 0U;
+            auto caught = false;
+            try
+            {
+                from (expected) >> with_cancellation (token) >> join (
+                        source ()
+                    ,   [] (int i) {return i;}
+                    ,   [] (int i) {return i;}
+                    ,   [] (int i, int j) {return i + j;}
+                    ) >> first_or_default ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (pulled <= cancel_at + detail::batch_size));
+
+            cancellation_token other_token;
+            to_cancel   = &other_token;
+
+            pulled = 0U;
+            caught = false;
+            try
+            {
+                from (expected) >> with_cancellation (other_token) >> hash_join (
+                        source ()
+                    ,   [] (int i) {return i;}
+                    ,   [] (int i) {return i;}
+                    ,   [] (int i, int j) {return i + j;}
+                    ) >> first_or_default ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (pulled <= cancel_at + detail::batch_size));
+        }
+
+#ifndef CPPLINQ_NO_PARALLEL
+        // The parallel sort checks the token of the pieces it sorts and merges
+        {
+            executor pool (3U, 64U);
+
+            cancellation_token token;
+            to_cancel   = &token;
+            cancel_at   = 2U*size;
+
+            keys = 0U;
+            auto caught = false;
+            auto ordered = from (expected) >> orderby_ascending (key_of) >> parallel_sort (pool) >> with_cancellation (token);
+            try
+            {
+                ordered.next ();
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (0U, ordered.range.sorted_values.capacity ());
+        }
+
+        // Parallel workers check the token of the parts they run
+        std::size_t const worker_counts[] = {0U, 1U, 3U};
+        for (auto worker_count : worker_counts)
+        {
+            executor pool (worker_count, 64U);
+
+            cancellation_token token;
+            auto total = from (expected) >> with_cancellation (token) >> par_sum (pool);
+            TEST_ASSERT (size*(size - 1)/2, total);
+
+            std::atomic<std::size_t> visited (0U);
+            auto caught = false;
+            try
+            {
+                from (expected) >> with_cancellation (token) >> par_for_each (
+                        [&] (int)
+                        {
+                            if (++visited == 1000U)
+                            {
+                                token.cancel ();
+                            }
+                        }
+                    ,   pool
+                    );
+            }
+            catch (operation_cancelled_exception const &)
+            {
+                caught = true;
+            }
+            TEST_ASSERT (true, caught);
+            TEST_ASSERT (true, (visited.load () < (std::size_t)size));
+        }
+#endif
+    }
+
+    template<typename TDuration, typename TPredicate>
+    long long execute_testruns_in (
+            std::size_t test_runs
+        ,   TPredicate predicate
+        )
+    {
+        auto then = std::chrono::high_resolution_clock::now ();
+
+        for (auto test_run = 0U; test_run < test_runs; ++test_run)
+        {
+            predicate ();
+        }
+
+        auto now = std::chrono::high_resolution_clock::now ();
+
+        auto diff = now - then;
+
+        return std::chrono::duration_cast<TDuration>(diff).count ();
+    }
+
+    template<typename TPredicate>
+    long long execute_testruns (
+            std::size_t test_runs
+        ,   TPredicate predicate
+        )
+    {
+        return execute_testruns_in<std::chrono::milliseconds> (test_runs, predicate);
+    }
+
+    // Times expected and result in alternating rounds and returns the median
+    // of the round ratios, so a machine that speeds up or stalls during a
+    // round doesn't skew the ratio. Rounds are timed in microseconds, the total
+    // times go to expected and result in milliseconds
+    template<typename TExpected, typename TResult>
+    double execute_testrounds (
+            std::size_t test_runs
+        ,   TExpected   expected_predicate
+        ,   TResult     result_predicate
+        ,   long long & expected
+        ,   long long & result
+        )
+    {
+        std::size_t const test_rounds   = 20U;
+        auto round_runs = test_runs > test_rounds ? test_runs / test_rounds : 1U;
+
+        long long expected_in_us    = 0;
+        long long result_in_us      = 0;
+        std::vector<double> ratios;
+
+        for (auto round = 0U; round < test_rounds && round * round_runs < test_runs; ++round)
+        {
+            auto expected_round = execute_testruns_in<std::chrono::microseconds> (round_runs, expected_predicate);
+            auto result_round   = execute_testruns_in<std::chrono::microseconds> (round_runs, result_predicate);
+
+            expected_in_us  += expected_round;
+            result_in_us    += result_round;
+
+            // Rounds too short for the clock are left out
+            if (expected_round > 0 && result_round > 0)
+            {
+                ratios.push_back (((double)expected_round)/result_round);
+            }
+        }
+
+        expected    = expected_in_us / 1000;
+        result      = result_in_us / 1000;
+
+        if (ratios.empty ())
+        {
+            return 1.0;
+        }
+
+        auto median = ratios.begin () + ratios.size ()/2;
+        std::nth_element (ratios.begin (), median, ratios.end ());
+        return *median;
+    }
+
+    void test_performance_range_sum ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        int         const test_repeat       = 80000     ;
+        int         const test_size         = 20000     ;
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum = 0;
+                    for (auto iter = 0; iter < test_size; ++iter)
+                    {
+                        set_sum += iter;
+                    }
+                    expected_complete_sum += set_sum;
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum =
+                            range(0, test_size)
+                        >>  sum ()
+                        ;
+                    result_complete_sum += set_sum;
+                }
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        auto ratio_limit    = 3.0;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
+        printf (
+                "Performance numbers for simple sum over numbers, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_sum ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        int         const test_repeat       = 80000     ;
+        int         const test_size         = 20000     ;
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand ();})
+            >>  to_vector (test_size)
+            ;
+
+        long long   expected    = 0;
+        long long   result      = 0;
+
+        auto ratio = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum = 0;
+                    for (auto v : test_set)
+                    {
+                        set_sum += v;
+                    }
+                    expected_complete_sum += set_sum;
+                }
+            ,   [&] ()
+                {
+                    auto set_sum =
+                            from (test_set)
+                        >>  sum ()
+                        ;
+                    result_complete_sum += set_sum;
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        auto ratio_limit    = 1.25;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
+        printf (
+                "Performance numbers for simple sum over numbers, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    bool is_prime (int i)
+    {
+        if (i < 2)
+        {
+            return false;
+        }
+        else if (i == 2)
+        {
+            return true;
+        }
+        else
+        {
+            auto r = std::ceil (std::sqrt (i));
+
+            for (auto iter = 2; iter <= r; ++iter)
+            {
+                if (i % iter == 0)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+
+    void test_performance_is_prime ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 25        ;
+#else
+        int         const test_repeat   = 100       ;
+#endif
+        int         const test_size     = 10000     ;
+
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto        iter        = 3;
+                    auto        count       = 0;
+                    auto        expected_sum= 0;
+                    while (count < test_size)
+                    {
+                        if (is_prime (iter))
+                        {
+                            expected_sum += iter;
+                            ++count;
+                        }
+                        iter += 2;
+                    }
+                    expected_complete_sum += expected_sum;
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_sum +=
+                            range (1, INT_MAX)
+                        >>  select ([] (int i) {return 2*i + 1;})
+                        >>  where (is_prime)
+                        >>  take (test_size)
+                        >>  sum ()
+                        ;
+                }
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
+        printf (
+                "Performance numbers for computing primes, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_fused_pipeline ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+        int         const test_repeat       = 20000     ;
+        int         const test_size         = 20000     ;
+        int         const take_size         = 5000      ;
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand ();})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd     = [] (int i) {return i % 2 == 1;};
+        auto third      = [] (int i) {return i / 3;};
+        auto positive   = [] (int i) {return i >= 0;};
+        auto scramble   = [] (int i) {return i * 7 + 1;};
+
+        long long   expected    = 0;
+        long long   result      = 0;
+
+        auto ratio = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum    = 0;
+                    auto taken      = 0;
+                    for (auto v : test_set)
+                    {
+                        if (!is_odd (v))
+                        {
+                            continue;
+                        }
+
+                        auto t = third (v);
+                        if (!positive (t))
+                        {
+                            break;
+                        }
+
+                        set_sum += scramble (t);
+
+                        if (++taken >= take_size)
+                        {
+                            break;
+                        }
+                    }
+                    expected_complete_sum += set_sum;
+                }
+            ,   [&] ()
+                {
+                    auto set_sum =
+                            from (test_set)
+                        >>  where (is_odd)
+                        >>  select (third)
+                        >>  take_while (positive)
+                        >>  select (scramble)
+                        >>  take (take_size)
+                        >>  sum ()
+                        ;
+                    result_complete_sum += set_sum;
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        // The fused pipeline may well beat the hand-written loop, only slower fails
+        auto ratio_limit    = 1.25;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for a fused 5 stage pipeline, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_join_combiner ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 5         ;
+#else
+        int         const test_repeat   = 20        ;
+#endif
+        int         const test_size     = 20000     ;
+        int         const other_size    = 100       ;
+
+        std::size_t expected_complete_sum   = 0U        ;
+        std::size_t result_complete_sum     = 0U        ;
+        auto        reinvoked_calls         = 0         ;
+        auto        result_calls            = 0         ;
+
+        auto has_seven  = [] (std::string const & s) {return s.find ('7') != std::string::npos;};
+        auto combine    = [] (int l, int r) {return to_string (l * 1000 + r);};
+
+        // The baseline joins the way join did before it cached the combined
+        // value, the combiner runs again each time where and select read it
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    std::multimap<int, int> other;
+                    for (auto iter = 0; iter < other_size; ++iter)
+                    {
+                        other.insert (std::make_pair (iter, iter));
+                    }
+
+                    std::size_t expected_sum = 0U;
+                    for (auto iter = 0; iter < test_size; ++iter)
+                    {
+                        auto matches = other.equal_range (iter % other_size);
+                        for (auto match = matches.first; match != matches.second; ++match)
+                        {
+                            ++reinvoked_calls;
+                            if (has_seven (combine (iter, match->second)))
+                            {
+                                ++reinvoked_calls;
+                                expected_sum += combine (iter, match->second).size ();
+                            }
+                        }
+                    }
+                    expected_complete_sum += expected_sum;
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_sum +=
+                            range (0, test_size)
+                        >>  join (
+                                range (0, other_size)
+                            ,   [=] (int i) {return i % other_size;}
+                            ,   [] (int i) {return i;}
+                            ,   [&] (int l, int r) {++result_calls; return combine (l, r);}
+                            )
+                        >>  where (has_seven)
+                        >>  select ([] (std::string const & s) {return s.size ();})
+                        >>  sum ()
+                        ;
+                }
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+        TEST_ASSERT (test_size*test_repeat, result_calls);
+
+        // join calls the combiner once per joined element so it beats the
+        // baseline, only a slowdown fails
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for join with an expensive combiner, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+        printf (
+                "Combiner calls, cached:%d, reinvoked:%d, saved:%d\n"
+            ,   result_calls
+            ,   reinvoked_calls
+            ,   reinvoked_calls - result_calls
+            );
+    }
+
+    void test_performance_expensive_copy ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 500       ;
+#else
+        int         const test_repeat   = 5000      ;
+#endif
+        int         const test_size     = 10000     ;
+
+        auto        orders                  = get_orders (test_size);
+        auto        expected_complete_sum   = 0.0       ;
+        auto        result_complete_sum     = 0.0       ;
+
+        auto is_large   = [] (order const & o) {return o.amount > 50.0;};
+        auto amount     = [] (order const & o) {return o.amount;};
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto expected_sum = 0.0;
+                    for (auto pass = 0; pass < 2; ++pass)
+                    {
+                        for (auto const & o : orders)
+                        {
+                            if (is_large (o))
+                            {
+                                expected_sum += amount (o);
+                            }
+                        }
+                    }
+                    expected_complete_sum += expected_sum;
+                }
+            );
+
+        order_copies = 0U;
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_sum +=
+                            from (orders)
+                        >>  concat (from (orders))
+                        >>  where (is_large)
+                        >>  select (amount)
+                        >>  sum ()
+                        ;
+                }
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+        TEST_ASSERT (0U, order_copies);
+
+        // concat pushes into the fused where and select, copying the orders
+        // would cost an order of magnitude more. Only a slowdown fails
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/result;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for classes that are expensive to copy, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_container ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 500       ;
+#else
+        int         const test_repeat   = 20000     ;
+#endif
+        int         const test_size     = 20000     ;
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand ();})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+
+        long long   expected            = 0         ;
+        long long   result              = 0         ;
+
+        auto ratio = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto set_sum = 0;
+                    for (auto v : test_set)
+                    {
+                        if (is_odd (v))
+                        {
+                            set_sum += v;
+                        }
+                    }
+                    expected_complete_sum += set_sum;
+                }
+            ,   [&] ()
+                {
+                    auto set_sum = 0;
+                    for (auto v : from (test_set) >> container ())
+                    {
+                        if (is_odd (v))
+                        {
+                            set_sum += v;
+                        }
+                    }
+                    result_complete_sum += set_sum;
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        // A range-for over container may beat the hand-written loop, only slower fails
+        auto ratio_limit    = 1.25;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for range-for over container, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+#ifndef CPPLINQ_NO_PARALLEL
+    void test_performance_executor_scaling ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 2         ;
+#else
+        int         const test_repeat   = 10        ;
+#endif
+        int         const test_size     = 200000    ;
+
+        auto count_primes = [] (std::size_t begin, std::size_t end)
+            {
+                auto count = 0;
+                for (auto index = begin; index < end; ++index)
+                {
+                    if (is_prime (2 * (int)index + 3))
+                    {
+                        ++count;
+                    }
+                }
+                return count;
+            };
+
+        auto        expected_complete_count = 0         ;
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_count += count_primes (0U, test_size);
+                }
+            );
+
+        printf ("Performance numbers for executor scaling, cores:1 (sequential), time:%lld\n", expected);
+
+        auto cores = (std::max) (executor::default_worker_count () + 1U, (std::size_t)1U);
+        for (auto core_count = 1U; core_count <= cores; ++core_count)
+        {
+            executor pool (core_count - 1U);
+
+            std::atomic<int> result_complete_count (0);
+            auto result = execute_testruns (
+                    test_repeat
+                ,   [&] ()
+                    {
+                        pool.parallel_for (
+                                0U
+                            ,   test_size
+                            ,   0U
+                            ,   [&] (std::size_t begin, std::size_t end)
+                                {
+                                    result_complete_count += count_primes (begin, end);
+                                }
+                            );
+                    }
+                );
+
+            TEST_ASSERT (expected_complete_count, result_complete_count.load ());
+
+            // Only a slowdown fails, how much faster depends on the machine
+            auto ratio_limit    = 1.25;
+            auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+            TEST_ASSERT (true, (ratio > 1/ratio_limit));
+            printf (
+                    "Performance numbers for executor scaling, cores:%u, time:%lld, ratio_limit:%f, speedup:%f\n"
+                ,   (unsigned)core_count
+                ,   result
+                ,   ratio_limit
+                ,   ratio
+                );
+        }
+    }
+#endif
+
+#ifndef CPPLINQ_NO_PARALLEL
+    void test_performance_par_aggregates ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 5         ;
+#else
+        int         const test_repeat   = 50        ;
+#endif
+        int         const test_size     = 2000000   ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand () % 1000;})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+        auto square = [] (int i) {return (long long)i * i;};
+
+        long long   expected_complete_sum   = 0;
+        long long   result_complete_sum     = 0;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_sum += from (test_set) >> where (is_odd) >> sum (square);
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_sum += from (test_set) >> where (is_odd) >> par_sum (square);
+                }
+            );
+
+        TEST_ASSERT (true, (expected_complete_sum == result_complete_sum));
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for par_sum, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)default_executor ().concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_par_to_vector ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 2         ;
+#else
+        int         const test_repeat   = 20        ;
+#endif
+        int         const test_size     = 2000000   ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand () % 1000;})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+        auto square = [] (int i) {return (long long)i * i;};
+
+        std::size_t expected_complete_size  = 0U;
+        std::size_t result_complete_size    = 0U;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_size += (from (test_set) >> where (is_odd) >> select (square) >> to_vector ()).size ();
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_size += (from (test_set) >> where (is_odd) >> select (square) >> par_to_vector ()).size ();
+                }
+            );
+
+        TEST_ASSERT (expected_complete_size, result_complete_size);
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for par_to_vector, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)default_executor ().concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_parallel_sort ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 1         ;
+#else
+        int         const test_repeat   = 5         ;
+#endif
+        int         const test_size     = 2000000   ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand ();})
+            >>  to_vector (test_size)
+            ;
+
+        auto identity = [] (int i) {return i;};
+
+        long long   expected_complete_sum   = 0;
+        long long   result_complete_sum     = 0;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_sum += from (test_set) >> orderby_ascending (identity) >> sequential_sort () >> first ();
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_sum += from (test_set) >> orderby_ascending (identity) >> parallel_sort () >> first ();
+                }
+            );
+
+        TEST_ASSERT (true, (expected_complete_sum == result_complete_sum));
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for parallel_sort, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)default_executor ().concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_async_buffer ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 2         ;
+#else
+        int         const test_repeat   = 10        ;
+#endif
+        int         const test_size     = 200000    ;
+
+        // Both stages are expensive, the producer finds primes, the consumer twin primes
+        auto produce = [] (int i) {return is_prime (i) ? i : 0;};
+        auto consume = [] (int i) {return i > 0 && is_prime (i + 2);};
+
+        std::size_t expected_complete_count = 0U;
+        std::size_t result_complete_count   = 0U;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_count += range (3, test_size) >> select (produce) >> count (consume);
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_complete_count += range (3, test_size) >> select (produce) >> async_buffer () >> count (consume);
+                }
+            );
+
+        TEST_ASSERT (expected_complete_count, result_complete_count);
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for async_buffer, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)std::thread::hardware_concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_par_select ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 25        ;
+#else
+        int         const test_repeat   = 100       ;
+#endif
+        int         const test_size     = 10000     ;
+
+        auto        expected_complete_sum   = 0         ;
+        auto        result_complete_sum     = 0         ;
+
+        long long   expected    = 0;
+        long long   result      = 0;
+
+        auto ratio = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_complete_sum +=
+                            range (1, INT_MAX)
+                        >>  select ([] (int i) {return 2*i + 1;})
+                        >>  where (is_prime)
+                        >>  take (test_size)
+                        >>  sum ()
+                        ;
+                }
+            ,   [&] ()
+                {
+                    result_complete_sum +=
+                            range (1, INT_MAX)
+                        >>  select ([] (int i) {return 2*i + 1;})
+                        >>  par_select ([] (int i) {return is_prime (i) ? i : 0;})
+                        >>  where ([] (int i) {return i > 0;})
+                        >>  take (test_size)
+                        >>  sum ()
+                        ;
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for par_select, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)default_executor ().concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_par_for_each ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 2         ;
+#else
+        int         const test_repeat   = 20        ;
+#endif
+        int         const test_size     = 2000000   ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand () % 1000;})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+
+        // Rows are written to a buffer per shard, each thread has its own shards
+        typedef std::vector<std::vector<int>> shards;
+
+        std::size_t expected_complete_size  = 0U;
+        std::size_t result_complete_size    = 0U;
+
+        auto new_shards = [] () {return shards (16U);};
+        auto write      = [] (shards & s, int i) {s[i % 16].push_back (i);};
+        auto close      = [] (std::size_t & complete_size, shards & s)
+            {
+                for (auto & shard : s)
+                {
+                    complete_size += shard.size ();
+                }
+            };
+
+        long long   expected    = 0;
+        long long   result      = 0;
+
+        auto ratio = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto s = new_shards ();
+                    from (test_set) >> where (is_odd) >> for_each ([&] (int i) {write (s, i);});
+                    close (expected_complete_size, s);
+                }
+            ,   [&] ()
+                {
+                    from (test_set) >> where (is_odd) >> par_for_each (
+                            new_shards
+                        ,   write
+                        ,   [&] (shards & s) {close (result_complete_size, s);}
+                        );
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (expected_complete_size, result_complete_size);
+
+        // Only a slowdown fails, the speedup depends on the number of cores
+        auto ratio_limit    = 1.25;
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for par_for_each, cores:%u, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   (unsigned)default_executor ().concurrency ()
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+#endif
+
+    void test_performance_cancellation ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 2         ;
+#else
+        int         const test_repeat   = 50        ;
+#endif
+        int         const test_size     = 2000000   ;
+
+        srand (19740531);
+
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int i){return rand () % 1000;})
+            >>  to_vector (test_size)
+            ;
+
+        auto is_odd = [] (int i) {return i % 2 == 1;};
+        auto square = [] (int i) {return (long long)i*i;};
+
+        cancellation_token token;
+
+        long long expected_sum  = 0;
+        long long result_sum    = 0;
+        long long expected      = 0;
+        long long result        = 0;
+
+        auto speedup = execute_testrounds (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_sum += from (test_set) >> where (is_odd) >> select (square) >> sum ();
+                }
+            ,   [&] ()
+                {
+                    result_sum += from (test_set) >> with_cancellation (token) >> where (is_odd) >> select (square) >> sum ();
+                }
+            ,   expected
+            ,   result
+            );
+
+        TEST_ASSERT (true, (expected_sum == result_sum));
+
+        // Checking the token once per batch should be close to free
+        auto ratio_limit    = 1.25;
+        auto ratio          = 1/speedup;
+        TEST_ASSERT (true, (ratio < ratio_limit));
+        printf (
+                "Performance numbers for cancellation, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_hash_distinct ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat   = 1         ;
+#else
+        int         const test_repeat   = 3         ;
+#endif
+        int         const test_size     = 1000000   ;
+
+        srand (19740531);
+
+        // Sparse ids drawn from half as many as there are elements
+        auto test_set =
+                range (0, test_size)
+            >>  select ([] (int){return (long long)(rand () % (test_size / 2)) * 1000003;})
+            >>  to_vector (test_size)
+            ;
+
+        std::size_t expected_count  = 0U;
+        std::size_t result_count    = 0U;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_count += from (test_set) >> distinct () >> count ();
                 }
             );
 
@@ -3083,23 +6854,313 @@ namespace
                 test_repeat
             ,   [&] ()
                 {
-                    result_complete_sum +=
-                            range (1, INT_MAX)
-                        >>  select ([] (int i) {return 2*i + 1;})
-                        >>  where (is_prime)
-                        >>  take (test_size)
+                    result_count += from (test_set) >> hash_distinct () >> count ();
+                }
+            );
+
+        TEST_ASSERT (expected_count, result_count);
+
+        // Only a slowdown fails
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for hash_distinct, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_hash_set_operators ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_work     = 100000    ;
+#else
+        int         const test_work     = 1000000   ;
+#endif
+        int         const test_sizes[]  = {1000, 100000, 1000000};
+
+        srand (19740531);
+
+        for (auto test_size : test_sizes)
+        {
+            auto test_repeat = test_work > test_size ? test_work / test_size : 1;
+
+            auto left   = range (0, test_size) >> select ([=] (int) {return rand () % test_size;}) >> to_vector ();
+            auto right  = range (0, test_size / 2) >> select ([=] (int) {return rand () % test_size;}) >> to_vector ();
+
+            auto compare = [&] (char const * name, std::function<std::size_t ()> expected_query, std::function<std::size_t ()> result_query)
+                {
+                    std::size_t expected_count  = 0U;
+                    std::size_t result_count    = 0U;
+
+                    auto expected   = execute_testruns (test_repeat, [&] () {expected_count += expected_query ();});
+                    auto result     = execute_testruns (test_repeat, [&] () {result_count += result_query ();});
+
+                    TEST_ASSERT (expected_count, result_count);
+
+                    // Only a slowdown fails
+                    auto ratio_limit    = 1.25;
+                    auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+                    TEST_ASSERT (true, (ratio > 1/ratio_limit));
+                    printf (
+                            "Performance numbers for %s, size:%d, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+                        ,   name
+                        ,   test_size
+                        ,   expected
+                        ,   result
+                        ,   ratio_limit
+                        ,   ratio
+                        );
+                };
+
+            compare (
+                    "hash_union_with"
+                ,   [&] () {return from (left) >> union_with (from (right)) >> count ();}
+                ,   [&] () {return from (left) >> hash_union_with (from (right)) >> count ();}
+                );
+
+            compare (
+                    "hash_intersect_with"
+                ,   [&] () {return from (left) >> intersect_with (from (right)) >> count ();}
+                ,   [&] () {return from (left) >> hash_intersect_with (from (right), build_smaller) >> count ();}
+                );
+
+            compare (
+                    "hash_except"
+                ,   [&] () {return from (left) >> except (from (right)) >> count ();}
+                ,   [&] () {return from (left) >> hash_except (from (right), build_smaller) >> count ();}
+                );
+        }
+    }
+
+    void test_performance_hash_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat       = 1         ;
+#else
+        int         const test_repeat       = 3         ;
+#endif
+        int         const order_count       = 2000000   ;
+        int         const customer_count    = 200000    ;
+
+        srand (19740531);
+
+        // Half of the orders refer to customers that aren't there
+        auto test_orders =
+                range (0, order_count)
+            >>  select ([] (int i) {return order (i, ((std::size_t)rand () * 1000U + rand ()) % (2U * customer_count), i % 100);})
+            >>  to_vector (order_count)
+            ;
+
+        auto test_customers =
+                range (0, customer_count)
+            >>  select ([] (int i) {return customer (i, "", "");})
+            >>  to_vector (customer_count)
+            ;
+
+        auto order_key      = [] (order const & o) {return o.customer_id;};
+        auto customer_key   = [] (customer const & c) {return c.id;};
+        auto amount         = [] (order const & o, customer const &) {return o.amount;};
+
+        double expected_total   = 0.0;
+        double result_total     = 0.0;
+        double filtered_total   = 0.0;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_total += from (test_orders) >> join (from (test_customers), order_key, customer_key, amount) >> sum ();
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_total += from (test_orders) >> hash_join (from (test_customers), order_key, customer_key, amount) >> sum ();
+                }
+            );
+
+        auto filtered = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    filtered_total += from (test_orders) >> hash_join (from (test_customers), order_key, customer_key, amount, bloom_probe_filter) >> sum ();
+                }
+            );
+
+        TEST_ASSERT (expected_total, result_total);
+        TEST_ASSERT (expected_total, filtered_total);
+
+        // Only a slowdown fails
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        auto filtered_ratio = ((double)expected)/(filtered > 0 ? filtered : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        TEST_ASSERT (true, (filtered_ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for hash_join, expected:%lld, result:%lld, bloom filtered:%lld, ratio_limit:%f, speedup:%f, bloom filtered speedup:%f\n"
+            ,   expected
+            ,   result
+            ,   filtered
+            ,   ratio_limit
+            ,   ratio
+            ,   filtered_ratio
+            );
+    }
+
+    void test_performance_group_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat       = 1         ;
+#else
+        int         const test_repeat       = 3         ;
+#endif
+        int         const order_count       = 2000000   ;
+        int         const customer_count    = 200000    ;
+
+        srand (19740531);
+
+        auto test_orders =
+                range (0, order_count)
+            >>  select ([] (int i) {return order (i, ((std::size_t)rand () * 1000U + rand ()) % customer_count, i % 100);})
+            >>  to_vector (order_count)
+            ;
+
+        auto test_customers =
+                range (0, customer_count)
+            >>  select ([] (int i) {return customer (i, "", "");})
+            >>  to_vector (customer_count)
+            ;
+
+        auto order_key      = [] (order const & o) {return o.customer_id;};
+        auto customer_key   = [] (customer const & c) {return c.id;};
+        auto order_total    = [] (order const & o) {return o.amount;};
+
+        double expected_total   = 0.0;
+        double result_total     = 0.0;
+
+        // What group_join replaces, a lookup of the orders queried per customer
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    auto orders_of = from (test_orders) >> to_lookup (order_key);
+                    expected_total += from (test_customers)
+                        >>  select ([&] (customer const & c) {return orders_of[c.id] >> select (order_total) >> sum ();})
                         >>  sum ()
                         ;
                 }
             );
 
-        TEST_ASSERT (expected_complete_sum, result_complete_sum);
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_total += from (test_customers)
+                        >>  group_join (
+                                    from (test_orders)
+                                ,   customer_key
+                                ,   order_key
+                                ,   [&] (customer const &, hash_group<order> orders) {return orders >> select (order_total) >> sum ();}
+                                )
+                        >>  sum ()
+                        ;
+                }
+            );
 
+        TEST_ASSERT (expected_total, result_total);
+
+        // Only a slowdown fails
         auto ratio_limit    = 1.25;
-        auto ratio          = ((double)expected)/result;
-        TEST_ASSERT (true, (ratio > 1/ratio_limit && ratio < ratio_limit));
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
         printf (
-                "Performance numbers for computing primes, expected:%lld, result:%lld, ratio_limit:%f, ratio:%f\n"
+                "Performance numbers for group_join, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
+            ,   expected
+            ,   result
+            ,   ratio_limit
+            ,   ratio
+            );
+    }
+
+    void test_performance_merge_join ()
+    {
+        using namespace cpplinq;
+
+        TEST_PRELUDE ();
+
+#if _DEBUG
+        int         const test_repeat       = 1         ;
+#else
+        int         const test_repeat       = 3         ;
+#endif
+        int         const order_count       = 2000000   ;
+        int         const customer_count    = 200000    ;
+
+        srand (19740531);
+
+        // Both sides are already ordered by customer id
+        auto test_orders =
+                range (0, order_count)
+            >>  select ([] (int i) {return order (i, ((std::size_t)rand () * 1000U + rand ()) % (2U * customer_count), i % 100);})
+            >>  orderby_ascending ([] (order const & o) {return o.customer_id;})
+            >>  to_vector (order_count)
+            ;
+
+        auto test_customers =
+                range (0, customer_count)
+            >>  select ([] (int i) {return customer (i, "", "");})
+            >>  to_vector (customer_count)
+            ;
+
+        auto order_key      = [] (order const & o) {return o.customer_id;};
+        auto customer_key   = [] (customer const & c) {return c.id;};
+        auto amount         = [] (order const & o, customer const &) {return o.amount;};
+
+        double expected_total   = 0.0;
+        double result_total     = 0.0;
+
+        auto expected = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    expected_total += from (test_orders) >> join (from (test_customers), order_key, customer_key, amount) >> sum ();
+                }
+            );
+
+        auto result = execute_testruns (
+                test_repeat
+            ,   [&] ()
+                {
+                    result_total += from (test_orders) >> merge_join (from (test_customers), order_key, customer_key, amount) >> sum ();
+                }
+            );
+
+        TEST_ASSERT (expected_total, result_total);
+
+        // Only a slowdown fails
+        auto ratio_limit    = 1.25;
+        auto ratio          = ((double)expected)/(result > 0 ? result : 1);
+        TEST_ASSERT (true, (ratio > 1/ratio_limit));
+        printf (
+                "Performance numbers for merge_join, expected:%lld, result:%lld, ratio_limit:%f, speedup:%f\n"
             ,   expected
             ,   result
             ,   ratio_limit
@@ -3141,6 +7202,10 @@ namespace
         test_select                 ();
         test_select_many            ();
         test_join                   ();
+        test_hash_join              ();
+        test_group_join             ();
+        test_left_join              ();
+        test_merge_join             ();
         test_orderby                ();
         test_reverse                ();
         test_take                   ();
@@ -3151,13 +7216,41 @@ namespace
         test_element_at_or_default  ();
         test_aggregate              ();
         test_distinct               ();
+        test_hash_distinct          ();
         test_union_with             ();
         test_intersect_with         ();
         test_except                 ();
+        test_hash_set_operators     ();
         test_concat                 ();
         test_sequence_equal         ();
         test_pairwise               ();
         test_zip_with               ();
+        test_batch                  ();
+        test_contiguous             ();
+        test_size_hint              ();
+        test_push                   ();
+        test_random_access          ();
+        test_reference_preservation ();
+#if CPPLINQ_CONSTEXPR_PIPELINES
+        test_constexpr              ();
+#endif
+#if CPPLINQ_RVALUE_OPERATORS
+        test_move_pipeline          ();
+#endif
+#ifndef CPPLINQ_NO_PARALLEL
+        test_executor               ();
+#endif
+        test_split                  ();
+#ifndef CPPLINQ_NO_PARALLEL
+        test_par_aggregates         ();
+        test_parallel_aggregate     ();
+        test_par_to_vector          ();
+        test_parallel_sort          ();
+        test_async_buffer           ();
+        test_par_select             ();
+        test_par_for_each           ();
+#endif
+        test_cancellation           ();
         // -------------------------------------------------------------------------
         if (run_perfomance_tests)
         {
@@ -3168,6 +7261,25 @@ namespace
             test_performance_range_sum ();
             test_performance_sum ();
             test_performance_is_prime ();
+            test_performance_fused_pipeline ();
+            test_performance_join_combiner ();
+            test_performance_expensive_copy ();
+            test_performance_container ();
+#ifndef CPPLINQ_NO_PARALLEL
+            test_performance_executor_scaling ();
+            test_performance_par_aggregates ();
+            test_performance_par_to_vector ();
+            test_performance_parallel_sort ();
+            test_performance_async_buffer ();
+            test_performance_par_select ();
+            test_performance_par_for_each ();
+#endif
+            test_performance_cancellation ();
+            test_performance_hash_distinct ();
+            test_performance_hash_set_operators ();
+            test_performance_hash_join ();
+            test_performance_group_join ();
+            test_performance_merge_join ();
         }
         // -------------------------------------------------------------------------
         if (errors == 0)
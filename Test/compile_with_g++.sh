@@ -1 +1 @@
-g++ -std=c++11 -O2 -Wall -Wformat=2 -Wformat-security -Wpedantic CppLinq.cpp -o cpplinq.g++
+g++ -std=c++11 -O2 -pthread -Wall -Wformat=2 -Wformat-security -Wpedantic CppLinq.cpp -o cpplinq.g++